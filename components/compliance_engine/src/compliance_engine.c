@@ -30,17 +30,14 @@ esp_err_t compliance_check_animal(const char *animal_id,
   // This is a stub logic
   if (strcasecmp(r.species, "Python regius") == 0 ||
       strstr(r.species, "Python")) {
-    // Query documents for this animal
-    cJSON *docs = data_manager_list_documents(r.id);
-    if (!docs || cJSON_GetArraySize(docs) == 0) {
+    // Documents attached to this animal (in-RAM index lookup)
+    if (data_manager_count_documents(r.id) == 0) {
       out_report->status = COMPLIANCE_WARNING;
       snprintf(out_report->message, sizeof(out_report->message),
                "Missing origin proof for %s", r.species);
       strlcpy(out_report->missing_doc_type, "ORIGIN_PROOF",
               sizeof(out_report->missing_doc_type));
     }
-    if (docs)
-      cJSON_Delete(docs);
   }
 
   return ESP_OK;
@@ -50,20 +50,36 @@ typedef struct {
 typedef struct {
   char id[37];
   char name[64];
-  char species[64];
+  const char *species; // Interned: compare with data_manager_find_string()
 } animal_summary_t;
 
 // API
 esp_err_t core_add_weight(const char *animal_id, float value, const char *unit);
 esp_err_t core_add_event(const char *animal_id, event_type_t type,
                          const char *description);
+// Compact, increasing id for a new animal (DATA_MANAGER_ID_LEN bytes).
+esp_err_t core_new_id(char *out, size_t len);
 esp_err_t core_get_animal(const char *animal_id, animal_t *out_animal);
 esp_err_t core_delete_animal(const char *animal_id);
+// Writes pending saves and settings to flash; call before a reboot or an
+// OTA update.
+esp_err_t core_flush(void);
 void core_free_animal_content(animal_t *animal);
 
 // List API
 esp_err_t core_list_animals(animal_summary_t **out_list, size_t *count);
 void core_free_animal_list(animal_summary_t *list);
+// Streams the animal list in id order, one small page at a time; no data
+// lock is held while cb runs. Return false from cb to stop early. limit = 0
+// means no limit.
+typedef bool (*core_animal_cb_t)(const animal_summary_t *animal, void *ctx);
+esp_err_t core_foreach_animal(size_t offset, size_t limit, core_animal_cb_t cb,
+                              void *ctx);
+
+// Animals whose last feeding is older than `days` (or never fed), in id
+// order, from the in-RAM aggregates: no history file is read.
+esp_err_t core_list_unfed_animals(uint32_t days, animal_summary_t **out_list,
+                                  size_t *count);
 
 esp_err_t core_list_reports(char ***out_list, size_t *count);
 void core_free_report_list(char **list, size_t count);
@@ -77,3 +93,19 @@ void core_free_alert_list(char **list, size_t count);
 esp_err_t core_get_logs(char ***out_list, size_t *count, size_t max);
 void core_free_log_list(char **list, size_t count);
 esp_err_t core_generate_report(const char *animal_id);
+
+// Storage diagnostics, for /health.
+esp_err_t core_get_op_stats(data_manager_op_t op, data_manager_op_stats_t *out);
+// Short stable name of op, NULL when out of range.
+const char *core_op_name(data_manager_op_t op);
+// Upper bound in us of the bucket holding the q-th quantile of stats.
+uint32_t core_op_quantile_us(const data_manager_op_stats_t *stats, float q);
+// Integrity scrubber progress; ESP_ERR_NOT_SUPPORTED when disabled.
+esp_err_t core_get_scrub_stats(data_manager_scrub_stats_t *out);
+
+// Change feed for incremental sync: see data_manager_changes_since().
+uint64_t core_change_seq(void);
+esp_err_t core_changes_since(uint64_t since, data_manager_change_t *out,
+                             size_t max, size_t *count);
+// Short stable name of entity, NULL when out of range.
+const char *core_entity_name(data_manager_entity_t entity);
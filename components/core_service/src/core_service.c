@@ -3,12 +3,17 @@
 #include "data_manager.h"
 #include "esp_log.h"
 #include "reptile_storage.h"
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
 static const char *TAG = "core_service";
 
+// Entries copied per cursor page. Pages live on the caller's stack (about
+// 230 bytes each), so keep this small for the LVGL and httpd tasks.
+#define CORE_LIST_PAGE 8
+
 esp_err_t core_add_weight(const char *animal_id, float value,
                           const char *unit) {
   // Ignore unit for now, store as float in data_manager (assumed grams)
@@ -30,10 +35,14 @@ esp_err_t core_add_event(const char *animal_id, event_type_t type,
   reptile_event_t evt = {0};
   snprintf(evt.reptile_id, sizeof(evt.reptile_id), "%s", animal_id);
 
+  // Several events can share a second: the id comes from the generator.
+  esp_err_t err = data_manager_new_id(evt.id, sizeof(evt.id));
+  if (err != ESP_OK) {
+    return err;
+  }
+
   struct timeval tv;
   gettimeofday(&tv, NULL);
-  // Simple ID generation
-  snprintf(evt.id, sizeof(evt.id), "%lld", (long long)tv.tv_sec);
 
   evt.type = (int)type;
   evt.timestamp = tv.tv_sec;
@@ -42,6 +51,60 @@ esp_err_t core_add_event(const char *animal_id, event_type_t type,
   return data_manager_add_event(&evt);
 }
 
+esp_err_t core_new_id(char *out, size_t len) {
+  return data_manager_new_id(out, len);
+}
+
+typedef struct {
+  weight_entry_t *items;
+  size_t count;
+  size_t capacity;
+} weight_collector_t;
+
+static bool collect_weight(const weight_sample_t *sample, void *user_ctx) {
+  weight_collector_t *c = (weight_collector_t *)user_ctx;
+  if (c->count == c->capacity) {
+    size_t new_cap = c->capacity ? c->capacity * 2 : 16;
+    weight_entry_t *grown = realloc(c->items, new_cap * sizeof(weight_entry_t));
+    if (!grown) {
+      ESP_LOGE(TAG, "Out of memory after %u weights", (unsigned)c->count);
+      return false;
+    }
+    c->items = grown;
+    c->capacity = new_cap;
+  }
+  weight_entry_t *w = &c->items[c->count++];
+  w->date = (uint32_t)sample->timestamp;
+  w->value = sample->weight;
+  strlcpy(w->unit, "g", sizeof(w->unit));
+  return true;
+}
+
+typedef struct {
+  event_entry_t *items;
+  size_t count;
+  size_t capacity;
+} event_collector_t;
+
+static bool collect_event(const reptile_event_t *event, void *user_ctx) {
+  event_collector_t *c = (event_collector_t *)user_ctx;
+  if (c->count == c->capacity) {
+    size_t new_cap = c->capacity ? c->capacity * 2 : 16;
+    event_entry_t *grown = realloc(c->items, new_cap * sizeof(event_entry_t));
+    if (!grown) {
+      ESP_LOGE(TAG, "Out of memory after %u events", (unsigned)c->count);
+      return false;
+    }
+    c->items = grown;
+    c->capacity = new_cap;
+  }
+  event_entry_t *e = &c->items[c->count++];
+  e->type = event->type;
+  e->date = (uint32_t)event->timestamp;
+  strlcpy(e->description, event->notes, sizeof(e->description));
+  return true;
+}
+
 esp_err_t core_get_animal(const char *animal_id, animal_t *out_animal) {
   if (!out_animal)
     return ESP_FAIL;
@@ -64,66 +127,18 @@ esp_err_t core_get_animal(const char *animal_id, animal_t *out_animal) {
   out_animal->origin[0] = '\0';
   out_animal->registry_id[0] = '\0';
 
-  // Load Weights
-  cJSON *w_arr = data_manager_get_weights(animal_id);
-  if (w_arr) {
-    out_animal->weight_count = cJSON_GetArraySize(w_arr);
-    if (out_animal->weight_count > 0) {
-      out_animal->weights =
-          calloc(out_animal->weight_count, sizeof(weight_entry_t));
-      int i = 0;
-      cJSON *item = NULL;
-      cJSON_ArrayForEach(item, w_arr) {
-        cJSON *w_val = cJSON_GetObjectItem(item, "weight");
-        cJSON *w_ts = cJSON_GetObjectItem(item, "timestamp");
-        if (w_val)
-          out_animal->weights[i].value = (float)w_val->valuedouble;
-        if (w_ts)
-          out_animal->weights[i].date = (uint32_t)w_ts->valuedouble;
-        strlcpy(out_animal->weights[i].unit, "g",
-                sizeof(out_animal->weights[i].unit));
-        i++;
-      }
-    } else {
-      out_animal->weights = NULL;
-    }
-    cJSON_Delete(w_arr);
-  } else {
-    out_animal->weight_count = 0;
-    out_animal->weights = NULL;
-  }
+  // Load Weights (decoded from the compressed time-series)
+  weight_collector_t weights = {0};
+  data_manager_query_weights(animal_id, INT64_MIN, INT64_MAX, collect_weight,
+                             &weights);
+  out_animal->weights = weights.items;
+  out_animal->weight_count = weights.count;
 
-  // Load Events
-  cJSON *e_arr = data_manager_get_events(animal_id);
-  if (e_arr) {
-    out_animal->event_count = cJSON_GetArraySize(e_arr);
-    if (out_animal->event_count > 0) {
-      out_animal->events =
-          calloc(out_animal->event_count, sizeof(event_entry_t));
-      int i = 0;
-      cJSON *item = NULL;
-      cJSON_ArrayForEach(item, e_arr) {
-        cJSON *e_type = cJSON_GetObjectItem(item, "type");
-        cJSON *e_ts = cJSON_GetObjectItem(item, "timestamp");
-        cJSON *e_desc = cJSON_GetObjectItem(item, "notes");
-
-        if (e_type)
-          out_animal->events[i].type = (event_type_t)e_type->valueint;
-        if (e_ts)
-          out_animal->events[i].date = (uint32_t)e_ts->valuedouble;
-        if (e_desc)
-          strlcpy(out_animal->events[i].description, e_desc->valuestring,
-                  sizeof(out_animal->events[i].description));
-        i++;
-      }
-    } else {
-      out_animal->events = NULL;
-    }
-    cJSON_Delete(e_arr);
-  } else {
-    out_animal->event_count = 0;
-    out_animal->events = NULL;
-  }
+  // Load Events (streamed from the binary log, no cJSON tree)
+  event_collector_t events = {0};
+  data_manager_foreach_event(animal_id, collect_event, &events);
+  out_animal->events = events.items;
+  out_animal->event_count = events.count;
 
   return ESP_OK;
 }
@@ -153,23 +168,25 @@ esp_err_t core_export_csv(const char *filepath) {
   // Header
   fprintf(f, "ID,Name,Species,Sex,DOB,Weight(g)\n");
 
-  cJSON *list = data_manager_list_reptiles();
-  if (list) {
-    cJSON *item = NULL;
-    cJSON_ArrayForEach(item, list) {
-      cJSON *id_obj = cJSON_GetObjectItem(item, "id");
-      if (id_obj) {
+  data_manager_cursor_t *cursor = NULL;
+  if (data_manager_open_reptile_cursor(0, 0, &cursor) == ESP_OK) {
+    reptile_summary_t page[CORE_LIST_PAGE];
+    size_t count = 0;
+    while (data_manager_cursor_next_reptiles(cursor, page, CORE_LIST_PAGE,
+                                             &count) == ESP_OK &&
+           count > 0) {
+      for (size_t i = 0; i < count; i++) {
         reptile_t r;
-        if (data_manager_load_reptile(id_obj->valuestring, &r) == ESP_OK) {
+        if (data_manager_load_reptile(page[i].id, &r) == ESP_OK) {
           const char *sex_str = (r.gender == GENDER_MALE)
                                     ? "M"
                                     : (r.gender == GENDER_FEMALE ? "F" : "U");
           fprintf(f, "%s,%s,%s,%s,%lld,%.1f\n", r.id, r.name, r.species,
-                  sex_str, (long long)r.birth_date, r.weight);
+                  sex_str, (long long)r.birth_date, page[i].weight);
         }
       }
     }
-    cJSON_Delete(list);
+    data_manager_cursor_close(cursor);
   }
 
   fclose(f);
@@ -177,53 +194,191 @@ esp_err_t core_export_csv(const char *filepath) {
   return ESP_OK;
 }
 
-esp_err_t core_list_animals(animal_summary_t **out_list, size_t *count) {
-  cJSON *arr = data_manager_list_reptiles();
-  if (!arr)
-    return ESP_FAIL;
-
-  *count = cJSON_GetArraySize(arr);
-  if (*count == 0) {
+static esp_err_t to_animal_summaries(reptile_summary_t *summaries, size_t n,
+                                     animal_summary_t **out_list,
+                                     size_t *count) {
+  *count = n;
+  if (n == 0) {
     *out_list = NULL;
-    cJSON_Delete(arr);
     return ESP_OK;
   }
 
-  *out_list = calloc(*count, sizeof(animal_summary_t));
+  *out_list = calloc(n, sizeof(animal_summary_t));
   if (!*out_list) {
-    cJSON_Delete(arr);
+    free(summaries);
+    *count = 0;
     return ESP_ERR_NO_MEM;
   }
 
-  int i = 0;
-  cJSON *item = NULL;
-  cJSON_ArrayForEach(item, arr) {
-    cJSON *id = cJSON_GetObjectItem(item, "id");
-    cJSON *name = cJSON_GetObjectItem(item, "name");
-    if (id) {
-      strlcpy((*out_list)[i].id, id->valuestring, sizeof((*out_list)[i].id));
-      // Basic load to get species if not in list check
-      reptile_t r;
-      if (data_manager_load_reptile(id->valuestring, &r) == ESP_OK) {
-        strlcpy((*out_list)[i].species, r.species,
-                sizeof((*out_list)[i].species));
-      } else {
-        strlcpy((*out_list)[i].species, "Unknown",
-                sizeof((*out_list)[i].species));
-      }
-    }
-    if (name)
-      strlcpy((*out_list)[i].name, name->valuestring,
-              sizeof((*out_list)[i].name));
-    i++;
+  for (size_t i = 0; i < n; i++) {
+    strlcpy((*out_list)[i].id, summaries[i].id, sizeof((*out_list)[i].id));
+    strlcpy((*out_list)[i].name, summaries[i].name,
+            sizeof((*out_list)[i].name));
+    (*out_list)[i].species = summaries[i].species;
   }
 
-  cJSON_Delete(arr);
+  free(summaries);
   return ESP_OK;
 }
 
+esp_err_t core_list_animals(animal_summary_t **out_list, size_t *count) {
+  if (!out_list || !count)
+    return ESP_ERR_INVALID_ARG;
+
+  reptile_summary_t *summaries = NULL;
+  size_t n = 0;
+  esp_err_t err = data_manager_list_reptile_summaries(&summaries, &n);
+  if (err != ESP_OK)
+    return err;
+
+  return to_animal_summaries(summaries, n, out_list, count);
+}
+
 void core_free_animal_list(animal_summary_t *list) { free(list); }
 
+static void to_animal_summary(const reptile_summary_t *r, animal_summary_t *a) {
+  memset(a, 0, sizeof(*a));
+  strlcpy(a->id, r->id, sizeof(a->id));
+  strlcpy(a->name, r->name, sizeof(a->name));
+  a->species = r->species;
+}
+
+esp_err_t core_foreach_animal(size_t offset, size_t limit, core_animal_cb_t cb,
+                              void *ctx) {
+  if (!cb)
+    return ESP_ERR_INVALID_ARG;
+
+  // One version for the whole walk: cb never delays a writer and the list
+  // never mixes two states.
+  const data_manager_snapshot_t *snap = data_manager_snapshot_acquire();
+  if (snap) {
+    size_t n = data_manager_snapshot_reptile_count(snap);
+    size_t end = n;
+    if (limit > 0 && offset < n && limit < n - offset)
+      end = offset + limit;
+    bool more = true;
+    for (size_t i = offset; i < end && more; i++) {
+      animal_summary_t a;
+      to_animal_summary(data_manager_snapshot_reptile(snap, i), &a);
+      more = cb(&a, ctx);
+    }
+    data_manager_snapshot_release(snap);
+    return ESP_OK;
+  }
+
+  data_manager_cursor_t *cursor = NULL;
+  esp_err_t err = data_manager_open_reptile_cursor(offset, limit, &cursor);
+  if (err != ESP_OK)
+    return err;
+
+  reptile_summary_t page[CORE_LIST_PAGE];
+  size_t count = 0;
+  bool more = true;
+  while (more && (err = data_manager_cursor_next_reptiles(
+                      cursor, page, CORE_LIST_PAGE, &count)) == ESP_OK &&
+         count > 0) {
+    for (size_t i = 0; i < count && more; i++) {
+      animal_summary_t a;
+      to_animal_summary(&page[i], &a);
+      more = cb(&a, ctx);
+    }
+  }
+  data_manager_cursor_close(cursor);
+  return err;
+}
+
+static bool unfed_since(const reptile_aggregate_t *agg, int64_t cutoff) {
+  int64_t last = agg ? agg->last_feeding : 0;
+  return last == 0 || last < cutoff;
+}
+
+// Animals and aggregates from the same version, copied straight out.
+static esp_err_t unfed_from_snapshot(const data_manager_snapshot_t *snap,
+                                     int64_t cutoff,
+                                     animal_summary_t **out_list,
+                                     size_t *count) {
+  size_t n = data_manager_snapshot_reptile_count(snap);
+  *out_list = NULL;
+  *count = 0;
+  if (n == 0)
+    return ESP_OK;
+  animal_summary_t *list = calloc(n, sizeof(animal_summary_t));
+  if (!list)
+    return ESP_ERR_NO_MEM;
+
+  size_t kept = 0;
+  size_t a = 0;
+  size_t n_aggs = data_manager_snapshot_aggregate_count(snap);
+  for (size_t i = 0; i < n; i++) {
+    const reptile_summary_t *r = data_manager_snapshot_reptile(snap, i);
+    const reptile_aggregate_t *agg = NULL;
+    while (a < n_aggs &&
+           strcmp((agg = data_manager_snapshot_aggregate(snap, a))->id,
+                  r->id) < 0)
+      a++;
+    if (a >= n_aggs || strcmp(agg->id, r->id) != 0)
+      agg = NULL;
+    if (unfed_since(agg, cutoff))
+      to_animal_summary(r, &list[kept++]);
+  }
+  if (kept == 0) {
+    free(list);
+    list = NULL;
+  }
+  *out_list = list;
+  *count = kept;
+  return ESP_OK;
+}
+
+esp_err_t core_list_unfed_animals(uint32_t days, animal_summary_t **out_list,
+                                  size_t *count) {
+  if (!out_list || !count)
+    return ESP_ERR_INVALID_ARG;
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  int64_t cutoff = (int64_t)tv.tv_sec - (int64_t)days * 86400;
+
+  const data_manager_snapshot_t *snap = data_manager_snapshot_acquire();
+  if (snap) {
+    esp_err_t err = unfed_from_snapshot(snap, cutoff, out_list, count);
+    data_manager_snapshot_release(snap);
+    return err;
+  }
+
+  reptile_summary_t *animals = NULL;
+  size_t n = 0;
+  esp_err_t err = data_manager_list_reptile_summaries(&animals, &n);
+  if (err != ESP_OK)
+    return err;
+  reptile_aggregate_t *aggs = NULL;
+  size_t n_aggs = 0;
+  err = data_manager_list_aggregates(&aggs, &n_aggs);
+  if (err != ESP_OK) {
+    free(animals);
+    return err;
+  }
+
+  // Both lists are sorted by id: merge them, keeping the unfed animals in
+  // place at the front of `animals`.
+  size_t kept = 0;
+  size_t a = 0;
+  for (size_t i = 0; i < n; i++) {
+    while (a < n_aggs && strcmp(aggs[a].id, animals[i].id) < 0)
+      a++;
+    bool has_agg = a < n_aggs && strcmp(aggs[a].id, animals[i].id) == 0;
+    if (unfed_since(has_agg ? &aggs[a] : NULL, cutoff))
+      animals[kept++] = animals[i];
+  }
+  free(aggs);
+  if (kept == 0) {
+    free(animals);
+    animals = NULL;
+  }
+
+  return to_animal_summaries(animals, kept, out_list, count);
+}
+
 esp_err_t core_list_reports(char ***out_list, size_t *count) {
   ESP_LOGI(TAG, "Stub: core_list_reports");
   if (!out_list || !count)
@@ -251,11 +406,20 @@ void core_free_report_list(char **list, size_t count) {
 
 // Missing implementations
 
+// Served by the in-RAM search index: cheap enough to run on every keystroke
+// from the LVGL task.
 esp_err_t core_search_animals(const char *query, animal_summary_t **out_list,
                               size_t *count) {
-  ESP_LOGI(TAG, "Stub: core_search_animals query='%s'", query ? query : "NULL");
-  // For now, just return the list of all animals regardless of query
-  return core_list_animals(out_list, count);
+  if (!out_list || !count)
+    return ESP_ERR_INVALID_ARG;
+
+  reptile_summary_t *summaries = NULL;
+  size_t n = 0;
+  esp_err_t err = data_manager_search_reptiles(query, 0, &summaries, &n);
+  if (err != ESP_OK)
+    return err;
+
+  return to_animal_summaries(summaries, n, out_list, count);
 }
 
 esp_err_t core_save_animal(const animal_t *animal) {
@@ -341,3 +505,37 @@ esp_err_t core_generate_report(const char *animal_id) {
 esp_err_t core_delete_animal(const char *animal_id) {
   return data_manager_delete_reptile(animal_id);
 }
+
+esp_err_t core_flush(void) {
+  esp_err_t err = data_manager_flush();
+  esp_err_t settings_err = storage_nvs_flush();
+  return err != ESP_OK ? err : settings_err;
+}
+
+esp_err_t core_get_op_stats(data_manager_op_t op,
+                            data_manager_op_stats_t *out) {
+  return data_manager_get_op_stats(op, out);
+}
+
+const char *core_op_name(data_manager_op_t op) {
+  return data_manager_op_name(op);
+}
+
+uint32_t core_op_quantile_us(const data_manager_op_stats_t *stats, float q) {
+  return data_manager_op_quantile_us(stats, q);
+}
+
+esp_err_t core_get_scrub_stats(data_manager_scrub_stats_t *out) {
+  return data_manager_get_scrub_stats(out);
+}
+
+uint64_t core_change_seq(void) { return data_manager_change_seq(); }
+
+esp_err_t core_changes_since(uint64_t since, data_manager_change_t *out,
+                             size_t max, size_t *count) {
+  return data_manager_changes_since(since, out, max, count);
+}
+
+const char *core_entity_name(data_manager_entity_t entity) {
+  return data_manager_entity_name(entity);
+}
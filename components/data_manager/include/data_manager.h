@@ -3,6 +3,7 @@
 #include <cJSON.h>
 #include <esp_err.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define MAX_NAME_LEN 64
@@ -27,6 +28,19 @@ typedef struct {
   // Add more fields as needed
 } reptile_t;
 
+// Lightweight view kept in RAM by the reptile index (see
+// data_manager_list_reptile_summaries). species and morph are interned: never
+// NULL, never freed, equal pointers for equal strings (see
+// data_manager_find_string).
+typedef struct {
+  char id[MAX_ID_LEN];
+  char name[MAX_NAME_LEN];
+  const char *species;
+  const char *morph;
+  reptile_gender_t gender;
+  float weight; // Last known weight
+} reptile_summary_t;
+
 typedef enum {
   EVENT_FEEDING,
   EVENT_MOLT, // Kept for backward compat if used, mapped to SHEDDING
@@ -66,6 +80,16 @@ typedef struct {
   int64_t timestamp;
 } document_t;
 
+// Lightweight view kept in RAM by the document index (see
+// data_manager_list_document_summaries).
+typedef struct {
+  char id[MAX_ID_LEN];
+  char related_id[MAX_ID_LEN];
+  document_type_t type;
+  char title[64];
+  int64_t timestamp;
+} document_summary_t;
+
 typedef struct {
   char id[MAX_ID_LEN];
   char name[64];
@@ -83,37 +107,443 @@ bool data_manager_is_ready(void);
 esp_err_t data_manager_save_reptile(const reptile_t *reptile);
 esp_err_t data_manager_load_reptile(const char *id, reptile_t *out_reptile);
 esp_err_t data_manager_delete_reptile(const char *id);
-// Returns a list of IDs. Caller must free cJSON object.
+// Returns id/name/species/morph/gender/weight entries served from the in-RAM
+// index (no filesystem access). Caller must free cJSON object.
 cJSON *data_manager_list_reptiles(void);
+// Copy of the in-RAM index, sorted by id. Caller must free(*out_list).
+esp_err_t data_manager_list_reptile_summaries(reptile_summary_t **out_list,
+                                              size_t *count);
+// Ranked search over the in-RAM index (name, id, species, morph), case and
+// accent insensitive; no filesystem access. Every word of the query must
+// match: one or two letters match word prefixes, longer words any substring.
+// A query without letters or digits returns the whole index in id order.
+// max_results = 0 means no limit. Caller must free(*out_list).
+esp_err_t data_manager_search_reptiles(const char *query, size_t max_results,
+                                       reptile_summary_t **out_list,
+                                       size_t *count);
+// Rebuilds the index by scanning /data/reptiles (slow, O(N) parses).
+esp_err_t data_manager_rebuild_index(void);
 
 // Event Operations
+// Events are stored in append-only binary logs per animal, one per calendar
+// month (UTC); appends cost O(1) regardless of history size.
 esp_err_t data_manager_add_event(const reptile_event_t *event);
+// Whole history as a cJSON array (oldest first). Prefer
+// data_manager_foreach_event() to avoid materialising the tree.
 cJSON *data_manager_get_events(const char *reptile_id);
+// Return false to stop the iteration early.
+typedef bool (*data_manager_event_cb_t)(const reptile_event_t *event,
+                                        void *user_ctx);
+// Streams the whole history, month by month oldest first (insertion order
+// within a month). The FS read lock is held while iterating, so the callback
+// must not call back into data_manager (a queued writer would block it
+// forever).
+esp_err_t data_manager_foreach_event(const char *reptile_id,
+                                     data_manager_event_cb_t cb,
+                                     void *user_ctx);
+// Same order and locking rule, restricted to from <= timestamp <= to; only
+// the months overlapping the range are opened. type_mask is a set of
+// DATA_MANAGER_EVENT_TYPE_BIT(type), 0 for every type. Stops after limit
+// matches (0 = no limit).
+#define DATA_MANAGER_EVENT_TYPE_BIT(type) (1u << (type))
+esp_err_t data_manager_query_events(const char *reptile_id, int64_t from,
+                                    int64_t to, uint32_t type_mask,
+                                    size_t limit, data_manager_event_cb_t cb,
+                                    void *user_ctx);
+// Removes the whole event history of an animal.
+esp_err_t data_manager_delete_events(const char *reptile_id);
 
 // Weight Operations
+// Weighings are kept in a compressed block time-series per animal; an append
+// only rewrites the tail block.
+typedef struct {
+  int64_t timestamp;
+  float weight; // 0.1 g resolution
+} weight_sample_t;
+
+typedef struct {
+  size_t count;
+  float min;
+  float max;
+  float avg;
+  float last; // Weight at last_ts
+  int64_t first_ts;
+  int64_t last_ts;
+} weight_stats_t;
+
+// Return false to stop the iteration early.
+typedef bool (*data_manager_weight_cb_t)(const weight_sample_t *sample,
+                                         void *user_ctx);
+
 esp_err_t data_manager_add_weight(const char *reptile_id, float weight,
                                   int64_t timestamp);
+// Whole history as a cJSON array. Prefer data_manager_query_weights().
 cJSON *data_manager_get_weights(const char *reptile_id);
+// Streams samples with from <= timestamp <= to, in insertion order. Same
+// locking rule as data_manager_foreach_event().
+esp_err_t data_manager_query_weights(const char *reptile_id, int64_t from,
+                                     int64_t to, data_manager_weight_cb_t cb,
+                                     void *user_ctx);
+// min/max/avg over [from, to], using per-block aggregates where possible.
+esp_err_t data_manager_get_weight_stats(const char *reptile_id, int64_t from,
+                                        int64_t to, weight_stats_t *out);
 
-// Document Operations
-esp_err_t data_manager_save_document(const document_t *doc);
-esp_err_t data_manager_load_document(const char *id, document_t *out_doc);
-cJSON *data_manager_list_documents(const char *related_id); // NULL for all
+// Per-animal aggregates
+// Derived facts kept up to date by every event and weight append, readable
+// without touching history files. Timestamps are 0 when there is no such
+// record. Rebuilt from history at init when missing or corrupt.
+#define DATA_MANAGER_EVENT_TYPE_COUNT (EVENT_HATCHING + 1)
 
-// Contact Operations
-esp_err_t data_manager_save_contact(const contact_t *contact);
-esp_err_t data_manager_load_contact(const char *id, contact_t *out_contact);
-cJSON *data_manager_list_contacts(void);
+typedef struct {
+  char id[MAX_ID_LEN];
+  int64_t last_feeding;
+  int64_t last_shedding; // EVENT_SHEDDING or EVENT_MOLT
+  int64_t last_event;
+  int64_t last_weight_ts;
+  float current_weight; // Weight with the latest timestamp
+  uint32_t weight_count;
+  uint32_t event_count;
+  uint32_t events_by_type[DATA_MANAGER_EVENT_TYPE_COUNT];
+} reptile_aggregate_t;
+
+// ESP_ERR_NOT_FOUND (and *out zeroed) for an animal without history.
+esp_err_t data_manager_get_aggregate(const char *reptile_id,
+                                     reptile_aggregate_t *out);
+// Every animal with history, sorted by id. Caller must free(*out_list).
+esp_err_t data_manager_list_aggregates(reptile_aggregate_t **out_list,
+                                       size_t *count);
+// Recomputes the table by scanning every indexed animal's history (slow).
+esp_err_t data_manager_rebuild_aggregates(void);
+
+// Ids
+// Compact id for a new record or event: 8 base32 characters ([0-9a-z]
+// without i, l, o, u), increasing in creation order. out_len must be at
+// least DATA_MANAGER_ID_LEN.
+#define DATA_MANAGER_ID_LEN 9
+
+esp_err_t data_manager_new_id(char *out, size_t out_len);
+
+// Record files
+// Reptiles, documents and contacts are stored as CBOR behind a storage_core
+// header (schema version + CRC32), spread over hashed bucket directories
+// (CONFIG_ARS_DATA_RECORD_FANOUT_BITS). Legacy .json records stay readable;
+// this opt-in pass rewrites them all as CBOR. out_converted may be NULL.
+esp_err_t data_manager_convert_records_to_cbor(size_t *out_converted);
 
 // Document Operations
+// Saves keep a persistent index on related_id up to date; listings and counts
+// are served from RAM (no filesystem access).
 esp_err_t data_manager_save_document(const document_t *doc);
 esp_err_t data_manager_load_document(const char *id, document_t *out_doc);
-cJSON *data_manager_list_documents(const char *related_id); // NULL for all
+// Summaries (id, related_id, type, title, timestamp); NULL for all.
+cJSON *data_manager_list_documents(const char *related_id);
+// Sorted by related_id then id. Caller must free(*out_list).
+esp_err_t data_manager_list_document_summaries(const char *related_id,
+                                               document_summary_t **out_list,
+                                               size_t *count);
+size_t data_manager_count_documents(const char *related_id);
 
 // Contact Operations
 esp_err_t data_manager_save_contact(const contact_t *contact);
 esp_err_t data_manager_load_contact(const char *id, contact_t *out_contact);
 cJSON *data_manager_list_contacts(void);
 
+// Cursors
+// Page through a listing in a stable key order without materialising it.
+// Each next() call copies one batch under the index lock (contacts: the FS
+// read lock) and releases it before returning, and resumes after the last key
+// handed out, so saves and deletes between batches never repeat or skip a
+// surviving entry. offset skips entries; limit = 0 means no limit.
+typedef struct data_manager_cursor data_manager_cursor_t;
+
+// Reptile summaries by id.
+esp_err_t data_manager_open_reptile_cursor(size_t offset, size_t limit,
+                                           data_manager_cursor_t **out);
+// Document summaries by related_id then id; NULL related_id for all.
+esp_err_t data_manager_open_document_cursor(const char *related_id,
+                                            size_t offset, size_t limit,
+                                            data_manager_cursor_t **out);
+// Full contacts by id. Contacts are not indexed: every batch rescans the
+// directory names, so prefer large batches.
+esp_err_t data_manager_open_contact_cursor(size_t offset, size_t limit,
+                                           data_manager_cursor_t **out);
+// Fill out[0..max) with the next entries; *count = 0 once the cursor is
+// exhausted. ESP_ERR_INVALID_ARG if the cursor lists another kind.
+esp_err_t data_manager_cursor_next_reptiles(data_manager_cursor_t *cursor,
+                                            reptile_summary_t *out, size_t max,
+                                            size_t *count);
+esp_err_t data_manager_cursor_next_documents(data_manager_cursor_t *cursor,
+                                             document_summary_t *out,
+                                             size_t max, size_t *count);
+esp_err_t data_manager_cursor_next_contacts(data_manager_cursor_t *cursor,
+                                            contact_t *out, size_t max,
+                                            size_t *count);
+void data_manager_cursor_close(data_manager_cursor_t *cursor);
+
+// Bulk import
+// Stages reptiles, events and weighings in RAM (PSRAM when available); the
+// commit then takes the /data write lock once, writes each reptile file once
+// (the last put of an id wins), opens each event log and weight series once,
+// and persists the summary index once. Readers wait for the whole commit, so
+// keep batches for imports and restores. Atomic: the files go through one
+// journal with a single fsync, so an error or a reset leaves either the whole
+// batch or none of it (a commit cut short after the journal is sealed is
+// finished by the next data_manager_init() or batch commit).
+typedef struct data_manager_batch data_manager_batch_t;
+
+esp_err_t data_manager_batch_begin(data_manager_batch_t **out);
+esp_err_t data_manager_batch_put_reptile(data_manager_batch_t *batch,
+                                         const reptile_t *reptile);
+esp_err_t data_manager_batch_put_event(data_manager_batch_t *batch,
+                                       const reptile_event_t *event);
+esp_err_t data_manager_batch_put_weight(data_manager_batch_t *batch,
+                                        const char *reptile_id, float weight,
+                                        int64_t timestamp);
+// Both free the batch, whatever the outcome.
+esp_err_t data_manager_batch_commit(data_manager_batch_t *batch);
+void data_manager_batch_abort(data_manager_batch_t *batch);
+
+// Filesystem lock statistics
+// Readers (loads, listings, history scans) share the /data lock; saves,
+// appends and deletes take it exclusively. Times are in microseconds.
+typedef struct {
+  uint32_t read_acquired;
+  uint32_t write_acquired;
+  uint32_t read_contended; // Had to block before acquiring
+  uint32_t write_contended;
+  uint32_t timeouts;
+  uint32_t max_wait_us;
+  uint64_t total_wait_us;
+  uint32_t max_read_hold_us; // Per reader group, first in to last out
+  uint64_t total_read_hold_us;
+  uint32_t max_write_hold_us;
+  uint64_t total_write_hold_us;
+  uint32_t active_readers;
+} data_manager_lock_stats_t;
+
+esp_err_t data_manager_get_lock_stats(data_manager_lock_stats_t *out);
+void data_manager_reset_lock_stats(void);
+
+// Transient allocation arena (CONFIG_ARS_DATA_ARENA)
+// Legacy migrations, index persistence and contact paging carve their
+// temporary buffers and cJSON nodes out of a per-operation bump arena
+// (in PSRAM when enabled) released in one go. cJSON calls made anywhere else
+// go to the heap, PSRAM first. ESP_ERR_NOT_SUPPORTED when disabled.
+typedef struct {
+  uint32_t scopes;       // Operations that ran on an arena
+  uint32_t scope_misses; // Ran on the heap: every arena was taken
+  uint32_t arena_allocs; // Allocations served by an arena...
+  uint32_t chunk_allocs; // ...and the heap allocations backing them
+  uint32_t heap_allocs;  // cJSON allocations outside any arena
+  uint32_t peak_scope_bytes; // Largest footprint of a single operation
+} data_manager_arena_stats_t;
+
+esp_err_t data_manager_get_arena_stats(data_manager_arena_stats_t *out);
+void data_manager_reset_arena_stats(void);
+
+// Operation metrics (CONFIG_ARS_DATA_METRICS)
+// Every public call is counted under one operation class, with its latency
+// in a log2 histogram and the time it spent waiting for the /data lock, in
+// file I/O and in encoding/decoding, plus the bytes it read and wrote.
+// Times are in microseconds. ESP_ERR_NOT_SUPPORTED when disabled.
+typedef enum {
+  DATA_MANAGER_OP_LOAD,          // load_reptile/document/contact
+  DATA_MANAGER_OP_SAVE,          // save_reptile/document/contact
+  DATA_MANAGER_OP_DELETE,        // delete_reptile, delete_events
+  DATA_MANAGER_OP_LIST,          // Listings, search, counts, cursor pages
+  DATA_MANAGER_OP_EVENT_APPEND,  // add_event
+  DATA_MANAGER_OP_EVENT_READ,    // get/foreach/query_events
+  DATA_MANAGER_OP_WEIGHT_APPEND, // add_weight
+  DATA_MANAGER_OP_WEIGHT_READ,   // get/query_weights, get_weight_stats
+  DATA_MANAGER_OP_AGGREGATE,     // get/list_aggregates
+  DATA_MANAGER_OP_BATCH,         // batch_commit
+  DATA_MANAGER_OP_FLUSH,         // Cache write-backs, one per record
+  DATA_MANAGER_OP_MAINTENANCE,   // init, rebuilds, conversion, new_id
+  DATA_MANAGER_OP_SCRUB,         // Integrity scrubber, one per slice
+  DATA_MANAGER_OP_COUNT,
+} data_manager_op_t;
+
+// Bucket 0 counts calls under 1 us, bucket i >= 1 those in
+// [2^(i-1), 2^i) us; the last bucket is open-ended (>= 262 ms).
+#define DATA_MANAGER_LATENCY_BUCKETS 20
+
+typedef struct {
+  uint32_t calls;
+  uint32_t max_us;
+  uint64_t total_us;
+  uint64_t lock_wait_us; // Waiting for the /data lock
+  uint64_t io_us;        // Reading and writing files
+  uint64_t parse_us;     // CBOR/JSON/binary record encode and decode
+  uint64_t bytes_read;
+  uint64_t bytes_written;
+  uint32_t latency[DATA_MANAGER_LATENCY_BUCKETS];
+} data_manager_op_stats_t;
+
+esp_err_t data_manager_get_op_stats(data_manager_op_t op,
+                                    data_manager_op_stats_t *out);
+void data_manager_reset_op_stats(void);
+// Short stable name ("load", "event_read"...), NULL when out of range.
+const char *data_manager_op_name(data_manager_op_t op);
+// Upper bound in us of the bucket holding the q-th quantile (0 < q <= 1),
+// 0 when no call was counted. UINT32_MAX for the open-ended bucket.
+uint32_t data_manager_op_quantile_us(const data_manager_op_stats_t *stats,
+                                     float q);
+
+// Entity cache (CONFIG_ARS_DATA_CACHE)
+// Decoded reptiles, documents and contacts are kept in an LRU (PSRAM when
+// available) in front of their files. Reptile and document saves are
+// write-back: a low-priority task writes them within
+// CONFIG_ARS_DATA_CACHE_FLUSH_MS, so a power cut can lose that window of
+// saves (the indexes are then rebuilt from the files at boot). Contacts are
+// written through. ESP_ERR_NOT_SUPPORTED when disabled.
+typedef struct {
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+  uint32_t writebacks; // Dirty entries written to flash
+  uint32_t write_errors;
+  uint32_t entries; // Current content, not reset
+  uint32_t dirty;
+  uint32_t bytes;
+} data_manager_cache_stats_t;
+
+esp_err_t data_manager_get_cache_stats(data_manager_cache_stats_t *out);
+void data_manager_reset_cache_stats(void);
+// Writes every pending save, the indexes and the change log now. Call before
+// a restart, an OTA reboot or unmounting /data.
+esp_err_t data_manager_flush(void);
+
+// Integrity scrubber (CONFIG_ARS_DATA_SCRUB)
+// A low-priority task re-reads every record, event shard and weight series
+// in small slices, only when the /data lock is free, and sleeps so that it
+// uses at most CONFIG_ARS_DATA_SCRUB_DUTY_PCT of the time. A record that no
+// longer decodes is rewritten from the entity cache when it holds a copy,
+// otherwise moved to /data/quarantine; every finding is appended to
+// /data/quarantine/report.log. Damaged event or weight records are only
+// reported: readers already skip them. The position is saved regularly, so
+// a pass resumes where it stopped after a reboot. ESP_ERR_NOT_SUPPORTED when
+// disabled.
+typedef struct {
+  uint32_t passes;        // Completed since boot
+  uint32_t files_checked; // Since boot
+  uint64_t bytes_checked;
+  uint32_t quarantined; // Records moved to /data/quarantine
+  uint32_t repaired;    // Records rewritten from the cache
+  uint32_t damaged;     // Logs and series holding skipped records
+  uint32_t deferred;    // Slices put off because /data was busy
+  uint32_t max_slice_us;
+  uint32_t position; // Files checked in the current pass, resumed at boot
+} data_manager_scrub_stats_t;
+
+esp_err_t data_manager_get_scrub_stats(data_manager_scrub_stats_t *out);
+// Finishes the current pass now, slice by slice, without the pauses.
+esp_err_t data_manager_scrub_now(void);
+
+// Change log (CONFIG_ARS_DATA_CHANGES)
+// Every save, delete, event and weighing append takes the next sequence
+// number and an entry in a bounded log, so a consumer (web UI, backup,
+// publisher) that remembers the last seq it handled reads only what changed
+// since, in O(changes). Events and weighings are logged under the animal id;
+// a batch commit logs one entry per animal and kind. The log keeps the last
+// CONFIG_ARS_DATA_CHANGES_SIZE changes and is saved by data_manager_flush().
+typedef enum {
+  DATA_MANAGER_ENTITY_REPTILE,
+  DATA_MANAGER_ENTITY_DOCUMENT,
+  DATA_MANAGER_ENTITY_CONTACT,
+  DATA_MANAGER_ENTITY_EVENTS,  // History of the animal id
+  DATA_MANAGER_ENTITY_WEIGHTS, // Weighings of the animal id
+  DATA_MANAGER_ENTITY_COUNT,
+} data_manager_entity_t;
+
+typedef enum {
+  DATA_MANAGER_CHANGE_PUT,    // Created, replaced or appended to
+  DATA_MANAGER_CHANGE_DELETE, // Removed (the whole history for events)
+} data_manager_change_op_t;
+
+typedef struct {
+  uint64_t seq;
+  data_manager_entity_t entity;
+  data_manager_change_op_t op;
+  char id[MAX_ID_LEN];
+} data_manager_change_t;
+
+// seq of the latest change, 0 before the first one. A consumer starting from
+// scratch reads it first, then everything, then the changes since that seq
+// (replaying the few that raced the full read).
+uint64_t data_manager_change_seq(void);
+// Copies up to max changes with seq > since, oldest first; fewer than max
+// means the consumer has caught up. ESP_ERR_INVALID_STATE when some of them
+// are no longer in the log (overwritten, lost in a reset, or since comes
+// from another log): resync in full. ESP_ERR_NOT_SUPPORTED when disabled.
+esp_err_t data_manager_changes_since(uint64_t since,
+                                     data_manager_change_t *out, size_t max,
+                                     size_t *count);
+// Short stable name ("reptile", "events"...), NULL when out of range.
+const char *data_manager_entity_name(data_manager_entity_t entity);
+
+// Interned strings
+// A facility has a few dozen species and morphs shared by hundreds of
+// animals: the summaries point into one pool holding each distinct string
+// once, and the index file stores their ids. Filter on a species with ==.
+typedef struct {
+  uint32_t strings; // Distinct strings, "" included
+  uint32_t bytes;   // Pool blocks and tables
+} data_manager_string_stats_t;
+
+// The pooled copy of s, comparable by pointer with the species and morph of
+// any summary; NULL when no animal ever used s (so none matches).
+const char *data_manager_find_string(const char *s);
+esp_err_t data_manager_get_string_stats(data_manager_string_stats_t *out);
+
+// Snapshots (CONFIG_ARS_DATA_SNAPSHOT)
+// Immutable, consistent view of the reptile summaries, document summaries and
+// aggregates as of one version. Acquiring is a pointer load and a reference
+// count under a short critical section: readers never wait on a writer, and a
+// writer never waits on a reader. Every change publishes a new version that
+// shares the unchanged parts of the previous one; a version is freed when its
+// last reader releases it. Keep a snapshot for one request or one screen,
+// not longer: a held version pins the memory it shares.
+typedef struct data_manager_snapshot data_manager_snapshot_t;
+
+typedef struct {
+  uint32_t publishes;
+  uint32_t live_versions; // Published, held by readers, or being built
+  uint32_t chunks;
+  uint32_t bytes;        // Everything the versions allocate
+  uint32_t chunk_copies; // Shared chunks copied on write
+  uint32_t max_build_us; // Building and publishing one version
+  uint64_t total_build_us;
+} data_manager_snapshot_stats_t;
+
+// NULL when disabled, before init, or after running out of memory: read
+// through the index functions instead. Release every non-NULL snapshot.
+const data_manager_snapshot_t *data_manager_snapshot_acquire(void);
+void data_manager_snapshot_release(const data_manager_snapshot_t *snap);
+uint32_t data_manager_snapshot_version(const data_manager_snapshot_t *snap);
+// Entries stay valid until the release; NULL past the end.
+size_t data_manager_snapshot_reptile_count(const data_manager_snapshot_t *snap);
+const reptile_summary_t *
+data_manager_snapshot_reptile(const data_manager_snapshot_t *snap, size_t i);
+const reptile_summary_t *
+data_manager_snapshot_find_reptile(const data_manager_snapshot_t *snap,
+                                   const char *id);
+// Sorted by related_id then id.
+size_t
+data_manager_snapshot_document_count(const data_manager_snapshot_t *snap);
+const document_summary_t *
+data_manager_snapshot_document(const data_manager_snapshot_t *snap, size_t i);
+// Number of documents of related_id; they start at *first.
+size_t data_manager_snapshot_documents_of(const data_manager_snapshot_t *snap,
+                                          const char *related_id,
+                                          size_t *first);
+size_t
+data_manager_snapshot_aggregate_count(const data_manager_snapshot_t *snap);
+const reptile_aggregate_t *
+data_manager_snapshot_aggregate(const data_manager_snapshot_t *snap, size_t i);
+const reptile_aggregate_t *
+data_manager_snapshot_find_aggregate(const data_manager_snapshot_t *snap,
+                                     const char *id);
+esp_err_t data_manager_get_snapshot_stats(data_manager_snapshot_stats_t *out);
+
 // Utils
 const char *gender_to_str(reptile_gender_t gender);
@@ -0,0 +1,69 @@
+#include "blob_stream.h"
+#include "storage_core.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  const blob_stream_ops_t *ops;
+  void *ctx;
+  bool started;
+  uint32_t count;
+  uint32_t decoded;
+  size_t used; // Bytes of a partial entry carried over to the next chunk
+  uint8_t *buf;
+} blob_stream_t;
+
+static esp_err_t on_chunk(const uint8_t *chunk, size_t len, void *ctx) {
+  blob_stream_t *s = ctx;
+  // The carry-over is shorter than one entry: a chunk always fits.
+  memcpy(s->buf + s->used, chunk, len);
+  const uint8_t *p = s->buf;
+  const uint8_t *end = s->buf + s->used + len;
+  if (!s->started) {
+    if ((size_t)(end - p) < sizeof(s->count)) {
+      s->used = (size_t)(end - p);
+      return ESP_OK;
+    }
+    memcpy(&s->count, p, sizeof(s->count));
+    p += sizeof(s->count);
+    s->started = true;
+    esp_err_t err = s->ops->start(s->count, s->ctx);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  while (p < end) {
+    if (s->decoded == s->count) {
+      return ESP_ERR_INVALID_SIZE; // Trailing bytes
+    }
+    size_t n = s->ops->entry(s->decoded, p, end, s->ctx);
+    if (n == 0) {
+      if ((size_t)(end - p) >= s->ops->max_entry) {
+        return ESP_ERR_INVALID_SIZE;
+      }
+      break;
+    }
+    p += n;
+    s->decoded++;
+  }
+  s->used = (size_t)(end - p);
+  memmove(s->buf, p, s->used);
+  return ESP_OK;
+}
+
+esp_err_t blob_stream_load(const char *path, uint32_t version,
+                           const blob_stream_ops_t *ops, void *ctx) {
+  blob_stream_t s = {.ops = ops, .ctx = ctx};
+  s.buf = malloc(ops->max_entry + STORAGE_CHUNK_SIZE);
+  if (!s.buf) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t err = storage_load_secure_stream(path, version, on_chunk, &s);
+  free(s.buf);
+  if (err == ESP_OK &&
+      (!s.started || s.decoded != s.count || s.used != 0)) {
+    err = ESP_ERR_INVALID_SIZE;
+  }
+  return err;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+// Streaming decoder for the index blobs: u32 count, then count entries of
+// bounded size. The storage_core file is read with
+// storage_load_secure_stream(), so only one chunk and one partial entry are
+// ever in RAM, whatever the collection size. Entries are decoded before the
+// CRC is checked: the caller builds them in scratch state and installs it
+// only on ESP_OK.
+
+#include "esp_err.h"
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+  // Called once with the entry count, before any entry.
+  esp_err_t (*start)(uint32_t count, void *ctx);
+  // Decodes entry index from [p, end); returns the bytes used, 0 when the
+  // entry runs past end.
+  size_t (*entry)(uint32_t index, const uint8_t *p, const uint8_t *end,
+                  void *ctx);
+  size_t max_entry; // Upper bound of one encoded entry
+} blob_stream_ops_t;
+
+// ESP_ERR_NOT_FOUND without a file, ESP_ERR_INVALID_CRC or
+// ESP_ERR_INVALID_SIZE when it is corrupt.
+esp_err_t blob_stream_load(const char *path, uint32_t version,
+                           const blob_stream_ops_t *ops, void *ctx);
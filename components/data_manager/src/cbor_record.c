@@ -0,0 +1,326 @@
+#include "cbor_record.h"
+#include <stdbool.h>
+#include <string.h>
+
+#define CBOR_MAJOR_UINT 0
+#define CBOR_MAJOR_NINT 1
+#define CBOR_MAJOR_BYTES 2
+#define CBOR_MAJOR_TEXT 3
+#define CBOR_MAJOR_ARRAY 4
+#define CBOR_MAJOR_MAP 5
+#define CBOR_MAJOR_TAG 6
+#define CBOR_MAJOR_SIMPLE 7
+
+#define CBOR_INFO_FLOAT32 26
+#define CBOR_INFO_FLOAT64 27
+
+// Nesting allowed while skipping unknown values.
+#define CBOR_MAX_SKIP_DEPTH 8
+
+typedef struct {
+  uint8_t *p;
+  uint8_t *end;
+  bool overflow;
+} cbor_out_t;
+
+static void put_bytes(cbor_out_t *o, const void *data, size_t len) {
+  if (o->overflow || (size_t)(o->end - o->p) < len) {
+    o->overflow = true;
+    return;
+  }
+  memcpy(o->p, data, len);
+  o->p += len;
+}
+
+// Big-endian argument using the shortest encoding.
+static void put_head(cbor_out_t *o, uint8_t major, uint64_t value) {
+  uint8_t buf[9];
+  if (value < 24) {
+    buf[0] = (uint8_t)(major << 5) | (uint8_t)value;
+    put_bytes(o, buf, 1);
+    return;
+  }
+  size_t n;
+  uint8_t info;
+  if (value <= UINT8_MAX) {
+    n = 1;
+    info = 24;
+  } else if (value <= UINT16_MAX) {
+    n = 2;
+    info = 25;
+  } else if (value <= UINT32_MAX) {
+    n = 4;
+    info = 26;
+  } else {
+    n = 8;
+    info = 27;
+  }
+  buf[0] = (uint8_t)(major << 5) | info;
+  for (size_t i = n; i > 0; i--) {
+    buf[i] = (uint8_t)value;
+    value >>= 8;
+  }
+  put_bytes(o, buf, n + 1);
+}
+
+static void put_int(cbor_out_t *o, int64_t v) {
+  if (v >= 0) {
+    put_head(o, CBOR_MAJOR_UINT, (uint64_t)v);
+  } else {
+    put_head(o, CBOR_MAJOR_NINT, ~(uint64_t)v); // -1 - v
+  }
+}
+
+static void put_float(cbor_out_t *o, const record_field_t *field,
+                      const void *obj) {
+  uint8_t buf[9];
+  if (field->size == sizeof(float)) {
+    float f = (float)record_field_get_float(field, obj);
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    buf[0] = (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_FLOAT32;
+    for (int i = 4; i >= 1; i--, bits >>= 8) {
+      buf[i] = (uint8_t)bits;
+    }
+    put_bytes(o, buf, 5);
+  } else {
+    double d = record_field_get_float(field, obj);
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    buf[0] = (CBOR_MAJOR_SIMPLE << 5) | CBOR_INFO_FLOAT64;
+    for (int i = 8; i >= 1; i--, bits >>= 8) {
+      buf[i] = (uint8_t)bits;
+    }
+    put_bytes(o, buf, 9);
+  }
+}
+
+esp_err_t cbor_record_encode(const record_field_t *fields, size_t count,
+                             const void *obj, uint8_t *out, size_t cap,
+                             size_t *out_len) {
+  if (!fields || !obj || !out || !out_len) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  cbor_out_t o = {.p = out, .end = out + cap};
+  put_head(&o, CBOR_MAJOR_MAP, count);
+  for (size_t i = 0; i < count; i++) {
+    const record_field_t *field = &fields[i];
+    put_head(&o, CBOR_MAJOR_UINT, i);
+    switch (field->type) {
+    case RECORD_FIELD_STRING: {
+      size_t len = record_field_strlen(field, obj);
+      put_head(&o, CBOR_MAJOR_TEXT, len);
+      put_bytes(&o, (const char *)obj + field->offset, len);
+      break;
+    }
+    case RECORD_FIELD_INT:
+      put_int(&o, record_field_get_int(field, obj));
+      break;
+    case RECORD_FIELD_FLOAT:
+      put_float(&o, field, obj);
+      break;
+    }
+  }
+  if (o.overflow) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  *out_len = (size_t)(o.p - out);
+  return ESP_OK;
+}
+
+typedef struct {
+  const uint8_t *p;
+  const uint8_t *end;
+} cbor_in_t;
+
+static bool get_head(cbor_in_t *in, uint8_t *major, uint8_t *info,
+                     uint64_t *value) {
+  if (in->p >= in->end) {
+    return false;
+  }
+  uint8_t b = *in->p++;
+  *major = b >> 5;
+  *info = b & 0x1F;
+  size_t n;
+  if (*info < 24) {
+    *value = *info;
+    return true;
+  } else if (*info <= 27) {
+    n = (size_t)1 << (*info - 24);
+  } else {
+    return false; // Reserved or indefinite length
+  }
+  if ((size_t)(in->end - in->p) < n) {
+    return false;
+  }
+  uint64_t v = 0;
+  for (size_t i = 0; i < n; i++) {
+    v = (v << 8) | *in->p++;
+  }
+  *value = v;
+  return true;
+}
+
+static bool skip_item(cbor_in_t *in, int depth) {
+  uint8_t major, info;
+  uint64_t value;
+  if (depth > CBOR_MAX_SKIP_DEPTH || !get_head(in, &major, &info, &value)) {
+    return false;
+  }
+  switch (major) {
+  case CBOR_MAJOR_BYTES:
+  case CBOR_MAJOR_TEXT:
+    if ((uint64_t)(in->end - in->p) < value) {
+      return false;
+    }
+    in->p += value;
+    return true;
+  case CBOR_MAJOR_ARRAY:
+  case CBOR_MAJOR_MAP: {
+    uint64_t items = major == CBOR_MAJOR_MAP ? value * 2 : value;
+    for (uint64_t i = 0; i < items; i++) {
+      if (!skip_item(in, depth + 1)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case CBOR_MAJOR_TAG:
+    return skip_item(in, depth + 1);
+  default:
+    return true; // Integers, simple values and floats carry no payload
+  }
+}
+
+// float32/float64 payload already consumed by get_head() as an integer.
+static bool head_to_double(uint8_t info, uint64_t bits, double *out) {
+  if (info == CBOR_INFO_FLOAT32) {
+    uint32_t b32 = (uint32_t)bits;
+    float f;
+    memcpy(&f, &b32, sizeof(f));
+    *out = f;
+    return true;
+  }
+  if (info == CBOR_INFO_FLOAT64) {
+    memcpy(out, &bits, sizeof(*out));
+    return true;
+  }
+  return false;
+}
+
+static bool decode_value(cbor_in_t *in, const record_field_t *field,
+                         void *obj) {
+  const uint8_t *start = in->p;
+  uint8_t major, info;
+  uint64_t value;
+  if (!get_head(in, &major, &info, &value)) {
+    return false;
+  }
+
+  double d;
+  switch (field->type) {
+  case RECORD_FIELD_STRING:
+    if (major == CBOR_MAJOR_TEXT) {
+      if ((uint64_t)(in->end - in->p) < value) {
+        return false;
+      }
+      size_t n = value < field->size ? (size_t)value : field->size - 1u;
+      char *dst = (char *)obj + field->offset;
+      memcpy(dst, in->p, n);
+      dst[n] = '\0';
+      in->p += value;
+      return true;
+    }
+    break;
+  case RECORD_FIELD_INT:
+    if (major == CBOR_MAJOR_UINT) {
+      record_field_set_int(field, obj, (int64_t)value);
+      return true;
+    }
+    if (major == CBOR_MAJOR_NINT) {
+      record_field_set_int(field, obj, (int64_t)~value);
+      return true;
+    }
+    if (major == CBOR_MAJOR_SIMPLE && head_to_double(info, value, &d)) {
+      record_field_set_int(field, obj, (int64_t)d);
+      return true;
+    }
+    break;
+  case RECORD_FIELD_FLOAT:
+    if (major == CBOR_MAJOR_SIMPLE && head_to_double(info, value, &d)) {
+      record_field_set_float(field, obj, d);
+      return true;
+    }
+    if (major == CBOR_MAJOR_UINT) {
+      record_field_set_float(field, obj, (double)value);
+      return true;
+    }
+    if (major == CBOR_MAJOR_NINT) {
+      record_field_set_float(field, obj, (double)(int64_t)~value);
+      return true;
+    }
+    break;
+  }
+  // Type does not fit the field: rewind and skip it.
+  in->p = start;
+  return skip_item(in, 0);
+}
+
+static const record_field_t *key_to_field(cbor_in_t *in,
+                                          const record_field_t *fields,
+                                          size_t count, bool *ok) {
+  const uint8_t *start = in->p;
+  uint8_t major, info;
+  uint64_t value;
+  *ok = get_head(in, &major, &info, &value);
+  if (!*ok) {
+    return NULL;
+  }
+  if (major == CBOR_MAJOR_UINT) {
+    return value < count ? &fields[value] : NULL;
+  }
+  if (major == CBOR_MAJOR_TEXT) {
+    if ((uint64_t)(in->end - in->p) < value) {
+      *ok = false;
+      return NULL;
+    }
+    const char *key = (const char *)in->p;
+    in->p += value;
+    for (size_t i = 0; i < count; i++) {
+      if (strlen(fields[i].name) == value &&
+          memcmp(fields[i].name, key, value) == 0) {
+        return &fields[i];
+      }
+    }
+    return NULL;
+  }
+  in->p = start;
+  *ok = skip_item(in, 0);
+  return NULL;
+}
+
+esp_err_t cbor_record_decode(const uint8_t *data, size_t len,
+                             const record_field_t *fields, size_t count,
+                             void *out) {
+  if (!data || !fields || !out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  cbor_in_t in = {.p = data, .end = data + len};
+  uint8_t major, info;
+  uint64_t pairs;
+  if (!get_head(&in, &major, &info, &pairs) || major != CBOR_MAJOR_MAP) {
+    return ESP_FAIL;
+  }
+  for (uint64_t i = 0; i < pairs; i++) {
+    bool ok;
+    const record_field_t *field = key_to_field(&in, fields, count, &ok);
+    if (!ok) {
+      return ESP_FAIL;
+    }
+    ok = field ? decode_value(&in, field, out) : skip_item(&in, 0);
+    if (!ok) {
+      return ESP_FAIL;
+    }
+  }
+  return ESP_OK;
+}
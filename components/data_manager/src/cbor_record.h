@@ -0,0 +1,26 @@
+#pragma once
+
+// Minimal CBOR (RFC 8949) codec for flat records described by a
+// record_schema.h field table. A record is one definite-length map whose
+// keys are the field indexes (one byte each) and whose values are text
+// strings, integers or float32/float64.
+//
+// The decoder also accepts text keys matching the field names, skips unknown
+// keys and any nested item, and leaves fields absent from the input
+// untouched. Indefinite-length items are rejected.
+
+#include "esp_err.h"
+#include "record_schema.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// Largest encoding the encoder will produce for the data_manager records.
+#define CBOR_RECORD_MAX_SIZE 512
+
+// ESP_ERR_INVALID_SIZE if the encoding does not fit in cap bytes.
+esp_err_t cbor_record_encode(const record_field_t *fields, size_t count,
+                             const void *obj, uint8_t *out, size_t cap,
+                             size_t *out_len);
+esp_err_t cbor_record_decode(const uint8_t *data, size_t len,
+                             const record_field_t *fields, size_t count,
+                             void *out);
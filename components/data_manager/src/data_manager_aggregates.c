@@ -0,0 +1,605 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "storage_core.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+static const char *TAG = "dm_aggregates";
+
+// Materialised per-animal aggregates: /data/index/aggregates.dat is an array
+// of fixed 128-byte slots, one per animal with history, each with its own
+// CRC. The whole table is loaded in RAM at init; an append updates the RAM
+// entry and rewrites its slot only, so the cost does not depend on the
+// history or the collection size. Missing or corrupt, the table is rebuilt
+// from the event logs and weight series.
+#define AGG_PATH DATA_MANAGER_INDEX_DIR "/aggregates.dat"
+// Present while a rebuild runs: an interrupted rebuild is restarted at init.
+#define AGG_REBUILD_MARK DATA_MANAGER_INDEX_DIR "/aggregates.rebuild"
+#define AGG_MAGIC 0x4741u // "AG"
+#define AGG_VERSION 1
+#define AGG_GROW_STEP 16
+#define AGG_REBUILD_RETRIES 3
+
+typedef struct {
+  uint16_t magic;
+  uint16_t version;
+  uint32_t crc32; // Whole slot with this field zeroed
+  char id[MAX_ID_LEN];
+  int64_t last_feeding;
+  int64_t last_shedding;
+  int64_t last_event;
+  int64_t last_weight_ts;
+  float current_weight;
+  uint32_t weight_count;
+  uint32_t event_count;
+  uint32_t events_by_type[DATA_MANAGER_EVENT_TYPE_COUNT];
+  uint32_t reserved;
+} agg_slot_t;
+
+_Static_assert(sizeof(agg_slot_t) == 128, "aggregate slot must be 128 bytes");
+
+typedef struct {
+  reptile_aggregate_t agg;
+  uint32_t slot;
+} agg_entry_t;
+
+static SemaphoreHandle_t s_agg_lock = NULL;
+static agg_entry_t *s_entries = NULL; // Sorted by id
+static size_t s_count = 0;
+static size_t s_capacity = 0;
+static uint32_t *s_free_slots = NULL; // Slots left by removed animals
+static size_t s_free_count = 0;
+static uint32_t s_slot_count = 0; // Slots in the file
+static uint32_t s_apply_seq = 0;  // Bumped by every change, for rebuilds
+
+static bool agg_lock(void) {
+  return s_agg_lock && xSemaphoreTake(s_agg_lock, portMAX_DELAY) == pdTRUE;
+}
+
+static void agg_unlock(void) { xSemaphoreGive(s_agg_lock); }
+
+// Binary search; returns the insertion point when the id is absent.
+static size_t agg_find(const char *id, bool *found) {
+  size_t lo = 0, hi = s_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(s_entries[mid].agg.id, id);
+    if (cmp == 0) {
+      *found = true;
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *found = false;
+  return lo;
+}
+
+static bool free_slot_push(uint32_t slot) {
+  uint32_t *grown =
+      realloc(s_free_slots, (s_free_count + 1) * sizeof(uint32_t));
+  if (!grown) {
+    return false;
+  }
+  s_free_slots = grown;
+  s_free_slots[s_free_count++] = slot;
+  return true;
+}
+
+// Finds or creates the entry of id. A new entry gets the given slot, or a
+// free or new one for UINT32_MAX.
+static agg_entry_t *agg_insert_slot(const char *id, uint32_t slot) {
+  bool found = false;
+  size_t pos = agg_find(id, &found);
+  if (found) {
+    return &s_entries[pos];
+  }
+  if (s_count == s_capacity) {
+    size_t new_cap = s_capacity + AGG_GROW_STEP;
+    agg_entry_t *grown = realloc(s_entries, new_cap * sizeof(agg_entry_t));
+    if (!grown) {
+      ESP_LOGE(TAG, "Failed to grow aggregates to %u", (unsigned)new_cap);
+      return NULL;
+    }
+    s_entries = grown;
+    s_capacity = new_cap;
+  }
+  memmove(&s_entries[pos + 1], &s_entries[pos],
+          (s_count - pos) * sizeof(agg_entry_t));
+  s_count++;
+  agg_entry_t *e = &s_entries[pos];
+  memset(e, 0, sizeof(*e));
+  copy_bounded(e->agg.id, sizeof(e->agg.id), id);
+  if (slot != UINT32_MAX) {
+    e->slot = slot;
+  } else {
+    e->slot = s_free_count > 0 ? s_free_slots[--s_free_count] : s_slot_count++;
+  }
+  return e;
+}
+
+static void slot_encode(const reptile_aggregate_t *agg, agg_slot_t *slot) {
+  memset(slot, 0, sizeof(*slot));
+  slot->magic = AGG_MAGIC;
+  slot->version = AGG_VERSION;
+  copy_bounded(slot->id, sizeof(slot->id), agg->id);
+  slot->last_feeding = agg->last_feeding;
+  slot->last_shedding = agg->last_shedding;
+  slot->last_event = agg->last_event;
+  slot->last_weight_ts = agg->last_weight_ts;
+  slot->current_weight = agg->current_weight;
+  slot->weight_count = agg->weight_count;
+  slot->event_count = agg->event_count;
+  memcpy(slot->events_by_type, agg->events_by_type,
+         sizeof(slot->events_by_type));
+  slot->crc32 = storage_crc32((const uint8_t *)slot, sizeof(*slot));
+}
+
+static bool slot_decode(const agg_slot_t *slot, reptile_aggregate_t *agg) {
+  agg_slot_t tmp = *slot;
+  tmp.crc32 = 0;
+  if (slot->magic != AGG_MAGIC || slot->version != AGG_VERSION ||
+      storage_crc32((const uint8_t *)&tmp, sizeof(tmp)) != slot->crc32) {
+    return false;
+  }
+  memset(agg, 0, sizeof(*agg));
+  copy_bounded(agg->id, sizeof(agg->id), slot->id);
+  agg->last_feeding = slot->last_feeding;
+  agg->last_shedding = slot->last_shedding;
+  agg->last_event = slot->last_event;
+  agg->last_weight_ts = slot->last_weight_ts;
+  agg->current_weight = slot->current_weight;
+  agg->weight_count = slot->weight_count;
+  agg->event_count = slot->event_count;
+  memcpy(agg->events_by_type, slot->events_by_type,
+         sizeof(agg->events_by_type));
+  return true;
+}
+
+// Rewrites one slot; a NULL agg clears it. Caller holds the FS write lock.
+static esp_err_t slot_write_unlocked(uint32_t index,
+                                     const reptile_aggregate_t *agg) {
+  agg_slot_t slot;
+  if (agg) {
+    slot_encode(agg, &slot);
+  } else {
+    memset(&slot, 0, sizeof(slot));
+  }
+  int64_t t0 = dm_metrics_now();
+  FILE *f = fopen(AGG_PATH, "r+b");
+  if (!f) {
+    f = fopen(AGG_PATH, "w+b");
+  }
+  if (!f) {
+    ESP_LOGE(TAG, "Failed to open %s", AGG_PATH);
+    return ESP_FAIL;
+  }
+  esp_err_t err = ESP_OK;
+  if (fseek(f, (long)index * sizeof(slot), SEEK_SET) != 0 ||
+      fwrite(&slot, 1, sizeof(slot), f) != sizeof(slot)) {
+    err = ESP_FAIL;
+  }
+  if (fclose(f) != 0) {
+    err = ESP_FAIL;
+  }
+  dm_op_io(t0, 0, sizeof(slot));
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Short write on aggregate slot %u", (unsigned)index);
+  }
+  return err;
+}
+
+static void apply_event(reptile_aggregate_t *agg, const reptile_event_t *e) {
+  agg->event_count++;
+  if ((unsigned)e->type < DATA_MANAGER_EVENT_TYPE_COUNT) {
+    agg->events_by_type[e->type]++;
+  }
+  if (e->timestamp > agg->last_event) {
+    agg->last_event = e->timestamp;
+  }
+  if (e->type == EVENT_FEEDING && e->timestamp > agg->last_feeding) {
+    agg->last_feeding = e->timestamp;
+  }
+  if ((e->type == EVENT_SHEDDING || e->type == EVENT_MOLT) &&
+      e->timestamp > agg->last_shedding) {
+    agg->last_shedding = e->timestamp;
+  }
+}
+
+static void apply_weight(reptile_aggregate_t *agg, const weight_sample_t *s) {
+  // Latest timestamp wins; on a tie, the latest recorded.
+  if (agg->weight_count == 0 || s->timestamp >= agg->last_weight_ts) {
+    agg->current_weight = s->weight;
+    agg->last_weight_ts = s->timestamp;
+  }
+  agg->weight_count++;
+}
+
+// Caller holds the aggregate lock; e was just updated, or inserted when the
+// table grew.
+static void agg_snapshot_put(const agg_entry_t *e, size_t count_before) {
+  snapshot_edit_begin();
+  snapshot_put(SNAPSHOT_AGGREGATES, e - s_entries, &e->agg,
+               s_count != count_before);
+  snapshot_edit_end();
+}
+
+// Caller holds the aggregate lock.
+static void agg_snapshot_load(void) {
+  snapshot_edit_begin();
+  snapshot_load(SNAPSHOT_AGGREGATES, s_entries, s_count, sizeof(*s_entries));
+  snapshot_edit_end();
+}
+
+// Clears the slot of the entry at pos and drops the entry; the caller has
+// freed the slot. Caller holds the aggregate lock.
+static void agg_erase(size_t pos) {
+  slot_write_unlocked(s_entries[pos].slot, NULL);
+  memmove(&s_entries[pos], &s_entries[pos + 1],
+          (s_count - pos - 1) * sizeof(agg_entry_t));
+  s_count--;
+  snapshot_edit_begin();
+  snapshot_erase(SNAPSHOT_AGGREGATES, pos);
+  snapshot_edit_end();
+}
+
+void aggregate_apply_events_unlocked(const char *reptile_id,
+                                     const reptile_event_t *const *events,
+                                     size_t count) {
+  if (count == 0 || !agg_lock()) {
+    return;
+  }
+  size_t before = s_count;
+  agg_entry_t *e = agg_insert_slot(reptile_id, UINT32_MAX);
+  if (e) {
+    for (size_t i = 0; i < count; i++) {
+      apply_event(&e->agg, events[i]);
+    }
+    slot_write_unlocked(e->slot, &e->agg);
+    agg_snapshot_put(e, before);
+  }
+  s_apply_seq++;
+  agg_unlock();
+}
+
+void aggregate_apply_weights_unlocked(const char *reptile_id,
+                                      const weight_sample_t *samples,
+                                      size_t count) {
+  if (count == 0 || !agg_lock()) {
+    return;
+  }
+  size_t before = s_count;
+  agg_entry_t *e = agg_insert_slot(reptile_id, UINT32_MAX);
+  if (e) {
+    for (size_t i = 0; i < count; i++) {
+      apply_weight(&e->agg, &samples[i]);
+    }
+    slot_write_unlocked(e->slot, &e->agg);
+    agg_snapshot_put(e, before);
+  }
+  s_apply_seq++;
+  agg_unlock();
+}
+
+void aggregate_clear_events_unlocked(const char *reptile_id) {
+  if (!agg_lock()) {
+    return;
+  }
+  bool found = false;
+  size_t pos = agg_find(reptile_id, &found);
+  if (found) {
+    agg_entry_t *e = &s_entries[pos];
+    e->agg.event_count = 0;
+    e->agg.last_event = 0;
+    e->agg.last_feeding = 0;
+    e->agg.last_shedding = 0;
+    memset(e->agg.events_by_type, 0, sizeof(e->agg.events_by_type));
+    if (e->agg.weight_count > 0 || !free_slot_push(e->slot)) {
+      slot_write_unlocked(e->slot, &e->agg);
+      agg_snapshot_put(e, s_count);
+    } else {
+      agg_erase(pos);
+    }
+  }
+  s_apply_seq++;
+  agg_unlock();
+}
+
+void aggregate_remove_unlocked(const char *reptile_id) {
+  if (!agg_lock()) {
+    return;
+  }
+  bool found = false;
+  size_t pos = agg_find(reptile_id, &found);
+  if (found) {
+    // Without room in the free list the cleared slot is reused after the
+    // next load.
+    free_slot_push(s_entries[pos].slot);
+    agg_erase(pos);
+  }
+  s_apply_seq++;
+  agg_unlock();
+}
+
+bool aggregate_current_weight(const char *reptile_id, float *out) {
+  if (!reptile_id || !agg_lock()) {
+    return false;
+  }
+  bool found = false;
+  size_t pos = agg_find(reptile_id, &found);
+  found = found && s_entries[pos].agg.weight_count > 0;
+  if (found) {
+    *out = s_entries[pos].agg.current_weight;
+  }
+  agg_unlock();
+  return found;
+}
+
+// The index is loaded or rebuilt before the table: copies the current weights
+// into it, with a single persist. Also heals a reset between a weighing and
+// the index persist.
+static void agg_sync_index(void) {
+  typedef struct {
+    char id[MAX_ID_LEN];
+    float weight;
+  } agg_weight_t;
+  agg_weight_t *weights = NULL;
+  size_t count = 0;
+  if (!agg_lock()) {
+    return;
+  }
+  if (s_count > 0) {
+    weights = malloc(s_count * sizeof(agg_weight_t));
+  }
+  for (size_t i = 0; weights && i < s_count; i++) {
+    if (s_entries[i].agg.weight_count > 0) {
+      memcpy(weights[count].id, s_entries[i].agg.id, MAX_ID_LEN);
+      weights[count++].weight = s_entries[i].agg.current_weight;
+    }
+  }
+  agg_unlock();
+
+  data_manager_index_hold();
+  for (size_t i = 0; i < count; i++) {
+    data_manager_index_set_weight(weights[i].id, weights[i].weight);
+  }
+  data_manager_index_release();
+  free(weights);
+}
+
+// --- Rebuild ----------------------------------------------------------------
+
+static bool rebuild_event(const reptile_event_t *event, void *user_ctx) {
+  apply_event((reptile_aggregate_t *)user_ctx, event);
+  return true;
+}
+
+// Recomputes one animal from its history. The scans take the read lock, so
+// the result is stored only if nothing was applied meanwhile; otherwise the
+// animal is scanned again.
+static esp_err_t rebuild_one(const char *reptile_id) {
+  for (int attempt = 0; attempt < AGG_REBUILD_RETRIES; attempt++) {
+    uint32_t seq = 0;
+    if (agg_lock()) {
+      seq = s_apply_seq;
+      agg_unlock();
+    }
+    reptile_aggregate_t agg = {0};
+    copy_bounded(agg.id, sizeof(agg.id), reptile_id);
+    esp_err_t err =
+        data_manager_foreach_event(reptile_id, rebuild_event, &agg);
+    weight_stats_t ws;
+    if (err == ESP_OK) {
+      err = data_manager_get_weight_stats(reptile_id, INT64_MIN, INT64_MAX,
+                                          &ws);
+    }
+    if (err != ESP_OK) {
+      return err;
+    }
+    agg.weight_count = (uint32_t)ws.count;
+    agg.current_weight = ws.count > 0 ? ws.last : 0.0f;
+    agg.last_weight_ts = ws.count > 0 ? ws.last_ts : 0;
+    bool empty = agg.event_count == 0 && agg.weight_count == 0;
+
+    if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+      return ESP_ERR_TIMEOUT;
+    }
+    bool stored = false;
+    if (agg_lock()) {
+      if (s_apply_seq == seq) {
+        bool found = false;
+        agg_find(reptile_id, &found);
+        size_t before = s_count;
+        agg_entry_t *e = (empty && !found)
+                             ? NULL
+                             : agg_insert_slot(reptile_id, UINT32_MAX);
+        if (e) {
+          e->agg = agg;
+          err = slot_write_unlocked(e->slot, &e->agg);
+          agg_snapshot_put(e, before);
+        }
+        stored = true;
+      }
+      agg_unlock();
+    }
+    data_fs_write_unlock();
+    if (stored) {
+      return err;
+    }
+  }
+  ESP_LOGW(TAG, "%s kept changing, aggregate left as is", reptile_id);
+  return ESP_OK;
+}
+
+esp_err_t data_manager_rebuild_aggregates(void) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_MAINTENANCE);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  reptile_summary_t *animals = NULL;
+  size_t count = 0;
+  esp_err_t err = data_manager_list_reptile_summaries(&animals, &count);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // Start from an empty table and an empty file, which marks the table as
+  // present for the next init even when no animal has history.
+  if (!data_fs_write_lock(pdMS_TO_TICKS(10000))) {
+    free(animals);
+    return ESP_ERR_TIMEOUT;
+  }
+  if (agg_lock()) {
+    s_count = 0;
+    s_free_count = 0;
+    s_slot_count = 0;
+    s_apply_seq++;
+    agg_snapshot_load();
+    FILE *mark = fopen(AGG_REBUILD_MARK, "wb");
+    if (!mark || fclose(mark) != 0) {
+      err = ESP_FAIL;
+    }
+    FILE *f = fopen(AGG_PATH, "wb");
+    if (!f || fclose(f) != 0) {
+      err = ESP_FAIL;
+    }
+    agg_unlock();
+  }
+  data_fs_write_unlock();
+
+  for (size_t i = 0; i < count && err == ESP_OK; i++) {
+    err = rebuild_one(animals[i].id);
+  }
+  if (err == ESP_OK && data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    unlink(AGG_REBUILD_MARK);
+    data_fs_write_unlock();
+  }
+  agg_sync_index();
+  ESP_LOGI(TAG, "Aggregates rebuilt for %u animals", (unsigned)count);
+  free(animals);
+  return err;
+}
+
+// --- Load -------------------------------------------------------------------
+
+// Reads every slot. False when the file is missing, has a corrupt slot or an
+// earlier rebuild did not finish.
+static bool agg_load(void) {
+  if (!data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    return false;
+  }
+  FILE *f = access(AGG_REBUILD_MARK, F_OK) == 0 ? NULL : fopen(AGG_PATH, "rb");
+  if (!f) {
+    data_fs_read_unlock();
+    return false;
+  }
+  bool ok = agg_lock();
+  if (ok) {
+    s_count = 0;
+    s_free_count = 0;
+    s_slot_count = 0;
+    agg_slot_t slot;
+    while (ok && fread(&slot, 1, sizeof(slot), f) == sizeof(slot)) {
+      uint32_t index = s_slot_count++;
+      if (slot.magic == 0 && slot.id[0] == '\0') {
+        ok = free_slot_push(index); // Cleared
+        continue;
+      }
+      reptile_aggregate_t agg;
+      if (!slot_decode(&slot, &agg)) {
+        ESP_LOGW(TAG, "Corrupt aggregate slot %u", (unsigned)index);
+        ok = false;
+        break;
+      }
+      agg_entry_t *e = agg_insert_slot(agg.id, index);
+      if (!e) {
+        ok = false;
+        break;
+      }
+      e->agg = agg;
+    }
+    agg_snapshot_load();
+    agg_unlock();
+  }
+  fclose(f);
+  data_fs_read_unlock();
+  return ok;
+}
+
+esp_err_t data_manager_aggregates_init(void) {
+  if (!s_agg_lock) {
+    s_agg_lock = xSemaphoreCreateMutex();
+    if (!s_agg_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  if (agg_load()) {
+    ESP_LOGI(TAG, "Loaded aggregates: %u animals", (unsigned)s_count);
+    agg_sync_index();
+    return ESP_OK;
+  }
+  ESP_LOGW(TAG, "Aggregates missing or corrupt, rebuilding from history");
+  return data_manager_rebuild_aggregates();
+}
+
+// --- Queries ----------------------------------------------------------------
+
+esp_err_t data_manager_get_aggregate(const char *reptile_id,
+                                     reptile_aggregate_t *out) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_AGGREGATE);
+  if (!reptile_id || !out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!agg_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  bool found = false;
+  size_t pos = agg_find(reptile_id, &found);
+  if (found) {
+    *out = s_entries[pos].agg;
+  } else {
+    memset(out, 0, sizeof(*out));
+    copy_bounded(out->id, sizeof(out->id), reptile_id);
+  }
+  agg_unlock();
+  return found ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t data_manager_list_aggregates(reptile_aggregate_t **out_list,
+                                       size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_AGGREGATE);
+  if (!out_list || !count) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_list = NULL;
+  *count = 0;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!agg_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = ESP_OK;
+  if (s_count > 0) {
+    *out_list = malloc(s_count * sizeof(reptile_aggregate_t));
+    if (*out_list) {
+      for (size_t i = 0; i < s_count; i++) {
+        (*out_list)[i] = s_entries[i].agg;
+      }
+      *count = s_count;
+    } else {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  agg_unlock();
+  return err;
+}
@@ -0,0 +1,459 @@
+#include "data_manager_priv.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "dm_batch";
+
+// Bulk import: puts are staged in RAM, commit writes every touched file once
+// under a single FS write lock, as one storage_core transaction: after a
+// reset the batch is either fully there or not at all.
+//
+// Staged records never move, so commit sorts references to them rather than
+// the records themselves.
+#define BATCH_GROW_STEP 64
+#define BATCH_LOCK_TIMEOUT_MS 10000
+
+typedef struct {
+  char reptile_id[MAX_ID_LEN];
+  weight_sample_t sample;
+} batch_weight_t;
+
+// Each staged kind sits in a chunk list so the records keep their address
+// while the batch grows.
+typedef struct batch_chunk {
+  struct batch_chunk *next;
+  size_t count;
+  size_t capacity;
+  size_t item_size;
+  uint8_t items[];
+} batch_chunk_t;
+
+typedef struct {
+  batch_chunk_t *head;
+  batch_chunk_t *tail;
+  size_t count;
+} batch_list_t;
+
+struct data_manager_batch {
+  batch_list_t reptiles; // reptile_t
+  batch_list_t events;   // reptile_event_t
+  batch_list_t weights;  // batch_weight_t
+};
+
+// Thousands of staged events are a few MB: keep them in PSRAM when there is
+// some.
+static void *batch_alloc(size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return malloc(size);
+}
+
+static void *list_push(batch_list_t *list, size_t item_size) {
+  batch_chunk_t *c = list->tail;
+  if (!c || c->count == c->capacity) {
+    c = batch_alloc(sizeof(batch_chunk_t) + BATCH_GROW_STEP * item_size);
+    if (!c) {
+      return NULL;
+    }
+    c->next = NULL;
+    c->count = 0;
+    c->capacity = BATCH_GROW_STEP;
+    c->item_size = item_size;
+    if (list->tail) {
+      list->tail->next = c;
+    } else {
+      list->head = c;
+    }
+    list->tail = c;
+  }
+  list->count++;
+  return c->items + c->count++ * item_size;
+}
+
+static void list_free(batch_list_t *list) {
+  batch_chunk_t *c = list->head;
+  while (c) {
+    batch_chunk_t *next = c->next;
+    free(c);
+    c = next;
+  }
+  memset(list, 0, sizeof(*list));
+}
+
+// seq is the put position, so sorting by (key, seq) yields one contiguous
+// group per file with its records in put order.
+typedef struct {
+  const void *item;
+  const char *key;
+  size_t seq;
+} batch_ref_t;
+
+static int ref_cmp(const void *a, const void *b) {
+  const batch_ref_t *ra = a;
+  const batch_ref_t *rb = b;
+  int cmp = strcmp(ra->key, rb->key);
+  if (cmp != 0) {
+    return cmp;
+  }
+  return ra->seq < rb->seq ? -1 : ra->seq > rb->seq;
+}
+
+// Staged items grouped by key, each group in put order.
+static batch_ref_t *sorted_refs(const batch_list_t *list, size_t key_offset) {
+  if (list->count == 0) {
+    return NULL;
+  }
+  batch_ref_t *refs = batch_alloc(list->count * sizeof(batch_ref_t));
+  if (!refs) {
+    return NULL;
+  }
+  size_t n = 0;
+  for (const batch_chunk_t *c = list->head; c; c = c->next) {
+    for (size_t i = 0; i < c->count; i++, n++) {
+      const uint8_t *item = c->items + i * c->item_size;
+      refs[n].item = item;
+      refs[n].key = (const char *)item + key_offset;
+      refs[n].seq = n;
+    }
+  }
+  qsort(refs, n, sizeof(batch_ref_t), ref_cmp);
+  return refs;
+}
+
+static size_t group_end(const batch_ref_t *refs, size_t count, size_t i) {
+  size_t j = i + 1;
+  while (j < count && strcmp(refs[j].key, refs[i].key) == 0) {
+    j++;
+  }
+  return j;
+}
+
+esp_err_t data_manager_batch_begin(data_manager_batch_t **out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out = NULL;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  *out = calloc(1, sizeof(data_manager_batch_t));
+  return *out ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+esp_err_t data_manager_batch_put_reptile(data_manager_batch_t *batch,
+                                         const reptile_t *reptile) {
+  if (!batch || !reptile || reptile->id[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  reptile_t *slot = list_push(&batch->reptiles, sizeof(reptile_t));
+  if (!slot) {
+    return ESP_ERR_NO_MEM;
+  }
+  *slot = *reptile;
+  // Same as data_manager_save_reptile(): weight = 0 keeps the last one.
+  if (slot->weight <= 0.0f) {
+    data_manager_index_get_weight(slot->id, &slot->weight);
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_batch_put_event(data_manager_batch_t *batch,
+                                       const reptile_event_t *event) {
+  if (!batch || !event || event->reptile_id[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  reptile_event_t *slot = list_push(&batch->events, sizeof(reptile_event_t));
+  if (!slot) {
+    return ESP_ERR_NO_MEM;
+  }
+  *slot = *event;
+  return ESP_OK;
+}
+
+esp_err_t data_manager_batch_put_weight(data_manager_batch_t *batch,
+                                        const char *reptile_id, float weight,
+                                        int64_t timestamp) {
+  if (!batch || !reptile_id || reptile_id[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  batch_weight_t *slot = list_push(&batch->weights, sizeof(batch_weight_t));
+  if (!slot) {
+    return ESP_ERR_NO_MEM;
+  }
+  copy_bounded(slot->reptile_id, sizeof(slot->reptile_id), reptile_id);
+  slot->sample.timestamp = timestamp;
+  slot->sample.weight = weight;
+  return ESP_OK;
+}
+
+void data_manager_batch_abort(data_manager_batch_t *batch) {
+  if (!batch) {
+    return;
+  }
+  list_free(&batch->reptiles);
+  list_free(&batch->events);
+  list_free(&batch->weights);
+  free(batch);
+}
+
+// --- Commit -----------------------------------------------------------------
+
+typedef struct {
+  batch_ref_t *reptiles;
+  batch_ref_t *events;
+  batch_ref_t *weights;
+  const reptile_event_t **event_run;
+  weight_sample_t *weight_run;
+} commit_plan_t;
+
+static void plan_free(commit_plan_t *plan) {
+  free(plan->reptiles);
+  free(plan->events);
+  free(plan->weights);
+  free(plan->event_run);
+  free(plan->weight_run);
+}
+
+static esp_err_t plan_build(const data_manager_batch_t *batch,
+                            commit_plan_t *plan) {
+  memset(plan, 0, sizeof(*plan));
+  plan->reptiles = sorted_refs(&batch->reptiles, offsetof(reptile_t, id));
+  plan->events =
+      sorted_refs(&batch->events, offsetof(reptile_event_t, reptile_id));
+  plan->weights =
+      sorted_refs(&batch->weights, offsetof(batch_weight_t, reptile_id));
+  // A group is at most the whole list: size the run buffers once.
+  if (batch->events.count > 0) {
+    plan->event_run =
+        batch_alloc(batch->events.count * sizeof(reptile_event_t *));
+  }
+  if (batch->weights.count > 0) {
+    plan->weight_run =
+        batch_alloc(batch->weights.count * sizeof(weight_sample_t));
+  }
+  if ((batch->reptiles.count > 0 && !plan->reptiles) ||
+      (batch->events.count > 0 && (!plan->events || !plan->event_run)) ||
+      (batch->weights.count > 0 && (!plan->weights || !plan->weight_run))) {
+    plan_free(plan);
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+// Runs under the write lock: stages every touched file in txn. Any error
+// fails the whole batch, as nothing reaches the files before the commit.
+static esp_err_t stage_files(storage_txn_t *txn,
+                             const data_manager_batch_t *batch,
+                             commit_plan_t *plan, size_t *files) {
+  esp_err_t err = ESP_OK;
+  size_t n = batch->reptiles.count;
+  for (size_t i = 0; i < n && err == ESP_OK;) {
+    size_t end = group_end(plan->reptiles, n, i);
+    const reptile_t *r = plan->reptiles[end - 1].item; // Last put wins
+    err = record_write_unlocked(txn, RECORD_REPTILE, r->id, r);
+    (*files)++;
+    i = end;
+  }
+
+  n = batch->events.count;
+  for (size_t i = 0; i < n && err == ESP_OK;) {
+    size_t end = group_end(plan->events, n, i);
+    for (size_t k = i; k < end; k++) {
+      plan->event_run[k - i] = plan->events[k].item;
+    }
+    err = event_log_append_unlocked(txn, plan->events[i].key, plan->event_run,
+                                    end - i);
+    (*files)++;
+    i = end;
+  }
+
+  n = batch->weights.count;
+  for (size_t i = 0; i < n && err == ESP_OK;) {
+    size_t end = group_end(plan->weights, n, i);
+    for (size_t k = i; k < end; k++) {
+      const batch_weight_t *w = plan->weights[k].item;
+      plan->weight_run[k - i] = w->sample;
+    }
+    err = weight_append_unlocked(txn, plan->weights[i].key, plan->weight_run,
+                                 end - i);
+    (*files)++;
+    i = end;
+  }
+  return err;
+}
+
+// Once the transaction is committed, still under the write lock: the
+// aggregates follow the appended history.
+static void apply_aggregates(const data_manager_batch_t *batch,
+                             commit_plan_t *plan) {
+  size_t n = batch->events.count;
+  for (size_t i = 0; i < n;) {
+    size_t end = group_end(plan->events, n, i);
+    for (size_t k = i; k < end; k++) {
+      plan->event_run[k - i] = plan->events[k].item;
+    }
+    aggregate_apply_events_unlocked(plan->events[i].key, plan->event_run,
+                                    end - i);
+    i = end;
+  }
+  n = batch->weights.count;
+  for (size_t i = 0; i < n;) {
+    size_t end = group_end(plan->weights, n, i);
+    for (size_t k = i; k < end; k++) {
+      const batch_weight_t *w = plan->weights[k].item;
+      plan->weight_run[k - i] = w->sample;
+    }
+    aggregate_apply_weights_unlocked(plan->weights[i].key, plan->weight_run,
+                                     end - i);
+    i = end;
+  }
+}
+
+// Stages and commits every file under one write lock hold.
+static esp_err_t commit_files(const data_manager_batch_t *batch,
+                              commit_plan_t *plan, size_t *files) {
+  storage_txn_t *txn = NULL;
+  esp_err_t err = storage_txn_begin(DATA_MANAGER_JOURNAL, &txn);
+  if (err == ESP_OK) {
+    err = stage_files(txn, batch, plan, files);
+  }
+  if (err != ESP_OK) {
+    storage_txn_abort(txn);
+    return err;
+  }
+  int64_t t0 = dm_metrics_now();
+  err = storage_txn_commit(txn);
+  dm_op_io(t0, 0, 0);
+  if (err == ESP_OK) {
+    apply_aggregates(batch, plan);
+  }
+  return err;
+}
+
+// Batch writes bypass the entity cache, so the cached copies are dropped once
+// the commit has released the FS lock: never before, as nothing is written
+// if the lock or the commit fails. The cache stays locked from before the
+// commit, so a dirty copy is dropped before its write-back can replace the
+// committed file. The drop bumps the cache epoch, which also keeps a load
+// that raced the commit from caching the old file.
+static void drop_cached(const data_manager_batch_t *batch,
+                        const commit_plan_t *plan) {
+  size_t n = batch->reptiles.count;
+  for (size_t i = 0; i < n; i = group_end(plan->reptiles, n, i)) {
+    record_cache_drop_locked(RECORD_REPTILE, plan->reptiles[i].key);
+  }
+}
+
+// The index follows the files, with a single persist at the end. Like
+// data_manager_add_weight(), the summary weight is the aggregate's, applied
+// by the commit: the weighing with the latest timestamp, not the last put.
+static void update_index(const data_manager_batch_t *batch,
+                         const commit_plan_t *plan) {
+  data_manager_index_hold();
+  size_t n = batch->reptiles.count;
+  for (size_t i = 0; i < n;) {
+    size_t end = group_end(plan->reptiles, n, i);
+    data_manager_index_upsert(plan->reptiles[end - 1].item);
+    i = end;
+  }
+  n = batch->weights.count;
+  for (size_t i = 0; i < n;) {
+    size_t end = group_end(plan->weights, n, i);
+    const batch_weight_t *w = plan->weights[i].item;
+    float current = 0.0f;
+    if (aggregate_current_weight(w->reptile_id, &current)) {
+      data_manager_index_set_weight(w->reptile_id, current);
+    }
+    i = end;
+  }
+  data_manager_index_release();
+}
+
+// One change per animal and kind, after the index: the batch is atomic, so
+// consumers see it all or nothing.
+static void log_changes(const data_manager_batch_t *batch,
+                        const commit_plan_t *plan) {
+  size_t n = batch->reptiles.count;
+  for (size_t i = 0; i < n; i = group_end(plan->reptiles, n, i)) {
+    change_log_record(DATA_MANAGER_ENTITY_REPTILE, DATA_MANAGER_CHANGE_PUT,
+                      plan->reptiles[i].key);
+  }
+  n = batch->events.count;
+  for (size_t i = 0; i < n; i = group_end(plan->events, n, i)) {
+    change_log_record(DATA_MANAGER_ENTITY_EVENTS, DATA_MANAGER_CHANGE_PUT,
+                      plan->events[i].key);
+  }
+  n = batch->weights.count;
+  for (size_t i = 0; i < n; i = group_end(plan->weights, n, i)) {
+    change_log_record(DATA_MANAGER_ENTITY_WEIGHTS, DATA_MANAGER_CHANGE_PUT,
+                      plan->weights[i].key);
+  }
+}
+
+esp_err_t data_manager_batch_commit(data_manager_batch_t *batch) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_BATCH);
+  if (!batch) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  commit_plan_t plan;
+  esp_err_t err = plan_build(batch, &plan);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Not enough memory to sort the batch");
+    data_manager_batch_abort(batch);
+    return err;
+  }
+
+  // The journal covers the files only: a reset before the index persist
+  // leaves the stale mark, and init rebuilds from the records.
+  bool indexed = batch->reptiles.count > 0 || batch->weights.count > 0;
+  if (indexed && (err = data_manager_index_begin()) != ESP_OK) {
+    plan_free(&plan);
+    data_manager_batch_abort(batch);
+    return err;
+  }
+
+  size_t files = 0;
+  if (!record_cache_lock()) {
+    err = ESP_ERR_INVALID_STATE;
+  } else if (!data_fs_write_lock(pdMS_TO_TICKS(BATCH_LOCK_TIMEOUT_MS))) {
+    record_cache_unlock();
+    ESP_LOGE(TAG, "FS busy, cannot commit batch");
+    err = ESP_ERR_TIMEOUT;
+  } else {
+    // Aggregates and summaries reach the snapshots as one version.
+    snapshot_edit_begin();
+    err = commit_files(batch, &plan, &files);
+    data_fs_write_unlock();
+    if (err == ESP_OK) {
+      drop_cached(batch, &plan);
+    }
+    record_cache_unlock();
+    if (err == ESP_OK) {
+      update_index(batch, &plan);
+    }
+    snapshot_edit_end();
+    if (err == ESP_OK) {
+      log_changes(batch, &plan);
+      ESP_LOGI(TAG,
+               "Committed %u reptiles, %u events, %u weights in %u files",
+               (unsigned)batch->reptiles.count, (unsigned)batch->events.count,
+               (unsigned)batch->weights.count, (unsigned)files);
+    } else {
+      ESP_LOGE(TAG, "Batch not committed (%s)", esp_err_to_name(err));
+    }
+  }
+  if (indexed) {
+    data_manager_index_end();
+  }
+  plan_free(&plan);
+  data_manager_batch_abort(batch);
+  return err;
+}
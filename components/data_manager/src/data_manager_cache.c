@@ -0,0 +1,450 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+
+#if CONFIG_ARS_DATA_CACHE
+
+#include "esp_heap_caps.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <stdlib.h>
+
+static const char *TAG = "dm_cache";
+
+// LRU of decoded records in front of the record files.
+//
+// Reptile and document saves only update the cache and mark the entry dirty;
+// the flush task writes dirty entries back every CONFIG_ARS_DATA_CACHE_FLUSH_MS
+// and eviction writes a dirty victim before dropping it. Contacts are listed
+// straight from their directory, so they are written through and only cached
+// for reads.
+//
+// The indexes are updated when the save returns, ahead of the file. Every
+// dirty entry holds the stale mark of the index citing it, so a reset before
+// the write-back makes init rebuild that index from the files; the summary
+// index is also held, so it is persisted once, after the last write-back.
+// The change log is saved by data_manager_flush() after the write-backs.
+//
+// Lock order: cache mutex, then the FS lock. Write-backs run under both, one
+// entry per hold, so a flush can never race a newer save of the same id. Code
+// that already holds the FS lock must not call into the cache.
+#define CACHE_BUDGET (CONFIG_ARS_DATA_CACHE_BUDGET_KB * 1024)
+#define CACHE_BUCKETS 64
+
+typedef struct cache_entry {
+  struct cache_entry *prev; // LRU list, most recent first
+  struct cache_entry *next;
+  struct cache_entry *chain; // Hash bucket
+  record_kind_t kind;
+  bool dirty;
+  size_t size; // Footprint charged to the budget
+  char id[MAX_ID_LEN];
+  uint8_t obj[] __attribute__((aligned(8)));
+} cache_entry_t;
+
+static SemaphoreHandle_t s_lock = NULL;
+static TaskHandle_t s_flush_task = NULL;
+static cache_entry_t *s_buckets[CACHE_BUCKETS];
+static cache_entry_t *s_head = NULL;
+static cache_entry_t *s_tail = NULL;
+static size_t s_bytes = 0;
+static uint32_t s_epoch = 0; // Bumped by every store and drop
+static data_manager_cache_stats_t s_stats;
+static uint32_t s_dirty_reptiles = 0; // Summary index held while > 0
+
+static bool write_back(record_kind_t kind) { return kind != RECORD_CONTACT; }
+
+// Stale mark of the index citing kind, held while an entry is dirty.
+static esp_err_t mark_begin(record_kind_t kind) {
+  return kind == RECORD_REPTILE ? data_manager_index_begin()
+                                : data_manager_doc_index_begin();
+}
+
+static void mark_end(record_kind_t kind) {
+  if (kind == RECORD_REPTILE) {
+    data_manager_index_end();
+  } else {
+    data_manager_doc_index_end();
+  }
+}
+
+static uint32_t bucket_of(record_kind_t kind, const char *id) {
+  uint32_t h = 2166136261u ^ (uint32_t)kind; // FNV-1a
+  for (const char *p = id; *p; p++) {
+    h = (h ^ (uint8_t)*p) * 16777619u;
+  }
+  return h % CACHE_BUCKETS;
+}
+
+static cache_entry_t *find(record_kind_t kind, const char *id) {
+  for (cache_entry_t *e = s_buckets[bucket_of(kind, id)]; e; e = e->chain) {
+    if (e->kind == kind && strcmp(e->id, id) == 0) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+static void lru_unlink(cache_entry_t *e) {
+  if (e->prev) {
+    e->prev->next = e->next;
+  } else {
+    s_head = e->next;
+  }
+  if (e->next) {
+    e->next->prev = e->prev;
+  } else {
+    s_tail = e->prev;
+  }
+}
+
+static void lru_push_front(cache_entry_t *e) {
+  e->prev = NULL;
+  e->next = s_head;
+  if (s_head) {
+    s_head->prev = e;
+  } else {
+    s_tail = e;
+  }
+  s_head = e;
+}
+
+// The caller took the entry's stale mark before setting it dirty; clearing
+// releases it.
+static void set_dirty(cache_entry_t *e, bool dirty) {
+  if (e->dirty == dirty) {
+    return;
+  }
+  e->dirty = dirty;
+  if (dirty) {
+    s_stats.dirty++;
+    if (e->kind == RECORD_REPTILE && s_dirty_reptiles++ == 0) {
+      data_manager_index_hold();
+    }
+    return;
+  }
+  s_stats.dirty--;
+  if (e->kind == RECORD_REPTILE && --s_dirty_reptiles == 0) {
+    data_manager_index_release(); // Persists what the saves changed
+  }
+  mark_end(e->kind);
+}
+
+// Frees e; a dirty copy is discarded, its caller has superseded it.
+static void entry_free(cache_entry_t *e) {
+  cache_entry_t **link = &s_buckets[bucket_of(e->kind, e->id)];
+  while (*link != e) {
+    link = &(*link)->chain;
+  }
+  *link = e->chain;
+  lru_unlink(e);
+  s_bytes -= e->size;
+  s_stats.entries--;
+  set_dirty(e, false);
+  free(e);
+}
+
+static esp_err_t entry_flush(cache_entry_t *e) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_FLUSH);
+  esp_err_t err = record_write(e->kind, e->id, e->obj);
+  if (err == ESP_OK) {
+    set_dirty(e, false);
+    s_stats.writebacks++;
+  } else {
+    s_stats.write_errors++;
+    ESP_LOGE(TAG, "Write-back of %s/%s failed (%s)", record_dir(e->kind),
+             e->id, esp_err_to_name(err));
+  }
+  return err;
+}
+
+// Evicts from the LRU tail until size more bytes fit. A dirty victim that
+// cannot be written back stays; false if the budget is still short.
+static bool make_room(size_t size) {
+  cache_entry_t *e = s_tail;
+  while (e && s_bytes + size > CACHE_BUDGET) {
+    cache_entry_t *prev = e->prev;
+    if (!e->dirty || entry_flush(e) == ESP_OK) {
+      entry_free(e);
+      s_stats.evictions++;
+    }
+    e = prev;
+  }
+  return s_bytes + size <= CACHE_BUDGET;
+}
+
+// Thousands of decoded records would not fit the internal heap.
+static void *entry_alloc(size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return malloc(size);
+}
+
+// Inserts or refreshes (kind, id) at the LRU head. NULL when it cannot be
+// cached; any older copy is gone then.
+static cache_entry_t *upsert(record_kind_t kind, const char *id,
+                             const void *obj, size_t obj_size) {
+  cache_entry_t *e = find(kind, id);
+  if (e) {
+    memcpy(e->obj, obj, obj_size);
+    lru_unlink(e);
+    lru_push_front(e);
+    return e;
+  }
+  size_t size = sizeof(cache_entry_t) + obj_size;
+  if (!make_room(size)) {
+    return NULL;
+  }
+  e = entry_alloc(size);
+  if (!e) {
+    return NULL;
+  }
+  memset(e, 0, sizeof(*e));
+  e->kind = kind;
+  e->size = size;
+  copy_bounded(e->id, sizeof(e->id), id);
+  memcpy(e->obj, obj, obj_size);
+  uint32_t b = bucket_of(kind, id);
+  e->chain = s_buckets[b];
+  s_buckets[b] = e;
+  lru_push_front(e);
+  s_bytes += size;
+  s_stats.entries++;
+  return e;
+}
+
+static bool cache_lock(void) {
+  return s_lock && xSemaphoreTake(s_lock, portMAX_DELAY) == pdTRUE;
+}
+
+static void cache_unlock(void) { xSemaphoreGive(s_lock); }
+
+bool record_cache_get(record_kind_t kind, const char *id, void *out) {
+  if (!cache_lock()) {
+    return false;
+  }
+  cache_entry_t *e = find(kind, id);
+  if (e) {
+    memcpy(out, e->obj, record_size(kind));
+    lru_unlink(e);
+    lru_push_front(e);
+    s_stats.hits++;
+  } else {
+    s_stats.misses++;
+  }
+  cache_unlock();
+  return e != NULL;
+}
+
+uint32_t record_cache_epoch(void) {
+  if (!cache_lock()) {
+    return 0;
+  }
+  uint32_t epoch = s_epoch;
+  cache_unlock();
+  return epoch;
+}
+
+void record_cache_fill(record_kind_t kind, const char *id, const void *obj,
+                       uint32_t epoch) {
+  if (!cache_lock()) {
+    return;
+  }
+  // A store or drop since the caller's read may have made obj stale.
+  if (epoch == s_epoch && !find(kind, id)) {
+    upsert(kind, id, obj, record_size(kind));
+  }
+  cache_unlock();
+}
+
+// Caches obj as a dirty entry; false when it must be written through (no
+// stale mark, or no room left by unwritable entries).
+static bool store_dirty(record_kind_t kind, const char *id, const void *obj) {
+  cache_entry_t *e = find(kind, id);
+  if (e && e->dirty) {
+    upsert(kind, id, obj, record_size(kind)); // Keeps its mark
+    return true;
+  }
+  if (mark_begin(kind) != ESP_OK) {
+    return false;
+  }
+  e = upsert(kind, id, obj, record_size(kind));
+  if (!e) {
+    mark_end(kind);
+    return false;
+  }
+  set_dirty(e, true);
+  return true;
+}
+
+esp_err_t record_cache_store(record_kind_t kind, const char *id,
+                             const void *obj) {
+  if (!cache_lock()) {
+    return record_write(kind, id, obj);
+  }
+  s_epoch++;
+  esp_err_t err = ESP_OK;
+  if (!write_back(kind) || !store_dirty(kind, id, obj)) {
+    err = record_write(kind, id, obj);
+    cache_entry_t *e = find(kind, id);
+    if (err == ESP_OK) {
+      e = upsert(kind, id, obj, record_size(kind));
+      if (e) {
+        set_dirty(e, false); // Written: an older dirty copy is superseded
+      }
+    } else if (e) {
+      entry_free(e);
+    }
+  }
+  cache_unlock();
+  return err;
+}
+
+static bool drop_locked(record_kind_t kind, const char *id) {
+  s_epoch++;
+  bool dirty = false;
+  cache_entry_t *e = find(kind, id);
+  if (e) {
+    dirty = e->dirty;
+    entry_free(e);
+  }
+  return dirty;
+}
+
+bool record_cache_drop(record_kind_t kind, const char *id) {
+  if (!cache_lock()) {
+    return false;
+  }
+  bool dirty = drop_locked(kind, id);
+  cache_unlock();
+  return dirty;
+}
+
+bool record_cache_lock(void) { return cache_lock(); }
+
+void record_cache_unlock(void) { cache_unlock(); }
+
+bool record_cache_drop_locked(record_kind_t kind, const char *id) {
+  return drop_locked(kind, id);
+}
+
+// Writes dirty entries one lock hold at a time, from the LRU end, so readers
+// and savers wait for a single record write at most. Stops at the first
+// failure; that entry stays dirty for the next round.
+esp_err_t record_cache_flush(void) {
+  for (;;) {
+    if (!cache_lock()) {
+      return ESP_ERR_INVALID_STATE;
+    }
+    cache_entry_t *e = s_tail;
+    while (e && !e->dirty) {
+      e = e->prev;
+    }
+    esp_err_t err = e ? entry_flush(e) : ESP_OK;
+    cache_unlock();
+    if (!e || err != ESP_OK) {
+      return err;
+    }
+  }
+}
+
+static void flush_task(void *arg) {
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_ARS_DATA_CACHE_FLUSH_MS));
+    record_cache_flush();
+  }
+}
+
+esp_err_t record_cache_init(void) {
+  if (!s_lock) {
+    s_lock = xSemaphoreCreateMutex();
+    if (!s_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  if (!s_flush_task &&
+      xTaskCreate(flush_task, "dm_flush", 4096, NULL, 1, &s_flush_task) !=
+          pdPASS) {
+    s_flush_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_get_cache_stats(data_manager_cache_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!cache_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  *out = s_stats;
+  out->bytes = (uint32_t)s_bytes;
+  cache_unlock();
+  return ESP_OK;
+}
+
+void data_manager_reset_cache_stats(void) {
+  if (!cache_lock()) {
+    return;
+  }
+  // entries, dirty and bytes describe the cache, not a period.
+  s_stats.hits = 0;
+  s_stats.misses = 0;
+  s_stats.evictions = 0;
+  s_stats.writebacks = 0;
+  s_stats.write_errors = 0;
+  cache_unlock();
+}
+
+#else // !CONFIG_ARS_DATA_CACHE
+
+esp_err_t record_cache_init(void) { return ESP_OK; }
+
+bool record_cache_get(record_kind_t kind, const char *id, void *out) {
+  return false;
+}
+
+uint32_t record_cache_epoch(void) { return 0; }
+
+void record_cache_fill(record_kind_t kind, const char *id, const void *obj,
+                       uint32_t epoch) {}
+
+esp_err_t record_cache_store(record_kind_t kind, const char *id,
+                             const void *obj) {
+  return record_write(kind, id, obj);
+}
+
+bool record_cache_drop(record_kind_t kind, const char *id) { return false; }
+
+bool record_cache_lock(void) { return true; }
+
+void record_cache_unlock(void) {}
+
+bool record_cache_drop_locked(record_kind_t kind, const char *id) {
+  return false;
+}
+
+esp_err_t record_cache_flush(void) { return ESP_OK; }
+
+esp_err_t data_manager_get_cache_stats(data_manager_cache_stats_t *out) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+void data_manager_reset_cache_stats(void) {}
+
+#endif
+
+esp_err_t data_manager_flush(void) {
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  // Records first: the saved log must not announce an unwritten save.
+  esp_err_t err = record_cache_flush();
+  esp_err_t log_err = change_log_save();
+  return err != ESP_OK ? err : log_err;
+}
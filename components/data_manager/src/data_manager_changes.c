@@ -0,0 +1,365 @@
+#include "data_manager_priv.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "storage_core.h"
+#include <stdlib.h>
+#include <time.h>
+
+static const char *TAG = "dm_changes";
+
+// The scrubber logs a record kind as the entity of the same rank.
+_Static_assert((int)DATA_MANAGER_ENTITY_REPTILE == (int)RECORD_REPTILE &&
+                   (int)DATA_MANAGER_ENTITY_DOCUMENT == (int)RECORD_DOCUMENT &&
+                   (int)DATA_MANAGER_ENTITY_CONTACT == (int)RECORD_CONTACT,
+               "record kinds and change entities must line up");
+
+static const char *const s_entity_names[DATA_MANAGER_ENTITY_COUNT] = {
+    "reptile", "document", "contact", "events", "weights",
+};
+
+const char *data_manager_entity_name(data_manager_entity_t entity) {
+  if ((unsigned)entity >= DATA_MANAGER_ENTITY_COUNT) {
+    return NULL;
+  }
+  return s_entity_names[entity];
+}
+
+#if CONFIG_ARS_DATA_CHANGES
+
+// Every mutation takes the next sequence number and a slot in a RAM ring of
+// CHANGE_CAPACITY entries, oldest overwritten first. The window is
+// contiguous, so entries carry no seq (slot i after the head is s_first + i)
+// and a "since" query starts at its first entry without searching.
+//
+// The sequence survives reboots like the id counter: a mark is written
+// CHANGE_RESERVE values ahead and a reboot resumes from it. The ring is
+// saved by data_manager_flush(), followed by an exact mark. At boot it is
+// kept only if it ends right before the mark; after a reset without a flush
+// the mark has moved past the lost changes, the ring restarts empty and
+// consumers that had not seen them are told to resync.
+//
+// Without a mark (corrupt, or missing next to a saved ring) the seqs handed
+// out since the last flush are unknown. The log then stays unseeded, and
+// every consumer is told to resync, until the clock can be trusted: it
+// restarts at max(end of the saved ring, time in seconds), ahead of the lost
+// seqs as long as they averaged less than one change per second. Before
+// SNTP the clock reads 1970 and would hand old seqs out again.
+#define CHANGE_SEQ_PATH DATA_MANAGER_INDEX_DIR "/change_seq.bin"
+#define CHANGE_LOG_PATH DATA_MANAGER_INDEX_DIR "/changes.bin"
+#define CHANGE_SEQ_VERSION 1
+#define CHANGE_LOG_VERSION 1
+#define CHANGE_RESERVE 64
+#define CHANGE_CAPACITY CONFIG_ARS_DATA_CHANGES_SIZE
+#define CHANGE_CLOCK_MIN 1704067200 // 2024-01-01 UTC
+
+typedef struct {
+  uint8_t entity;
+  uint8_t op;
+  char id[MAX_ID_LEN];
+} change_entry_t;
+
+// changes.bin: header, then the entries oldest first.
+typedef struct {
+  uint64_t first;
+  uint32_t count;
+  uint32_t reserved;
+} change_log_header_t;
+
+static SemaphoreHandle_t s_change_lock = NULL;
+static change_entry_t *s_ring = NULL;
+static size_t s_head;        // Slot of the oldest entry
+static size_t s_count;       // Entries in the ring
+static uint64_t s_first;     // seq of the oldest entry, s_next when empty
+static uint64_t s_next;      // seq of the next change
+static uint64_t s_reserved;  // First seq not covered by the mark
+static uint64_t s_saved = 0; // s_next when the ring was last saved
+static bool s_seeded = false; // s_next is known to be past every seq
+static uint64_t s_floor = 0;  // Unseeded: end of the saved ring
+
+// The ring is CHANGE_CAPACITY * 34 bytes: PSRAM when available.
+static void *ring_alloc(size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return malloc(size);
+}
+
+// Caller holds the FS write lock.
+static esp_err_t save_mark_unlocked(uint64_t mark) {
+  return storage_save_secure(CHANGE_SEQ_PATH, &mark, sizeof(mark),
+                             CHANGE_SEQ_VERSION);
+}
+
+// seq after the last entry of the saved ring, 0 without a readable one.
+static uint64_t saved_ring_end(void) {
+  void *data = NULL;
+  size_t len = 0;
+  uint64_t end = 0;
+  change_log_header_t hdr;
+  if (storage_load_secure(CHANGE_LOG_PATH, &data, &len, CHANGE_LOG_VERSION) ==
+          ESP_OK &&
+      len >= sizeof(hdr)) {
+    memcpy(&hdr, data, sizeof(hdr));
+    end = hdr.first + hdr.count;
+  }
+  free(data);
+  return end;
+}
+
+// Caller holds s_change_lock. Seeds an unknown sequence once the clock is
+// past CHANGE_CLOCK_MIN; the next change then rewrites the mark.
+static bool seed_from_clock_locked(void) {
+  time_t now = time(NULL);
+  if (now < CHANGE_CLOCK_MIN) {
+    return false;
+  }
+  uint64_t mark = (uint64_t)now > s_floor ? (uint64_t)now : s_floor;
+  s_head = 0;
+  s_count = 0;
+  s_first = mark;
+  s_next = mark;
+  s_reserved = mark;
+  s_saved = 0; // The next flush rewrites ring and mark
+  s_seeded = true;
+  ESP_LOGW(TAG, "Change log reseeded at seq %llu", (unsigned long long)mark);
+  return true;
+}
+
+// Restores the ring saved by the last flush if nothing was handed out after
+// it. Returns the seq of its oldest entry, mark when it is not usable.
+static uint64_t load_ring(uint64_t mark) {
+  void *data = NULL;
+  size_t len = 0;
+  esp_err_t err =
+      storage_load_secure(CHANGE_LOG_PATH, &data, &len, CHANGE_LOG_VERSION);
+  if (err != ESP_OK) {
+    if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGW(TAG, "Change log unreadable (%s)", esp_err_to_name(err));
+    }
+    return mark;
+  }
+  change_log_header_t hdr;
+  uint64_t first = mark;
+  if (len >= sizeof(hdr)) {
+    memcpy(&hdr, data, sizeof(hdr));
+    if (hdr.count <= CHANGE_CAPACITY &&
+        len == sizeof(hdr) + hdr.count * sizeof(change_entry_t) &&
+        hdr.first + hdr.count == mark) {
+      memcpy(s_ring, (const uint8_t *)data + sizeof(hdr),
+             hdr.count * sizeof(change_entry_t));
+      s_count = hdr.count;
+      first = hdr.first;
+    } else {
+      ESP_LOGW(TAG, "Change log predates the last reset, starting empty");
+    }
+  }
+  free(data);
+  return first;
+}
+
+esp_err_t data_manager_changes_init(void) {
+  if (!s_change_lock) {
+    s_change_lock = xSemaphoreCreateMutex();
+    if (!s_change_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  if (!s_ring) {
+    s_ring = ring_alloc(CHANGE_CAPACITY * sizeof(change_entry_t));
+    if (!s_ring) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  void *data = NULL;
+  size_t len = 0;
+  esp_err_t err =
+      storage_load_secure(CHANGE_SEQ_PATH, &data, &len, CHANGE_SEQ_VERSION);
+  uint64_t mark = 0;
+  bool seeded = err == ESP_OK && len == sizeof(mark);
+  if (seeded) {
+    memcpy(&mark, data, sizeof(mark));
+  }
+  free(data);
+  uint64_t ring_end = seeded ? 0 : saved_ring_end();
+  if (!seeded && err == ESP_ERR_NOT_FOUND && ring_end == 0) {
+    seeded = true; // First boot: nothing was handed out
+  } else if (!seeded) {
+    ESP_LOGW(TAG, "Change mark lost (%s), waiting for the clock",
+             esp_err_to_name(err));
+  }
+  if (mark == 0) {
+    mark = 1; // seq 0 stands for "before the first change"
+  }
+  xSemaphoreTake(s_change_lock, portMAX_DELAY);
+  s_head = 0;
+  s_count = 0;
+  s_seeded = seeded;
+  s_floor = ring_end;
+  if (seeded) {
+    s_first = load_ring(mark);
+    s_next = mark;
+    s_reserved = mark;
+    s_saved = mark;
+  } else {
+    seed_from_clock_locked();
+  }
+  xSemaphoreGive(s_change_lock);
+  if (s_seeded) {
+    ESP_LOGI(TAG, "Change log at seq %llu (%u kept)",
+             (unsigned long long)(s_next - 1), (unsigned)s_count);
+  }
+  return ESP_OK;
+}
+
+void change_log_record(data_manager_entity_t entity,
+                       data_manager_change_op_t op, const char *id) {
+  if (!s_ring || !id) {
+    return;
+  }
+  xSemaphoreTake(s_change_lock, portMAX_DELAY);
+  if (!s_seeded && !seed_from_clock_locked()) {
+    // Consumers resync in full until then.
+    xSemaphoreGive(s_change_lock);
+    return;
+  }
+  if (s_next >= s_reserved) {
+    uint64_t mark = s_next + CHANGE_RESERVE;
+    esp_err_t err = ESP_ERR_TIMEOUT;
+    if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+      err = save_mark_unlocked(mark);
+      data_fs_write_unlock();
+    }
+    if (err == ESP_OK) {
+      s_reserved = mark;
+    } else {
+      // The change is logged anyway; a reset before the next successful
+      // reservation would hand its seq out again.
+      ESP_LOGW(TAG, "Cannot reserve change seqs (%s)", esp_err_to_name(err));
+    }
+  }
+  size_t slot;
+  if (s_count == CHANGE_CAPACITY) {
+    slot = s_head;
+    s_head = (s_head + 1) % CHANGE_CAPACITY;
+    s_first++;
+  } else {
+    slot = (s_head + s_count) % CHANGE_CAPACITY;
+    s_count++;
+  }
+  s_ring[slot].entity = (uint8_t)entity;
+  s_ring[slot].op = (uint8_t)op;
+  copy_bounded(s_ring[slot].id, sizeof(s_ring[slot].id), id);
+  s_next++;
+  xSemaphoreGive(s_change_lock);
+}
+
+esp_err_t change_log_save(void) {
+  if (!s_ring) {
+    return ESP_OK;
+  }
+  xSemaphoreTake(s_change_lock, portMAX_DELAY);
+  if (!s_seeded || s_saved == s_next) {
+    xSemaphoreGive(s_change_lock);
+    return ESP_OK;
+  }
+  change_log_header_t hdr = {.first = s_first, .count = (uint32_t)s_count};
+  size_t len = sizeof(hdr) + s_count * sizeof(change_entry_t);
+  uint8_t *buf = ring_alloc(len);
+  if (!buf) {
+    xSemaphoreGive(s_change_lock);
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(buf, &hdr, sizeof(hdr));
+  change_entry_t *dst = (change_entry_t *)(buf + sizeof(hdr));
+  size_t tail = CHANGE_CAPACITY - s_head;
+  size_t part = s_count < tail ? s_count : tail;
+  memcpy(dst, &s_ring[s_head], part * sizeof(change_entry_t));
+  memcpy(dst + part, s_ring, (s_count - part) * sizeof(change_entry_t));
+
+  esp_err_t err = ESP_ERR_TIMEOUT;
+  if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    // Ring first: a reset in between leaves the reserved mark, which does
+    // not match the saved ring, so it is discarded at boot.
+    err = storage_save_secure(CHANGE_LOG_PATH, buf, len, CHANGE_LOG_VERSION);
+    if (err == ESP_OK) {
+      err = save_mark_unlocked(s_next);
+    }
+    data_fs_write_unlock();
+  }
+  free(buf);
+  if (err == ESP_OK) {
+    s_reserved = s_next;
+    s_saved = s_next;
+  } else {
+    ESP_LOGE(TAG, "Cannot save the change log (%s)", esp_err_to_name(err));
+  }
+  xSemaphoreGive(s_change_lock);
+  return err;
+}
+
+uint64_t data_manager_change_seq(void) {
+  if (!s_ring) {
+    return 0;
+  }
+  xSemaphoreTake(s_change_lock, portMAX_DELAY);
+  uint64_t seq = s_seeded ? s_next - 1 : 0;
+  xSemaphoreGive(s_change_lock);
+  return seq;
+}
+
+esp_err_t data_manager_changes_since(uint64_t since,
+                                     data_manager_change_t *out, size_t max,
+                                     size_t *count) {
+  if (!count || (!out && max > 0)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *count = 0;
+  if (!s_ring) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(s_change_lock, portMAX_DELAY);
+  // Up to date is since == s_next - 1; beyond is a seq from another log.
+  if (!s_seeded || since >= s_next || since + 1 < s_first) {
+    xSemaphoreGive(s_change_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  size_t skip = (size_t)(since + 1 - s_first);
+  size_t n = s_count - skip;
+  if (n > max) {
+    n = max;
+  }
+  for (size_t i = 0; i < n; i++) {
+    const change_entry_t *e =
+        &s_ring[(s_head + skip + i) % CHANGE_CAPACITY];
+    out[i].seq = since + 1 + i;
+    out[i].entity = (data_manager_entity_t)e->entity;
+    out[i].op = (data_manager_change_op_t)e->op;
+    copy_bounded(out[i].id, sizeof(out[i].id), e->id);
+  }
+  xSemaphoreGive(s_change_lock);
+  *count = n;
+  return ESP_OK;
+}
+
+#else // !CONFIG_ARS_DATA_CHANGES
+
+esp_err_t data_manager_changes_init(void) { return ESP_OK; }
+
+void change_log_record(data_manager_entity_t entity,
+                       data_manager_change_op_t op, const char *id) {}
+
+esp_err_t change_log_save(void) { return ESP_OK; }
+
+uint64_t data_manager_change_seq(void) { return 0; }
+
+esp_err_t data_manager_changes_since(uint64_t since,
+                                     data_manager_change_t *out, size_t max,
+                                     size_t *count) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
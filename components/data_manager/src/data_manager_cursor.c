@@ -0,0 +1,193 @@
+#include "data_manager_priv.h"
+#include "dm_arena.h"
+#include "esp_log.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "dm_cursor";
+
+static esp_err_t cursor_open(record_kind_t kind, size_t offset, size_t limit,
+                             data_manager_cursor_t **out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out = NULL;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  data_manager_cursor_t *cursor = calloc(1, sizeof(*cursor));
+  if (!cursor) {
+    return ESP_ERR_NO_MEM;
+  }
+  cursor->kind = kind;
+  cursor->skip = offset;
+  cursor->remaining = limit > 0 ? limit : SIZE_MAX;
+  *out = cursor;
+  return ESP_OK;
+}
+
+esp_err_t data_manager_open_reptile_cursor(size_t offset, size_t limit,
+                                           data_manager_cursor_t **out) {
+  return cursor_open(RECORD_REPTILE, offset, limit, out);
+}
+
+esp_err_t data_manager_open_document_cursor(const char *related_id,
+                                            size_t offset, size_t limit,
+                                            data_manager_cursor_t **out) {
+  esp_err_t err = cursor_open(RECORD_DOCUMENT, offset, limit, out);
+  if (err == ESP_OK && related_id) {
+    (*out)->filtered = true;
+    copy_bounded((*out)->related_id, sizeof((*out)->related_id), related_id);
+  }
+  return err;
+}
+
+esp_err_t data_manager_open_contact_cursor(size_t offset, size_t limit,
+                                           data_manager_cursor_t **out) {
+  return cursor_open(RECORD_CONTACT, offset, limit, out);
+}
+
+void data_manager_cursor_close(data_manager_cursor_t *cursor) { free(cursor); }
+
+// Common prologue of the next() calls; returns the batch size to fetch, 0
+// when the cursor is done or the arguments are wrong (*err tells which).
+static size_t cursor_batch(data_manager_cursor_t *cursor, record_kind_t kind,
+                           const void *out, size_t max, size_t *count,
+                           esp_err_t *err) {
+  *err = ESP_OK;
+  if (!count) {
+    *err = ESP_ERR_INVALID_ARG;
+    return 0;
+  }
+  *count = 0;
+  if (!cursor || cursor->kind != kind || !out) {
+    *err = ESP_ERR_INVALID_ARG;
+    return 0;
+  }
+  return max < cursor->remaining ? max : cursor->remaining;
+}
+
+esp_err_t data_manager_cursor_next_reptiles(data_manager_cursor_t *cursor,
+                                            reptile_summary_t *out, size_t max,
+                                            size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  esp_err_t err;
+  size_t batch = cursor_batch(cursor, RECORD_REPTILE, out, max, count, &err);
+  if (batch == 0) {
+    return err;
+  }
+  err = data_manager_index_page(cursor, out, batch, count);
+  cursor->remaining -= *count;
+  return err;
+}
+
+esp_err_t data_manager_cursor_next_documents(data_manager_cursor_t *cursor,
+                                             document_summary_t *out,
+                                             size_t max, size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  esp_err_t err;
+  size_t batch = cursor_batch(cursor, RECORD_DOCUMENT, out, max, count, &err);
+  if (batch == 0) {
+    return err;
+  }
+  err = data_manager_doc_index_page(cursor, out, batch, count);
+  cursor->remaining -= *count;
+  return err;
+}
+
+// --- Contacts ----------------------------------------------------------------
+// There is no contact index: each page rescans the directory names and keeps
+// the max smallest ids after the cursor key, so memory stays O(max) and the
+// read lock is held for one page only.
+
+static size_t select_ids_after(record_scan_t *scan,
+                               const data_manager_cursor_t *cursor,
+                               char (*ids)[MAX_ID_LEN], size_t max) {
+  size_t n = 0;
+  char id[MAX_ID_LEN];
+  record_scan_rewind(scan);
+  while (record_scan_next(scan, id, sizeof(id))) {
+    if (cursor->started && strcmp(id, cursor->last_id) <= 0) {
+      continue;
+    }
+    if (n == max && strcmp(id, ids[n - 1]) >= 0) {
+      continue;
+    }
+    size_t pos = n < max ? n : max - 1;
+    while (pos > 0 && strcmp(ids[pos - 1], id) > 0) {
+      memcpy(ids[pos], ids[pos - 1], MAX_ID_LEN);
+      pos--;
+    }
+    memcpy(ids[pos], id, MAX_ID_LEN);
+    if (n < max) {
+      n++;
+    }
+  }
+  return n;
+}
+
+esp_err_t data_manager_cursor_next_contacts(data_manager_cursor_t *cursor,
+                                            contact_t *out, size_t max,
+                                            size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  esp_err_t err;
+  size_t batch = cursor_batch(cursor, RECORD_CONTACT, out, max, count, &err);
+  if (batch == 0) {
+    return err;
+  }
+  dm_arena_begin();
+  char(*ids)[MAX_ID_LEN] = dm_arena_alloc(batch * MAX_ID_LEN);
+  if (!ids) {
+    dm_arena_end();
+    return ESP_ERR_NO_MEM;
+  }
+  if (!data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    dm_arena_free(ids);
+    dm_arena_end();
+    return ESP_ERR_TIMEOUT;
+  }
+  record_scan_t scan;
+  if (!record_scan_open(&scan, RECORD_CONTACT)) {
+    data_fs_read_unlock();
+    dm_arena_free(ids);
+    dm_arena_end();
+    return ESP_FAIL;
+  }
+
+  // The offset is consumed a batch of names at a time.
+  bool exhausted = false;
+  while (cursor->skip > 0 && !exhausted) {
+    size_t want = cursor->skip < batch ? cursor->skip : batch;
+    size_t n = select_ids_after(&scan, cursor, ids, want);
+    if (n > 0) {
+      copy_bounded(cursor->last_id, sizeof(cursor->last_id), ids[n - 1]);
+      cursor->started = true;
+    }
+    cursor->skip -= n;
+    exhausted = n < want;
+  }
+  // Unreadable records are skipped without cutting the page short.
+  while (!exhausted && *count < batch) {
+    size_t want = batch - *count;
+    size_t n = select_ids_after(&scan, cursor, ids, want);
+    for (size_t i = 0; i < n; i++) {
+      copy_bounded(cursor->last_id, sizeof(cursor->last_id), ids[i]);
+      cursor->started = true;
+      contact_t *c = &out[*count];
+      memset(c, 0, sizeof(*c));
+      if (record_read_unlocked(RECORD_CONTACT, ids[i], c) != ESP_OK) {
+        ESP_LOGW(TAG, "Skipping unreadable contact %s", ids[i]);
+        continue;
+      }
+      (*count)++;
+    }
+    exhausted = n < want;
+  }
+  record_scan_close(&scan);
+  data_fs_read_unlock();
+  dm_arena_free(ids);
+  dm_arena_end();
+  cursor->remaining -= *count;
+  return ESP_OK;
+}
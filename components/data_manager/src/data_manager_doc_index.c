@@ -0,0 +1,479 @@
+#include "blob_stream.h"
+#include "data_manager_priv.h"
+#include "dm_arena.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "storage_core.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "dm_doc_index";
+
+// Persistent secondary index on documents.related_id: one storage_core blob
+// holding every document's summary, so per-animal lookups never walk
+// /data/documents.
+#define DOC_INDEX_PATH DATA_MANAGER_INDEX_DIR "/documents.idx"
+#define DOC_INDEX_VERSION 1
+#define DOC_INDEX_GROW_STEP 16
+#define DOC_INDEX_STALE_PATH DATA_MANAGER_INDEX_DIR "/documents.stale"
+
+static SemaphoreHandle_t s_doc_index_lock = NULL;
+static document_summary_t *s_docs = NULL; // Sorted by related_id, then id
+static size_t s_doc_count = 0;
+static size_t s_doc_capacity = 0;
+static index_mark_t s_doc_mark = {.path = DOC_INDEX_STALE_PATH};
+
+static bool doc_index_lock(void) {
+  return s_doc_index_lock &&
+         xSemaphoreTake(s_doc_index_lock, portMAX_DELAY) == pdTRUE;
+}
+
+static void doc_index_unlock(void) { xSemaphoreGive(s_doc_index_lock); }
+
+static int doc_cmp(const char *related_id, const char *id,
+                   const document_summary_t *e) {
+  int cmp = strcmp(related_id, e->related_id);
+  return cmp != 0 ? cmp : strcmp(id, e->id);
+}
+
+// First entry not ordered before (related_id, id).
+static size_t doc_index_lower_bound(const char *related_id, const char *id) {
+  size_t lo = 0, hi = s_doc_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (doc_cmp(related_id, id, &s_docs[mid]) > 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Range of entries attached to related_id; the whole index for NULL.
+static void doc_index_range(const char *related_id, size_t *first,
+                            size_t *last) {
+  if (!related_id) {
+    *first = 0;
+    *last = s_doc_count;
+    return;
+  }
+  *first = doc_index_lower_bound(related_id, "");
+  size_t end = *first;
+  while (end < s_doc_count && strcmp(s_docs[end].related_id, related_id) == 0) {
+    end++;
+  }
+  *last = end;
+}
+
+// A document can move to another related_id, so the old entry is found by
+// id alone. Saves are rare next to lookups; a linear scan is fine. Caller has
+// a snapshot edit open.
+static void doc_index_erase_id(const char *id) {
+  for (size_t i = 0; i < s_doc_count; i++) {
+    if (strcmp(s_docs[i].id, id) == 0) {
+      memmove(&s_docs[i], &s_docs[i + 1],
+              (s_doc_count - i - 1) * sizeof(document_summary_t));
+      s_doc_count--;
+      snapshot_erase(SNAPSHOT_DOCUMENTS, i);
+      return;
+    }
+  }
+}
+
+static esp_err_t doc_index_insert(const document_summary_t *entry) {
+  if (s_doc_count == s_doc_capacity) {
+    size_t new_cap = s_doc_capacity + DOC_INDEX_GROW_STEP;
+    document_summary_t *grown =
+        realloc(s_docs, new_cap * sizeof(document_summary_t));
+    if (!grown) {
+      ESP_LOGE(TAG, "Failed to grow index to %u entries", (unsigned)new_cap);
+      return ESP_ERR_NO_MEM;
+    }
+    s_docs = grown;
+    s_doc_capacity = new_cap;
+  }
+  size_t pos = doc_index_lower_bound(entry->related_id, entry->id);
+  memmove(&s_docs[pos + 1], &s_docs[pos],
+          (s_doc_count - pos) * sizeof(document_summary_t));
+  s_docs[pos] = *entry;
+  s_doc_count++;
+  return ESP_OK;
+}
+
+static void summarize(const document_t *doc, document_summary_t *out) {
+  memset(out, 0, sizeof(*out));
+  copy_bounded(out->id, sizeof(out->id), doc->id);
+  copy_bounded(out->related_id, sizeof(out->related_id), doc->related_id);
+  copy_bounded(out->title, sizeof(out->title), doc->title);
+  out->type = doc->type;
+  out->timestamp = doc->timestamp;
+}
+
+// --- Serialization ---------------------------------------------------------
+// Payload: u32 count, then per entry: u8 type, i64 timestamp, and id,
+// related_id, title as u8 length + bytes (no terminator).
+
+static uint8_t *doc_index_serialize(size_t *out_len) {
+  size_t len = sizeof(uint32_t);
+  for (size_t i = 0; i < s_doc_count; i++) {
+    const document_summary_t *e = &s_docs[i];
+    len += 1 + sizeof(int64_t) + 3 + strlen(e->id) + strlen(e->related_id) +
+           strlen(e->title);
+  }
+  uint8_t *buf = dm_arena_alloc(len);
+  if (!buf) {
+    return NULL;
+  }
+  uint8_t *p = buf;
+  uint32_t count = (uint32_t)s_doc_count;
+  memcpy(p, &count, sizeof(count));
+  p += sizeof(count);
+  for (size_t i = 0; i < s_doc_count; i++) {
+    const document_summary_t *e = &s_docs[i];
+    *p++ = (uint8_t)e->type;
+    memcpy(p, &e->timestamp, sizeof(int64_t));
+    p += sizeof(int64_t);
+    p += blob_put_str(p, e->id);
+    p += blob_put_str(p, e->related_id);
+    p += blob_put_str(p, e->title);
+  }
+  *out_len = len;
+  return buf;
+}
+
+// Same scheme as the reptile index: scratch entries, installed on ESP_OK.
+typedef struct {
+  document_summary_t *entries;
+  uint32_t count;
+} doc_index_load_t;
+
+#define DOC_INDEX_MAX_ENTRY (1 + sizeof(int64_t) + 3 * 256)
+
+static esp_err_t doc_index_load_start(uint32_t count, void *ctx) {
+  doc_index_load_t *load = ctx;
+  if (count > 0) {
+    load->entries = calloc(count, sizeof(document_summary_t));
+    if (!load->entries) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  load->count = count;
+  return ESP_OK;
+}
+
+static size_t doc_index_load_entry(uint32_t index, const uint8_t *p,
+                                   const uint8_t *end, void *ctx) {
+  doc_index_load_t *load = ctx;
+  document_summary_t *e = &load->entries[index];
+  const uint8_t *start = p;
+  if ((size_t)(end - p) < 1 + sizeof(int64_t)) {
+    return 0;
+  }
+  e->type = (document_type_t)*p++;
+  memcpy(&e->timestamp, p, sizeof(int64_t));
+  p += sizeof(int64_t);
+  if (!blob_get_str(&p, end, e->id, sizeof(e->id)) ||
+      !blob_get_str(&p, end, e->related_id, sizeof(e->related_id)) ||
+      !blob_get_str(&p, end, e->title, sizeof(e->title))) {
+    return 0;
+  }
+  return (size_t)(p - start);
+}
+
+static const blob_stream_ops_t s_doc_index_blob = {
+    .start = doc_index_load_start,
+    .entry = doc_index_load_entry,
+    .max_entry = DOC_INDEX_MAX_ENTRY,
+};
+
+// Same lock order as the reptile index: FS lock, then index lock, the latter
+// only while copying to the staging buffer.
+static esp_err_t doc_index_persist(void) {
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot persist index");
+    return ESP_ERR_TIMEOUT;
+  }
+  size_t len = 0;
+  uint8_t *buf = NULL;
+  dm_arena_begin();
+  if (doc_index_lock()) {
+    buf = doc_index_serialize(&len);
+    doc_index_unlock();
+  }
+  esp_err_t err = ESP_ERR_NO_MEM;
+  if (buf) {
+    int64_t t0 = dm_metrics_now();
+    err = storage_save_secure(DOC_INDEX_PATH, buf, len, DOC_INDEX_VERSION);
+    dm_op_io(t0, 0, sizeof(storage_header_t) + len);
+    dm_arena_free(buf);
+  }
+  dm_arena_end();
+  index_mark_saved_unlocked(&s_doc_mark, err);
+  data_fs_write_unlock();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to persist index (%s)", esp_err_to_name(err));
+  }
+  return err;
+}
+
+static esp_err_t doc_index_rebuild_from_files(void) {
+  if (!data_fs_read_lock(pdMS_TO_TICKS(10000))) {
+    ESP_LOGE(TAG, "FS busy, cannot rebuild index");
+    return ESP_ERR_TIMEOUT;
+  }
+
+  record_scan_t scan;
+  if (!record_scan_open(&scan, RECORD_DOCUMENT)) {
+    data_fs_read_unlock();
+    return ESP_FAIL;
+  }
+
+  if (!doc_index_lock()) {
+    record_scan_close(&scan);
+    data_fs_read_unlock();
+    return ESP_ERR_INVALID_STATE;
+  }
+  s_doc_count = 0;
+
+  esp_err_t err = ESP_OK;
+  char id[MAX_ID_LEN];
+  while (record_scan_next(&scan, id, sizeof(id))) {
+    document_t doc = {0};
+    if (record_read_unlocked(RECORD_DOCUMENT, id, &doc) != ESP_OK) {
+      ESP_LOGW(TAG, "Skipping unreadable document %s", id);
+      continue;
+    }
+    if (doc.id[0] == '\0') {
+      continue;
+    }
+    document_summary_t entry;
+    summarize(&doc, &entry);
+    err = doc_index_insert(&entry);
+    if (err != ESP_OK) {
+      break;
+    }
+  }
+  size_t count = s_doc_count;
+  snapshot_edit_begin();
+  snapshot_load(SNAPSHOT_DOCUMENTS, s_docs, s_doc_count, sizeof(*s_docs));
+  snapshot_edit_end();
+  doc_index_unlock();
+  record_scan_close(&scan);
+  data_fs_read_unlock();
+
+  ESP_LOGI(TAG, "Index rebuilt from files: %u documents", (unsigned)count);
+  return err;
+}
+
+esp_err_t data_manager_doc_index_init(void) {
+  if (!s_doc_index_lock) {
+    s_doc_index_lock = xSemaphoreCreateMutex();
+    if (!s_doc_index_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  doc_index_load_t load = {0};
+  esp_err_t err = ESP_FAIL;
+  if (index_mark_init(&s_doc_mark)) {
+    ESP_LOGW(TAG, "Index may be behind the records, rebuilding");
+  } else if (data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    err = blob_stream_load(DOC_INDEX_PATH, DOC_INDEX_VERSION,
+                           &s_doc_index_blob, &load);
+    data_fs_read_unlock();
+  }
+
+  if (err == ESP_OK && doc_index_lock()) {
+    free(s_docs);
+    s_docs = load.entries;
+    s_doc_count = load.count;
+    s_doc_capacity = load.count;
+    load.entries = NULL;
+    snapshot_edit_begin();
+    snapshot_load(SNAPSHOT_DOCUMENTS, s_docs, s_doc_count, sizeof(*s_docs));
+    snapshot_edit_end();
+    doc_index_unlock();
+  }
+  free(load.entries);
+
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Loaded index: %u documents", (unsigned)s_doc_count);
+    return ESP_OK;
+  }
+
+  if (err != ESP_ERR_NOT_FOUND && !s_doc_mark.marked) {
+    ESP_LOGW(TAG, "Index unusable (%s), rebuilding", esp_err_to_name(err));
+  }
+  err = doc_index_rebuild_from_files();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return doc_index_persist();
+}
+
+esp_err_t data_manager_doc_index_begin(void) {
+  return index_mark_begin(&s_doc_mark);
+}
+
+void data_manager_doc_index_end(void) { index_mark_end(&s_doc_mark, false); }
+
+void data_manager_doc_index_upsert(const document_t *doc) {
+  if (!doc || !doc_index_lock()) {
+    return;
+  }
+  document_summary_t entry;
+  summarize(doc, &entry);
+  size_t pos = doc_index_lower_bound(entry.related_id, entry.id);
+  bool unchanged = pos < s_doc_count &&
+                   memcmp(&s_docs[pos], &entry, sizeof(entry)) == 0;
+  if (!unchanged) {
+    // One edit: no snapshot shows the document erased but not reinserted.
+    snapshot_edit_begin();
+    doc_index_erase_id(entry.id);
+    if (doc_index_insert(&entry) == ESP_OK) {
+      snapshot_put(SNAPSHOT_DOCUMENTS,
+                   doc_index_lower_bound(entry.related_id, entry.id), &entry,
+                   true);
+    }
+    snapshot_edit_end();
+  }
+  doc_index_unlock();
+
+  if (!unchanged) {
+    doc_index_persist();
+  }
+}
+
+void data_manager_doc_index_remove(const char *id) {
+  if (!id || !doc_index_lock()) {
+    return;
+  }
+  size_t before = s_doc_count;
+  snapshot_edit_begin();
+  doc_index_erase_id(id);
+  snapshot_edit_end();
+  bool removed = s_doc_count != before;
+  doc_index_unlock();
+
+  if (removed) {
+    doc_index_persist();
+  }
+}
+
+esp_err_t data_manager_list_document_summaries(const char *related_id,
+                                               document_summary_t **out_list,
+                                               size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  if (!out_list || !count) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_list = NULL;
+  *count = 0;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!doc_index_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  size_t first, last;
+  doc_index_range(related_id, &first, &last);
+  esp_err_t err = ESP_OK;
+  if (last > first) {
+    *out_list = malloc((last - first) * sizeof(document_summary_t));
+    if (*out_list) {
+      memcpy(*out_list, &s_docs[first],
+             (last - first) * sizeof(document_summary_t));
+      *count = last - first;
+    } else {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  doc_index_unlock();
+  return err;
+}
+
+esp_err_t data_manager_doc_index_page(data_manager_cursor_t *cursor,
+                                      document_summary_t *out, size_t max,
+                                      size_t *count) {
+  *count = 0;
+  if (!doc_index_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  size_t first, last;
+  doc_index_range(cursor->filtered ? cursor->related_id : NULL, &first, &last);
+  size_t pos = first;
+  if (cursor->started) {
+    size_t resume =
+        doc_index_lower_bound(cursor->last_related_id, cursor->last_id);
+    if (resume < s_doc_count &&
+        doc_cmp(cursor->last_related_id, cursor->last_id, &s_docs[resume]) ==
+            0) {
+      resume++;
+    }
+    pos = resume > first ? resume : first;
+  }
+  if (pos > last) {
+    pos = last;
+  }
+  size_t skipped = last - pos < cursor->skip ? last - pos : cursor->skip;
+  pos += skipped;
+  cursor->skip -= skipped;
+  size_t n = last - pos < max ? last - pos : max;
+  if (n > 0) {
+    memcpy(out, &s_docs[pos], n * sizeof(document_summary_t));
+  }
+  if (skipped + n > 0) {
+    const document_summary_t *e = &s_docs[pos + n - 1];
+    copy_bounded(cursor->last_related_id, sizeof(cursor->last_related_id),
+                 e->related_id);
+    copy_bounded(cursor->last_id, sizeof(cursor->last_id), e->id);
+    cursor->started = true;
+  }
+  doc_index_unlock();
+  *count = n;
+  return ESP_OK;
+}
+
+size_t data_manager_count_documents(const char *related_id) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  if (!storage_ready_guard(__func__) || !doc_index_lock()) {
+    return 0;
+  }
+  size_t first, last;
+  doc_index_range(related_id, &first, &last);
+  doc_index_unlock();
+  return last - first;
+}
+
+cJSON *data_manager_list_documents(const char *related_id) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  cJSON *arr = cJSON_CreateArray();
+  if (!arr) {
+    ESP_LOGE(TAG, "Failed to allocate documents array");
+    return NULL;
+  }
+  if (!storage_ready_guard(__func__) || !doc_index_lock()) {
+    return arr;
+  }
+  size_t first, last;
+  doc_index_range(related_id, &first, &last);
+  for (size_t i = first; i < last; i++) {
+    const document_summary_t *e = &s_docs[i];
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj) {
+      ESP_LOGE(TAG, "Failed to allocate document entry for %s", e->id);
+      doc_index_unlock();
+      cJSON_Delete(arr);
+      return NULL;
+    }
+    cJSON_AddStringToObject(obj, "id", e->id);
+    cJSON_AddStringToObject(obj, "related_id", e->related_id);
+    cJSON_AddNumberToObject(obj, "type", e->type);
+    cJSON_AddStringToObject(obj, "title", e->title);
+    cJSON_AddNumberToObject(obj, "timestamp", (double)e->timestamp);
+    cJSON_AddItemToArray(arr, obj);
+  }
+  doc_index_unlock();
+  return arr;
+}
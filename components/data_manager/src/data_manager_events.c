@@ -0,0 +1,798 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "json_reader.h"
+#include "storage_core.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+#include <time.h>
+
+static const char *TAG = "dm_events";
+
+// Append-only event logs, one directory per animal and one file per calendar
+// month (UTC) of the event timestamp: /data/events/<id>/<YYYYMM>.log.
+// Negative timestamps go to 000000.log. A range query only opens the months
+// it overlaps, so recent history costs the same after years of records.
+//
+// Each record is an 8-byte header followed by the payload:
+//   u16 magic | u16 payload_len | u32 crc32(payload)
+// Payload (little endian):
+//   i64 timestamp | u8 type | u8 id_len | id | u16 notes_len | notes
+//
+// Appends never read the existing file. The magic lets the reader resync
+// after a torn record (power loss mid-append) instead of losing the tail.
+#define EVENT_LOG_MAGIC 0x4C45u // "EL"
+#define EVENT_HEADER_SIZE 8
+#define EVENT_MAX_PAYLOAD                                                      \
+  (sizeof(int64_t) + 1 + 1 + MAX_ID_LEN + sizeof(uint16_t) +                  \
+   sizeof(((reptile_event_t *)0)->notes))
+
+// Bounded month ranges are probed file by file; wider ones list the
+// directory instead.
+#define EVENT_SHARD_PROBE_MAX 24
+
+static void event_dir_path(const char *reptile_id, char *out, size_t len) {
+  snprintf(out, len, DATA_MANAGER_ROOT "/events/%s", reptile_id);
+}
+
+static void event_shard_path(const char *reptile_id, uint32_t shard,
+                             char *out, size_t len) {
+  snprintf(out, len, DATA_MANAGER_ROOT "/events/%s/%06u.log", reptile_id,
+           (unsigned)shard);
+}
+
+// Legacy histories are sharded here first, then renamed into place.
+static void event_stage_path(const char *reptile_id, char *out, size_t len) {
+  snprintf(out, len, DATA_MANAGER_ROOT "/events/%s.migrating", reptile_id);
+}
+
+// Pre-sharding single log, converted on first access.
+static void event_flat_log_path(const char *reptile_id, char *out,
+                                size_t len) {
+  snprintf(out, len, DATA_MANAGER_ROOT "/events/%s.log", reptile_id);
+}
+
+// YYYYMM of the timestamp, 0 before the epoch. Monotonic in ts.
+// Last second of year 9999: later timestamps, INT64_MAX included, would
+// overflow gmtime_r and all map to the last shard.
+#define EVENT_TS_MAX 253402300799LL
+#define EVENT_SHARD_MAX 999912u
+
+static uint32_t event_shard_of(int64_t ts) {
+  if (ts < 0) {
+    return 0;
+  }
+  if (ts > EVENT_TS_MAX) {
+    return EVENT_SHARD_MAX;
+  }
+  time_t t = (time_t)ts;
+  struct tm tm;
+  if (!gmtime_r(&t, &tm)) {
+    return 0;
+  }
+  return (uint32_t)(tm.tm_year + 1900) * 100 + (uint32_t)(tm.tm_mon + 1);
+}
+
+static uint32_t shard_next(uint32_t shard) {
+  return shard % 100 == 12 ? (shard / 100 + 1) * 100 + 1 : shard + 1;
+}
+
+static uint32_t shard_months(uint32_t shard) {
+  return (shard / 100) * 12 + shard % 100;
+}
+
+static size_t event_encode(const reptile_event_t *event, uint8_t *out) {
+  uint8_t *p = out;
+  memcpy(p, &event->timestamp, sizeof(int64_t));
+  p += sizeof(int64_t);
+  *p++ = (uint8_t)event->type;
+  size_t id_len = strnlen(event->id, sizeof(event->id) - 1);
+  *p++ = (uint8_t)id_len;
+  memcpy(p, event->id, id_len);
+  p += id_len;
+  uint16_t notes_len =
+      (uint16_t)strnlen(event->notes, sizeof(event->notes) - 1);
+  memcpy(p, &notes_len, sizeof(notes_len));
+  p += sizeof(notes_len);
+  memcpy(p, event->notes, notes_len);
+  p += notes_len;
+  return (size_t)(p - out);
+}
+
+static bool event_decode(const uint8_t *data, size_t len,
+                         const char *reptile_id, reptile_event_t *out) {
+  const uint8_t *p = data;
+  const uint8_t *end = data + len;
+  memset(out, 0, sizeof(*out));
+  if (len < sizeof(int64_t) + 2) {
+    return false;
+  }
+  memcpy(&out->timestamp, p, sizeof(int64_t));
+  p += sizeof(int64_t);
+  out->type = (event_type_t)*p++;
+  size_t id_len = *p++;
+  if (id_len >= sizeof(out->id) || (size_t)(end - p) < id_len + 2) {
+    return false;
+  }
+  memcpy(out->id, p, id_len);
+  p += id_len;
+  uint16_t notes_len = 0;
+  memcpy(&notes_len, p, sizeof(notes_len));
+  p += sizeof(notes_len);
+  if (notes_len >= sizeof(out->notes) || (size_t)(end - p) < notes_len) {
+    return false;
+  }
+  memcpy(out->notes, p, notes_len);
+  copy_bounded(out->reptile_id, sizeof(out->reptile_id), reptile_id);
+  return true;
+}
+
+// Encodes header and payload into record; returns the record size.
+static size_t event_record(const reptile_event_t *event, uint8_t *record) {
+  int64_t t0 = dm_metrics_now();
+  size_t payload_len = event_encode(event, record + EVENT_HEADER_SIZE);
+  uint16_t magic = EVENT_LOG_MAGIC;
+  uint16_t len16 = (uint16_t)payload_len;
+  uint32_t crc = storage_crc32(record + EVENT_HEADER_SIZE, payload_len);
+  memcpy(record, &magic, sizeof(magic));
+  memcpy(record + 2, &len16, sizeof(len16));
+  memcpy(record + 4, &crc, sizeof(crc));
+  dm_op_parse(t0);
+  return EVENT_HEADER_SIZE + payload_len;
+}
+
+static esp_err_t event_append_unlocked(FILE *f, const reptile_event_t *event) {
+  uint8_t record[EVENT_HEADER_SIZE + EVENT_MAX_PAYLOAD];
+  size_t total = event_record(event, record);
+  int64_t t0 = dm_metrics_now();
+  size_t written = fwrite(record, 1, total, f);
+  dm_op_io(t0, 0, written);
+  return written == total ? ESP_OK : ESP_FAIL;
+}
+
+// Appends to the shard of each event, keeping the current shard open across
+// consecutive events of the same month. With a transaction, records are
+// staged at the shard size instead, so each shard must be visited once.
+typedef struct {
+  storage_txn_t *txn;
+  const char *reptile_id;
+  const char *dir; // Staging directory, NULL for the animal's own
+  uint32_t shard;
+  FILE *f;
+  bool open;
+  bool dir_ready;
+  uint32_t offset; // Transaction only: where the next record goes
+  char path[128];
+} shard_writer_t;
+
+static esp_err_t shard_writer_put(shard_writer_t *w,
+                                  const reptile_event_t *event) {
+  uint32_t shard = event_shard_of(event->timestamp);
+  if (!w->open || shard != w->shard) {
+    if (w->f && fclose(w->f) != 0) {
+      w->f = NULL;
+      return ESP_FAIL;
+    }
+    w->f = NULL;
+    w->open = false;
+    if (!w->dir_ready) {
+      if (w->dir) {
+        copy_bounded(w->path, sizeof(w->path), w->dir);
+      } else {
+        event_dir_path(w->reptile_id, w->path, sizeof(w->path));
+      }
+      if (mkdir(w->path, 0775) != 0 && errno != EEXIST) {
+        ESP_LOGE(TAG, "Cannot create %s (errno=%d)", w->path, errno);
+        return ESP_FAIL;
+      }
+      w->dir_ready = true;
+    }
+    if (w->dir) {
+      snprintf(w->path, sizeof(w->path), "%s/%06u.log", w->dir,
+               (unsigned)shard);
+    } else {
+      event_shard_path(w->reptile_id, shard, w->path, sizeof(w->path));
+    }
+    if (w->txn) {
+      struct stat st;
+      w->offset = stat(w->path, &st) == 0 ? (uint32_t)st.st_size : 0;
+    } else {
+      w->f = fopen(w->path, "ab");
+      if (!w->f) {
+        ESP_LOGE(TAG, "Failed to open %s for append", w->path);
+        return ESP_FAIL;
+      }
+    }
+    w->shard = shard;
+    w->open = true;
+  }
+  if (!w->txn) {
+    return event_append_unlocked(w->f, event);
+  }
+  uint8_t record[EVENT_HEADER_SIZE + EVENT_MAX_PAYLOAD];
+  size_t total = event_record(event, record);
+  esp_err_t err = storage_txn_write(w->txn, w->path, w->offset, record, total);
+  w->offset += (uint32_t)total;
+  return err;
+}
+
+static esp_err_t shard_writer_close(shard_writer_t *w) {
+  esp_err_t err = ESP_OK;
+  if (w->f && fclose(w->f) != 0) {
+    err = ESP_FAIL;
+  }
+  w->f = NULL;
+  w->open = false;
+  return err;
+}
+
+// Event indexes sorted by shard, put order within a shard.
+typedef struct {
+  uint32_t shard;
+  uint32_t index;
+} shard_ref_t;
+
+static int shard_ref_cmp(const void *a, const void *b) {
+  const shard_ref_t *ra = a;
+  const shard_ref_t *rb = b;
+  if (ra->shard != rb->shard) {
+    return ra->shard < rb->shard ? -1 : 1;
+  }
+  return ra->index < rb->index ? -1 : ra->index > rb->index;
+}
+
+static shard_ref_t *shard_order(const reptile_event_t *const *events,
+                                size_t count) {
+  shard_ref_t *refs = malloc(count * sizeof(shard_ref_t));
+  if (!refs) {
+    return NULL;
+  }
+  for (size_t i = 0; i < count; i++) {
+    refs[i].shard = event_shard_of(events[i]->timestamp);
+    refs[i].index = (uint32_t)i;
+  }
+  qsort(refs, count, sizeof(shard_ref_t), shard_ref_cmp);
+  return refs;
+}
+
+// Lists the shards of an animal within [lo, hi], ascending. Caller holds the
+// FS lock and frees *out.
+static esp_err_t list_shards(const char *reptile_id, uint32_t lo, uint32_t hi,
+                             uint32_t **out, size_t *count) {
+  *out = NULL;
+  *count = 0;
+  char path[128];
+  event_dir_path(reptile_id, path, sizeof(path));
+  DIR *d = opendir(path);
+  if (!d) {
+    return ESP_OK; // No events yet
+  }
+  size_t cap = 0;
+  esp_err_t err = ESP_OK;
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    unsigned shard;
+    char tail;
+    if (strlen(entry->d_name) != 10 ||
+        sscanf(entry->d_name, "%6u.lo%c", &shard, &tail) != 2 ||
+        tail != 'g' || shard < lo || shard > hi) {
+      continue;
+    }
+    if (*count == cap) {
+      size_t new_cap = cap ? cap * 2 : 16;
+      uint32_t *grown = realloc(*out, new_cap * sizeof(uint32_t));
+      if (!grown) {
+        err = ESP_ERR_NO_MEM;
+        break;
+      }
+      *out = grown;
+      cap = new_cap;
+    }
+    (*out)[(*count)++] = shard;
+  }
+  closedir(d);
+  if (err != ESP_OK) {
+    free(*out);
+    *out = NULL;
+    *count = 0;
+    return err;
+  }
+  // Insertion sort: a few hundred months at most.
+  for (size_t a = 1; a < *count; a++) {
+    uint32_t v = (*out)[a];
+    size_t b = a;
+    for (; b > 0 && (*out)[b - 1] > v; b--) {
+      (*out)[b] = (*out)[b - 1];
+    }
+    (*out)[b] = v;
+  }
+  return ESP_OK;
+}
+
+// Unlinks every shard and the animal's directory. Caller holds the write
+// lock.
+static void remove_shards(const char *reptile_id) {
+  uint32_t *shards = NULL;
+  size_t count = 0;
+  if (list_shards(reptile_id, 0, UINT32_MAX, &shards, &count) != ESP_OK) {
+    return;
+  }
+  char path[128];
+  for (size_t i = 0; i < count; i++) {
+    event_shard_path(reptile_id, shards[i], path, sizeof(path));
+    unlink(path);
+  }
+  free(shards);
+  event_dir_path(reptile_id, path, sizeof(path));
+  rmdir(path);
+}
+
+// Unlinks a staging directory left by an interrupted migration, if any.
+// Caller holds the write lock.
+static void remove_stage(const char *reptile_id) {
+  char dir[128];
+  char path[192];
+  event_stage_path(reptile_id, dir, sizeof(dir));
+  DIR *d = opendir(dir);
+  if (!d) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] != '.') {
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      unlink(path);
+    }
+  }
+  closedir(d);
+  rmdir(dir);
+}
+
+// Streams the intact records of one log file. Returns the bytes skipped while
+// resyncing; *stopped is set when cb asked to stop.
+static size_t scan_log(FILE *f, const char *reptile_id,
+                       data_manager_event_cb_t cb, void *user_ctx,
+                       bool *stopped) {
+  uint8_t header[EVENT_HEADER_SIZE];
+  uint8_t payload[EVENT_MAX_PAYLOAD];
+  size_t skipped = 0;
+  long offset = 0;
+  *stopped = false;
+  for (;;) {
+    int64_t t0 = dm_metrics_now();
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) {
+      break;
+    }
+    uint16_t magic, len;
+    uint32_t crc;
+    memcpy(&magic, header, sizeof(magic));
+    memcpy(&len, header + 2, sizeof(len));
+    memcpy(&crc, header + 4, sizeof(crc));
+
+    reptile_event_t evt;
+    bool valid = magic == EVENT_LOG_MAGIC && len <= sizeof(payload) &&
+                 fread(payload, 1, len, f) == len;
+    dm_op_io(t0, sizeof(header) + (valid ? len : 0), 0);
+    t0 = dm_metrics_now();
+    valid = valid && storage_crc32(payload, len) == crc &&
+            event_decode(payload, len, reptile_id, &evt);
+    dm_op_parse(t0);
+    if (!valid) {
+      // Resync: retry one byte further until the next intact record.
+      skipped++;
+      offset++;
+      fseek(f, offset, SEEK_SET);
+      continue;
+    }
+    offset += EVENT_HEADER_SIZE + len;
+    if (!cb(&evt, user_ctx)) {
+      *stopped = true;
+      break;
+    }
+  }
+  return skipped;
+}
+
+static bool count_event(const reptile_event_t *event, void *user_ctx) {
+  return true;
+}
+
+esp_err_t event_shard_check_unlocked(const char *path, size_t *bad_bytes,
+                                     size_t *bytes) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  bool stopped = false;
+  *bad_bytes = scan_log(f, "", count_event, NULL, &stopped);
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  fclose(f);
+  *bytes = size > 0 ? (size_t)size : 0;
+  return ESP_OK;
+}
+
+typedef struct {
+  shard_writer_t *writer;
+  size_t migrated;
+  esp_err_t err;
+} migrate_ctx_t;
+
+static bool migrate_event(const reptile_event_t *event, void *user_ctx) {
+  migrate_ctx_t *ctx = (migrate_ctx_t *)user_ctx;
+  ctx->err = shard_writer_put(ctx->writer, event);
+  if (ctx->err != ESP_OK) {
+    return false;
+  }
+  ctx->migrated++;
+  return true;
+}
+
+static const record_field_t s_legacy_event_fields[] = {
+    RECORD_FIELD(reptile_event_t, id, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_event_t, type, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_event_t, timestamp, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_event_t, notes, RECORD_FIELD_STRING),
+};
+
+static bool migrate_json_event(void *out, void *user_ctx) {
+  reptile_event_t *evt = (reptile_event_t *)out;
+  migrate_ctx_t *ctx = (migrate_ctx_t *)user_ctx;
+  copy_bounded(evt->reptile_id, sizeof(evt->reptile_id),
+               ctx->writer->reptile_id);
+  bool more = migrate_event(evt, ctx);
+  memset(evt, 0, sizeof(*evt)); // Absent fields of the next element
+  return more;
+}
+
+// Legacy /data/events/<id>.json array, pulled element by element: the file
+// size is not bounded by CONFIG_ARS_DATA_MAX_JSON_SIZE. A file that does not
+// parse is an error, so the caller keeps it.
+static esp_err_t migrate_json_events(const char *json_path,
+                                     shard_writer_t *w, size_t *migrated) {
+  FILE *f = fopen(json_path, "rb");
+  if (!f) {
+    return ESP_FAIL;
+  }
+  migrate_ctx_t ctx = {.writer = w, .err = ESP_OK};
+  reptile_event_t evt = {0};
+  esp_err_t err = json_decode_array_file(
+      f, s_legacy_event_fields,
+      sizeof(s_legacy_event_fields) / sizeof(s_legacy_event_fields[0]), &evt,
+      migrate_json_event, &ctx);
+  fclose(f);
+  *migrated += ctx.migrated;
+  if (ctx.err != ESP_OK) {
+    return ctx.err;
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "%s is not a valid event array", json_path);
+  }
+  return err;
+}
+
+// Pre-sharding /data/events/<id>.log.
+static esp_err_t migrate_flat_log(const char *flat_path, shard_writer_t *w,
+                                  size_t *migrated) {
+  FILE *f = fopen(flat_path, "rb");
+  if (!f) {
+    return ESP_FAIL;
+  }
+  migrate_ctx_t ctx = {.writer = w, .err = ESP_OK};
+  bool stopped;
+  scan_log(f, w->reptile_id, migrate_event, &ctx, &stopped);
+  fclose(f);
+  *migrated += ctx.migrated;
+  return ctx.err;
+}
+
+// One-time conversion of the legacy JSON array and of the pre-sharding flat
+// log into monthly shards. The shards are built in a staging directory and
+// renamed into place once complete, then the sources are unlinked. Migration
+// runs before any append for the animal, so a shard directory next to a
+// legacy file can only come from a conversion cut short after its rename:
+// the sources are then just removed. On failure the staging directory is
+// dropped and the sources are kept for a retry; appends are refused
+// meanwhile, as they would create the shard directory.
+// Caller holds the FS write lock.
+static esp_err_t migrate_legacy_events(const char *reptile_id) {
+  char flat_path[128];
+  char json_path[128];
+  event_flat_log_path(reptile_id, flat_path, sizeof(flat_path));
+  snprintf(json_path, sizeof(json_path), DATA_MANAGER_ROOT "/events/%s.json",
+           reptile_id);
+  bool has_flat = access(flat_path, F_OK) == 0;
+  bool has_json = access(json_path, F_OK) == 0;
+  if (!has_flat && !has_json) {
+    return ESP_OK;
+  }
+
+  char dir[128];
+  event_dir_path(reptile_id, dir, sizeof(dir));
+  if (access(dir, F_OK) != 0) {
+    char stage[128];
+    event_stage_path(reptile_id, stage, sizeof(stage));
+    remove_stage(reptile_id); // Left by an earlier attempt
+    shard_writer_t w = {.reptile_id = reptile_id, .dir = stage};
+    size_t migrated = 0;
+    esp_err_t err = ESP_OK;
+    if (has_json) {
+      err = migrate_json_events(json_path, &w, &migrated);
+    }
+    if (err == ESP_OK && has_flat) {
+      err = migrate_flat_log(flat_path, &w, &migrated);
+    }
+    if (shard_writer_close(&w) != ESP_OK && err == ESP_OK) {
+      err = ESP_FAIL;
+    }
+    // An empty history leaves no staging directory: nothing to move.
+    if (err == ESP_OK && migrated > 0 && rename(stage, dir) != 0) {
+      ESP_LOGE(TAG, "Cannot rename %s (errno=%d)", stage, errno);
+      err = ESP_FAIL;
+    }
+    if (err != ESP_OK) {
+      remove_stage(reptile_id);
+      ESP_LOGE(TAG, "Event migration failed for %s, legacy files kept",
+               reptile_id);
+      return err;
+    }
+    ESP_LOGI(TAG, "Sharded %u legacy events for %s", (unsigned)migrated,
+             reptile_id);
+  }
+
+  if (has_json) {
+    unlink(json_path);
+  }
+  if (has_flat) {
+    unlink(flat_path);
+  }
+  return ESP_OK;
+}
+
+static bool has_legacy_events(const char *reptile_id) {
+  char path[128];
+  event_flat_log_path(reptile_id, path, sizeof(path));
+  if (access(path, F_OK) == 0) {
+    return true;
+  }
+  snprintf(path, sizeof(path), DATA_MANAGER_ROOT "/events/%s.json",
+           reptile_id);
+  return access(path, F_OK) == 0;
+}
+
+// Reader-side variant: the conversion rewrites files, so the write lock is
+// only taken when a legacy file is actually present.
+static void migrate_legacy_events_exclusive(const char *reptile_id) {
+  if (!has_legacy_events(reptile_id)) {
+    return;
+  }
+  if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    (void)migrate_legacy_events(reptile_id);
+    data_fs_write_unlock();
+  }
+}
+
+esp_err_t event_log_append_unlocked(storage_txn_t *txn, const char *reptile_id,
+                                    const reptile_event_t *const *events,
+                                    size_t count) {
+  esp_err_t err = migrate_legacy_events(reptile_id);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  shard_ref_t *order = NULL;
+  if (txn && count > 1) {
+    order = shard_order(events, count);
+    if (!order) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  shard_writer_t w = {.txn = txn, .reptile_id = reptile_id};
+  for (size_t i = 0; i < count && err == ESP_OK; i++) {
+    err = shard_writer_put(&w, events[order ? order[i].index : i]);
+  }
+  free(order);
+  if (shard_writer_close(&w) != ESP_OK && err == ESP_OK) {
+    err = ESP_FAIL;
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Short write on the event log of %s", reptile_id);
+    return err;
+  }
+  if (!txn) {
+    aggregate_apply_events_unlocked(reptile_id, events, count);
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_add_event(const reptile_event_t *event) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_EVENT_APPEND);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!event) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot append event for %s", event->reptile_id);
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err =
+      event_log_append_unlocked(NULL, event->reptile_id, &event, 1);
+  data_fs_write_unlock();
+  if (err == ESP_OK) {
+    change_log_record(DATA_MANAGER_ENTITY_EVENTS, DATA_MANAGER_CHANGE_PUT,
+                      event->reptile_id);
+  }
+  return err;
+}
+
+typedef struct {
+  int64_t from;
+  int64_t to;
+  uint32_t type_mask;
+  size_t remaining; // SIZE_MAX without a limit
+  data_manager_event_cb_t cb;
+  void *user_ctx;
+} event_filter_t;
+
+static bool filter_event(const reptile_event_t *event, void *user_ctx) {
+  event_filter_t *flt = (event_filter_t *)user_ctx;
+  if (event->timestamp < flt->from || event->timestamp > flt->to) {
+    return true;
+  }
+  if (flt->type_mask != 0 &&
+      ((uint32_t)event->type >= 32 ||
+       !(flt->type_mask & DATA_MANAGER_EVENT_TYPE_BIT(event->type)))) {
+    return true;
+  }
+  if (!flt->cb(event, flt->user_ctx)) {
+    return false;
+  }
+  return --flt->remaining > 0;
+}
+
+// Shards overlapping [from, to]: probed directly when the range is a few
+// months wide, listed from the directory otherwise. Caller frees *out.
+static esp_err_t shards_for_range(const char *reptile_id, int64_t from,
+                                  int64_t to, uint32_t **out, size_t *count) {
+  uint32_t lo = event_shard_of(from);
+  uint32_t hi = event_shard_of(to);
+  if (lo == 0 || shard_months(hi) - shard_months(lo) >= EVENT_SHARD_PROBE_MAX) {
+    return list_shards(reptile_id, lo, hi, out, count);
+  }
+  *count = 0;
+  *out = malloc(EVENT_SHARD_PROBE_MAX * sizeof(uint32_t));
+  if (!*out) {
+    return ESP_ERR_NO_MEM;
+  }
+  char path[128];
+  for (uint32_t shard = lo; shard <= hi; shard = shard_next(shard)) {
+    event_shard_path(reptile_id, shard, path, sizeof(path));
+    if (access(path, F_OK) == 0) {
+      (*out)[(*count)++] = shard;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_query_events(const char *reptile_id, int64_t from,
+                                    int64_t to, uint32_t type_mask,
+                                    size_t limit, data_manager_event_cb_t cb,
+                                    void *user_ctx) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_EVENT_READ);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!reptile_id || !cb) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (from > to) {
+    return ESP_OK;
+  }
+
+  migrate_legacy_events_exclusive(reptile_id);
+  if (!data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot read the events of %s", reptile_id);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  uint32_t *shards = NULL;
+  size_t count = 0;
+  esp_err_t err = shards_for_range(reptile_id, from, to, &shards, &count);
+  event_filter_t flt = {
+      .from = from,
+      .to = to,
+      .type_mask = type_mask,
+      .remaining = limit ? limit : SIZE_MAX,
+      .cb = cb,
+      .user_ctx = user_ctx,
+  };
+  bool stopped = false;
+  for (size_t i = 0; err == ESP_OK && i < count && !stopped; i++) {
+    char path[128];
+    event_shard_path(reptile_id, shards[i], path, sizeof(path));
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+      continue;
+    }
+    size_t skipped = scan_log(f, reptile_id, filter_event, &flt, &stopped);
+    fclose(f);
+    if (skipped > 0) {
+      ESP_LOGW(TAG, "%s: skipped %u corrupt bytes", path, (unsigned)skipped);
+    }
+  }
+  free(shards);
+  data_fs_read_unlock();
+  return err;
+}
+
+esp_err_t data_manager_foreach_event(const char *reptile_id,
+                                     data_manager_event_cb_t cb,
+                                     void *user_ctx) {
+  return data_manager_query_events(reptile_id, INT64_MIN, INT64_MAX, 0, 0, cb,
+                                   user_ctx);
+}
+
+void event_log_remove_unlocked(const char *reptile_id) {
+  char path[128];
+  event_flat_log_path(reptile_id, path, sizeof(path));
+  unlink(path);
+  snprintf(path, sizeof(path), DATA_MANAGER_ROOT "/events/%s.json",
+           reptile_id);
+  unlink(path);
+  remove_stage(reptile_id);
+  remove_shards(reptile_id);
+}
+
+esp_err_t data_manager_delete_events(const char *reptile_id) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_DELETE);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!reptile_id) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    return ESP_ERR_TIMEOUT;
+  }
+  event_log_remove_unlocked(reptile_id);
+  aggregate_clear_events_unlocked(reptile_id);
+  data_fs_write_unlock();
+  change_log_record(DATA_MANAGER_ENTITY_EVENTS, DATA_MANAGER_CHANGE_DELETE,
+                    reptile_id);
+  return ESP_OK;
+}
+
+static bool append_event_json(const reptile_event_t *event, void *user_ctx) {
+  cJSON *arr = (cJSON *)user_ctx;
+  cJSON *evt_obj = cJSON_CreateObject();
+  if (!evt_obj) {
+    return false;
+  }
+  cJSON_AddStringToObject(evt_obj, "id", event->id);
+  cJSON_AddStringToObject(evt_obj, "reptile_id", event->reptile_id);
+  cJSON_AddNumberToObject(evt_obj, "type", event->type);
+  cJSON_AddNumberToObject(evt_obj, "timestamp", (double)event->timestamp);
+  cJSON_AddStringToObject(evt_obj, "notes", event->notes);
+  cJSON_AddItemToArray(arr, evt_obj);
+  return true;
+}
+
+cJSON *data_manager_get_events(const char *reptile_id) {
+  if (!storage_ready_guard(__func__)) {
+    return NULL;
+  }
+  cJSON *arr = cJSON_CreateArray();
+  if (!arr) {
+    ESP_LOGE(TAG, "Failed to allocate events array for %s", reptile_id);
+    return NULL;
+  }
+  data_manager_foreach_event(reptile_id, append_event_json, arr);
+  return arr;
+}
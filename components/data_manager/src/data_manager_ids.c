@@ -0,0 +1,170 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "storage_core.h"
+#include <stdlib.h>
+
+static const char *TAG = "dm_ids";
+
+// Compact, increasing ids for new records and events: a 40-bit counter
+// written as 8 Crockford base32 characters, so ids sort in creation order
+// and the record bucket hash spreads them evenly.
+//
+// The counter is not persisted per id: a high-water mark is written
+// ID_RESERVE values ahead and a reboot resumes from it, skipping at most
+// ID_RESERVE unused values. A missing or corrupt mark is reseeded past the
+// highest id among the record files, never from the clock: before SNTP it
+// reads 1970 and would hand out ids of existing animals again. Event ids are
+// not scanned; a repeated one overwrites nothing.
+#define ID_SEQ_PATH DATA_MANAGER_INDEX_DIR "/id_seq.bin"
+#define ID_SEQ_VERSION 1
+#define ID_RESERVE 32
+#define ID_CHARS (DATA_MANAGER_ID_LEN - 1)
+#define ID_MAX ((1ULL << (5 * ID_CHARS)) - 1)
+
+static const char s_alphabet[] = "0123456789abcdefghjkmnpqrstvwxyz";
+
+static SemaphoreHandle_t s_id_lock = NULL;
+static uint64_t s_next = 0;
+static uint64_t s_reserved = 0; // First value not covered by the mark
+static bool s_seeded = false;   // s_next is known to be past every id
+
+// Value of a compact id, false for ids of another form.
+static bool id_decode(const char *id, uint64_t *out) {
+  uint64_t value = 0;
+  size_t i = 0;
+  for (; id[i]; i++) {
+    const char *c = i < ID_CHARS ? strchr(s_alphabet, id[i]) : NULL;
+    if (!c) {
+      return false;
+    }
+    value = (value << 5) | (uint64_t)(c - s_alphabet);
+  }
+  *out = value;
+  return i == ID_CHARS;
+}
+
+// First value above every compact record id. Runs after record_layout_init(),
+// so every record is in its bucket.
+static esp_err_t seed_from_records(uint64_t *out) {
+  if (!data_fs_read_lock(pdMS_TO_TICKS(10000))) {
+    return ESP_ERR_TIMEOUT;
+  }
+  uint64_t next = 0;
+  char id[MAX_ID_LEN];
+  for (int kind = 0; kind < RECORD_KIND_COUNT; kind++) {
+    record_scan_t scan;
+    if (!record_scan_open(&scan, (record_kind_t)kind)) {
+      continue;
+    }
+    while (record_scan_next(&scan, id, sizeof(id))) {
+      uint64_t value;
+      if (id_decode(id, &value) && value >= next) {
+        next = value + 1;
+      }
+    }
+    record_scan_close(&scan);
+  }
+  data_fs_read_unlock();
+  *out = next;
+  return ESP_OK;
+}
+
+// The saved mark, or the value after the highest record id when it is
+// missing or corrupt. An error leaves the counter unseeded.
+static esp_err_t load_mark(uint64_t *mark) {
+  void *data = NULL;
+  size_t len = 0;
+  esp_err_t err = ESP_ERR_TIMEOUT;
+  if (data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    err = storage_load_secure(ID_SEQ_PATH, &data, &len, ID_SEQ_VERSION);
+    data_fs_read_unlock();
+  }
+  bool ok = err == ESP_OK && len == sizeof(*mark);
+  if (ok) {
+    memcpy(mark, data, sizeof(*mark));
+  }
+  free(data);
+  if (ok) {
+    return ESP_OK;
+  }
+  if (err == ESP_ERR_TIMEOUT) {
+    return err;
+  }
+  if (err != ESP_ERR_NOT_FOUND) {
+    ESP_LOGW(TAG, "Id mark unreadable (%s), reseeding from the records",
+             esp_err_to_name(err));
+  }
+  return seed_from_records(mark);
+}
+
+esp_err_t data_manager_ids_init(void) {
+  if (!s_id_lock) {
+    s_id_lock = xSemaphoreCreateMutex();
+    if (!s_id_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  uint64_t mark = 0;
+  esp_err_t err = load_mark(&mark);
+  xSemaphoreTake(s_id_lock, portMAX_DELAY);
+  s_seeded = err == ESP_OK;
+  s_next = mark;
+  s_reserved = mark;
+  xSemaphoreGive(s_id_lock);
+  return err;
+}
+
+static esp_err_t reserve_unlocked(void) {
+  uint64_t mark = s_next + ID_RESERVE;
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err =
+      storage_save_secure(ID_SEQ_PATH, &mark, sizeof(mark), ID_SEQ_VERSION);
+  data_fs_write_unlock();
+  if (err == ESP_OK) {
+    s_reserved = mark;
+  }
+  return err;
+}
+
+esp_err_t data_manager_new_id(char *out, size_t out_len) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_MAINTENANCE);
+  if (!out || out_len < DATA_MANAGER_ID_LEN) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (!storage_ready_guard(__func__) || !s_id_lock) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (xSemaphoreTake(s_id_lock, pdMS_TO_TICKS(2000)) != pdTRUE) {
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err = ESP_OK;
+  if (!s_seeded) {
+    // Retried here: allocating blind could hand out an existing animal's id.
+    err = load_mark(&s_next);
+    s_seeded = err == ESP_OK;
+    s_reserved = s_next;
+  }
+  if (err == ESP_OK && s_next > ID_MAX) {
+    err = ESP_ERR_INVALID_STATE;
+  } else if (err == ESP_OK && s_next >= s_reserved) {
+    err = reserve_unlocked();
+  }
+  uint64_t value = s_next;
+  if (err == ESP_OK) {
+    s_next++;
+  }
+  xSemaphoreGive(s_id_lock);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot allocate an id (%s)", esp_err_to_name(err));
+    return err;
+  }
+  for (int i = ID_CHARS - 1; i >= 0; i--) {
+    out[i] = s_alphabet[value & 31];
+    value >>= 5;
+  }
+  out[ID_CHARS] = '\0';
+  return ESP_OK;
+}
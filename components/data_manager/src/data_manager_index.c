@@ -0,0 +1,667 @@
+#include "blob_stream.h"
+#include "data_manager_priv.h"
+#include "dm_arena.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "search_index.h"
+#include "storage_core.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+static const char *TAG = "dm_index";
+
+// Persistent summary index: one storage_core blob holding every reptile's
+// list-screen fields, so listing never has to walk /data/reptiles. Version 1
+// stored species and morph as text; such a file is rebuilt from the records.
+#define INDEX_PATH DATA_MANAGER_INDEX_DIR "/reptiles.idx"
+#define INDEX_VERSION 2
+#define INDEX_GROW_STEP 16
+#define INDEX_STALE_PATH DATA_MANAGER_INDEX_DIR "/reptiles.stale"
+
+static SemaphoreHandle_t s_index_lock = NULL;
+static reptile_summary_t *s_entries = NULL; // Sorted by id
+static size_t s_count = 0;
+static size_t s_capacity = 0;
+static search_index_t *s_search = NULL; // Mirrors s_entries
+static uint32_t s_hold = 0;             // Open data_manager_index_hold() calls
+static bool s_dirty = false;            // Changed while held
+static index_mark_t s_mark = {.path = INDEX_STALE_PATH};
+
+static bool index_lock(void) {
+  return s_index_lock && xSemaphoreTake(s_index_lock, portMAX_DELAY) == pdTRUE;
+}
+
+static void index_unlock(void) { xSemaphoreGive(s_index_lock); }
+
+// Binary search; returns the insertion point when the id is absent.
+static size_t index_find(const char *id, bool *found) {
+  size_t lo = 0, hi = s_count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(s_entries[mid].id, id);
+    if (cmp == 0) {
+      *found = true;
+      return mid;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  *found = false;
+  return lo;
+}
+
+static reptile_summary_t *index_insert_slot(const char *id) {
+  bool found = false;
+  size_t pos = index_find(id, &found);
+  if (found) {
+    return &s_entries[pos];
+  }
+  if (s_count == s_capacity) {
+    size_t new_cap = s_capacity + INDEX_GROW_STEP;
+    reptile_summary_t *grown =
+        realloc(s_entries, new_cap * sizeof(reptile_summary_t));
+    if (!grown) {
+      ESP_LOGE(TAG, "Failed to grow index to %u entries", (unsigned)new_cap);
+      return NULL;
+    }
+    s_entries = grown;
+    s_capacity = new_cap;
+  }
+  memmove(&s_entries[pos + 1], &s_entries[pos],
+          (s_count - pos) * sizeof(reptile_summary_t));
+  s_count++;
+  memset(&s_entries[pos], 0, sizeof(reptile_summary_t));
+  copy_bounded(s_entries[pos].id, sizeof(s_entries[pos].id), id);
+  s_entries[pos].species = string_intern(NULL);
+  s_entries[pos].morph = s_entries[pos].species;
+  return &s_entries[pos];
+}
+
+// --- Serialization ---------------------------------------------------------
+// Payload: u32 count, then per entry: u8 gender, f32 weight, id and name as
+// u8 length + bytes (no terminator), then species and morph as u16 string
+// pool ids.
+
+static uint8_t *index_serialize(size_t *out_len) {
+  size_t len = sizeof(uint32_t);
+  for (size_t i = 0; i < s_count; i++) {
+    const reptile_summary_t *e = &s_entries[i];
+    len += 1 + sizeof(float) + 2 + strlen(e->id) + strlen(e->name) +
+           2 * sizeof(uint16_t);
+  }
+  uint8_t *buf = dm_arena_alloc(len);
+  if (!buf) {
+    return NULL;
+  }
+  uint8_t *p = buf;
+  uint32_t count = (uint32_t)s_count;
+  memcpy(p, &count, sizeof(count));
+  p += sizeof(count);
+  for (size_t i = 0; i < s_count; i++) {
+    const reptile_summary_t *e = &s_entries[i];
+    *p++ = (uint8_t)e->gender;
+    memcpy(p, &e->weight, sizeof(float));
+    p += sizeof(float);
+    p += blob_put_str(p, e->id);
+    p += blob_put_str(p, e->name);
+    uint16_t ids[2] = {string_id(e->species), string_id(e->morph)};
+    memcpy(p, ids, sizeof(ids));
+    p += sizeof(ids);
+  }
+  *out_len = len;
+  return buf;
+}
+
+// Loads decode into scratch entries, installed only once the CRC matched.
+typedef struct {
+  reptile_summary_t *entries;
+  uint32_t count;
+} index_load_t;
+
+#define INDEX_MAX_ENTRY (1 + sizeof(float) + 2 * 256 + 2 * sizeof(uint16_t))
+
+static esp_err_t index_load_start(uint32_t count, void *ctx) {
+  index_load_t *load = ctx;
+  if (count > 0) {
+    load->entries = calloc(count, sizeof(reptile_summary_t));
+    if (!load->entries) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  load->count = count;
+  return ESP_OK;
+}
+
+static size_t index_load_entry(uint32_t index, const uint8_t *p,
+                               const uint8_t *end, void *ctx) {
+  index_load_t *load = ctx;
+  reptile_summary_t *e = &load->entries[index];
+  const uint8_t *start = p;
+  if ((size_t)(end - p) < 1 + sizeof(float)) {
+    return 0;
+  }
+  e->gender = (reptile_gender_t)*p++;
+  memcpy(&e->weight, p, sizeof(float));
+  p += sizeof(float);
+  uint16_t ids[2];
+  if (!blob_get_str(&p, end, e->id, sizeof(e->id)) ||
+      !blob_get_str(&p, end, e->name, sizeof(e->name)) ||
+      (size_t)(end - p) < sizeof(ids)) {
+    return 0;
+  }
+  memcpy(ids, p, sizeof(ids));
+  p += sizeof(ids);
+  // Unknown ids: the string pool was lost, rebuild from the records.
+  e->species = string_at(ids[0]);
+  e->morph = string_at(ids[1]);
+  if (!e->species || !e->morph) {
+    return 0;
+  }
+  return (size_t)(p - start);
+}
+
+static const blob_stream_ops_t s_index_blob = {
+    .start = index_load_start,
+    .entry = index_load_entry,
+    .max_entry = INDEX_MAX_ENTRY,
+};
+
+// Caller holds the index lock; takes ownership of load->entries.
+static void index_install(index_load_t *load) {
+  free(s_entries);
+  s_entries = load->entries;
+  s_count = load->count;
+  s_capacity = load->count;
+  search_index_clear(s_search);
+  for (size_t i = 0; i < s_count; i++) {
+    search_index_put(s_search, &s_entries[i]);
+  }
+  load->entries = NULL;
+  snapshot_edit_begin();
+  snapshot_load(SNAPSHOT_REPTILES, s_entries, s_count, sizeof(*s_entries));
+  snapshot_edit_end();
+}
+
+// Writes the current index to flash. Lock order is FS lock, then index lock;
+// the index lock is only held while copying to the staging buffer so readers
+// never wait on flash I/O. The staging buffer comes from the arena (PSRAM).
+static esp_err_t index_persist(void) {
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot persist index");
+    return ESP_ERR_TIMEOUT;
+  }
+  size_t len = 0;
+  uint8_t *buf = NULL;
+  dm_arena_begin();
+  if (index_lock()) {
+    buf = index_serialize(&len);
+    index_unlock();
+  }
+  esp_err_t err = ESP_ERR_NO_MEM;
+  if (buf) {
+    // Every id in buf was interned before it was serialized.
+    int64_t t0 = dm_metrics_now();
+    err = string_pool_save_unlocked();
+    if (err == ESP_OK) {
+      err = storage_save_secure(INDEX_PATH, buf, len, INDEX_VERSION);
+    }
+    dm_op_io(t0, 0, sizeof(storage_header_t) + len);
+    dm_arena_free(buf);
+  }
+  dm_arena_end();
+  index_mark_saved_unlocked(&s_mark, err);
+  data_fs_write_unlock();
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to persist index (%s)", esp_err_to_name(err));
+  }
+  return err;
+}
+
+static esp_err_t index_rebuild_from_files(void) {
+  if (!data_fs_read_lock(pdMS_TO_TICKS(10000))) {
+    ESP_LOGE(TAG, "FS busy, cannot rebuild index");
+    return ESP_ERR_TIMEOUT;
+  }
+
+  record_scan_t scan;
+  if (!record_scan_open(&scan, RECORD_REPTILE)) {
+    data_fs_read_unlock();
+    return ESP_FAIL;
+  }
+
+  if (!index_lock()) {
+    record_scan_close(&scan);
+    data_fs_read_unlock();
+    return ESP_ERR_INVALID_STATE;
+  }
+  s_count = 0;
+  search_index_clear(s_search);
+
+  esp_err_t err = ESP_OK;
+  char id[MAX_ID_LEN];
+  while (record_scan_next(&scan, id, sizeof(id))) {
+    reptile_t r = {0};
+    if (record_read_unlocked(RECORD_REPTILE, id, &r) != ESP_OK) {
+      ESP_LOGW(TAG, "Skipping unreadable reptile %s", id);
+      continue;
+    }
+    if (r.id[0] == '\0') {
+      continue;
+    }
+    reptile_summary_t *e = index_insert_slot(r.id);
+    if (!e) {
+      err = ESP_ERR_NO_MEM;
+      break;
+    }
+    copy_bounded(e->name, sizeof(e->name), r.name);
+    e->species = string_intern(r.species);
+    e->morph = string_intern(r.morph);
+    e->gender = r.gender;
+    // Before the aggregates at init: agg_sync_index() catches up then.
+    e->weight = r.weight;
+    aggregate_current_weight(r.id, &e->weight);
+    search_index_put(s_search, e);
+  }
+  size_t count = s_count;
+  snapshot_edit_begin();
+  snapshot_load(SNAPSHOT_REPTILES, s_entries, s_count, sizeof(*s_entries));
+  snapshot_edit_end();
+  index_unlock();
+  record_scan_close(&scan);
+  data_fs_read_unlock();
+
+  ESP_LOGI(TAG, "Index rebuilt from files: %u reptiles", (unsigned)count);
+  return err;
+}
+
+// Under the index lock, after a change: true when the caller must persist
+// now, false when an open hold defers it to data_manager_index_release().
+static bool index_changed_unheld(void) {
+  if (s_hold > 0) {
+    s_dirty = true;
+    return false;
+  }
+  return true;
+}
+
+esp_err_t data_manager_index_init(void) {
+  if (!s_index_lock) {
+    s_index_lock = xSemaphoreCreateMutex();
+    if (!s_index_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  if (!s_search) {
+    s_search = search_index_create();
+    if (!s_search) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+
+  // A reset between a record write and the index persist: the file may
+  // miss that animal, or still list it.
+  if (index_mark_init(&s_mark)) {
+    ESP_LOGW(TAG, "Index may be behind the records, rebuilding");
+    return data_manager_rebuild_index();
+  }
+
+  // Streamed: thousands of animals never need the whole file in one block.
+  index_load_t load = {0};
+  esp_err_t err = ESP_FAIL;
+  if (data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    err = blob_stream_load(INDEX_PATH, INDEX_VERSION, &s_index_blob, &load);
+    data_fs_read_unlock();
+  }
+
+  if (err == ESP_OK && index_lock()) {
+    index_install(&load);
+    index_unlock();
+  }
+  free(load.entries);
+
+  if (err == ESP_OK) {
+    ESP_LOGI(TAG, "Loaded index: %u reptiles", (unsigned)s_count);
+    return ESP_OK;
+  }
+
+  if (err != ESP_ERR_NOT_FOUND) {
+    ESP_LOGW(TAG, "Index unusable (%s), rebuilding", esp_err_to_name(err));
+  }
+  return data_manager_rebuild_index();
+}
+
+esp_err_t data_manager_rebuild_index(void) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_MAINTENANCE);
+  // The rebuild reads the files: pending saves go first.
+  record_cache_flush();
+  esp_err_t err = index_rebuild_from_files();
+  if (err != ESP_OK) {
+    return err;
+  }
+  return index_persist();
+}
+
+esp_err_t data_manager_index_begin(void) { return index_mark_begin(&s_mark); }
+
+void data_manager_index_end(void) {
+  bool pending = false;
+  if (index_lock()) {
+    pending = s_dirty;
+    index_unlock();
+  }
+  index_mark_end(&s_mark, pending);
+}
+
+void data_manager_index_upsert(const reptile_t *reptile) {
+  if (!reptile) {
+    return;
+  }
+  // Same weight as a rebuild: the latest weighing, else the record's.
+  float weight = reptile->weight;
+  aggregate_current_weight(reptile->id, &weight);
+  if (!index_lock()) {
+    return;
+  }
+  bool changed = false;
+  bool found = false;
+  index_find(reptile->id, &found);
+  reptile_summary_t *e = index_insert_slot(reptile->id);
+  if (e) {
+    reptile_summary_t before = *e;
+    copy_bounded(e->name, sizeof(e->name), reptile->name);
+    e->species = string_intern(reptile->species);
+    e->morph = string_intern(reptile->morph);
+    e->gender = reptile->gender;
+    e->weight = weight;
+    changed = !found || memcmp(&before, e, sizeof(before)) != 0;
+    if (changed) {
+      search_index_put(s_search, e);
+      snapshot_edit_begin();
+      snapshot_put(SNAPSHOT_REPTILES, e - s_entries, e, !found);
+      snapshot_edit_end();
+    }
+  }
+  bool persist = changed && index_changed_unheld();
+  index_unlock();
+
+  if (persist) {
+    index_persist();
+  }
+}
+
+void data_manager_index_remove(const char *id) {
+  if (!id || !index_lock()) {
+    return;
+  }
+  bool found = false;
+  size_t pos = index_find(id, &found);
+  if (found) {
+    memmove(&s_entries[pos], &s_entries[pos + 1],
+            (s_count - pos - 1) * sizeof(reptile_summary_t));
+    s_count--;
+    search_index_remove(s_search, id);
+    snapshot_edit_begin();
+    snapshot_erase(SNAPSHOT_REPTILES, pos);
+    snapshot_edit_end();
+  }
+  bool persist = found && index_changed_unheld();
+  index_unlock();
+
+  if (persist) {
+    index_persist();
+  }
+}
+
+void data_manager_index_set_weight(const char *id, float weight) {
+  if (!id || !index_lock()) {
+    return;
+  }
+  bool found = false;
+  size_t pos = index_find(id, &found);
+  bool changed = found && s_entries[pos].weight != weight;
+  if (changed) {
+    s_entries[pos].weight = weight;
+    snapshot_edit_begin();
+    snapshot_put(SNAPSHOT_REPTILES, pos, &s_entries[pos], false);
+    snapshot_edit_end();
+  }
+  bool persist = changed && index_changed_unheld();
+  index_unlock();
+
+  if (persist) {
+    index_persist();
+  }
+}
+
+bool data_manager_index_get_weight(const char *id, float *out) {
+  if (!id || !index_lock()) {
+    return false;
+  }
+  bool found = false;
+  size_t pos = index_find(id, &found);
+  if (found) {
+    *out = s_entries[pos].weight;
+  }
+  index_unlock();
+  return found;
+}
+
+void data_manager_index_hold(void) {
+  if (index_lock()) {
+    s_hold++;
+    index_unlock();
+  }
+}
+
+void data_manager_index_release(void) {
+  if (!index_lock()) {
+    return;
+  }
+  bool persist = false;
+  if (s_hold > 0 && --s_hold == 0) {
+    persist = s_dirty;
+    s_dirty = false;
+  }
+  index_unlock();
+
+  if (persist) {
+    index_persist();
+  }
+}
+
+esp_err_t data_manager_list_reptile_summaries(reptile_summary_t **out_list,
+                                              size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  if (!out_list || !count) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_list = NULL;
+  *count = 0;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!index_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  esp_err_t err = ESP_OK;
+  if (s_count > 0) {
+    *out_list = malloc(s_count * sizeof(reptile_summary_t));
+    if (*out_list) {
+      memcpy(*out_list, s_entries, s_count * sizeof(reptile_summary_t));
+      *count = s_count;
+    } else {
+      err = ESP_ERR_NO_MEM;
+    }
+  }
+  index_unlock();
+  return err;
+}
+
+esp_err_t data_manager_search_reptiles(const char *query, size_t max_results,
+                                       reptile_summary_t **out_list,
+                                       size_t *count) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  if (!out_list || !count) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_list = NULL;
+  *count = 0;
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!index_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  const char **ids = NULL;
+  size_t n = 0;
+  esp_err_t err =
+      search_index_query(s_search, query ? query : "", max_results, &ids, &n);
+  bool list_all = err == ESP_ERR_INVALID_ARG;
+  if (list_all) {
+    // Nothing searchable in the query: same as listing, in id order.
+    n = (max_results > 0 && max_results < s_count) ? max_results : s_count;
+    err = ESP_OK;
+  }
+  if (err == ESP_OK && n > 0) {
+    *out_list = malloc(n * sizeof(reptile_summary_t));
+    if (!*out_list) {
+      err = ESP_ERR_NO_MEM;
+    } else if (list_all) {
+      memcpy(*out_list, s_entries, n * sizeof(reptile_summary_t));
+      *count = n;
+    } else {
+      for (size_t i = 0; i < n; i++) {
+        bool found = false;
+        size_t pos = index_find(ids[i], &found);
+        if (found) {
+          (*out_list)[(*count)++] = s_entries[pos];
+        }
+      }
+    }
+  }
+  index_unlock();
+  free(ids);
+  return err;
+}
+
+esp_err_t data_manager_index_page(data_manager_cursor_t *cursor,
+                                  reptile_summary_t *out, size_t max,
+                                  size_t *count) {
+  *count = 0;
+  if (!index_lock()) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  size_t pos = 0;
+  if (cursor->started) {
+    bool found = false;
+    pos = index_find(cursor->last_id, &found);
+    if (found) {
+      pos++;
+    }
+  }
+  size_t skipped = s_count - pos < cursor->skip ? s_count - pos : cursor->skip;
+  pos += skipped;
+  cursor->skip -= skipped;
+  size_t n = s_count - pos < max ? s_count - pos : max;
+  if (n > 0) {
+    memcpy(out, &s_entries[pos], n * sizeof(reptile_summary_t));
+  }
+  if (skipped + n > 0) {
+    copy_bounded(cursor->last_id, sizeof(cursor->last_id),
+                 s_entries[pos + n - 1].id);
+    cursor->started = true;
+  }
+  index_unlock();
+  *count = n;
+  return ESP_OK;
+}
+
+cJSON *data_manager_list_reptiles(void) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+  cJSON *arr = cJSON_CreateArray();
+  if (!arr) {
+    ESP_LOGE(TAG, "Failed to allocate reptiles array");
+    return NULL;
+  }
+  if (!storage_ready_guard(__func__) || !index_lock()) {
+    return arr;
+  }
+  for (size_t i = 0; i < s_count; i++) {
+    const reptile_summary_t *e = &s_entries[i];
+    cJSON *obj = cJSON_CreateObject();
+    if (!obj) {
+      ESP_LOGE(TAG, "Failed to allocate reptile entry for %s", e->id);
+      index_unlock();
+      cJSON_Delete(arr);
+      return NULL;
+    }
+    cJSON_AddStringToObject(obj, "id", e->id);
+    cJSON_AddStringToObject(obj, "name", e->name);
+    cJSON_AddStringToObject(obj, "species", e->species);
+    cJSON_AddStringToObject(obj, "morph", e->morph);
+    cJSON_AddNumberToObject(obj, "gender", e->gender);
+    cJSON_AddNumberToObject(obj, "weight", e->weight);
+    cJSON_AddItemToArray(arr, obj);
+  }
+  index_unlock();
+  return arr;
+}
+
+// --- Stale marks -----------------------------------------------------------
+
+bool index_mark_init(index_mark_t *m) {
+  m->writers = 0;
+  m->marked = access(m->path, F_OK) == 0;
+  m->saved = !m->marked;
+  return m->marked;
+}
+
+esp_err_t index_mark_begin(index_mark_t *m) {
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    return ESP_ERR_TIMEOUT;
+  }
+  if (!m->marked) {
+    FILE *f = fopen(m->path, "wb");
+    m->marked = f && fclose(f) == 0;
+  }
+  if (m->marked) {
+    m->writers++;
+  }
+  data_fs_write_unlock();
+  if (!m->marked) {
+    ESP_LOGE(TAG, "Cannot create %s", m->path);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// Caller holds the FS write lock.
+static void index_mark_clear_unlocked(index_mark_t *m, bool pending) {
+  if (m->marked && m->writers == 0 && m->saved && !pending &&
+      (unlink(m->path) == 0 || errno == ENOENT)) {
+    m->marked = false;
+  }
+}
+
+void index_mark_end(index_mark_t *m, bool pending) {
+  // Without the lock the count would never drop back: wait for it.
+  if (!data_fs_write_lock(portMAX_DELAY)) {
+    return;
+  }
+  if (m->writers > 0) {
+    m->writers--;
+  }
+  index_mark_clear_unlocked(m, pending);
+  data_fs_write_unlock();
+}
+
+void index_mark_saved_unlocked(index_mark_t *m, esp_err_t err) {
+  m->saved = err == ESP_OK;
+  index_mark_clear_unlocked(m, false);
+}
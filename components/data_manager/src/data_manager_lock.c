@@ -0,0 +1,228 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+static const char *TAG = "dm_lock";
+
+// Writer-preferring reader/writer lock over the /data filesystem.
+//
+// - s_turnstile: writers hold it from request to release, so readers that
+//   arrive while a writer is waiting queue behind it (bounded writer wait).
+// - s_room: binary semaphore owned by either one writer or the reader group
+//   (taken by the first reader in, given by the last reader out).
+// - s_state: protects the reader count.
+// Statistics sit behind their own spinlock: s_state may be held by a first
+// reader waiting on s_room, so the writer must never need it to release.
+static SemaphoreHandle_t s_turnstile = NULL;
+static SemaphoreHandle_t s_room = NULL;
+static SemaphoreHandle_t s_state = NULL;
+static uint32_t s_readers = 0;
+
+static portMUX_TYPE s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static data_manager_lock_stats_t s_stats;
+static int64_t s_read_group_start_us = 0;
+static int64_t s_write_start_us = 0;
+
+static inline TickType_t ticks_since(TickType_t start) {
+  return xTaskGetTickCount() - start;
+}
+
+static inline TickType_t remaining(TickType_t timeout, TickType_t start) {
+  if (timeout == portMAX_DELAY) {
+    return portMAX_DELAY;
+  }
+  TickType_t elapsed = ticks_since(start);
+  return elapsed >= timeout ? 0 : timeout - elapsed;
+}
+
+// Non-blocking attempt first so contention can be counted.
+static bool take_counted(SemaphoreHandle_t sem, TickType_t timeout,
+                         bool *contended) {
+  if (xSemaphoreTake(sem, 0) == pdTRUE) {
+    return true;
+  }
+  *contended = true;
+  return timeout > 0 && xSemaphoreTake(sem, timeout) == pdTRUE;
+}
+
+static void record_wait(bool write, bool contended, int64_t wait_us,
+                        bool ok) {
+  dm_op_lock_wait(wait_us);
+  portENTER_CRITICAL(&s_stats_mux);
+  if (!ok) {
+    s_stats.timeouts++;
+  } else if (write) {
+    s_stats.write_acquired++;
+  } else {
+    s_stats.read_acquired++;
+  }
+  if (contended) {
+    if (write) {
+      s_stats.write_contended++;
+    } else {
+      s_stats.read_contended++;
+    }
+  }
+  if ((uint64_t)wait_us > s_stats.max_wait_us) {
+    s_stats.max_wait_us = (uint32_t)wait_us;
+  }
+  s_stats.total_wait_us += (uint64_t)wait_us;
+  portEXIT_CRITICAL(&s_stats_mux);
+}
+
+static void record_hold(bool write, uint32_t held_us) {
+  portENTER_CRITICAL(&s_stats_mux);
+  if (write) {
+    if (held_us > s_stats.max_write_hold_us) {
+      s_stats.max_write_hold_us = held_us;
+    }
+    s_stats.total_write_hold_us += held_us;
+  } else {
+    if (held_us > s_stats.max_read_hold_us) {
+      s_stats.max_read_hold_us = held_us;
+    }
+    s_stats.total_read_hold_us += held_us;
+  }
+  portEXIT_CRITICAL(&s_stats_mux);
+}
+
+esp_err_t data_fs_lock_init(void) {
+  if (s_state) {
+    return ESP_OK;
+  }
+  s_turnstile = xSemaphoreCreateMutex();
+  s_room = xSemaphoreCreateBinary();
+  s_state = xSemaphoreCreateMutex();
+  if (!s_turnstile || !s_room || !s_state) {
+    ESP_LOGE(TAG, "Failed to create filesystem lock");
+    return ESP_ERR_NO_MEM;
+  }
+  xSemaphoreGive(s_room); // Binary semaphores start empty
+  return ESP_OK;
+}
+
+bool data_fs_read_lock(TickType_t timeout_ticks) {
+  if (!s_state) {
+    return false;
+  }
+  TickType_t start = xTaskGetTickCount();
+  int64_t start_us = esp_timer_get_time();
+  bool contended = false;
+
+  // Wait behind any queued writer, then let the next one through.
+  if (!take_counted(s_turnstile, timeout_ticks, &contended)) {
+    record_wait(false, contended, esp_timer_get_time() - start_us, false);
+    return false;
+  }
+  xSemaphoreGive(s_turnstile);
+
+  bool ok = false;
+  if (xSemaphoreTake(s_state, remaining(timeout_ticks, start)) == pdTRUE) {
+    if (s_readers == 0) {
+      ok = take_counted(s_room, remaining(timeout_ticks, start), &contended);
+      if (ok) {
+        s_read_group_start_us = esp_timer_get_time();
+      }
+    } else {
+      ok = true;
+    }
+    if (ok) {
+      s_readers++;
+    }
+    xSemaphoreGive(s_state);
+  }
+  record_wait(false, contended, esp_timer_get_time() - start_us, ok);
+  return ok;
+}
+
+bool data_fs_try_read_lock(void) {
+  if (!s_state || xSemaphoreTake(s_turnstile, 0) != pdTRUE) {
+    return false;
+  }
+  xSemaphoreGive(s_turnstile);
+  if (xSemaphoreTake(s_state, 0) != pdTRUE) {
+    return false;
+  }
+  bool ok = s_readers > 0 || xSemaphoreTake(s_room, 0) == pdTRUE;
+  if (ok) {
+    if (s_readers == 0) {
+      s_read_group_start_us = esp_timer_get_time();
+    }
+    s_readers++;
+  }
+  xSemaphoreGive(s_state);
+  if (ok) {
+    record_wait(false, false, 0, true);
+  }
+  return ok;
+}
+
+void data_fs_read_unlock(void) {
+  if (!s_state || xSemaphoreTake(s_state, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  uint32_t held = 0;
+  bool last = s_readers > 0 && --s_readers == 0;
+  if (last) {
+    held = (uint32_t)(esp_timer_get_time() - s_read_group_start_us);
+    xSemaphoreGive(s_room);
+  }
+  xSemaphoreGive(s_state);
+  if (last) {
+    record_hold(false, held);
+  }
+}
+
+bool data_fs_write_lock(TickType_t timeout_ticks) {
+  if (!s_state) {
+    return false;
+  }
+  TickType_t start = xTaskGetTickCount();
+  int64_t start_us = esp_timer_get_time();
+  bool contended = false;
+
+  bool ok = take_counted(s_turnstile, timeout_ticks, &contended);
+  if (ok) {
+    ok = take_counted(s_room, remaining(timeout_ticks, start), &contended);
+    if (ok) {
+      s_write_start_us = esp_timer_get_time();
+    } else {
+      xSemaphoreGive(s_turnstile);
+    }
+  }
+  record_wait(true, contended, esp_timer_get_time() - start_us, ok);
+  return ok;
+}
+
+void data_fs_write_unlock(void) {
+  if (!s_state) {
+    return;
+  }
+  uint32_t held = (uint32_t)(esp_timer_get_time() - s_write_start_us);
+  xSemaphoreGive(s_room);
+  xSemaphoreGive(s_turnstile);
+  record_hold(true, held);
+}
+
+esp_err_t data_manager_get_lock_stats(data_manager_lock_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (!s_state) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  portENTER_CRITICAL(&s_stats_mux);
+  *out = s_stats;
+  out->active_readers = s_readers;
+  portEXIT_CRITICAL(&s_stats_mux);
+  return ESP_OK;
+}
+
+void data_manager_reset_lock_stats(void) {
+  portENTER_CRITICAL(&s_stats_mux);
+  memset(&s_stats, 0, sizeof(s_stats));
+  portEXIT_CRITICAL(&s_stats_mux);
+}
@@ -0,0 +1,148 @@
+#include "data_manager_priv.h"
+
+static const char *const s_names[DATA_MANAGER_OP_COUNT] = {
+    [DATA_MANAGER_OP_LOAD] = "load",
+    [DATA_MANAGER_OP_SAVE] = "save",
+    [DATA_MANAGER_OP_DELETE] = "delete",
+    [DATA_MANAGER_OP_LIST] = "list",
+    [DATA_MANAGER_OP_EVENT_APPEND] = "event_append",
+    [DATA_MANAGER_OP_EVENT_READ] = "event_read",
+    [DATA_MANAGER_OP_WEIGHT_APPEND] = "weight_append",
+    [DATA_MANAGER_OP_WEIGHT_READ] = "weight_read",
+    [DATA_MANAGER_OP_AGGREGATE] = "aggregate",
+    [DATA_MANAGER_OP_BATCH] = "batch",
+    [DATA_MANAGER_OP_FLUSH] = "flush",
+    [DATA_MANAGER_OP_MAINTENANCE] = "maintenance",
+    [DATA_MANAGER_OP_SCRUB] = "scrub",
+};
+
+#if CONFIG_ARS_DATA_METRICS
+
+#include "freertos/FreeRTOS.h"
+#include <string.h>
+
+// Per-task innermost open operation. Phases are charged to it without any
+// lock; only dm_op_end() touches the shared table.
+static __thread dm_op_t *t_current = NULL;
+
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static data_manager_op_stats_t s_stats[DATA_MANAGER_OP_COUNT];
+
+static inline uint32_t clamp_u32(int64_t us) {
+  return us <= 0 ? 0 : us >= UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+}
+
+static inline uint32_t add_sat(uint32_t a, uint32_t b) {
+  return a > UINT32_MAX - b ? UINT32_MAX : a + b;
+}
+
+static unsigned latency_bucket(uint32_t us) {
+  unsigned b = us == 0 ? 0 : 32 - (unsigned)__builtin_clz(us);
+  return b < DATA_MANAGER_LATENCY_BUCKETS ? b
+                                          : DATA_MANAGER_LATENCY_BUCKETS - 1;
+}
+
+void dm_op_begin(dm_op_t *op, data_manager_op_t kind) {
+  memset(op, 0, sizeof(*op));
+  op->kind = kind;
+  op->outer = t_current;
+  op->start_us = esp_timer_get_time();
+  t_current = op;
+}
+
+void dm_op_end(dm_op_t *op) {
+  uint32_t us = clamp_u32(esp_timer_get_time() - op->start_us);
+  t_current = op->outer;
+  if ((unsigned)op->kind >= DATA_MANAGER_OP_COUNT) {
+    return;
+  }
+  portENTER_CRITICAL(&s_mux);
+  data_manager_op_stats_t *st = &s_stats[op->kind];
+  st->calls++;
+  st->total_us += us;
+  if (us > st->max_us) {
+    st->max_us = us;
+  }
+  st->latency[latency_bucket(us)]++;
+  st->lock_wait_us += op->lock_wait_us;
+  st->io_us += op->io_us;
+  st->parse_us += op->parse_us;
+  st->bytes_read += op->bytes_read;
+  st->bytes_written += op->bytes_written;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+void dm_op_lock_wait(int64_t wait_us) {
+  dm_op_t *op = t_current;
+  if (op) {
+    op->lock_wait_us = add_sat(op->lock_wait_us, clamp_u32(wait_us));
+  }
+}
+
+void dm_op_io(int64_t since_us, size_t bytes_read, size_t bytes_written) {
+  dm_op_t *op = t_current;
+  if (op) {
+    op->io_us = add_sat(op->io_us, clamp_u32(esp_timer_get_time() - since_us));
+    op->bytes_read = add_sat(op->bytes_read, clamp_u32(bytes_read));
+    op->bytes_written = add_sat(op->bytes_written, clamp_u32(bytes_written));
+  }
+}
+
+void dm_op_parse(int64_t since_us) {
+  dm_op_t *op = t_current;
+  if (op) {
+    op->parse_us =
+        add_sat(op->parse_us, clamp_u32(esp_timer_get_time() - since_us));
+  }
+}
+
+esp_err_t data_manager_get_op_stats(data_manager_op_t op,
+                                    data_manager_op_stats_t *out) {
+  if (!out || (unsigned)op >= DATA_MANAGER_OP_COUNT) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  portENTER_CRITICAL(&s_mux);
+  *out = s_stats[op];
+  portEXIT_CRITICAL(&s_mux);
+  return ESP_OK;
+}
+
+void data_manager_reset_op_stats(void) {
+  portENTER_CRITICAL(&s_mux);
+  memset(s_stats, 0, sizeof(s_stats));
+  portEXIT_CRITICAL(&s_mux);
+}
+
+#else
+
+esp_err_t data_manager_get_op_stats(data_manager_op_t op,
+                                    data_manager_op_stats_t *out) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+void data_manager_reset_op_stats(void) {}
+
+#endif
+
+const char *data_manager_op_name(data_manager_op_t op) {
+  return (unsigned)op < DATA_MANAGER_OP_COUNT ? s_names[op] : NULL;
+}
+
+uint32_t data_manager_op_quantile_us(const data_manager_op_stats_t *stats,
+                                     float q) {
+  if (!stats || stats->calls == 0) {
+    return 0;
+  }
+  uint64_t rank = (uint64_t)(q * stats->calls + 0.5f);
+  if (rank == 0) {
+    rank = 1;
+  }
+  uint64_t seen = 0;
+  for (unsigned b = 0; b < DATA_MANAGER_LATENCY_BUCKETS; b++) {
+    seen += stats->latency[b];
+    if (seen >= rank) {
+      return b == DATA_MANAGER_LATENCY_BUCKETS - 1 ? UINT32_MAX : 1u << b;
+    }
+  }
+  return UINT32_MAX;
+}
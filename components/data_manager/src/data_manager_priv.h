@@ -0,0 +1,360 @@
+#pragma once
+
+// Internal helpers shared between the data_manager translation units.
+// Not part of the public API.
+
+#include "data_manager.h"
+#include "freertos/FreeRTOS.h"
+#include "sdkconfig.h"
+#include "storage_core.h"
+#include <dirent.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Root of every data file: the LittleFS mount point on target, a host
+// directory on the linux target (host tests and benchmarks).
+#if CONFIG_IDF_TARGET_LINUX
+#define DATA_MANAGER_ROOT CONFIG_ARS_DATA_HOST_ROOT
+#else
+#define DATA_MANAGER_ROOT "/data"
+#endif
+
+#define DATA_MANAGER_INDEX_DIR DATA_MANAGER_ROOT "/index"
+
+// Redo journal of multi-file updates (storage_txn_*), replayed at init.
+#define DATA_MANAGER_JOURNAL DATA_MANAGER_INDEX_DIR "/txn.journal"
+
+static inline void copy_bounded(char *dst, size_t dst_size, const char *src) {
+  if (!dst || dst_size == 0) {
+    return;
+  }
+  if (!src) {
+    dst[0] = '\0';
+    return;
+  }
+  strlcpy(dst, src, dst_size);
+}
+
+// Index blobs store strings as u8 length + bytes, no terminator. Strings must
+// be shorter than 256 bytes.
+static inline size_t blob_put_str(uint8_t *p, const char *s) {
+  size_t len = strlen(s);
+  p[0] = (uint8_t)len;
+  memcpy(p + 1, s, len);
+  return len + 1;
+}
+
+static inline bool blob_get_str(const uint8_t **p, const uint8_t *end,
+                                char *dst, size_t dst_size) {
+  if (*p >= end) {
+    return false;
+  }
+  size_t len = (*p)[0];
+  if ((size_t)(end - *p) < len + 1) {
+    return false;
+  }
+  size_t copy = (len < dst_size - 1) ? len : dst_size - 1;
+  memcpy(dst, *p + 1, copy);
+  dst[copy] = '\0';
+  *p += len + 1;
+  return true;
+}
+
+// Logs once and returns false while LittleFS is not mounted.
+bool storage_ready_guard(const char *context);
+
+// Reader/writer lock over /data (data_manager_lock.c). Readers share it;
+// anything that creates, rewrites, appends to or unlinks a file is a writer.
+esp_err_t data_fs_lock_init(void);
+bool data_fs_read_lock(TickType_t timeout_ticks);
+// Shares the lock only if that needs no wait; a failure is not counted as a
+// timeout.
+bool data_fs_try_read_lock(void);
+void data_fs_read_unlock(void);
+bool data_fs_write_lock(TickType_t timeout_ticks);
+void data_fs_write_unlock(void);
+
+// Operation metrics (data_manager_metrics.c). DM_OP_SCOPE() opens an
+// operation that ends when the enclosing block exits, whatever the return
+// path. Lock waits, I/O and parse time reported while it is open (on the same
+// task) are charged to it; a nested scope takes them over until it ends.
+#if CONFIG_ARS_DATA_METRICS
+#include "esp_timer.h"
+
+typedef struct dm_op {
+  struct dm_op *outer;
+  data_manager_op_t kind;
+  int64_t start_us;
+  uint32_t lock_wait_us;
+  uint32_t io_us;
+  uint32_t parse_us;
+  uint32_t bytes_read;
+  uint32_t bytes_written;
+} dm_op_t;
+
+void dm_op_begin(dm_op_t *op, data_manager_op_t kind);
+void dm_op_end(dm_op_t *op);
+void dm_op_lock_wait(int64_t wait_us);
+// since_us: dm_metrics_now() at the start of the measured section.
+void dm_op_io(int64_t since_us, size_t bytes_read, size_t bytes_written);
+void dm_op_parse(int64_t since_us);
+
+static inline int64_t dm_metrics_now(void) { return esp_timer_get_time(); }
+
+#define DM_OP_SCOPE(kind)                                                      \
+  dm_op_t dm_op_scope_ __attribute__((cleanup(dm_op_end)));                    \
+  dm_op_begin(&dm_op_scope_, (kind))
+#else
+static inline void dm_op_lock_wait(int64_t wait_us) { (void)wait_us; }
+static inline void dm_op_io(int64_t since_us, size_t bytes_read,
+                            size_t bytes_written) {
+  (void)since_us;
+  (void)bytes_read;
+  (void)bytes_written;
+}
+static inline void dm_op_parse(int64_t since_us) { (void)since_us; }
+static inline int64_t dm_metrics_now(void) { return 0; }
+
+#define DM_OP_SCOPE(kind) (void)(kind)
+#endif
+
+// Read and parse a JSON file into a cJSON tree, bounded by
+// CONFIG_ARS_DATA_MAX_JSON_SIZE. Caller must already hold the filesystem lock.
+cJSON *read_json_unlocked(const char *path);
+
+// Entity records (data_manager_records.c): <dir>/<bucket>/<id>.cbor, or the
+// legacy <dir>/<bucket>/<id>.json. record_save/load/delete go through the
+// entity cache and take the filesystem lock when they reach flash.
+typedef enum {
+  RECORD_REPTILE,
+  RECORD_DOCUMENT,
+  RECORD_CONTACT,
+  RECORD_KIND_COUNT,
+} record_kind_t;
+
+const char *record_dir(record_kind_t kind);
+size_t record_size(record_kind_t kind); // sizeof the record struct
+esp_err_t record_save(record_kind_t kind, const char *id, const void *obj);
+esp_err_t record_load(record_kind_t kind, const char *id, void *out);
+esp_err_t record_delete(record_kind_t kind, const char *id);
+// Straight to flash under the write lock, bypassing the cache.
+esp_err_t record_write(record_kind_t kind, const char *id, const void *obj);
+// Caller holds the filesystem lock (the write lock for writes). With a
+// transaction the files are only staged in it.
+esp_err_t record_write_unlocked(storage_txn_t *txn, record_kind_t kind,
+                                const char *id, const void *obj);
+esp_err_t record_read_unlocked(record_kind_t kind, const char *id, void *out);
+
+// Walks the ids of one record kind, bucket directory by bucket directory (no
+// particular order). A .json shadowed by a .cbor of the same id is skipped.
+// Caller holds the filesystem lock from open to close.
+typedef struct {
+  record_kind_t kind;
+  unsigned bucket; // Next bucket to open
+  DIR *dir;
+  bool json; // The last id came from a legacy .json file
+} record_scan_t;
+
+bool record_scan_open(record_scan_t *scan, record_kind_t kind);
+bool record_scan_next(record_scan_t *scan, char *id, size_t id_len);
+void record_scan_rewind(record_scan_t *scan);
+void record_scan_close(record_scan_t *scan);
+
+// Scrubber hooks (data_manager_scrub.c). record_check_file_unlocked() decodes
+// <dir>/<name> into scratch (one caller at a time) and sets id;
+// ESP_ERR_INVALID_ARG for files that are not records. Caller holds the read
+// lock.
+unsigned record_bucket_count(void);
+void record_bucket_dir(record_kind_t kind, unsigned bucket, char *out,
+                       size_t len);
+esp_err_t record_check_file_unlocked(record_kind_t kind, const char *dir,
+                                     const char *name, char *id,
+                                     size_t id_len);
+
+// Creates the bucket directories and moves files left by another fan-out
+// (flat directories of older firmware) into place. Takes the write lock.
+esp_err_t record_layout_init(void);
+
+// Id generator (data_manager_ids.c): loads the persisted high-water mark.
+// data_manager_new_id() may take the write lock: never call it with the FS
+// lock held.
+esp_err_t data_manager_ids_init(void);
+
+// Interned strings (data_manager_strings.c). string_intern() returns the
+// pool's copy of s: never freed, "" for NULL or when the pool is full.
+// string_id() is its id in the index blob, string_at() the reverse (NULL for
+// an unknown id). The pool lock is a leaf. string_pool_save_unlocked()
+// persists new strings: caller holds the write lock, and saves the pool after
+// serializing and before writing any blob holding ids.
+esp_err_t data_manager_strings_init(void);
+const char *string_intern(const char *s);
+uint16_t string_id(const char *interned);
+const char *string_at(uint16_t id);
+esp_err_t string_pool_save_unlocked(void);
+
+// Change log (data_manager_changes.c). change_log_record() may take the
+// write lock to move the seq mark: call it once the change is done, never
+// with the FS lock held. change_log_save() persists the ring (flush).
+esp_err_t data_manager_changes_init(void);
+void change_log_record(data_manager_entity_t entity,
+                       data_manager_change_op_t op, const char *id);
+esp_err_t change_log_save(void);
+
+// Published snapshots (data_manager_snapshot.c). The reptile index, document
+// index and aggregates replay every change to their sorted array, same
+// position, between snapshot_edit_begin() and snapshot_edit_end(); the last
+// end to close publishes, so a snapshot never holds half of an operation.
+// Called under the owning module's lock (lock order: module, then snapshot).
+typedef enum {
+  SNAPSHOT_REPTILES,   // reptile_summary_t, by id
+  SNAPSHOT_DOCUMENTS,  // document_summary_t, by related_id then id
+  SNAPSHOT_AGGREGATES, // reptile_aggregate_t, by id
+  SNAPSHOT_TABLE_COUNT,
+} snapshot_table_t;
+
+esp_err_t data_manager_snapshot_init(void);
+void snapshot_edit_begin(void);
+void snapshot_edit_end(void);
+// inserted: the entry was inserted at pos, else overwrote it.
+void snapshot_put(snapshot_table_t table, size_t pos, const void *entry,
+                  bool inserted);
+void snapshot_erase(snapshot_table_t table, size_t pos);
+// Replaces the whole table; entries are stride bytes apart.
+void snapshot_load(snapshot_table_t table, const void *entries, size_t count,
+                   size_t stride);
+
+// Entity cache (data_manager_cache.c). Lock order is cache, then FS lock:
+// never call these with the FS lock held.
+esp_err_t record_cache_init(void);
+bool record_cache_get(record_kind_t kind, const char *id, void *out);
+// Read the epoch before loading a miss from flash; record_cache_fill() then
+// drops the copy if a store or drop happened in between.
+uint32_t record_cache_epoch(void);
+void record_cache_fill(record_kind_t kind, const char *id, const void *obj,
+                       uint32_t epoch);
+// Saves through the cache: write-back for reptiles and documents,
+// write-through for contacts.
+esp_err_t record_cache_store(record_kind_t kind, const char *id,
+                             const void *obj);
+// Forgets (kind, id); true if the dropped copy had not been written back.
+bool record_cache_drop(record_kind_t kind, const char *id);
+// Writes every dirty entry back; stops at the first failure.
+esp_err_t record_cache_flush(void);
+// Held across a batch commit, around the FS lock: no write-back can then
+// land over the committed files. record_cache_drop_locked() is
+// record_cache_drop() for the holder.
+bool record_cache_lock(void);
+void record_cache_unlock(void);
+bool record_cache_drop_locked(record_kind_t kind, const char *id);
+
+// Appends to one animal's event log / weight series, in order, opening the
+// file once. Caller holds the write lock. With a transaction the writes are
+// only staged in it and the aggregates are left to the caller, once the
+// transaction is committed; at most one call per animal per transaction.
+esp_err_t event_log_append_unlocked(storage_txn_t *txn, const char *reptile_id,
+                                    const reptile_event_t *const *events,
+                                    size_t count);
+esp_err_t weight_append_unlocked(storage_txn_t *txn, const char *reptile_id,
+                                 const weight_sample_t *samples, size_t count);
+// Remove every file of one animal's event log / weight series, legacy and
+// staged ones included; the aggregates are left to the caller. Caller holds
+// the write lock.
+void event_log_remove_unlocked(const char *reptile_id);
+void weight_series_remove_unlocked(const char *reptile_id);
+
+// Integrity checks of one event shard / weight series (scrubber): damaged
+// bytes or blocks are counted, readers already skip them. Caller holds the
+// read lock.
+esp_err_t event_shard_check_unlocked(const char *path, size_t *bad_bytes,
+                                     size_t *bytes);
+esp_err_t weight_series_check_unlocked(const char *path, size_t *bad_blocks,
+                                       size_t *bytes);
+
+// Background integrity scrubber (data_manager_scrub.c), started last by
+// data_manager_init().
+esp_err_t data_manager_scrub_init(void);
+
+// Per-animal aggregates (data_manager_aggregates.c), fed by the two appends
+// above once their records are written. Caller holds the write lock; lock
+// order is FS lock, then aggregate lock.
+esp_err_t data_manager_aggregates_init(void);
+void aggregate_apply_events_unlocked(const char *reptile_id,
+                                     const reptile_event_t *const *events,
+                                     size_t count);
+void aggregate_apply_weights_unlocked(const char *reptile_id,
+                                      const weight_sample_t *samples,
+                                      size_t count);
+void aggregate_clear_events_unlocked(const char *reptile_id);
+// Forgets the animal altogether (its record is gone).
+void aggregate_remove_unlocked(const char *reptile_id);
+// Summary weight of an animal with weighings: the one with the latest
+// timestamp, whatever the order they were recorded in. False without any.
+// Takes only the aggregate lock.
+bool aggregate_current_weight(const char *reptile_id, float *out);
+
+// Stale marks (data_manager_index.c): a file present on flash while record
+// files may be ahead of a persisted index, so the next init rebuilds that
+// index. index_mark_begin() creates it before a record write and
+// index_mark_end() closes the write once the index has it in RAM; the last
+// to close removes the mark if the latest persist succeeded and nothing is
+// pending. Both take the write lock; index_mark_saved_unlocked() is called
+// by the persist with the lock held.
+typedef struct {
+  const char *path;
+  uint32_t writers; // Writes between begin and end
+  bool marked;      // The file exists
+  bool saved;       // The last persist succeeded
+} index_mark_t;
+
+bool index_mark_init(index_mark_t *m); // True when found
+esp_err_t index_mark_begin(index_mark_t *m);
+void index_mark_end(index_mark_t *m, bool pending);
+void index_mark_saved_unlocked(index_mark_t *m, esp_err_t err);
+
+// Reptile summary index (data_manager_index.c). Writes of reptile files are
+// bracketed by begin (which may fail, and then nothing must be written) and
+// end, after the matching upsert or remove.
+esp_err_t data_manager_index_init(void);
+esp_err_t data_manager_index_begin(void);
+void data_manager_index_end(void);
+void data_manager_index_upsert(const reptile_t *reptile);
+void data_manager_index_remove(const char *id);
+void data_manager_index_set_weight(const char *id, float weight);
+// Summary weight of id; false when it is not indexed.
+bool data_manager_index_get_weight(const char *id, float *out);
+// Between hold and release, changes stay in RAM; release persists them once.
+// Holds nest.
+void data_manager_index_hold(void);
+void data_manager_index_release(void);
+
+// Document index by related_id (data_manager_doc_index.c), same brackets
+// around writes of document files.
+esp_err_t data_manager_doc_index_init(void);
+esp_err_t data_manager_doc_index_begin(void);
+void data_manager_doc_index_end(void);
+void data_manager_doc_index_upsert(const document_t *doc);
+void data_manager_doc_index_remove(const char *id);
+
+// Listing cursors (data_manager_cursor.c). A cursor remembers the key of the
+// last entry it handed out or skipped; each page resumes right after it.
+struct data_manager_cursor {
+  record_kind_t kind;
+  bool filtered; // Documents only: restricted to related_id
+  char related_id[MAX_ID_LEN];
+  bool started; // last_related_id/last_id hold a key
+  char last_related_id[MAX_ID_LEN];
+  char last_id[MAX_ID_LEN];
+  size_t skip;      // Part of the offset not consumed yet
+  size_t remaining; // SIZE_MAX without a limit
+};
+
+// Copy up to max entries following the cursor and advance it. Each call
+// holds the owning index lock for the copy only.
+esp_err_t data_manager_index_page(data_manager_cursor_t *cursor,
+                                  reptile_summary_t *out, size_t max,
+                                  size_t *count);
+esp_err_t data_manager_doc_index_page(data_manager_cursor_t *cursor,
+                                      document_summary_t *out, size_t max,
+                                      size_t *count);
@@ -0,0 +1,731 @@
+#include "cbor_record.h"
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "json_reader.h"
+#include "json_writer.h"
+#include "sdkconfig.h"
+#include "storage_core.h"
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+static const char *TAG = "dm_records";
+
+// Reptile, document and contact records: one file per entity.
+//
+//   <dir>/<bb>/<id>.cbor  storage_core blob (magic, schema version, CRC32)
+//                         around a CBOR map keyed by field index
+//                         (cbor_record.h)
+//   <dir>/<bb>/<id>.json  legacy / CONFIG_ARS_DATA_RECORD_FORMAT_JSON text
+//
+// Reads accept both; a save writes the configured format and removes the
+// other file so an id never has two live copies.
+//
+// <bb> is one of 2^CONFIG_ARS_DATA_RECORD_FANOUT_BITS bucket directories,
+// the top bits of an FNV-1a hash of the id in hex: LittleFS lookups and
+// readdir are linear in the directory size, so no directory holds more than
+// a slice of the records. With 0 bits the files sit directly in <dir>.
+#define RECORD_CBOR_VERSION 1
+
+#define RECORD_FANOUT_BITS CONFIG_ARS_DATA_RECORD_FANOUT_BITS
+#define RECORD_BUCKETS (1u << RECORD_FANOUT_BITS)
+
+// Fan-out the files were last laid out with; absent on older firmware.
+#define RECORD_LAYOUT_PATH DATA_MANAGER_INDEX_DIR "/records.layout"
+#define RECORD_LAYOUT_VERSION 1
+#define RECORD_LAYOUT_MAX_BITS 8
+
+#if CONFIG_ARS_DATA_RECORD_FORMAT_JSON
+#define RECORD_WRITE_JSON 1
+#else
+#define RECORD_WRITE_JSON 0
+#endif
+
+#define RECORD_EXT_CBOR ".cbor"
+#define RECORD_EXT_JSON ".json"
+
+#define FIELD_COUNT(table) (sizeof(table) / sizeof((table)[0]))
+
+static const record_field_t s_reptile_fields[] = {
+    RECORD_FIELD(reptile_t, id, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, name, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, species, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, morph, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, birth_date, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_t, gender, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_t, weight, RECORD_FIELD_FLOAT),
+};
+
+static const record_field_t s_document_fields[] = {
+    RECORD_FIELD(document_t, id, RECORD_FIELD_STRING),
+    RECORD_FIELD(document_t, related_id, RECORD_FIELD_STRING),
+    RECORD_FIELD(document_t, type, RECORD_FIELD_INT),
+    RECORD_FIELD(document_t, title, RECORD_FIELD_STRING),
+    RECORD_FIELD(document_t, filename, RECORD_FIELD_STRING),
+    RECORD_FIELD(document_t, timestamp, RECORD_FIELD_INT),
+};
+
+static const record_field_t s_contact_fields[] = {
+    RECORD_FIELD(contact_t, id, RECORD_FIELD_STRING),
+    RECORD_FIELD(contact_t, name, RECORD_FIELD_STRING),
+    RECORD_FIELD(contact_t, role, RECORD_FIELD_STRING),
+    RECORD_FIELD(contact_t, phone, RECORD_FIELD_STRING),
+    RECORD_FIELD(contact_t, email, RECORD_FIELD_STRING),
+    RECORD_FIELD(contact_t, notes, RECORD_FIELD_STRING),
+};
+
+typedef struct {
+  const char *dir;
+  const record_field_t *fields;
+  size_t count;
+  size_t struct_size;
+} record_desc_t;
+
+static const record_desc_t s_records[RECORD_KIND_COUNT] = {
+    [RECORD_REPTILE] = {DATA_MANAGER_ROOT "/reptiles", s_reptile_fields,
+                        FIELD_COUNT(s_reptile_fields), sizeof(reptile_t)},
+    [RECORD_DOCUMENT] = {DATA_MANAGER_ROOT "/documents", s_document_fields,
+                         FIELD_COUNT(s_document_fields), sizeof(document_t)},
+    [RECORD_CONTACT] = {DATA_MANAGER_ROOT "/contacts", s_contact_fields,
+                        FIELD_COUNT(s_contact_fields), sizeof(contact_t)},
+};
+
+typedef char record_id_t[MAX_ID_LEN];
+
+// Scratch large enough for any record kind.
+typedef union {
+  reptile_t reptile;
+  document_t document;
+  contact_t contact;
+} record_any_t;
+
+static unsigned record_bucket(const char *id, unsigned bits) {
+  if (bits == 0) {
+    return 0;
+  }
+  uint32_t h = 2166136261u; // FNV-1a
+  for (const char *p = id; *p; p++) {
+    h = (h ^ (uint8_t)*p) * 16777619u;
+  }
+  return h >> (32 - bits);
+}
+
+static void bucket_path(record_kind_t kind, unsigned bits, unsigned bucket,
+                        char *out, size_t len) {
+  if (bits == 0) {
+    snprintf(out, len, "%s", s_records[kind].dir);
+  } else {
+    snprintf(out, len, "%s/%02x", s_records[kind].dir, bucket);
+  }
+}
+
+static void record_path(record_kind_t kind, const char *id, const char *ext,
+                        char *out, size_t len) {
+  if (RECORD_FANOUT_BITS == 0) {
+    snprintf(out, len, "%s/%s%s", s_records[kind].dir, id, ext);
+  } else {
+    snprintf(out, len, "%s/%02x/%s%s", s_records[kind].dir,
+             record_bucket(id, RECORD_FANOUT_BITS), id, ext);
+  }
+}
+
+const char *record_dir(record_kind_t kind) { return s_records[kind].dir; }
+
+size_t record_size(record_kind_t kind) { return s_records[kind].struct_size; }
+
+static bool has_suffix(const char *name, const char *suffix) {
+  size_t n = strlen(name);
+  size_t s = strlen(suffix);
+  return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+// Maps a directory entry to its record id. False for other files and for a
+// .json shadowed by a .cbor of the same id.
+static bool record_id_from_entry(record_kind_t kind, const char *name,
+                                 char *id, size_t id_len, bool *json) {
+  bool cbor = has_suffix(name, RECORD_EXT_CBOR);
+  if (!cbor && !has_suffix(name, RECORD_EXT_JSON)) {
+    return false;
+  }
+  *json = !cbor;
+  size_t n = strlen(name) - strlen(cbor ? RECORD_EXT_CBOR : RECORD_EXT_JSON);
+  if (n >= id_len) {
+    return false;
+  }
+  memcpy(id, name, n);
+  id[n] = '\0';
+  if (!cbor) {
+    // Both files only coexist after an interrupted save or conversion; the
+    // CBOR copy is the newer one.
+    char path[128];
+    record_path(kind, id, RECORD_EXT_CBOR, path, sizeof(path));
+    if (access(path, F_OK) == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool record_scan_open(record_scan_t *scan, record_kind_t kind) {
+  memset(scan, 0, sizeof(*scan));
+  scan->kind = kind;
+  return access(s_records[kind].dir, F_OK) == 0;
+}
+
+bool record_scan_next(record_scan_t *scan, char *id, size_t id_len) {
+  for (;;) {
+    if (!scan->dir) {
+      if (scan->bucket >= RECORD_BUCKETS) {
+        return false;
+      }
+      char path[128];
+      bucket_path(scan->kind, RECORD_FANOUT_BITS, scan->bucket++, path,
+                  sizeof(path));
+      scan->dir = opendir(path); // A missing bucket is simply empty
+      continue;
+    }
+    struct dirent *ent = readdir(scan->dir);
+    if (!ent) {
+      closedir(scan->dir);
+      scan->dir = NULL;
+      continue;
+    }
+    if (record_id_from_entry(scan->kind, ent->d_name, id, id_len,
+                             &scan->json)) {
+      return true;
+    }
+  }
+}
+
+void record_scan_rewind(record_scan_t *scan) {
+  if (scan->dir) {
+    closedir(scan->dir);
+    scan->dir = NULL;
+  }
+  scan->bucket = 0;
+}
+
+void record_scan_close(record_scan_t *scan) { record_scan_rewind(scan); }
+
+unsigned record_bucket_count(void) { return RECORD_BUCKETS; }
+
+void record_bucket_dir(record_kind_t kind, unsigned bucket, char *out,
+                       size_t len) {
+  bucket_path(kind, RECORD_FANOUT_BITS, bucket, out, len);
+}
+
+static void write_json_fields(json_writer_t *w, const record_desc_t *desc,
+                              const void *obj) {
+  json_writer_begin_object(w);
+  for (size_t i = 0; i < desc->count; i++) {
+    const record_field_t *field = &desc->fields[i];
+    json_writer_key(w, field->name);
+    switch (field->type) {
+    case RECORD_FIELD_STRING:
+      json_writer_string(w, (const char *)obj + field->offset);
+      break;
+    case RECORD_FIELD_INT:
+      json_writer_int(w, record_field_get_int(field, obj));
+      break;
+    case RECORD_FIELD_FLOAT:
+      json_writer_number(w, record_field_get_float(field, obj));
+      break;
+    }
+  }
+  json_writer_end_object(w);
+}
+
+// Streams the writer output into a transaction as one file image.
+typedef struct {
+  storage_txn_t *txn;
+  const char *path;
+  uint32_t offset;
+} txn_sink_t;
+
+static size_t txn_json_sink(const char *data, size_t len, void *ctx) {
+  txn_sink_t *s = ctx;
+  esp_err_t err =
+      s->offset == 0 ? storage_txn_replace(s->txn, s->path, data, len)
+                     : storage_txn_write(s->txn, s->path, s->offset, data, len);
+  if (err != ESP_OK) {
+    return 0;
+  }
+  s->offset += (uint32_t)len;
+  return len;
+}
+
+static esp_err_t write_json_unlocked(storage_txn_t *txn, const char *path,
+                                     const record_desc_t *desc,
+                                     const void *obj) {
+  json_writer_t w;
+  if (txn) {
+    txn_sink_t sink = {.txn = txn, .path = path};
+    json_writer_init(&w, txn_json_sink, &sink);
+    write_json_fields(&w, desc, obj);
+    return json_writer_finish(&w);
+  }
+
+  // Written beside the record and renamed over it, like
+  // storage_save_secure(): a reset mid-write keeps the previous version.
+  char tmp[136];
+  snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+  FILE *f = fopen(tmp, "w");
+  if (f == NULL) {
+    ESP_LOGE(TAG, "Failed to open file for writing: %s", tmp);
+    return ESP_FAIL;
+  }
+  // The writer already batches output; skip the stdio buffer allocation.
+  setvbuf(f, NULL, _IONBF, 0);
+  int64_t t0 = dm_metrics_now();
+
+  json_writer_init_file(&w, f);
+  write_json_fields(&w, desc, obj);
+  esp_err_t err = json_writer_finish(&w);
+  long written = ftell(f);
+  if (err == ESP_OK && fsync(fileno(f)) != 0) {
+    err = ESP_FAIL;
+  }
+  if (fclose(f) != 0 && err == ESP_OK) {
+    err = ESP_FAIL;
+  }
+  if (err == ESP_OK && rename(tmp, path) != 0) {
+    err = ESP_FAIL;
+  }
+  // Formatting and writing are interleaved: all of it counts as I/O.
+  dm_op_io(t0, 0, written > 0 ? (size_t)written : 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Short write on %s (%s)", path, esp_err_to_name(err));
+    unlink(tmp);
+  }
+  return err;
+}
+
+static esp_err_t write_cbor_unlocked(storage_txn_t *txn, const char *path,
+                                     const record_desc_t *desc,
+                                     const void *obj) {
+  uint8_t buf[CBOR_RECORD_MAX_SIZE];
+  size_t len = 0;
+  int64_t t0 = dm_metrics_now();
+  esp_err_t err = cbor_record_encode(desc->fields, desc->count, obj, buf,
+                                     sizeof(buf), &len);
+  dm_op_parse(t0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot encode %s (%s)", path, esp_err_to_name(err));
+    return err;
+  }
+  if (txn) {
+    return storage_txn_save_secure(txn, path, buf, len, RECORD_CBOR_VERSION);
+  }
+  t0 = dm_metrics_now();
+  err = storage_save_secure(path, buf, len, RECORD_CBOR_VERSION);
+  dm_op_io(t0, 0, sizeof(storage_header_t) + len);
+  return err;
+}
+
+static esp_err_t read_json_record(const char *path, const record_desc_t *desc,
+                                  void *out) {
+  FILE *f = fopen(path, "r");
+  if (f == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  // The decoder reads in fixed chunks; skip the stdio buffer allocation.
+  setvbuf(f, NULL, _IONBF, 0);
+  int64_t t0 = dm_metrics_now();
+  esp_err_t err = json_decode_file(f, desc->fields, desc->count, out);
+  long bytes = ftell(f);
+  fclose(f);
+  // Reading and parsing are interleaved: all of it counts as I/O.
+  dm_op_io(t0, bytes > 0 ? (size_t)bytes : 0, 0);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Malformed record %s", path);
+  }
+  return err;
+}
+
+// Decodes a CBOR payload written with schema `version` into the current
+// struct layout. A schema change bumps RECORD_CBOR_VERSION and adds a case
+// here for the previous version; record_load() then rewrites the file.
+static esp_err_t decode_cbor_version(const record_desc_t *desc,
+                                     uint32_t version, const uint8_t *data,
+                                     size_t len, void *out) {
+  switch (version) {
+  case RECORD_CBOR_VERSION:
+    return cbor_record_decode(data, len, desc->fields, desc->count, out);
+  default:
+    return ESP_ERR_NOT_SUPPORTED; // Written by newer firmware
+  }
+}
+
+// out_version is 0 when the record came from a .json file.
+static esp_err_t read_record(record_kind_t kind, const char *id, void *out,
+                             uint32_t *out_version) {
+  const record_desc_t *desc = &s_records[kind];
+  char path[128];
+  record_path(kind, id, RECORD_EXT_CBOR, path, sizeof(path));
+
+  void *data = NULL;
+  size_t len = 0;
+  uint32_t version = 0;
+  int64_t t0 = dm_metrics_now();
+  esp_err_t err = storage_load_secure_versioned(path, &data, &len, &version);
+  dm_op_io(t0, err == ESP_OK ? sizeof(storage_header_t) + len : 0, 0);
+  if (err == ESP_ERR_NOT_FOUND) {
+    record_path(kind, id, RECORD_EXT_JSON, path, sizeof(path));
+    *out_version = 0;
+    return read_json_record(path, desc, out);
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot load %s (%s)", path, esp_err_to_name(err));
+    return err;
+  }
+  t0 = dm_metrics_now();
+  err = decode_cbor_version(desc, version, data, len, out);
+  dm_op_parse(t0);
+  free(data);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Cannot decode %s v%u (%s)", path, (unsigned)version,
+             esp_err_to_name(err));
+  }
+  *out_version = version;
+  return err;
+}
+
+esp_err_t record_read_unlocked(record_kind_t kind, const char *id, void *out) {
+  uint32_t version;
+  return read_record(kind, id, out, &version);
+}
+
+esp_err_t record_check_file_unlocked(record_kind_t kind, const char *dir,
+                                     const char *name, char *id,
+                                     size_t id_len) {
+  static record_any_t scratch; // Only the scrubber task checks files
+  bool json = false;
+  if (!record_id_from_entry(kind, name, id, id_len, &json)) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  const record_desc_t *desc = &s_records[kind];
+  char path[128];
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if (json) {
+    return read_json_record(path, desc, &scratch);
+  }
+  void *data = NULL;
+  size_t len = 0;
+  uint32_t version = 0;
+  int64_t t0 = dm_metrics_now();
+  esp_err_t err = storage_load_secure_versioned(path, &data, &len, &version);
+  dm_op_io(t0, err == ESP_OK ? sizeof(storage_header_t) + len : 0, 0);
+  if (err != ESP_OK) {
+    return err;
+  }
+  t0 = dm_metrics_now();
+  err = decode_cbor_version(desc, version, data, len, &scratch);
+  dm_op_parse(t0);
+  free(data);
+  return err;
+}
+
+esp_err_t record_write_unlocked(storage_txn_t *txn, record_kind_t kind,
+                                const char *id, const void *obj) {
+  const record_desc_t *desc = &s_records[kind];
+  const char *ext = RECORD_WRITE_JSON ? RECORD_EXT_JSON : RECORD_EXT_CBOR;
+  const char *other = RECORD_WRITE_JSON ? RECORD_EXT_CBOR : RECORD_EXT_JSON;
+  char path[128];
+  char stale[128];
+  record_path(kind, id, ext, path, sizeof(path));
+  record_path(kind, id, other, stale, sizeof(stale));
+  esp_err_t err = RECORD_WRITE_JSON
+                      ? write_json_unlocked(txn, path, desc, obj)
+                      : write_cbor_unlocked(txn, path, desc, obj);
+  if (err != ESP_OK) {
+    return err;
+  }
+  if (!txn) {
+    unlink(stale); // Usually absent
+    return ESP_OK;
+  }
+  return access(stale, F_OK) == 0 ? storage_txn_remove(txn, stale) : ESP_OK;
+}
+
+esp_err_t record_write(record_kind_t kind, const char *id, const void *obj) {
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot write %s/%s", s_records[kind].dir, id);
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t err = record_write_unlocked(NULL, kind, id, obj);
+  data_fs_write_unlock();
+  return err;
+}
+
+esp_err_t record_save(record_kind_t kind, const char *id, const void *obj) {
+  return record_cache_store(kind, id, obj);
+}
+
+esp_err_t record_load(record_kind_t kind, const char *id, void *out) {
+  if (record_cache_get(kind, id, out)) {
+    return ESP_OK;
+  }
+  uint32_t epoch = record_cache_epoch();
+  if (!data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot read %s/%s", s_records[kind].dir, id);
+    return ESP_ERR_TIMEOUT;
+  }
+  uint32_t version = 0;
+  esp_err_t err = read_record(kind, id, out, &version);
+  data_fs_read_unlock();
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // Lazy schema migration: rewrite older CBOR payloads once decoded.
+  if (version != 0 && version < RECORD_CBOR_VERSION) {
+    ESP_LOGI(TAG, "Migrating %s/%s from v%u", s_records[kind].dir, id,
+             (unsigned)version);
+    record_save(kind, id, out);
+  } else {
+    record_cache_fill(kind, id, out, epoch);
+  }
+  return ESP_OK;
+}
+
+esp_err_t record_delete(record_kind_t kind, const char *id) {
+  char cbor_path[128];
+  char json_path[128];
+  record_path(kind, id, RECORD_EXT_CBOR, cbor_path, sizeof(cbor_path));
+  record_path(kind, id, RECORD_EXT_JSON, json_path, sizeof(json_path));
+  // A record saved since the last write-back may not have a file yet.
+  bool unwritten = record_cache_drop(kind, id);
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot delete %s", cbor_path);
+    return ESP_ERR_TIMEOUT;
+  }
+  bool removed = unlink(cbor_path) == 0;
+  removed |= unlink(json_path) == 0;
+  data_fs_write_unlock();
+  return removed || unwritten ? ESP_OK : ESP_FAIL;
+}
+
+// Ids of the .json files of one record kind, collected up front so no
+// directory is modified while it is being read.
+static record_id_t *collect_json_ids(record_kind_t kind, size_t *out_count) {
+  record_id_t *ids = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  *out_count = 0;
+  if (!data_fs_read_lock(pdMS_TO_TICKS(10000))) {
+    return NULL;
+  }
+  record_scan_t scan;
+  if (record_scan_open(&scan, kind)) {
+    char id[MAX_ID_LEN];
+    while (record_scan_next(&scan, id, sizeof(id))) {
+      if (!scan.json) {
+        continue;
+      }
+      if (count == cap) {
+        size_t new_cap = cap ? cap * 2 : 16;
+        void *grown = realloc(ids, new_cap * sizeof(*ids));
+        if (!grown) {
+          break;
+        }
+        ids = grown;
+        cap = new_cap;
+      }
+      memcpy(ids[count++], id, sizeof(id));
+    }
+    record_scan_close(&scan);
+  }
+  data_fs_read_unlock();
+  *out_count = count;
+  return ids;
+}
+
+esp_err_t data_manager_convert_records_to_cbor(size_t *out_converted) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_MAINTENANCE);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (RECORD_WRITE_JSON) {
+    ESP_LOGW(TAG, "Record format is JSON; nothing to convert");
+    return ESP_ERR_NOT_SUPPORTED;
+  }
+  size_t converted = 0;
+  esp_err_t result = ESP_OK;
+  for (int kind = 0; kind < RECORD_KIND_COUNT; kind++) {
+    const record_desc_t *desc = &s_records[kind];
+    size_t count = 0;
+    record_id_t *ids = collect_json_ids(kind, &count);
+    for (size_t i = 0; i < count; i++) {
+      // One file per write-lock hold so readers keep making progress.
+      if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+        result = ESP_ERR_TIMEOUT;
+        break;
+      }
+      char path[128];
+      record_path(kind, ids[i], RECORD_EXT_JSON, path, sizeof(path));
+      record_any_t rec;
+      memset(&rec, 0, desc->struct_size);
+      esp_err_t err = read_json_record(path, desc, &rec);
+      if (err == ESP_OK) {
+        err = record_write_unlocked(NULL, kind, ids[i], &rec);
+      }
+      data_fs_write_unlock();
+      if (err == ESP_OK) {
+        converted++;
+      } else {
+        ESP_LOGW(TAG, "Kept %s (%s)", path, esp_err_to_name(err));
+        result = err;
+      }
+    }
+    free(ids);
+  }
+  ESP_LOGI(TAG, "Converted %u records to CBOR", (unsigned)converted);
+  if (out_converted) {
+    *out_converted = converted;
+  }
+  return result;
+}
+
+// --- Layout migration -------------------------------------------------------
+
+static esp_err_t ensure_dir(const char *path) {
+  struct stat st;
+  if (stat(path, &st) == 0 || mkdir(path, 0775) == 0) {
+    return ESP_OK;
+  }
+  ESP_LOGE(TAG, "Cannot create %s (errno=%d)", path, errno);
+  return ESP_FAIL;
+}
+
+// Fan-out of the files on flash, or -1 when unknown (first boot of a firmware
+// with buckets, or a lost stamp): every possible bucket is then checked.
+static int load_layout_bits(void) {
+  void *data = NULL;
+  size_t len = 0;
+  if (storage_load_secure(RECORD_LAYOUT_PATH, &data, &len,
+                          RECORD_LAYOUT_VERSION) != ESP_OK) {
+    return -1;
+  }
+  int bits = len == 1 ? ((uint8_t *)data)[0] : -1;
+  free(data);
+  return bits <= RECORD_LAYOUT_MAX_BITS ? bits : -1;
+}
+
+// Moves every record file of src (the flat directory, or a bucket of another
+// fan-out) to its place in the current layout. Names are collected first so
+// the directory is not modified while it is being read.
+static esp_err_t relocate_records(record_kind_t kind, const char *src,
+                                  size_t *moved) {
+  typedef char name_t[MAX_ID_LEN + sizeof(RECORD_EXT_CBOR)];
+  DIR *d = opendir(src);
+  if (!d) {
+    return ESP_OK; // No such bucket
+  }
+  name_t *names = NULL;
+  size_t count = 0;
+  size_t cap = 0;
+  esp_err_t err = ESP_OK;
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    if ((!has_suffix(ent->d_name, RECORD_EXT_CBOR) &&
+         !has_suffix(ent->d_name, RECORD_EXT_JSON)) ||
+        strlen(ent->d_name) >= sizeof(name_t)) {
+      continue;
+    }
+    if (count == cap) {
+      size_t new_cap = cap ? cap * 2 : 16;
+      void *grown = realloc(names, new_cap * sizeof(*names));
+      if (!grown) {
+        err = ESP_ERR_NO_MEM;
+        break;
+      }
+      names = grown;
+      cap = new_cap;
+    }
+    strlcpy(names[count++], ent->d_name, sizeof(name_t));
+  }
+  closedir(d);
+
+  for (size_t i = 0; i < count; i++) {
+    bool cbor = has_suffix(names[i], RECORD_EXT_CBOR);
+    const char *ext = cbor ? RECORD_EXT_CBOR : RECORD_EXT_JSON;
+    char id[MAX_ID_LEN];
+    size_t n = strlen(names[i]) - strlen(ext);
+    memcpy(id, names[i], n);
+    id[n] = '\0';
+    char from[128];
+    char to[128];
+    snprintf(from, sizeof(from), "%s/%s", src, names[i]);
+    record_path(kind, id, ext, to, sizeof(to));
+    if (strcmp(from, to) == 0) {
+      continue;
+    }
+    if (rename(from, to) != 0) {
+      ESP_LOGE(TAG, "Cannot move %s to %s (errno=%d)", from, to, errno);
+      err = ESP_FAIL;
+      continue;
+    }
+    (*moved)++;
+  }
+  free(names);
+  return err;
+}
+
+esp_err_t record_layout_init(void) {
+  int prev = load_layout_bits();
+  if (!data_fs_write_lock(pdMS_TO_TICKS(10000))) {
+    return ESP_ERR_TIMEOUT;
+  }
+  esp_err_t result = ESP_OK;
+  size_t moved = 0;
+  for (int kind = 0; kind < RECORD_KIND_COUNT; kind++) {
+    const char *dir = s_records[kind].dir;
+    char path[128];
+    esp_err_t err = ensure_dir(dir);
+    for (unsigned b = 0; RECORD_FANOUT_BITS > 0 && b < RECORD_BUCKETS; b++) {
+      bucket_path(kind, RECORD_FANOUT_BITS, b, path, sizeof(path));
+      if (err == ESP_OK) {
+        err = ensure_dir(path);
+      }
+    }
+    if (err != ESP_OK) {
+      result = err;
+      continue;
+    }
+    // Flat files: older firmware, or written by a downgraded image.
+    err = relocate_records(kind, dir, &moved);
+    if (err != ESP_OK) {
+      result = err;
+    }
+    if (prev == RECORD_FANOUT_BITS || prev == 0) {
+      continue;
+    }
+    unsigned old_bits = prev < 0 ? RECORD_LAYOUT_MAX_BITS : (unsigned)prev;
+    for (unsigned b = 0; b < (1u << old_bits); b++) {
+      bucket_path(kind, old_bits, b, path, sizeof(path));
+      err = relocate_records(kind, path, &moved);
+      if (err != ESP_OK) {
+        result = err;
+      } else if (RECORD_FANOUT_BITS == 0 || b >= RECORD_BUCKETS) {
+        rmdir(path); // Not part of the current layout
+      }
+    }
+  }
+  if (result == ESP_OK && prev != RECORD_FANOUT_BITS) {
+    uint8_t bits = RECORD_FANOUT_BITS;
+    result = storage_save_secure(RECORD_LAYOUT_PATH, &bits, sizeof(bits),
+                                 RECORD_LAYOUT_VERSION);
+  }
+  data_fs_write_unlock();
+  if (moved > 0) {
+    ESP_LOGI(TAG, "Moved %u record files to %u buckets", (unsigned)moved,
+             RECORD_BUCKETS);
+  }
+  // On error the stamp is not updated: what was not moved is retried at the
+  // next boot.
+  return result;
+}
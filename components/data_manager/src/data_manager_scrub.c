@@ -0,0 +1,564 @@
+#include "data_manager_priv.h"
+
+#if CONFIG_ARS_DATA_SCRUB
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "storage_core.h"
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+#include <time.h>
+
+static const char *TAG = "dm_scrub";
+
+// Background integrity scrubber. A pass walks the record buckets of
+// reptiles, documents and contacts, then the event shards of every animal,
+// then the weight series, and checks each file the way its reader would:
+// CRC and CBOR/JSON decoding for records, record CRCs for event shards,
+// block CRCs for weight series.
+//
+// Work is cut into slices of at most CONFIG_ARS_DATA_SCRUB_SLICE_MS under the
+// /data read lock, taken only when it is free. The directories are closed at
+// the end of each slice and reopened at their telldir() position, which is
+// also saved every SCRUB_SAVE_EVERY files so a reboot resumes the pass.
+// Files created or removed between two slices can shift that position by a
+// few entries: a file may then be checked twice, or wait for the next pass.
+// A reboot during the pause between passes starts the next pass.
+#define SCRUB_STATE_PATH DATA_MANAGER_INDEX_DIR "/scrub.state"
+#define SCRUB_STATE_VERSION 1
+#define SCRUB_SAVE_EVERY 64
+#define SCRUB_BOOT_DELAY_MS 30000 // Let the UI and the caches settle
+#define SCRUB_QUARANTINE_DIR DATA_MANAGER_ROOT "/quarantine"
+#define SCRUB_REPORT_PATH SCRUB_QUARANTINE_DIR "/report.log"
+#define SCRUB_REPORT_OLD_PATH SCRUB_QUARANTINE_DIR "/report.old"
+#define SCRUB_REPORT_MAX 8192 // Then rotated to report.old
+#define SCRUB_SLICE_FINDINGS 4 // A slice ends early past this many
+
+typedef enum {
+  SCRUB_REPTILES,
+  SCRUB_DOCUMENTS,
+  SCRUB_CONTACTS,
+  SCRUB_EVENTS,
+  SCRUB_WEIGHTS,
+  SCRUB_DONE,
+} scrub_phase_t;
+
+_Static_assert(SCRUB_REPTILES == (int)RECORD_REPTILE &&
+                   SCRUB_DOCUMENTS == (int)RECORD_DOCUMENT &&
+                   SCRUB_CONTACTS == (int)RECORD_CONTACT,
+               "record phases follow record_kind_t");
+
+// Persisted position of the current pass.
+typedef struct {
+  uint32_t phase;
+  uint32_t bucket;  // Records: bucket directory
+  uint32_t checked; // Files checked in this pass
+  uint32_t reserved;
+  int64_t dir_pos;      // telldir() in the bucket, events or weights dir
+  int64_t sub_pos;      // Events: telldir() in the animal directory
+  char sub[MAX_ID_LEN]; // Events: animal being checked, "" between two
+} scrub_cursor_t;
+
+// Directories open during one slice.
+typedef struct {
+  DIR *dir;
+  DIR *sub;
+  char dir_path[96];
+} scrub_walk_t;
+
+typedef struct {
+  scrub_phase_t phase;
+  char id[MAX_ID_LEN]; // Records only
+  char path[128];
+  char detail[32];
+} scrub_finding_t;
+
+typedef enum {
+  SLICE_MORE,
+  SLICE_DONE, // End of the pass
+  SLICE_BUSY, // /data was not free
+} slice_result_t;
+
+// Cursor, walk and record check scratch: one slice at a time.
+static SemaphoreHandle_t s_scrub_lock = NULL;
+static scrub_cursor_t s_cursor;
+static uint32_t s_unsaved = 0;
+static TaskHandle_t s_task = NULL;
+
+static portMUX_TYPE s_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static data_manager_scrub_stats_t s_stats;
+
+static DIR *open_at(const char *path, int64_t pos) {
+  DIR *d = opendir(path);
+  if (d && pos > 0) {
+    seekdir(d, (long)pos);
+  }
+  return d;
+}
+
+// Next entry that is not a dot file, with the position following it.
+static struct dirent *next_entry(DIR *d, int64_t *pos) {
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL) {
+    *pos = telldir(d);
+    if (ent->d_name[0] != '.') {
+      return ent;
+    }
+  }
+  return NULL;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+  size_t n = strlen(name);
+  size_t s = strlen(suffix);
+  return n > s && strcmp(name + n - s, suffix) == 0;
+}
+
+static void walk_close(scrub_walk_t *w) {
+  if (w->sub) {
+    closedir(w->sub);
+    w->sub = NULL;
+  }
+  if (w->dir) {
+    closedir(w->dir);
+    w->dir = NULL;
+  }
+}
+
+static void walk_next_phase(scrub_walk_t *w) {
+  walk_close(w);
+  s_cursor.phase++;
+  s_cursor.bucket = 0;
+  s_cursor.dir_pos = 0;
+  s_cursor.sub_pos = 0;
+  s_cursor.sub[0] = '\0';
+}
+
+static void walk_open(scrub_walk_t *w, const char *path) {
+  copy_bounded(w->dir_path, sizeof(w->dir_path), path);
+  w->dir = open_at(path, s_cursor.dir_pos);
+}
+
+// Advances the cursor to the next file to check; false at the end of the
+// pass. Caller holds the read lock.
+static bool walk_next(scrub_walk_t *w, char *path, size_t len) {
+  scrub_cursor_t *c = &s_cursor;
+  for (;;) {
+    struct dirent *ent = NULL;
+    switch (c->phase) {
+    case SCRUB_REPTILES:
+    case SCRUB_DOCUMENTS:
+    case SCRUB_CONTACTS:
+      if (c->bucket >= record_bucket_count()) {
+        walk_next_phase(w);
+        continue;
+      }
+      if (!w->dir) {
+        char dir[96];
+        record_bucket_dir((record_kind_t)c->phase, c->bucket, dir,
+                          sizeof(dir));
+        walk_open(w, dir);
+      }
+      ent = w->dir ? next_entry(w->dir, &c->dir_pos) : NULL;
+      if (!ent) { // A missing bucket is simply empty
+        walk_close(w);
+        c->bucket++;
+        c->dir_pos = 0;
+        continue;
+      }
+      break;
+    case SCRUB_EVENTS:
+      if (!c->sub[0]) {
+        if (!w->dir) {
+          walk_open(w, DATA_MANAGER_ROOT "/events");
+        }
+        ent = w->dir ? next_entry(w->dir, &c->dir_pos) : NULL;
+        if (!ent) {
+          walk_next_phase(w);
+          continue;
+        }
+        if (ent->d_type != DT_DIR) {
+          continue; // Legacy log, converted on first access
+        }
+        copy_bounded(c->sub, sizeof(c->sub), ent->d_name);
+        c->sub_pos = 0;
+      }
+      if (!w->sub) {
+        snprintf(path, len, DATA_MANAGER_ROOT "/events/%s", c->sub);
+        w->sub = open_at(path, c->sub_pos);
+      }
+      ent = w->sub ? next_entry(w->sub, &c->sub_pos) : NULL;
+      if (!ent) {
+        if (w->sub) {
+          closedir(w->sub);
+          w->sub = NULL;
+        }
+        c->sub[0] = '\0';
+        continue;
+      }
+      if (!has_suffix(ent->d_name, ".log")) {
+        continue;
+      }
+      snprintf(path, len, DATA_MANAGER_ROOT "/events/%s/%s", c->sub,
+               ent->d_name);
+      return true;
+    case SCRUB_WEIGHTS:
+      if (!w->dir) {
+        walk_open(w, DATA_MANAGER_ROOT "/weights");
+      }
+      ent = w->dir ? next_entry(w->dir, &c->dir_pos) : NULL;
+      if (!ent) {
+        walk_next_phase(w);
+        continue;
+      }
+      if (!has_suffix(ent->d_name, ".wts")) {
+        continue; // Legacy JSON, converted on first access
+      }
+      break;
+    default:
+      return false;
+    }
+    snprintf(path, len, "%s/%s", w->dir_path, ent->d_name);
+    return true;
+  }
+}
+
+// False for errors that say nothing about the file itself.
+static bool is_corrupt(esp_err_t err) {
+  return err != ESP_OK && err != ESP_ERR_NOT_FOUND && err != ESP_ERR_NO_MEM &&
+         err != ESP_ERR_NOT_SUPPORTED; // Written by newer firmware
+}
+
+typedef enum {
+  CHECK_SKIPPED, // Not a data file, or gone
+  CHECK_OK,
+  CHECK_FINDING, // Filled in *finding
+} check_result_t;
+
+// *size is the file size. Caller holds the read lock.
+static check_result_t check_file(const scrub_walk_t *w, scrub_phase_t phase,
+                                 const char *path, scrub_finding_t *finding,
+                                 size_t *size) {
+  size_t bad = 0;
+  esp_err_t err;
+  *size = 0;
+  memset(finding, 0, sizeof(*finding));
+  if (phase <= SCRUB_CONTACTS) {
+    const char *name = strrchr(path, '/') + 1;
+    err = record_check_file_unlocked((record_kind_t)phase, w->dir_path, name,
+                                     finding->id, sizeof(finding->id));
+    struct stat st;
+    if (err == ESP_ERR_INVALID_ARG || stat(path, &st) != 0) {
+      return CHECK_SKIPPED;
+    }
+    *size = (size_t)st.st_size;
+    if (!is_corrupt(err)) {
+      return CHECK_OK;
+    }
+    copy_bounded(finding->detail, sizeof(finding->detail),
+                 esp_err_to_name(err));
+  } else {
+    err = phase == SCRUB_EVENTS ? event_shard_check_unlocked(path, &bad, size)
+                                : weight_series_check_unlocked(path, &bad,
+                                                               size);
+    if (err != ESP_OK) {
+      return CHECK_SKIPPED;
+    }
+    if (bad == 0) {
+      return CHECK_OK;
+    }
+    snprintf(finding->detail, sizeof(finding->detail), "%u bad %s",
+             (unsigned)bad, phase == SCRUB_EVENTS ? "bytes" : "blocks");
+  }
+  finding->phase = phase;
+  copy_bounded(finding->path, sizeof(finding->path), path);
+  return CHECK_FINDING;
+}
+
+// Caller holds the write lock.
+static void report_unlocked(const scrub_finding_t *f, const char *action) {
+  ESP_LOGW(TAG, "%s %s (%s)", action, f->path, f->detail);
+  mkdir(SCRUB_QUARANTINE_DIR, 0775);
+  struct stat st;
+  if (stat(SCRUB_REPORT_PATH, &st) == 0 && st.st_size > SCRUB_REPORT_MAX) {
+    unlink(SCRUB_REPORT_OLD_PATH);
+    rename(SCRUB_REPORT_PATH, SCRUB_REPORT_OLD_PATH);
+  }
+  FILE *r = fopen(SCRUB_REPORT_PATH, "a");
+  if (!r) {
+    return;
+  }
+  fprintf(r, "%lld %s %s (%s)\n", (long long)time(NULL), action, f->path,
+          f->detail);
+  fclose(r);
+}
+
+// Moves a record that is still unreadable out of its bucket. Caller holds
+// the write lock.
+static bool quarantine_unlocked(const scrub_finding_t *f) {
+  char dir[96];
+  char id[MAX_ID_LEN];
+  const char *name = strrchr(f->path, '/') + 1;
+  size_t dir_len = (size_t)(name - 1 - f->path);
+  if (dir_len >= sizeof(dir)) {
+    return false;
+  }
+  memcpy(dir, f->path, dir_len);
+  dir[dir_len] = '\0';
+  // Rewritten by a save since the slice: nothing left to do.
+  esp_err_t err = record_check_file_unlocked((record_kind_t)f->phase, dir,
+                                             name, id, sizeof(id));
+  if (!is_corrupt(err)) {
+    return false;
+  }
+  // reptiles/3a/<id>.cbor -> quarantine/reptiles_3a_<id>.cbor
+  char dest[160];
+  snprintf(dest, sizeof(dest), SCRUB_QUARANTINE_DIR "/%s",
+           f->path + strlen(DATA_MANAGER_ROOT) + 1);
+  for (char *p = dest + strlen(SCRUB_QUARANTINE_DIR) + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '_';
+    }
+  }
+  mkdir(SCRUB_QUARANTINE_DIR, 0775);
+  if (rename(f->path, dest) != 0) {
+    ESP_LOGE(TAG, "Cannot quarantine %s", f->path);
+    return false;
+  }
+  report_unlocked(f, "quarantined");
+  return true;
+}
+
+// Runs with no lock held: the cache lock comes before the FS lock.
+static void handle_finding(const scrub_finding_t *f) {
+  if (f->phase >= SCRUB_EVENTS) {
+    if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+      report_unlocked(f, "damaged");
+      data_fs_write_unlock();
+    }
+    portENTER_CRITICAL(&s_stats_mux);
+    s_stats.damaged++;
+    portEXIT_CRITICAL(&s_stats_mux);
+    return;
+  }
+  record_kind_t kind = (record_kind_t)f->phase;
+  void *copy = malloc(record_size(kind));
+  bool repaired = copy && record_cache_get(kind, f->id, copy) &&
+                  record_write(kind, f->id, copy) == ESP_OK;
+  free(copy);
+  // The listings drop the record right after the move: marked stale
+  // between the two, like any other record write.
+  bool indexed = false;
+  if (!repaired && kind == RECORD_REPTILE) {
+    indexed = data_manager_index_begin() == ESP_OK;
+  } else if (!repaired && kind == RECORD_DOCUMENT) {
+    indexed = data_manager_doc_index_begin() == ESP_OK;
+  }
+  bool quarantined = false;
+  if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    if (repaired) {
+      report_unlocked(f, "repaired");
+    } else {
+      quarantined = quarantine_unlocked(f);
+    }
+    if (quarantined && kind == RECORD_REPTILE) {
+      aggregate_remove_unlocked(f->id);
+    }
+    data_fs_write_unlock();
+  }
+  if (quarantined) {
+    // Out of the listings: they would point at a missing record.
+    if (kind == RECORD_REPTILE) {
+      data_manager_index_remove(f->id);
+    } else if (kind == RECORD_DOCUMENT) {
+      data_manager_doc_index_remove(f->id);
+    }
+    // Gone for consumers too.
+    change_log_record((data_manager_entity_t)kind, DATA_MANAGER_CHANGE_DELETE,
+                      f->id);
+  }
+  if (indexed && kind == RECORD_REPTILE) {
+    data_manager_index_end();
+  } else if (indexed) {
+    data_manager_doc_index_end();
+  }
+  portENTER_CRITICAL(&s_stats_mux);
+  s_stats.repaired += repaired;
+  s_stats.quarantined += quarantined;
+  portEXIT_CRITICAL(&s_stats_mux);
+}
+
+static void save_cursor(void) {
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    return; // Retried after the next slice
+  }
+  esp_err_t err = storage_save_secure(SCRUB_STATE_PATH, &s_cursor,
+                                      sizeof(s_cursor), SCRUB_STATE_VERSION);
+  data_fs_write_unlock();
+  if (err == ESP_OK) {
+    s_unsaved = 0;
+  }
+}
+
+// Caller holds s_scrub_lock.
+static slice_result_t scrub_slice(bool wait) {
+  bool locked = wait ? data_fs_read_lock(pdMS_TO_TICKS(2000))
+                     : data_fs_try_read_lock();
+  if (!locked) {
+    portENTER_CRITICAL(&s_stats_mux);
+    s_stats.deferred++;
+    portEXIT_CRITICAL(&s_stats_mux);
+    return SLICE_BUSY;
+  }
+  DM_OP_SCOPE(DATA_MANAGER_OP_SCRUB);
+  int64_t start = esp_timer_get_time();
+  scrub_walk_t walk = {0};
+  scrub_finding_t findings[SCRUB_SLICE_FINDINGS];
+  size_t found = 0;
+  uint32_t files = 0;
+  uint64_t bytes = 0;
+  bool more = true;
+  char path[128];
+  do {
+    if (!walk_next(&walk, path, sizeof(path))) {
+      more = false;
+      break;
+    }
+    size_t size = 0;
+    check_result_t res = check_file(&walk, (scrub_phase_t)s_cursor.phase,
+                                    path, &findings[found], &size);
+    found += res == CHECK_FINDING;
+    files += res != CHECK_SKIPPED;
+    bytes += size;
+  } while (found < SCRUB_SLICE_FINDINGS &&
+           esp_timer_get_time() - start <
+               CONFIG_ARS_DATA_SCRUB_SLICE_MS * 1000LL);
+  walk_close(&walk);
+  data_fs_read_unlock();
+  uint32_t held_us = (uint32_t)(esp_timer_get_time() - start);
+
+  for (size_t i = 0; i < found; i++) {
+    handle_finding(&findings[i]);
+  }
+  s_cursor.checked += files;
+  s_unsaved += files;
+  portENTER_CRITICAL(&s_stats_mux);
+  s_stats.files_checked += files;
+  s_stats.bytes_checked += bytes;
+  if (held_us > s_stats.max_slice_us) {
+    s_stats.max_slice_us = held_us;
+  }
+  s_stats.position = s_cursor.checked;
+  if (!more) {
+    s_stats.passes++;
+  }
+  portEXIT_CRITICAL(&s_stats_mux);
+
+  if (!more) {
+    ESP_LOGI(TAG, "Pass complete: %u files", (unsigned)s_cursor.checked);
+    memset(&s_cursor, 0, sizeof(s_cursor));
+    save_cursor();
+    return SLICE_DONE;
+  }
+  if (s_unsaved >= SCRUB_SAVE_EVERY) {
+    save_cursor();
+  }
+  return SLICE_MORE;
+}
+
+static void scrub_task(void *arg) {
+  uint32_t sleep_ms = SCRUB_BOOT_DELAY_MS;
+  for (;;) {
+    vTaskDelay(pdMS_TO_TICKS(sleep_ms));
+    xSemaphoreTake(s_scrub_lock, portMAX_DELAY);
+    int64_t start = esp_timer_get_time();
+    slice_result_t res = scrub_slice(false);
+    int64_t spent_us = esp_timer_get_time() - start;
+    xSemaphoreGive(s_scrub_lock);
+    if (res == SLICE_DONE) {
+      sleep_ms = CONFIG_ARS_DATA_SCRUB_PASS_INTERVAL_S * 1000u;
+      continue;
+    }
+    // Idle long enough to stay within the duty cycle.
+    int64_t idle_ms = spent_us * (100 - CONFIG_ARS_DATA_SCRUB_DUTY_PCT) /
+                      CONFIG_ARS_DATA_SCRUB_DUTY_PCT / 1000;
+    sleep_ms = idle_ms > CONFIG_ARS_DATA_SCRUB_PERIOD_MS
+                   ? (uint32_t)idle_ms
+                   : CONFIG_ARS_DATA_SCRUB_PERIOD_MS;
+  }
+}
+
+esp_err_t data_manager_scrub_init(void) {
+  if (!s_scrub_lock) {
+    s_scrub_lock = xSemaphoreCreateMutex();
+    if (!s_scrub_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  void *data = NULL;
+  size_t len = 0;
+  esp_err_t err =
+      storage_load_secure(SCRUB_STATE_PATH, &data, &len, SCRUB_STATE_VERSION);
+  xSemaphoreTake(s_scrub_lock, portMAX_DELAY);
+  memset(&s_cursor, 0, sizeof(s_cursor));
+  if (err == ESP_OK && len == sizeof(s_cursor)) {
+    memcpy(&s_cursor, data, sizeof(s_cursor));
+    s_cursor.sub[sizeof(s_cursor.sub) - 1] = '\0';
+    if (s_cursor.phase > SCRUB_DONE) {
+      memset(&s_cursor, 0, sizeof(s_cursor));
+    }
+  } else if (err != ESP_ERR_NOT_FOUND) {
+    ESP_LOGW(TAG, "Position unreadable (%s), starting a new pass",
+             esp_err_to_name(err));
+  }
+  s_stats.position = s_cursor.checked;
+  xSemaphoreGive(s_scrub_lock);
+  free(data);
+  if (!s_task &&
+      xTaskCreate(scrub_task, "dm_scrub", 4096, NULL, 1, &s_task) != pdPASS) {
+    s_task = NULL;
+    return ESP_ERR_NO_MEM;
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_scrub_now(void) {
+  if (!storage_ready_guard(__func__) || !s_scrub_lock) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  xSemaphoreTake(s_scrub_lock, portMAX_DELAY);
+  slice_result_t res;
+  do {
+    res = scrub_slice(true);
+  } while (res == SLICE_MORE);
+  xSemaphoreGive(s_scrub_lock);
+  return res == SLICE_BUSY ? ESP_ERR_TIMEOUT : ESP_OK;
+}
+
+esp_err_t data_manager_get_scrub_stats(data_manager_scrub_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  portENTER_CRITICAL(&s_stats_mux);
+  *out = s_stats;
+  portEXIT_CRITICAL(&s_stats_mux);
+  return ESP_OK;
+}
+
+#else
+
+esp_err_t data_manager_scrub_init(void) { return ESP_OK; }
+
+esp_err_t data_manager_scrub_now(void) { return ESP_ERR_NOT_SUPPORTED; }
+
+esp_err_t data_manager_get_scrub_stats(data_manager_scrub_stats_t *out) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
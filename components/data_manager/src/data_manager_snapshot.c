@@ -0,0 +1,631 @@
+#include "data_manager_priv.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include <stdlib.h>
+
+static const char *TAG = "dm_snapshot";
+
+#if CONFIG_ARS_DATA_SNAPSHOT
+
+// Versions of the three summary tables, each cut into chunks of
+// SNAP_CHUNK_ENTRIES entries (all full but the last). A version only holds
+// chunk pointers: the next one starts as a copy of that table, sharing every
+// chunk, and an edit copies the chunk it writes to unless the draft already
+// owns it. Publishing is a pointer swap.
+//
+// Writers edit one private draft under s_snap_lock, between
+// snapshot_edit_begin() and snapshot_edit_end(); the last end to close
+// publishes, so a version never shows half of an operation. Readers only take
+// s_snap_mux, for the pointer load and the reference count.
+#define SNAP_CHUNK_ENTRIES 32
+
+typedef struct {
+  uint32_t refs; // Versions holding it, under s_snap_mux
+  uint8_t data[];
+} snap_chunk_t;
+
+typedef struct {
+  size_t count;
+  size_t nchunks;
+  size_t capacity; // Chunk pointers allocated
+  snap_chunk_t **chunks;
+} snap_table_t;
+
+struct data_manager_snapshot {
+  uint32_t refs; // Readers, plus one while published; under s_snap_mux
+  uint32_t version;
+  snap_table_t tables[SNAPSHOT_TABLE_COUNT];
+};
+
+static const size_t s_entry_size[SNAPSHOT_TABLE_COUNT] = {
+    sizeof(reptile_summary_t),
+    sizeof(document_summary_t),
+    sizeof(reptile_aggregate_t),
+};
+
+static SemaphoreHandle_t s_snap_lock = NULL;
+static portMUX_TYPE s_snap_mux = portMUX_INITIALIZER_UNLOCKED;
+static data_manager_snapshot_t *s_published = NULL;
+// Below: under s_snap_lock. s_stats: under s_snap_mux.
+static data_manager_snapshot_t *s_draft = NULL;
+static uint32_t s_edits = 0;      // Open snapshot_edit_begin() calls
+static uint32_t s_draft_us = 0;   // Time spent building the draft
+static bool s_failed = false;     // Out of memory once: snapshots are off
+static uint32_t s_version = 0;
+static data_manager_snapshot_stats_t s_stats;
+
+// Thousands of summaries would not fit the internal heap.
+static void *snap_alloc(size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return malloc(size);
+}
+
+static size_t chunk_bytes(snapshot_table_t table) {
+  return sizeof(snap_chunk_t) + SNAP_CHUNK_ENTRIES * s_entry_size[table];
+}
+
+static void stats_bytes(int chunks, int64_t bytes) {
+  portENTER_CRITICAL(&s_snap_mux);
+  s_stats.chunks += chunks;
+  s_stats.bytes += bytes;
+  portEXIT_CRITICAL(&s_snap_mux);
+}
+
+static snap_chunk_t *chunk_new(snapshot_table_t table) {
+  snap_chunk_t *c = snap_alloc(chunk_bytes(table));
+  if (c) {
+    c->refs = 1;
+    stats_bytes(1, chunk_bytes(table));
+  }
+  return c;
+}
+
+static void chunk_unref(snap_chunk_t *c, snapshot_table_t table) {
+  portENTER_CRITICAL(&s_snap_mux);
+  bool last = --c->refs == 0;
+  if (last) {
+    s_stats.chunks--;
+    s_stats.bytes -= chunk_bytes(table);
+  }
+  portEXIT_CRITICAL(&s_snap_mux);
+  if (last) {
+    free(c);
+  }
+}
+
+static bool table_reserve(snap_table_t *t, size_t nchunks) {
+  if (nchunks <= t->capacity) {
+    return true;
+  }
+  size_t capacity = t->capacity ? t->capacity * 2 : 4;
+  while (capacity < nchunks) {
+    capacity *= 2;
+  }
+  snap_chunk_t **grown = realloc(t->chunks, capacity * sizeof(*grown));
+  if (!grown) {
+    return false;
+  }
+  stats_bytes(0, (int64_t)(capacity - t->capacity) * sizeof(*grown));
+  t->chunks = grown;
+  t->capacity = capacity;
+  return true;
+}
+
+static void table_clear(snap_table_t *t, snapshot_table_t table) {
+  for (size_t i = 0; i < t->nchunks; i++) {
+    chunk_unref(t->chunks[i], table);
+  }
+  t->count = 0;
+  t->nchunks = 0;
+}
+
+static void table_free(snap_table_t *t, snapshot_table_t table) {
+  table_clear(t, table);
+  stats_bytes(0, -(int64_t)(t->capacity * sizeof(*t->chunks)));
+  free(t->chunks);
+  t->chunks = NULL;
+  t->capacity = 0;
+}
+
+// Shares every chunk of src.
+static bool table_clone(snap_table_t *dst, const snap_table_t *src) {
+  if (!table_reserve(dst, src->nchunks)) {
+    return false;
+  }
+  memcpy(dst->chunks, src->chunks, src->nchunks * sizeof(*src->chunks));
+  dst->count = src->count;
+  dst->nchunks = src->nchunks;
+  portENTER_CRITICAL(&s_snap_mux);
+  for (size_t i = 0; i < dst->nchunks; i++) {
+    dst->chunks[i]->refs++;
+  }
+  portEXIT_CRITICAL(&s_snap_mux);
+  return true;
+}
+
+static const void *entry_at(const snap_table_t *t, snapshot_table_t table,
+                            size_t i) {
+  return t->chunks[i / SNAP_CHUNK_ENTRIES]->data +
+         (i % SNAP_CHUNK_ENTRIES) * s_entry_size[table];
+}
+
+// Entry i of the draft, its chunk copied first if another version holds it.
+static void *entry_mut(snap_table_t *t, snapshot_table_t table, size_t i) {
+  snap_chunk_t **slot = &t->chunks[i / SNAP_CHUNK_ENTRIES];
+  portENTER_CRITICAL(&s_snap_mux);
+  bool shared = (*slot)->refs > 1;
+  portEXIT_CRITICAL(&s_snap_mux);
+  if (shared) {
+    snap_chunk_t *copy = chunk_new(table);
+    if (!copy) {
+      return NULL;
+    }
+    memcpy(copy->data, (*slot)->data, SNAP_CHUNK_ENTRIES * s_entry_size[table]);
+    chunk_unref(*slot, table);
+    *slot = copy;
+    portENTER_CRITICAL(&s_snap_mux);
+    s_stats.chunk_copies++;
+    portEXIT_CRITICAL(&s_snap_mux);
+  }
+  return (*slot)->data + (i % SNAP_CHUNK_ENTRIES) * s_entry_size[table];
+}
+
+static bool table_insert(snap_table_t *t, snapshot_table_t table, size_t pos,
+                         const void *entry) {
+  size_t size = s_entry_size[table];
+  if (t->count == t->nchunks * SNAP_CHUNK_ENTRIES) {
+    snap_chunk_t *c = NULL;
+    if (!table_reserve(t, t->nchunks + 1) || !(c = chunk_new(table))) {
+      return false;
+    }
+    t->chunks[t->nchunks++] = c;
+  }
+  t->count++;
+  for (size_t i = t->count - 1; i > pos; i--) {
+    void *dst = entry_mut(t, table, i);
+    if (!dst) {
+      return false;
+    }
+    memcpy(dst, entry_at(t, table, i - 1), size);
+  }
+  void *dst = entry_mut(t, table, pos);
+  if (!dst) {
+    return false;
+  }
+  memcpy(dst, entry, size);
+  return true;
+}
+
+static bool table_erase(snap_table_t *t, snapshot_table_t table, size_t pos) {
+  size_t size = s_entry_size[table];
+  for (size_t i = pos; i + 1 < t->count; i++) {
+    void *dst = entry_mut(t, table, i);
+    if (!dst) {
+      return false;
+    }
+    memcpy(dst, entry_at(t, table, i + 1), size);
+  }
+  t->count--;
+  if (t->count == (t->nchunks - 1) * SNAP_CHUNK_ENTRIES) {
+    chunk_unref(t->chunks[--t->nchunks], table);
+  }
+  return true;
+}
+
+static bool table_load(snap_table_t *t, snapshot_table_t table,
+                       const uint8_t *entries, size_t count, size_t stride) {
+  table_clear(t, table);
+  size_t nchunks = (count + SNAP_CHUNK_ENTRIES - 1) / SNAP_CHUNK_ENTRIES;
+  if (!table_reserve(t, nchunks)) {
+    return false;
+  }
+  size_t size = s_entry_size[table];
+  for (size_t i = 0; i < count; i++) {
+    if (i % SNAP_CHUNK_ENTRIES == 0) {
+      snap_chunk_t *c = chunk_new(table);
+      if (!c) {
+        return false;
+      }
+      t->chunks[t->nchunks++] = c;
+    }
+    t->count++;
+    memcpy(t->chunks[t->nchunks - 1]->data + (i % SNAP_CHUNK_ENTRIES) * size,
+           entries + i * stride, size);
+  }
+  return true;
+}
+
+static void version_free(data_manager_snapshot_t *snap) {
+  for (int t = 0; t < SNAPSHOT_TABLE_COUNT; t++) {
+    table_free(&snap->tables[t], (snapshot_table_t)t);
+  }
+  free(snap);
+  stats_bytes(0, -(int64_t)sizeof(*snap));
+  portENTER_CRITICAL(&s_snap_mux);
+  s_stats.live_versions--;
+  portEXIT_CRITICAL(&s_snap_mux);
+}
+
+static void version_unref(data_manager_snapshot_t *snap) {
+  if (!snap) {
+    return;
+  }
+  portENTER_CRITICAL(&s_snap_mux);
+  bool last = --snap->refs == 0;
+  portEXIT_CRITICAL(&s_snap_mux);
+  if (last) {
+    version_free(snap);
+  }
+}
+
+// Caller holds s_snap_lock. Gives up for good on the first allocation
+// failure: a draft missing an edit would drift from the indexes.
+static void draft_fail(void) {
+  ESP_LOGE(TAG, "Out of memory, snapshots disabled");
+  s_failed = true;
+  if (s_draft) {
+    version_free(s_draft);
+    s_draft = NULL;
+  }
+  portENTER_CRITICAL(&s_snap_mux);
+  data_manager_snapshot_t *old = s_published;
+  s_published = NULL;
+  portEXIT_CRITICAL(&s_snap_mux);
+  version_unref(old);
+}
+
+// Caller holds s_snap_lock. The draft starts as the published version.
+static data_manager_snapshot_t *draft_get(void) {
+  if (s_failed) {
+    return NULL;
+  }
+  if (s_draft) {
+    return s_draft;
+  }
+  data_manager_snapshot_t *draft = calloc(1, sizeof(*draft));
+  if (!draft) {
+    draft_fail();
+    return NULL;
+  }
+  stats_bytes(0, sizeof(*draft));
+  portENTER_CRITICAL(&s_snap_mux);
+  s_stats.live_versions++;
+  portEXIT_CRITICAL(&s_snap_mux);
+  s_draft = draft;
+  for (int t = 0; s_published && t < SNAPSHOT_TABLE_COUNT; t++) {
+    if (!table_clone(&draft->tables[t], &s_published->tables[t])) {
+      draft_fail();
+      return NULL;
+    }
+  }
+  return draft;
+}
+
+// Caller holds s_snap_lock.
+static void draft_publish(void) {
+  if (!s_draft) {
+    return;
+  }
+  int64_t t0 = esp_timer_get_time();
+  s_draft->version = ++s_version;
+  s_draft->refs = 1;
+  portENTER_CRITICAL(&s_snap_mux);
+  data_manager_snapshot_t *old = s_published;
+  s_published = s_draft;
+  portEXIT_CRITICAL(&s_snap_mux);
+  s_draft = NULL;
+  version_unref(old);
+  uint32_t us = s_draft_us + (uint32_t)(esp_timer_get_time() - t0);
+  s_draft_us = 0;
+  portENTER_CRITICAL(&s_snap_mux);
+  s_stats.publishes++;
+  s_stats.total_build_us += us;
+  if (us > s_stats.max_build_us) {
+    s_stats.max_build_us = us;
+  }
+  portEXIT_CRITICAL(&s_snap_mux);
+}
+
+esp_err_t data_manager_snapshot_init(void) {
+  if (!s_snap_lock) {
+    s_snap_lock = xSemaphoreCreateMutex();
+    if (!s_snap_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  return ESP_OK;
+}
+
+void snapshot_edit_begin(void) {
+  if (s_snap_lock) {
+    xSemaphoreTake(s_snap_lock, portMAX_DELAY);
+    s_edits++;
+    xSemaphoreGive(s_snap_lock);
+  }
+}
+
+void snapshot_edit_end(void) {
+  if (!s_snap_lock) {
+    return;
+  }
+  xSemaphoreTake(s_snap_lock, portMAX_DELAY);
+  if (s_edits > 0 && --s_edits == 0) {
+    draft_publish();
+  }
+  xSemaphoreGive(s_snap_lock);
+}
+
+typedef enum { EDIT_PUT, EDIT_INSERT, EDIT_ERASE } edit_t;
+
+static void edit(snapshot_table_t table, edit_t op, size_t pos,
+                 const void *entry) {
+  if (!s_snap_lock) {
+    return;
+  }
+  xSemaphoreTake(s_snap_lock, portMAX_DELAY);
+  int64_t t0 = esp_timer_get_time();
+  data_manager_snapshot_t *draft = draft_get();
+  if (draft) {
+    snap_table_t *t = &draft->tables[table];
+    bool ok = true;
+    if (op == EDIT_INSERT) {
+      ok = table_insert(t, table, pos, entry);
+    } else if (op == EDIT_ERASE) {
+      ok = pos < t->count && table_erase(t, table, pos);
+    } else if (pos < t->count) {
+      void *dst = entry_mut(t, table, pos);
+      ok = dst != NULL;
+      if (ok) {
+        memcpy(dst, entry, s_entry_size[table]);
+      }
+    }
+    if (!ok) {
+      draft_fail();
+    }
+  }
+  s_draft_us += (uint32_t)(esp_timer_get_time() - t0);
+  xSemaphoreGive(s_snap_lock);
+}
+
+void snapshot_put(snapshot_table_t table, size_t pos, const void *entry,
+                  bool inserted) {
+  edit(table, inserted ? EDIT_INSERT : EDIT_PUT, pos, entry);
+}
+
+void snapshot_erase(snapshot_table_t table, size_t pos) {
+  edit(table, EDIT_ERASE, pos, NULL);
+}
+
+void snapshot_load(snapshot_table_t table, const void *entries, size_t count,
+                   size_t stride) {
+  if (!s_snap_lock) {
+    return;
+  }
+  xSemaphoreTake(s_snap_lock, portMAX_DELAY);
+  int64_t t0 = esp_timer_get_time();
+  data_manager_snapshot_t *draft = draft_get();
+  if (draft &&
+      !table_load(&draft->tables[table], table, entries, count, stride)) {
+    draft_fail();
+  }
+  s_draft_us += (uint32_t)(esp_timer_get_time() - t0);
+  xSemaphoreGive(s_snap_lock);
+}
+
+const data_manager_snapshot_t *data_manager_snapshot_acquire(void) {
+  portENTER_CRITICAL(&s_snap_mux);
+  data_manager_snapshot_t *snap = s_published;
+  if (snap) {
+    snap->refs++;
+  }
+  portEXIT_CRITICAL(&s_snap_mux);
+  return snap;
+}
+
+void data_manager_snapshot_release(const data_manager_snapshot_t *snap) {
+  version_unref((data_manager_snapshot_t *)snap);
+}
+
+uint32_t data_manager_snapshot_version(const data_manager_snapshot_t *snap) {
+  return snap ? snap->version : 0;
+}
+
+static size_t table_count(const data_manager_snapshot_t *snap,
+                          snapshot_table_t table) {
+  return snap ? snap->tables[table].count : 0;
+}
+
+static const void *table_get(const data_manager_snapshot_t *snap,
+                             snapshot_table_t table, size_t i) {
+  if (!snap || i >= snap->tables[table].count) {
+    return NULL;
+  }
+  return entry_at(&snap->tables[table], table, i);
+}
+
+// Reptiles and aggregates are sorted by id, their first field.
+static const void *table_find(const data_manager_snapshot_t *snap,
+                              snapshot_table_t table, const char *id) {
+  if (!id) {
+    return NULL;
+  }
+  size_t lo = 0, hi = table_count(snap, table);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const void *e = table_get(snap, table, mid);
+    int cmp = strcmp((const char *)e, id);
+    if (cmp == 0) {
+      return e;
+    }
+    if (cmp < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return NULL;
+}
+
+size_t
+data_manager_snapshot_reptile_count(const data_manager_snapshot_t *snap) {
+  return table_count(snap, SNAPSHOT_REPTILES);
+}
+
+const reptile_summary_t *
+data_manager_snapshot_reptile(const data_manager_snapshot_t *snap, size_t i) {
+  return table_get(snap, SNAPSHOT_REPTILES, i);
+}
+
+const reptile_summary_t *
+data_manager_snapshot_find_reptile(const data_manager_snapshot_t *snap,
+                                   const char *id) {
+  return table_find(snap, SNAPSHOT_REPTILES, id);
+}
+
+size_t
+data_manager_snapshot_document_count(const data_manager_snapshot_t *snap) {
+  return table_count(snap, SNAPSHOT_DOCUMENTS);
+}
+
+const document_summary_t *
+data_manager_snapshot_document(const data_manager_snapshot_t *snap, size_t i) {
+  return table_get(snap, SNAPSHOT_DOCUMENTS, i);
+}
+
+size_t data_manager_snapshot_documents_of(const data_manager_snapshot_t *snap,
+                                          const char *related_id,
+                                          size_t *first) {
+  size_t lo = 0, hi = table_count(snap, SNAPSHOT_DOCUMENTS);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    const document_summary_t *e = table_get(snap, SNAPSHOT_DOCUMENTS, mid);
+    if (strcmp(e->related_id, related_id) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  size_t end = lo;
+  const document_summary_t *e;
+  while ((e = table_get(snap, SNAPSHOT_DOCUMENTS, end)) != NULL &&
+         strcmp(e->related_id, related_id) == 0) {
+    end++;
+  }
+  if (first) {
+    *first = lo;
+  }
+  return end - lo;
+}
+
+size_t
+data_manager_snapshot_aggregate_count(const data_manager_snapshot_t *snap) {
+  return table_count(snap, SNAPSHOT_AGGREGATES);
+}
+
+const reptile_aggregate_t *
+data_manager_snapshot_aggregate(const data_manager_snapshot_t *snap,
+                                size_t i) {
+  return table_get(snap, SNAPSHOT_AGGREGATES, i);
+}
+
+const reptile_aggregate_t *
+data_manager_snapshot_find_aggregate(const data_manager_snapshot_t *snap,
+                                     const char *id) {
+  return table_find(snap, SNAPSHOT_AGGREGATES, id);
+}
+
+esp_err_t data_manager_get_snapshot_stats(data_manager_snapshot_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  portENTER_CRITICAL(&s_snap_mux);
+  *out = s_stats;
+  portEXIT_CRITICAL(&s_snap_mux);
+  return ESP_OK;
+}
+
+#else // !CONFIG_ARS_DATA_SNAPSHOT
+
+esp_err_t data_manager_snapshot_init(void) { return ESP_OK; }
+void snapshot_edit_begin(void) {}
+void snapshot_edit_end(void) {}
+void snapshot_put(snapshot_table_t table, size_t pos, const void *entry,
+                  bool inserted) {}
+void snapshot_erase(snapshot_table_t table, size_t pos) {}
+void snapshot_load(snapshot_table_t table, const void *entries, size_t count,
+                   size_t stride) {}
+
+const data_manager_snapshot_t *data_manager_snapshot_acquire(void) {
+  return NULL;
+}
+
+void data_manager_snapshot_release(const data_manager_snapshot_t *snap) {}
+
+uint32_t data_manager_snapshot_version(const data_manager_snapshot_t *snap) {
+  return 0;
+}
+
+size_t
+data_manager_snapshot_reptile_count(const data_manager_snapshot_t *snap) {
+  return 0;
+}
+
+const reptile_summary_t *
+data_manager_snapshot_reptile(const data_manager_snapshot_t *snap, size_t i) {
+  return NULL;
+}
+
+const reptile_summary_t *
+data_manager_snapshot_find_reptile(const data_manager_snapshot_t *snap,
+                                   const char *id) {
+  return NULL;
+}
+
+size_t
+data_manager_snapshot_document_count(const data_manager_snapshot_t *snap) {
+  return 0;
+}
+
+const document_summary_t *
+data_manager_snapshot_document(const data_manager_snapshot_t *snap, size_t i) {
+  return NULL;
+}
+
+size_t data_manager_snapshot_documents_of(const data_manager_snapshot_t *snap,
+                                          const char *related_id,
+                                          size_t *first) {
+  if (first) {
+    *first = 0;
+  }
+  return 0;
+}
+
+size_t
+data_manager_snapshot_aggregate_count(const data_manager_snapshot_t *snap) {
+  return 0;
+}
+
+const reptile_aggregate_t *
+data_manager_snapshot_aggregate(const data_manager_snapshot_t *snap,
+                                size_t i) {
+  return NULL;
+}
+
+const reptile_aggregate_t *
+data_manager_snapshot_find_aggregate(const data_manager_snapshot_t *snap,
+                                     const char *id) {
+  return NULL;
+}
+
+esp_err_t data_manager_get_snapshot_stats(data_manager_snapshot_stats_t *out) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+#endif
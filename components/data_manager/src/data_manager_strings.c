@@ -0,0 +1,303 @@
+#include "data_manager_priv.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "freertos/semphr.h"
+#include "storage_core.h"
+#include <stdlib.h>
+
+static const char *TAG = "dm_strings";
+
+// Interned species and morphs. Each distinct string is stored once, behind
+// its u16 id, in blocks that are never freed or moved: summaries keep a plain
+// pointer, valid for the life of the program, and equal strings have equal
+// pointers. Strings are only ever added, so an id never changes meaning; the
+// pool is saved (index/strings.bin) before every index blob that may refer to
+// a new id. Without it the ids of an index blob do not resolve and the index
+// is rebuilt from the records, which keep their strings.
+#define STRINGS_PATH DATA_MANAGER_INDEX_DIR "/strings.bin"
+#define STRINGS_VERSION 1
+#define STRINGS_BLOCK 1024
+#define STRINGS_MAX UINT16_MAX
+#define STRINGS_ID_SIZE sizeof(uint16_t)
+
+// Id 0, readable before init and after a failure.
+static const char s_empty[STRINGS_ID_SIZE + 1] = {0};
+#define STRING_EMPTY (s_empty + STRINGS_ID_SIZE)
+
+static SemaphoreHandle_t s_str_lock = NULL;
+static const char **s_strs = NULL; // By id
+static size_t s_count = 0;
+static size_t s_capacity = 0;
+static uint16_t *s_hash = NULL; // Open addressing: id + 1, 0 when empty
+static size_t s_hash_cap = 0;   // Power of two, at least twice s_count
+static char *s_block = NULL;    // Block being filled
+static size_t s_block_used = STRINGS_BLOCK;
+static size_t s_bytes = 0;
+static size_t s_saved = 0; // s_count when the pool was last saved
+
+static void *pool_alloc(size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return malloc(size);
+}
+
+static uint32_t str_hash(const char *s) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (; *s; s++) {
+    h = (h ^ (uint8_t)*s) * 16777619u;
+  }
+  return h;
+}
+
+// Caller holds s_str_lock. Slot of s, or the empty slot to insert it at.
+static size_t hash_slot(const char *s) {
+  size_t mask = s_hash_cap - 1;
+  size_t i = str_hash(s) & mask;
+  while (s_hash[i] != 0 && strcmp(s_strs[s_hash[i] - 1], s) != 0) {
+    i = (i + 1) & mask;
+  }
+  return i;
+}
+
+// Caller holds s_str_lock.
+static bool hash_grow(void) {
+  size_t cap = s_hash_cap ? s_hash_cap * 2 : 64;
+  uint16_t *grown = calloc(cap, sizeof(*grown));
+  if (!grown) {
+    return false;
+  }
+  free(s_hash);
+  s_bytes += (cap - s_hash_cap) * sizeof(*grown);
+  s_hash = grown;
+  s_hash_cap = cap;
+  for (size_t id = 1; id < s_count; id++) {
+    s_hash[hash_slot(s_strs[id])] = (uint16_t)(id + 1);
+  }
+  return true;
+}
+
+// Caller holds s_str_lock.
+static bool strs_reserve(void) {
+  if (s_count < s_capacity) {
+    return true;
+  }
+  size_t cap = s_capacity ? s_capacity * 2 : 32;
+  const char **grown = realloc(s_strs, cap * sizeof(*grown));
+  if (!grown) {
+    return false;
+  }
+  s_bytes += (cap - s_capacity) * sizeof(*grown);
+  s_strs = grown;
+  s_capacity = cap;
+  return true;
+}
+
+// Caller holds s_str_lock. NULL when out of memory or ids.
+static const char *pool_add(const char *s, size_t len) {
+  if (s_count >= STRINGS_MAX) {
+    return NULL;
+  }
+  if ((2 * (s_count + 1) > s_hash_cap && !hash_grow()) || !strs_reserve()) {
+    return NULL;
+  }
+  size_t need = STRINGS_ID_SIZE + len + 1;
+  if (s_block_used + need > STRINGS_BLOCK) {
+    // The tail of the previous block is lost; strings are short.
+    s_block = pool_alloc(STRINGS_BLOCK);
+    if (!s_block) {
+      return NULL;
+    }
+    s_bytes += STRINGS_BLOCK;
+    s_block_used = 0;
+  }
+  uint16_t id = (uint16_t)s_count;
+  char *dst = s_block + s_block_used;
+  memcpy(dst, &id, STRINGS_ID_SIZE);
+  memcpy(dst + STRINGS_ID_SIZE, s, len);
+  dst[STRINGS_ID_SIZE + len] = '\0';
+  s_block_used += need;
+  s_strs[s_count++] = dst + STRINGS_ID_SIZE;
+  s_hash[hash_slot(s)] = (uint16_t)(id + 1);
+  return dst + STRINGS_ID_SIZE;
+}
+
+// Caller holds s_str_lock.
+static const char *intern_locked(const char *s) {
+  size_t slot = hash_slot(s);
+  if (s_hash[slot] != 0) {
+    return s_strs[s_hash[slot] - 1];
+  }
+  return pool_add(s, strlen(s));
+}
+
+// Reads the pool saved by the last index persist. Ids are handed out in file
+// order, so each string gets its saved id back.
+static void pool_load(void) {
+  void *data = NULL;
+  size_t len = 0;
+  esp_err_t err = ESP_ERR_TIMEOUT;
+  if (data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    err = storage_load_secure(STRINGS_PATH, &data, &len, STRINGS_VERSION);
+    data_fs_read_unlock();
+  }
+  if (err != ESP_OK) {
+    if (err != ESP_ERR_NOT_FOUND) {
+      ESP_LOGW(TAG, "String pool unreadable (%s)", esp_err_to_name(err));
+    }
+    return;
+  }
+  const uint8_t *p = data;
+  const uint8_t *end = p + len;
+  uint32_t count = 0;
+  if (len >= sizeof(count)) {
+    memcpy(&count, p, sizeof(count));
+    p += sizeof(count);
+  }
+  char s[MAX_SPECIES_LEN];
+  xSemaphoreTake(s_str_lock, portMAX_DELAY);
+  for (uint32_t i = 1; i < count; i++) {
+    // A duplicate would shift every later id.
+    if (!blob_get_str(&p, end, s, sizeof(s)) || !s[0] ||
+        s_hash[hash_slot(s)] != 0 || !pool_add(s, strlen(s))) {
+      ESP_LOGW(TAG, "String pool damaged after %u strings", (unsigned)i);
+      break;
+    }
+  }
+  // A damaged pool is rewritten in full by the next save.
+  s_saved = s_count == count ? s_count : 0;
+  xSemaphoreGive(s_str_lock);
+  free(data);
+}
+
+esp_err_t data_manager_strings_init(void) {
+  if (!s_str_lock) {
+    s_str_lock = xSemaphoreCreateMutex();
+    if (!s_str_lock) {
+      return ESP_ERR_NO_MEM;
+    }
+  }
+  xSemaphoreTake(s_str_lock, portMAX_DELAY);
+  bool load = s_count == 0;
+  bool ok = !load || (hash_grow() && strs_reserve());
+  if (ok && load) {
+    s_strs[s_count++] = STRING_EMPTY; // Never in the hash table
+  }
+  xSemaphoreGive(s_str_lock);
+  if (!ok) {
+    return ESP_ERR_NO_MEM;
+  }
+  if (load) {
+    pool_load();
+  }
+  ESP_LOGI(TAG, "String pool: %u strings", (unsigned)s_count);
+  return ESP_OK;
+}
+
+const char *string_intern(const char *s) {
+  if (!s || !s[0] || !s_str_lock) {
+    return STRING_EMPTY;
+  }
+  xSemaphoreTake(s_str_lock, portMAX_DELAY);
+  const char *interned = s_count > 0 ? intern_locked(s) : NULL;
+  xSemaphoreGive(s_str_lock);
+  if (!interned) {
+    ESP_LOGE(TAG, "Cannot intern \"%s\" (pool full)", s);
+    return STRING_EMPTY;
+  }
+  return interned;
+}
+
+uint16_t string_id(const char *interned) {
+  uint16_t id;
+  memcpy(&id, interned - STRINGS_ID_SIZE, STRINGS_ID_SIZE);
+  return id;
+}
+
+const char *string_at(uint16_t id) {
+  if (id == 0) {
+    return STRING_EMPTY;
+  }
+  const char *s = NULL;
+  if (s_str_lock) {
+    xSemaphoreTake(s_str_lock, portMAX_DELAY);
+    s = id < s_count ? s_strs[id] : NULL;
+    xSemaphoreGive(s_str_lock);
+  }
+  return s;
+}
+
+// Payload: u32 count (id 0 included), then every string from id 1 as u8
+// length + bytes.
+esp_err_t string_pool_save_unlocked(void) {
+  if (!s_str_lock) {
+    return ESP_OK;
+  }
+  xSemaphoreTake(s_str_lock, portMAX_DELAY);
+  uint32_t count = (uint32_t)s_count;
+  if (count == s_saved) {
+    xSemaphoreGive(s_str_lock);
+    return ESP_OK;
+  }
+  size_t len = sizeof(count);
+  for (size_t id = 1; id < count; id++) {
+    len += 1 + strlen(s_strs[id]);
+  }
+  uint8_t *buf = pool_alloc(len);
+  if (buf) {
+    uint8_t *p = buf;
+    memcpy(p, &count, sizeof(count));
+    p += sizeof(count);
+    for (size_t id = 1; id < count; id++) {
+      p += blob_put_str(p, s_strs[id]);
+    }
+  }
+  xSemaphoreGive(s_str_lock);
+  if (!buf) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t err = storage_save_secure(STRINGS_PATH, buf, len, STRINGS_VERSION);
+  free(buf);
+  if (err == ESP_OK) {
+    xSemaphoreTake(s_str_lock, portMAX_DELAY);
+    s_saved = count;
+    xSemaphoreGive(s_str_lock);
+  } else {
+    ESP_LOGE(TAG, "Cannot save the string pool (%s)", esp_err_to_name(err));
+  }
+  return err;
+}
+
+const char *data_manager_find_string(const char *s) {
+  if (!s || !s[0]) {
+    return STRING_EMPTY;
+  }
+  if (!s_str_lock) {
+    return NULL;
+  }
+  const char *found = NULL;
+  xSemaphoreTake(s_str_lock, portMAX_DELAY);
+  if (s_count > 0) {
+    size_t slot = hash_slot(s);
+    found = s_hash[slot] ? s_strs[s_hash[slot] - 1] : NULL;
+  }
+  xSemaphoreGive(s_str_lock);
+  return found;
+}
+
+esp_err_t data_manager_get_string_stats(data_manager_string_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memset(out, 0, sizeof(*out));
+  if (s_str_lock) {
+    xSemaphoreTake(s_str_lock, portMAX_DELAY);
+    out->strings = (uint32_t)s_count;
+    out->bytes = (uint32_t)s_bytes;
+    xSemaphoreGive(s_str_lock);
+  }
+  return ESP_OK;
+}
@@ -0,0 +1,649 @@
+#include "data_manager_priv.h"
+#include "esp_log.h"
+#include "json_reader.h"
+#include "storage_core.h"
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+static const char *TAG = "dm_weights";
+
+// Weight time-series, one file per animal: /data/weights/<id>.wts
+//
+// The file is a sequence of fixed 256-byte blocks. Each block header keeps
+// the first sample verbatim plus running aggregates (min/max/sum) and the
+// state needed to append (last timestamp, last delta, last value). The body
+// stores the following samples as zigzag varints:
+//   timestamp: delta-of-delta in seconds (regular weighings cost one byte)
+//   value:     delta in fixed point (0.1 g)
+// Appends only rewrite the tail block; range queries skip whole blocks using
+// the header bounds and stats use the header aggregates when a block is
+// fully covered.
+#define WTS_MAGIC 0x5457u // "WT"
+#define WTS_BLOCK_SIZE 256
+#define WTS_SCALE 10.0f
+#define WTS_MAX_SAMPLE_BYTES 20 // Two worst-case 64-bit varints
+
+typedef struct {
+  uint16_t magic;
+  uint16_t count;
+  uint16_t used; // Body bytes in use
+  uint16_t reserved;
+  int64_t first_ts;
+  int64_t last_ts;
+  int32_t last_delta;
+  int32_t first_value;
+  int32_t last_value;
+  int32_t min_value;
+  int32_t max_value;
+  int32_t reserved2;
+  int64_t sum;
+  uint32_t crc32; // Whole block with this field zeroed
+  uint32_t reserved3;
+} wts_header_t;
+
+typedef struct {
+  wts_header_t h;
+  uint8_t body[WTS_BLOCK_SIZE - sizeof(wts_header_t)];
+} wts_block_t;
+
+_Static_assert(sizeof(wts_header_t) == 64, "unexpected wts header layout");
+_Static_assert(sizeof(wts_block_t) == WTS_BLOCK_SIZE,
+               "wts block must be exactly one block");
+
+static void wts_path(const char *reptile_id, char *out, size_t len) {
+  snprintf(out, len, DATA_MANAGER_ROOT "/weights/%s.wts", reptile_id);
+}
+
+static int32_t to_fixed(float weight) {
+  float scaled = roundf(weight * WTS_SCALE);
+  if (scaled > (float)INT32_MAX) {
+    return INT32_MAX;
+  }
+  if (scaled < (float)INT32_MIN) {
+    return INT32_MIN;
+  }
+  return (int32_t)scaled;
+}
+
+static float from_fixed(int64_t value) { return (float)value / WTS_SCALE; }
+
+static size_t varint_put(uint8_t *p, int64_t v) {
+  uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+  size_t n = 0;
+  do {
+    uint8_t byte = z & 0x7F;
+    z >>= 7;
+    p[n++] = byte | (z ? 0x80 : 0);
+  } while (z);
+  return n;
+}
+
+static bool varint_get(const uint8_t **p, const uint8_t *end, int64_t *out) {
+  uint64_t z = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (*p >= end) {
+      return false;
+    }
+    uint8_t byte = *(*p)++;
+    z |= (uint64_t)(byte & 0x7F) << shift;
+    if (!(byte & 0x80)) {
+      *out = (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+      return true;
+    }
+  }
+  return false;
+}
+
+static uint32_t wts_block_crc(const wts_block_t *block) {
+  wts_block_t tmp = *block;
+  tmp.h.crc32 = 0;
+  return storage_crc32((const uint8_t *)&tmp, sizeof(tmp));
+}
+
+static bool wts_block_valid(const wts_block_t *block) {
+  return block->h.magic == WTS_MAGIC && block->h.count > 0 &&
+         block->h.used <= sizeof(block->body) &&
+         wts_block_crc(block) == block->h.crc32;
+}
+
+esp_err_t weight_series_check_unlocked(const char *path, size_t *bad_blocks,
+                                       size_t *bytes) {
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  wts_block_t block;
+  size_t got = 0;
+  *bad_blocks = 0;
+  *bytes = 0;
+  int64_t t0 = dm_metrics_now();
+  while ((got = fread(&block, 1, sizeof(block), f)) == sizeof(block)) {
+    *bytes += got;
+    if (!wts_block_valid(&block)) {
+      (*bad_blocks)++;
+    }
+  }
+  fclose(f);
+  if (got > 0) {
+    *bytes += got;
+    (*bad_blocks)++; // Torn extension of the last block
+  }
+  dm_op_io(t0, *bytes, 0);
+  return ESP_OK;
+}
+
+static void wts_block_start(wts_block_t *block, int64_t ts, int32_t value) {
+  memset(block, 0, sizeof(*block));
+  block->h.magic = WTS_MAGIC;
+  block->h.count = 1;
+  block->h.first_ts = ts;
+  block->h.last_ts = ts;
+  block->h.first_value = value;
+  block->h.last_value = value;
+  block->h.min_value = value;
+  block->h.max_value = value;
+  block->h.sum = value;
+}
+
+// Returns false when the sample must start a new block (full, out of order
+// or delta too large).
+static bool wts_block_append(wts_block_t *block, int64_t ts, int32_t value) {
+  if (block->h.count == UINT16_MAX || ts < block->h.last_ts ||
+      ts - block->h.last_ts > INT32_MAX) {
+    return false;
+  }
+  int32_t delta = (int32_t)(ts - block->h.last_ts);
+  uint8_t enc[WTS_MAX_SAMPLE_BYTES];
+  size_t n = varint_put(enc, (int64_t)delta - block->h.last_delta);
+  n += varint_put(enc + n, (int64_t)value - block->h.last_value);
+  if (block->h.used + n > sizeof(block->body)) {
+    return false;
+  }
+  memcpy(block->body + block->h.used, enc, n);
+  block->h.used += n;
+  block->h.count++;
+  block->h.last_ts = ts;
+  block->h.last_delta = delta;
+  block->h.last_value = value;
+  if (value < block->h.min_value) {
+    block->h.min_value = value;
+  }
+  if (value > block->h.max_value) {
+    block->h.max_value = value;
+  }
+  block->h.sum += value;
+  return true;
+}
+
+// Decodes every sample of a block, calling cb for those within [from, to].
+static bool wts_block_decode(const wts_block_t *block, int64_t from,
+                             int64_t to, data_manager_weight_cb_t cb,
+                             void *user_ctx) {
+  int64_t ts = block->h.first_ts;
+  int64_t value = block->h.first_value;
+  int64_t delta = 0;
+  const uint8_t *p = block->body;
+  const uint8_t *end = block->body + block->h.used;
+  for (uint16_t i = 0; i < block->h.count; i++) {
+    if (i > 0) {
+      int64_t dod, dv;
+      if (!varint_get(&p, end, &dod) || !varint_get(&p, end, &dv)) {
+        ESP_LOGW(TAG, "Truncated block body");
+        return true;
+      }
+      delta += dod;
+      ts += delta;
+      value += dv;
+    }
+    if (ts < from) {
+      continue;
+    }
+    if (ts > to) {
+      break;
+    }
+    weight_sample_t sample = {.timestamp = ts, .weight = from_fixed(value)};
+    if (!cb(&sample, user_ctx)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static const record_field_t s_legacy_weight_fields[] = {
+    RECORD_FIELD(weight_sample_t, timestamp, RECORD_FIELD_INT),
+    RECORD_FIELD(weight_sample_t, weight, RECORD_FIELD_FLOAT),
+};
+
+typedef struct {
+  FILE *f;
+  wts_block_t block;
+  bool open_block;
+  bool ok;
+  size_t migrated;
+} weight_migration_t;
+
+// Entries missing either member are skipped, as they always were.
+static void legacy_sample_reset(weight_sample_t *sample) {
+  sample->timestamp = INT64_MIN;
+  sample->weight = NAN;
+}
+
+static bool migrate_json_weight(void *out, void *user_ctx) {
+  weight_sample_t *sample = (weight_sample_t *)out;
+  weight_migration_t *m = (weight_migration_t *)user_ctx;
+  if (sample->timestamp != INT64_MIN && !isnan(sample->weight)) {
+    int64_t ts = sample->timestamp;
+    int32_t value = to_fixed(sample->weight);
+    if (!m->open_block || !wts_block_append(&m->block, ts, value)) {
+      if (m->open_block) {
+        m->block.h.crc32 = wts_block_crc(&m->block);
+        m->ok = fwrite(&m->block, 1, sizeof(m->block), m->f) ==
+                sizeof(m->block);
+      }
+      wts_block_start(&m->block, ts, value);
+      m->open_block = true;
+    }
+    m->migrated++;
+  }
+  legacy_sample_reset(sample);
+  return m->ok;
+}
+
+static bool files_equal(const char *a, const char *b) {
+  FILE *fa = fopen(a, "rb");
+  FILE *fb = fopen(b, "rb");
+  bool equal = fa && fb;
+  while (equal) {
+    uint8_t ba[WTS_BLOCK_SIZE];
+    uint8_t bb[WTS_BLOCK_SIZE];
+    size_t na = fread(ba, 1, sizeof(ba), fa);
+    size_t nb = fread(bb, 1, sizeof(bb), fb);
+    equal = na == nb && memcmp(ba, bb, na) == 0;
+    if (na < sizeof(ba)) {
+      break;
+    }
+  }
+  if (fa) {
+    fclose(fa);
+  }
+  if (fb) {
+    fclose(fb);
+  }
+  return equal;
+}
+
+// One-time conversion of a legacy /data/weights/<id>.json array, pulled
+// element by element. The series is built in <id>.wts.mig and renamed into
+// place, so an existing series is never truncated: if one is already there,
+// the migration only completes when it is the output of an interrupted run
+// (same bytes); otherwise both files are kept and appends are refused.
+// Caller holds the FS write lock.
+static esp_err_t migrate_legacy_weights(const char *reptile_id,
+                                        const char *wts_file) {
+  char json_path[128];
+  snprintf(json_path, sizeof(json_path), DATA_MANAGER_ROOT "/weights/%s.json",
+           reptile_id);
+  if (access(json_path, F_OK) != 0) {
+    return ESP_OK;
+  }
+
+  char tmp_path[136];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.mig", wts_file);
+  FILE *in = fopen(json_path, "rb");
+  weight_migration_t m = {.f = fopen(tmp_path, "wb"), .ok = true};
+  esp_err_t err = ESP_FAIL;
+  if (in && m.f) {
+    weight_sample_t sample;
+    legacy_sample_reset(&sample);
+    err = json_decode_array_file(
+        in, s_legacy_weight_fields,
+        sizeof(s_legacy_weight_fields) / sizeof(s_legacy_weight_fields[0]),
+        &sample, migrate_json_weight, &m);
+    if (err == ESP_OK && m.open_block) {
+      m.block.h.crc32 = wts_block_crc(&m.block);
+      m.ok = fwrite(&m.block, 1, sizeof(m.block), m.f) == sizeof(m.block);
+    }
+  }
+  if (in) {
+    fclose(in);
+  }
+  if (m.f && fclose(m.f) != 0) {
+    m.ok = false;
+  }
+  if (err == ESP_OK && !m.ok) {
+    err = ESP_FAIL;
+  }
+
+  if (err == ESP_OK && access(wts_file, F_OK) == 0) {
+    if (files_equal(tmp_path, wts_file)) {
+      unlink(tmp_path);
+    } else {
+      ESP_LOGE(TAG, "%s and %s both exist, not merging them", json_path,
+               wts_file);
+      err = ESP_ERR_INVALID_STATE;
+    }
+  } else if (err == ESP_OK && rename(tmp_path, wts_file) != 0) {
+    err = ESP_FAIL;
+  }
+
+  if (err == ESP_OK) {
+    unlink(json_path);
+    ESP_LOGI(TAG, "Migrated %u legacy weights for %s", (unsigned)m.migrated,
+             reptile_id);
+  } else {
+    unlink(tmp_path);
+    ESP_LOGE(TAG, "Weight migration failed for %s, %s kept", reptile_id,
+             json_path);
+  }
+  return err;
+}
+
+void weight_series_remove_unlocked(const char *reptile_id) {
+  char path[128];
+  wts_path(reptile_id, path, sizeof(path));
+  char tmp_path[136];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.mig", path); // Interrupted
+  unlink(path);
+  unlink(tmp_path);
+  snprintf(path, sizeof(path), DATA_MANAGER_ROOT "/weights/%s.json",
+           reptile_id);
+  unlink(path);
+}
+
+// Reader-side variant: the conversion rewrites files, so the write lock is
+// only taken when a legacy file is actually present.
+static void migrate_legacy_weights_exclusive(const char *reptile_id,
+                                             const char *wts_file) {
+  char json_path[128];
+  snprintf(json_path, sizeof(json_path), DATA_MANAGER_ROOT "/weights/%s.json",
+           reptile_id);
+  if (access(json_path, F_OK) != 0) {
+    return;
+  }
+  if (data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    (void)migrate_legacy_weights(reptile_id, wts_file);
+    data_fs_write_unlock();
+  }
+}
+
+// Seals a block and writes it at pos, or stages it in the transaction.
+static bool wts_put_block(FILE *f, storage_txn_t *txn, const char *path,
+                          long pos, wts_block_t *block) {
+  block->h.crc32 = wts_block_crc(block);
+  if (txn) {
+    return storage_txn_write(txn, path, (uint32_t)pos, block,
+                             sizeof(*block)) == ESP_OK;
+  }
+  return fseek(f, pos, SEEK_SET) == 0 &&
+         fwrite(block, 1, sizeof(*block), f) == sizeof(*block);
+}
+
+esp_err_t weight_append_unlocked(storage_txn_t *txn, const char *reptile_id,
+                                 const weight_sample_t *samples, size_t count) {
+  char path[128];
+  wts_path(reptile_id, path, sizeof(path));
+  esp_err_t err = migrate_legacy_weights(reptile_id, path);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  // A transaction only reads the tail block here.
+  FILE *f = fopen(path, txn ? "rb" : "r+b");
+  if (!f && !txn) {
+    f = fopen(path, "w+b");
+    if (!f) {
+      ESP_LOGE(TAG, "Failed to open %s", path);
+      return ESP_FAIL;
+    }
+  }
+
+  // A torn tail block (size not a multiple of the block size) is overwritten.
+  long size = 0;
+  if (f) {
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+  }
+  long offset = (size / WTS_BLOCK_SIZE) * WTS_BLOCK_SIZE;
+
+  // The tail block is read once and each block is written once it is full
+  // (or at the end), so n samples cost one read and about n / 40 writes.
+  wts_block_t block;
+  bool open_block = false;
+  int64_t t0 = dm_metrics_now();
+  size_t bytes_read = 0;
+  size_t bytes_written = 0;
+  if (f && offset >= WTS_BLOCK_SIZE) {
+    fseek(f, offset - WTS_BLOCK_SIZE, SEEK_SET);
+    bytes_read = fread(&block, 1, sizeof(block), f);
+    if (bytes_read == sizeof(block) && wts_block_valid(&block)) {
+      offset -= WTS_BLOCK_SIZE;
+      open_block = true;
+    }
+  }
+
+  bool dirty = false; // The open block differs from its copy on flash
+  for (size_t i = 0; i < count && err == ESP_OK; i++) {
+    int32_t value = to_fixed(samples[i].weight);
+    if (open_block && wts_block_append(&block, samples[i].timestamp, value)) {
+      dirty = true;
+      continue;
+    }
+    if (dirty) {
+      if (!wts_put_block(f, txn, path, offset, &block)) {
+        err = ESP_FAIL;
+      }
+      bytes_written += sizeof(block);
+    }
+    if (open_block) {
+      offset += WTS_BLOCK_SIZE; // A full tail block is left as is
+    }
+    wts_block_start(&block, samples[i].timestamp, value);
+    open_block = true;
+    dirty = true;
+  }
+  if (err == ESP_OK && dirty) {
+    if (!wts_put_block(f, txn, path, offset, &block)) {
+      err = ESP_FAIL;
+    }
+    bytes_written += sizeof(block);
+  }
+  if (f && fclose(f) != 0 && err == ESP_OK) {
+    err = ESP_FAIL;
+  }
+  // Block encoding is a few integer ops per sample: all of it is I/O.
+  dm_op_io(t0, bytes_read, txn ? 0 : bytes_written);
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Short write on %s", path);
+    return err;
+  }
+  if (!txn) {
+    aggregate_apply_weights_unlocked(reptile_id, samples, count);
+  }
+  return ESP_OK;
+}
+
+esp_err_t data_manager_add_weight(const char *reptile_id, float weight,
+                                  int64_t timestamp) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_WEIGHT_APPEND);
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!reptile_id) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  if (!data_fs_write_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot add weight for %s", reptile_id);
+    return ESP_ERR_TIMEOUT;
+  }
+  weight_sample_t sample = {.timestamp = timestamp, .weight = weight};
+  esp_err_t err = weight_append_unlocked(NULL, reptile_id, &sample, 1);
+  data_fs_write_unlock();
+
+  // A back-filled weighing leaves the summary on the latest one.
+  float current = weight;
+  if (err == ESP_OK && aggregate_current_weight(reptile_id, &current)) {
+    data_manager_index_set_weight(reptile_id, current);
+  }
+  if (err == ESP_OK) {
+    change_log_record(DATA_MANAGER_ENTITY_WEIGHTS, DATA_MANAGER_CHANGE_PUT,
+                      reptile_id);
+  }
+  return err;
+}
+
+// Walks the blocks overlapping [from, to]. When stats is non-NULL, blocks
+// fully inside the range contribute their header aggregates without being
+// decoded; otherwise every matching sample is passed to cb.
+static esp_err_t wts_scan(const char *reptile_id, int64_t from, int64_t to,
+                          data_manager_weight_cb_t cb, void *user_ctx,
+                          weight_stats_t *stats, int64_t *stats_sum) {
+  if (!storage_ready_guard(__func__)) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  if (!reptile_id) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  char path[128];
+  wts_path(reptile_id, path, sizeof(path));
+  migrate_legacy_weights_exclusive(reptile_id, path);
+  if (!data_fs_read_lock(pdMS_TO_TICKS(2000))) {
+    ESP_LOGE(TAG, "FS busy, cannot read %s", path);
+    return ESP_ERR_TIMEOUT;
+  }
+
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    data_fs_read_unlock();
+    return ESP_OK; // No weighings yet
+  }
+
+  wts_block_t block;
+  for (;;) {
+    int64_t t0 = dm_metrics_now();
+    size_t got = fread(&block, 1, sizeof(block), f);
+    dm_op_io(t0, got, 0);
+    if (got != sizeof(block)) {
+      break;
+    }
+    if (!wts_block_valid(&block)) {
+      ESP_LOGW(TAG, "%s: skipping corrupt block", path);
+      continue;
+    }
+    if (block.h.last_ts < from || block.h.first_ts > to) {
+      continue;
+    }
+    if (stats && block.h.first_ts >= from && block.h.last_ts <= to) {
+      if (stats->count == 0 || from_fixed(block.h.min_value) < stats->min) {
+        stats->min = from_fixed(block.h.min_value);
+      }
+      if (stats->count == 0 || from_fixed(block.h.max_value) > stats->max) {
+        stats->max = from_fixed(block.h.max_value);
+      }
+      if (stats->count == 0 || block.h.first_ts < stats->first_ts) {
+        stats->first_ts = block.h.first_ts;
+      }
+      if (stats->count == 0 || block.h.last_ts > stats->last_ts) {
+        stats->last_ts = block.h.last_ts;
+        stats->last = from_fixed(block.h.last_value);
+      }
+      stats->count += block.h.count;
+      *stats_sum += block.h.sum;
+      continue;
+    }
+    // Decoding includes the callbacks of the samples it emits.
+    t0 = dm_metrics_now();
+    bool more = wts_block_decode(&block, from, to, cb, user_ctx);
+    dm_op_parse(t0);
+    if (!more) {
+      break;
+    }
+  }
+  fclose(f);
+  data_fs_read_unlock();
+  return ESP_OK;
+}
+
+esp_err_t data_manager_query_weights(const char *reptile_id, int64_t from,
+                                     int64_t to, data_manager_weight_cb_t cb,
+                                     void *user_ctx) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_WEIGHT_READ);
+  if (!cb) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  return wts_scan(reptile_id, from, to, cb, user_ctx, NULL, NULL);
+}
+
+typedef struct {
+  weight_stats_t *stats;
+  int64_t *sum;
+} stats_ctx_t;
+
+static bool accumulate_stats(const weight_sample_t *sample, void *user_ctx) {
+  stats_ctx_t *ctx = (stats_ctx_t *)user_ctx;
+  weight_stats_t *s = ctx->stats;
+  if (s->count == 0 || sample->weight < s->min) {
+    s->min = sample->weight;
+  }
+  if (s->count == 0 || sample->weight > s->max) {
+    s->max = sample->weight;
+  }
+  if (s->count == 0 || sample->timestamp < s->first_ts) {
+    s->first_ts = sample->timestamp;
+  }
+  if (s->count == 0 || sample->timestamp >= s->last_ts) {
+    s->last_ts = sample->timestamp;
+    s->last = sample->weight;
+  }
+  s->count++;
+  *ctx->sum += to_fixed(sample->weight);
+  return true;
+}
+
+esp_err_t data_manager_get_weight_stats(const char *reptile_id, int64_t from,
+                                        int64_t to, weight_stats_t *out) {
+  DM_OP_SCOPE(DATA_MANAGER_OP_WEIGHT_READ);
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  memset(out, 0, sizeof(*out));
+  int64_t sum = 0;
+  stats_ctx_t ctx = {.stats = out, .sum = &sum};
+  esp_err_t err =
+      wts_scan(reptile_id, from, to, accumulate_stats, &ctx, out, &sum);
+  if (err == ESP_OK && out->count > 0) {
+    out->avg = from_fixed(sum) / (float)out->count;
+  }
+  return err;
+}
+
+static bool append_weight_json(const weight_sample_t *sample, void *user_ctx) {
+  cJSON *arr = (cJSON *)user_ctx;
+  cJSON *w_obj = cJSON_CreateObject();
+  if (!w_obj) {
+    return false;
+  }
+  cJSON_AddNumberToObject(w_obj, "weight", sample->weight);
+  cJSON_AddNumberToObject(w_obj, "timestamp", (double)sample->timestamp);
+  cJSON_AddItemToArray(arr, w_obj);
+  return true;
+}
+
+cJSON *data_manager_get_weights(const char *reptile_id) {
+  if (!storage_ready_guard(__func__)) {
+    return NULL;
+  }
+  cJSON *arr = cJSON_CreateArray();
+  if (!arr) {
+    ESP_LOGE(TAG, "Failed to allocate weights array for %s", reptile_id);
+    return NULL;
+  }
+  data_manager_query_weights(reptile_id, INT64_MIN, INT64_MAX,
+                             append_weight_json, arr);
+  return arr;
+}
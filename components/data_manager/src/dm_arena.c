@@ -0,0 +1,247 @@
+#include "dm_arena.h"
+#include "data_manager.h"
+
+#if CONFIG_ARS_DATA_ARENA
+
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#define ARENA_ALIGN 8
+#define ARENA_CHUNK_SIZE CONFIG_ARS_DATA_ARENA_CHUNK_SIZE
+// Bigger requests get a chunk of their own, released as soon as they are
+// freed, instead of wasting the tail of the current chunk.
+#define ARENA_BIG_ALLOC (ARENA_CHUNK_SIZE / 4)
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size; // Usable bytes in data[]
+  size_t used;
+  bool dedicated; // Holds one big allocation
+  uint8_t data[] __attribute__((aligned(ARENA_ALIGN)));
+} arena_chunk_t;
+
+typedef struct {
+  TaskHandle_t owner; // NULL while the slot is free
+  uint32_t depth;
+  arena_chunk_t *chunks; // Head is the chunk being bumped
+  void *last;            // Most recent allocation, for LIFO frees
+  size_t bytes;          // Footprint of the current scope
+  size_t peak;
+  uint32_t allocs;
+  uint32_t chunk_allocs;
+} arena_slot_t;
+
+static arena_slot_t s_slots[CONFIG_ARS_DATA_ARENA_SLOTS];
+static portMUX_TYPE s_mux = portMUX_INITIALIZER_UNLOCKED;
+static data_manager_arena_stats_t s_stats;
+
+static void *heap_alloc(size_t size) {
+#if CONFIG_ARS_DATA_ARENA_PSRAM
+  return heap_caps_malloc_prefer(size, 2, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT,
+                                 MALLOC_CAP_DEFAULT);
+#else
+  return malloc(size);
+#endif
+}
+
+// The owner field is only ever set to a task's own handle by that task, so
+// looking for ourselves needs no lock.
+static arena_slot_t *current_slot(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (size_t i = 0; i < CONFIG_ARS_DATA_ARENA_SLOTS; i++) {
+    if (s_slots[i].owner == self) {
+      return &s_slots[i];
+    }
+  }
+  return NULL;
+}
+
+static arena_chunk_t *chunk_new(arena_slot_t *slot, size_t size,
+                                bool dedicated) {
+  arena_chunk_t *c = heap_alloc(sizeof(arena_chunk_t) + size);
+  if (!c) {
+    return NULL;
+  }
+  c->size = size;
+  c->used = 0;
+  c->dedicated = dedicated;
+  slot->chunk_allocs++;
+  return c;
+}
+
+static void slot_account(arena_slot_t *slot, size_t size) {
+  slot->bytes += size;
+  slot->allocs++;
+  if (slot->bytes > slot->peak) {
+    slot->peak = slot->bytes;
+  }
+}
+
+void *dm_arena_alloc(size_t size) {
+  arena_slot_t *slot = current_slot();
+  if (!slot) {
+    portENTER_CRITICAL(&s_mux);
+    s_stats.heap_allocs++;
+    portEXIT_CRITICAL(&s_mux);
+    return heap_alloc(size);
+  }
+  size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+  if (size > ARENA_BIG_ALLOC) {
+    arena_chunk_t *c = chunk_new(slot, size, true);
+    if (!c) {
+      return NULL;
+    }
+    // Kept behind the head so bumping continues in the current chunk.
+    if (slot->chunks) {
+      c->next = slot->chunks->next;
+      slot->chunks->next = c;
+    } else {
+      c->next = NULL;
+      slot->chunks = c;
+    }
+    c->used = size;
+    slot_account(slot, size);
+    return c->data;
+  }
+
+  arena_chunk_t *head = slot->chunks;
+  if (!head || head->dedicated || head->size - head->used < size) {
+    head = chunk_new(slot, ARENA_CHUNK_SIZE, false);
+    if (!head) {
+      return NULL;
+    }
+    head->next = slot->chunks;
+    slot->chunks = head;
+  }
+  void *p = head->data + head->used;
+  head->used += size;
+  slot->last = p;
+  slot_account(slot, size);
+  return p;
+}
+
+void dm_arena_free(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  arena_slot_t *slot = current_slot();
+  if (slot) {
+    arena_chunk_t **link = &slot->chunks;
+    for (arena_chunk_t *c = slot->chunks; c; link = &c->next, c = c->next) {
+      uint8_t *p = ptr;
+      if (p < c->data || p >= c->data + c->size) {
+        continue;
+      }
+      if (c->dedicated) {
+        slot->bytes -= c->used;
+        *link = c->next;
+        free(c);
+      } else if (ptr == slot->last && c == slot->chunks) {
+        size_t released = c->used - (size_t)(p - c->data);
+        c->used -= released;
+        slot->bytes -= released;
+        slot->last = NULL;
+      }
+      return;
+    }
+  }
+  free(ptr);
+}
+
+void dm_arena_begin(void) {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  arena_slot_t *slot = NULL;
+  portENTER_CRITICAL(&s_mux);
+  for (size_t i = 0; i < CONFIG_ARS_DATA_ARENA_SLOTS && !slot; i++) {
+    if (s_slots[i].owner == self) {
+      slot = &s_slots[i];
+    }
+  }
+  for (size_t i = 0; i < CONFIG_ARS_DATA_ARENA_SLOTS && !slot; i++) {
+    if (s_slots[i].owner == NULL) {
+      slot = &s_slots[i];
+      slot->owner = self;
+      s_stats.scopes++;
+    }
+  }
+  if (slot) {
+    slot->depth++;
+  } else {
+    s_stats.scope_misses++;
+  }
+  portEXIT_CRITICAL(&s_mux);
+}
+
+void dm_arena_end(void) {
+  arena_slot_t *slot = current_slot();
+  if (!slot || --slot->depth > 0) {
+    return;
+  }
+  // Keep one regular chunk for the next scope; release the rest.
+  arena_chunk_t *keep = NULL;
+  arena_chunk_t *c = slot->chunks;
+  while (c) {
+    arena_chunk_t *next = c->next;
+    if (!keep && !c->dedicated) {
+      keep = c;
+      keep->used = 0;
+      keep->next = NULL;
+    } else {
+      free(c);
+    }
+    c = next;
+  }
+  slot->chunks = keep;
+  slot->last = NULL;
+
+  portENTER_CRITICAL(&s_mux);
+  s_stats.arena_allocs += slot->allocs;
+  s_stats.chunk_allocs += slot->chunk_allocs;
+  if (slot->peak > s_stats.peak_scope_bytes) {
+    s_stats.peak_scope_bytes = (uint32_t)slot->peak;
+  }
+  slot->bytes = 0;
+  slot->peak = 0;
+  slot->allocs = 0;
+  slot->chunk_allocs = 0;
+  slot->owner = NULL;
+  portEXIT_CRITICAL(&s_mux);
+}
+
+void dm_arena_init(void) {
+  // Process-wide: other components' cJSON calls run outside any scope and
+  // simply land on the (PSRAM-preferring) heap.
+  cJSON_Hooks hooks = {.malloc_fn = dm_arena_alloc, .free_fn = dm_arena_free};
+  cJSON_InitHooks(&hooks);
+}
+
+esp_err_t data_manager_get_arena_stats(data_manager_arena_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  portENTER_CRITICAL(&s_mux);
+  *out = s_stats;
+  portEXIT_CRITICAL(&s_mux);
+  return ESP_OK;
+}
+
+void data_manager_reset_arena_stats(void) {
+  portENTER_CRITICAL(&s_mux);
+  memset(&s_stats, 0, sizeof(s_stats));
+  portEXIT_CRITICAL(&s_mux);
+}
+
+#else // !CONFIG_ARS_DATA_ARENA
+
+esp_err_t data_manager_get_arena_stats(data_manager_arena_stats_t *out) {
+  return ESP_ERR_NOT_SUPPORTED;
+}
+
+void data_manager_reset_arena_stats(void) {}
+
+#endif
@@ -0,0 +1,40 @@
+#pragma once
+
+// Per-operation bump allocator for transient buffers and cJSON nodes.
+//
+// dm_arena_begin() binds an arena to the calling task; until the matching
+// dm_arena_end(), dm_arena_alloc() and every cJSON allocation made by that
+// task are carved out of the arena's chunks, and dm_arena_end() releases
+// them all at once. Outside a scope (or when every arena is taken) the same
+// calls go to the heap, so code can use them unconditionally.
+//
+// Nothing allocated inside a scope may outlive it or be handed to another
+// task: no cJSON tree returned to a caller is ever built under a scope.
+// Callers still free what they allocate (cheap on an arena), so the code
+// stays correct with CONFIG_ARS_DATA_ARENA off. Scopes nest within a task;
+// only the outermost end() resets.
+
+#include "sdkconfig.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+#if CONFIG_ARS_DATA_ARENA
+
+void dm_arena_init(void); // Installs the cJSON hooks
+void dm_arena_begin(void);
+void dm_arena_end(void);
+void *dm_arena_alloc(size_t size);
+// Frees heap pointers. Arena pointers are released only when they are the
+// last allocation of their scope (the bump pointer rolls back) or live in a
+// chunk of their own; anything else waits for dm_arena_end().
+void dm_arena_free(void *ptr);
+
+#else
+
+static inline void dm_arena_init(void) {}
+static inline void dm_arena_begin(void) {}
+static inline void dm_arena_end(void) {}
+static inline void *dm_arena_alloc(size_t size) { return malloc(size); }
+static inline void dm_arena_free(void *ptr) { free(ptr); }
+
+#endif
@@ -0,0 +1,357 @@
+#include "json_reader.h"
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define JSON_READER_MAX_KEY 32
+#define JSON_READER_MAX_NUMBER 40
+
+typedef struct {
+  FILE *f; // NULL when decoding from memory
+  const char *data;
+  size_t len;
+  size_t pos;
+  char chunk[JSON_READER_CHUNK_SIZE];
+} json_reader_t;
+
+static int jr_peek(json_reader_t *r) {
+  if (r->pos == r->len) {
+    if (!r->f) {
+      return -1;
+    }
+    r->len = fread(r->chunk, 1, sizeof(r->chunk), r->f);
+    r->data = r->chunk;
+    r->pos = 0;
+    if (r->len == 0) {
+      return -1;
+    }
+  }
+  return (unsigned char)r->data[r->pos];
+}
+
+static int jr_get(json_reader_t *r) {
+  int c = jr_peek(r);
+  if (c >= 0) {
+    r->pos++;
+  }
+  return c;
+}
+
+static int jr_skip_ws(json_reader_t *r) {
+  int c;
+  while ((c = jr_peek(r)) == ' ' || c == '\t' || c == '\n' || c == '\r') {
+    r->pos++;
+  }
+  return c;
+}
+
+// Bounded output for string values; dst == NULL discards.
+typedef struct {
+  char *dst;
+  size_t size;
+  size_t used;
+  bool truncated;
+} jr_out_t;
+
+static void out_put(jr_out_t *o, char c) {
+  if (!o->dst) {
+    return;
+  }
+  if (o->used + 1 < o->size) {
+    o->dst[o->used++] = c;
+  } else {
+    o->truncated = true;
+  }
+}
+
+static bool jr_hex4(json_reader_t *r, uint32_t *out) {
+  uint32_t v = 0;
+  for (int i = 0; i < 4; i++) {
+    int c = jr_get(r);
+    v <<= 4;
+    if (c >= '0' && c <= '9') {
+      v |= (uint32_t)(c - '0');
+    } else if (c >= 'a' && c <= 'f') {
+      v |= (uint32_t)(c - 'a' + 10);
+    } else if (c >= 'A' && c <= 'F') {
+      v |= (uint32_t)(c - 'A' + 10);
+    } else {
+      return false;
+    }
+  }
+  *out = v;
+  return true;
+}
+
+static bool jr_unicode_escape(json_reader_t *r, jr_out_t *o) {
+  uint32_t cp;
+  if (!jr_hex4(r, &cp)) {
+    return false;
+  }
+  if (cp >= 0xD800 && cp <= 0xDBFF) {
+    uint32_t lo;
+    if (jr_get(r) != '\\' || jr_get(r) != 'u' || !jr_hex4(r, &lo) ||
+        lo < 0xDC00 || lo > 0xDFFF) {
+      return false;
+    }
+    cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+  } else if (cp >= 0xDC00 && cp <= 0xDFFF) {
+    return false;
+  }
+  if (cp < 0x80) {
+    out_put(o, (char)cp);
+  } else if (cp < 0x800) {
+    out_put(o, (char)(0xC0 | (cp >> 6)));
+    out_put(o, (char)(0x80 | (cp & 0x3F)));
+  } else if (cp < 0x10000) {
+    out_put(o, (char)(0xE0 | (cp >> 12)));
+    out_put(o, (char)(0x80 | ((cp >> 6) & 0x3F)));
+    out_put(o, (char)(0x80 | (cp & 0x3F)));
+  } else {
+    out_put(o, (char)(0xF0 | (cp >> 18)));
+    out_put(o, (char)(0x80 | ((cp >> 12) & 0x3F)));
+    out_put(o, (char)(0x80 | ((cp >> 6) & 0x3F)));
+    out_put(o, (char)(0x80 | (cp & 0x3F)));
+  }
+  return true;
+}
+
+// Reads a string body; the opening quote has already been consumed.
+static bool jr_string(json_reader_t *r, jr_out_t *o) {
+  for (;;) {
+    int c = jr_get(r);
+    if (c < 0x20) { // Also catches end of input (-1)
+      return false;
+    }
+    if (c == '"') {
+      break;
+    }
+    if (c != '\\') {
+      out_put(o, (char)c);
+      continue;
+    }
+    c = jr_get(r);
+    switch (c) {
+    case '"':
+    case '\\':
+    case '/':
+      out_put(o, (char)c);
+      break;
+    case 'b':
+      out_put(o, '\b');
+      break;
+    case 'f':
+      out_put(o, '\f');
+      break;
+    case 'n':
+      out_put(o, '\n');
+      break;
+    case 'r':
+      out_put(o, '\r');
+      break;
+    case 't':
+      out_put(o, '\t');
+      break;
+    case 'u':
+      if (!jr_unicode_escape(r, o)) {
+        return false;
+      }
+      break;
+    default:
+      return false;
+    }
+  }
+  if (o->dst && o->size > 0) {
+    o->dst[o->used] = '\0';
+  }
+  return true;
+}
+
+static bool is_scalar_char(int c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') ||
+         (c >= 'A' && c <= 'Z') || c == '-' || c == '+' || c == '.';
+}
+
+// Copies a bare token (number or literal) into buf.
+static bool jr_scalar(json_reader_t *r, char *buf, size_t size) {
+  size_t n = 0;
+  int c;
+  while ((c = jr_peek(r)) >= 0 && is_scalar_char(c)) {
+    if (n + 1 >= size) {
+      return false;
+    }
+    buf[n++] = (char)c;
+    r->pos++;
+  }
+  buf[n] = '\0';
+  return n > 0;
+}
+
+static bool jr_skip_value(json_reader_t *r) {
+  int depth = 0;
+  do {
+    int c = jr_skip_ws(r);
+    if (c < 0) {
+      return false;
+    }
+    if (c == '"') {
+      r->pos++;
+      jr_out_t discard = {0};
+      if (!jr_string(r, &discard)) {
+        return false;
+      }
+    } else if (c == '{' || c == '[') {
+      r->pos++;
+      depth++;
+    } else if (c == '}' || c == ']' || c == ',' || c == ':') {
+      if (depth == 0) {
+        return false;
+      }
+      r->pos++;
+      if (c == '}' || c == ']') {
+        depth--;
+      }
+    } else {
+      char token[JSON_READER_MAX_NUMBER];
+      if (!jr_scalar(r, token, sizeof(token))) {
+        return false;
+      }
+    }
+  } while (depth > 0);
+  return true;
+}
+
+static bool jr_number(json_reader_t *r, const record_field_t *field,
+                      void *obj) {
+  char token[JSON_READER_MAX_NUMBER];
+  if (!jr_scalar(r, token, sizeof(token))) {
+    return false;
+  }
+  char *end = NULL;
+  double d = strtod(token, &end);
+  if (*end != '\0') {
+    return false;
+  }
+  if (field->type == RECORD_FIELD_FLOAT) {
+    record_field_set_float(field, obj, d);
+  } else if (strpbrk(token, ".eE")) {
+    record_field_set_int(field, obj, (int64_t)d);
+  } else {
+    record_field_set_int(field, obj, strtoll(token, NULL, 10));
+  }
+  return true;
+}
+
+static const record_field_t *find_field(const record_field_t *fields,
+                                        size_t count, const char *key) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(fields[i].name, key) == 0) {
+      return &fields[i];
+    }
+  }
+  return NULL;
+}
+
+static esp_err_t jr_decode(json_reader_t *r, const record_field_t *fields,
+                           size_t count, void *out) {
+  if (jr_skip_ws(r) != '{') {
+    return ESP_FAIL;
+  }
+  r->pos++;
+  if (jr_skip_ws(r) == '}') {
+    return ESP_OK;
+  }
+
+  for (;;) {
+    if (jr_skip_ws(r) != '"') {
+      return ESP_FAIL;
+    }
+    r->pos++;
+    char key[JSON_READER_MAX_KEY];
+    jr_out_t key_out = {.dst = key, .size = sizeof(key)};
+    if (!jr_string(r, &key_out) || jr_skip_ws(r) != ':') {
+      return ESP_FAIL;
+    }
+    r->pos++;
+
+    // A truncated key cannot be one of ours.
+    const record_field_t *field =
+        key_out.truncated ? NULL : find_field(fields, count, key);
+    int c = jr_skip_ws(r);
+    bool ok;
+    if (field && field->type == RECORD_FIELD_STRING && c == '"') {
+      r->pos++;
+      jr_out_t value = {.dst = (char *)out + field->offset,
+                        .size = field->size};
+      ok = jr_string(r, &value);
+    } else if (field && field->type != RECORD_FIELD_STRING &&
+               (c == '-' || (c >= '0' && c <= '9'))) {
+      ok = jr_number(r, field, out);
+    } else {
+      ok = jr_skip_value(r);
+    }
+    if (!ok) {
+      return ESP_FAIL;
+    }
+
+    c = jr_skip_ws(r);
+    if (c != ',' && c != '}') {
+      return ESP_FAIL;
+    }
+    r->pos++;
+    if (c == '}') {
+      return ESP_OK;
+    }
+  }
+}
+
+esp_err_t json_decode_file(FILE *f, const record_field_t *fields,
+                           size_t count, void *out) {
+  if (!f || !fields || !out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  json_reader_t r = {.f = f};
+  return jr_decode(&r, fields, count, out);
+}
+
+esp_err_t json_decode_buffer(const char *data, size_t len,
+                             const record_field_t *fields, size_t count,
+                             void *out) {
+  if (!data || !fields || !out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  json_reader_t r = {.data = data, .len = len};
+  return jr_decode(&r, fields, count, out);
+}
+
+esp_err_t json_decode_array_file(FILE *f, const record_field_t *fields,
+                                 size_t count, void *out,
+                                 json_element_cb_t cb, void *user_ctx) {
+  if (!f || !fields || !out || !cb) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  json_reader_t r = {.f = f};
+  if (jr_skip_ws(&r) != '[') {
+    return ESP_FAIL;
+  }
+  r.pos++;
+  if (jr_skip_ws(&r) == ']') {
+    return ESP_OK;
+  }
+  for (;;) {
+    if (jr_decode(&r, fields, count, out) != ESP_OK) {
+      return ESP_FAIL;
+    }
+    if (!cb(out, user_ctx)) {
+      return ESP_ERR_INVALID_STATE;
+    }
+    int c = jr_skip_ws(&r);
+    if (c != ',' && c != ']') {
+      return ESP_FAIL;
+    }
+    r.pos++;
+    if (c == ']') {
+      return ESP_OK;
+    }
+  }
+}
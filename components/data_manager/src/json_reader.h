@@ -0,0 +1,39 @@
+#pragma once
+
+// Schema-driven pull decoder for flat JSON records. A static field table
+// (record_schema.h) maps member names to offsets in the destination struct;
+// the decoder walks the input once and stores matching values in place. No
+// DOM, no heap: input is pulled in JSON_READER_CHUNK_SIZE pieces, so file
+// size is not bounded.
+//
+// Only top-level members are matched. Unknown keys, nested values and values
+// whose JSON type does not fit the field are skipped. Fields absent from the
+// input are left untouched. On a syntax error the destination may already be
+// partially filled.
+
+#include "esp_err.h"
+#include "record_schema.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define JSON_READER_CHUNK_SIZE 256
+
+esp_err_t json_decode_file(FILE *f, const record_field_t *fields,
+                           size_t count, void *out);
+esp_err_t json_decode_buffer(const char *data, size_t len,
+                             const record_field_t *fields, size_t count,
+                             void *out);
+
+// Called once per element of a top-level array, with out holding the decoded
+// element. Return false to stop. The decoder never resets out between
+// elements: fields absent from an element keep whatever the callback left.
+typedef bool (*json_element_cb_t)(void *out, void *user_ctx);
+
+// Streams a top-level array of flat objects. ESP_OK once the closing bracket
+// is read, ESP_ERR_INVALID_STATE when cb stopped, ESP_FAIL on a syntax error
+// or an element that is not an object.
+esp_err_t json_decode_array_file(FILE *f, const record_field_t *fields,
+                                 size_t count, void *out,
+                                 json_element_cb_t cb, void *user_ctx);
@@ -0,0 +1,238 @@
+#include "json_writer.h"
+#include <inttypes.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t file_sink(const char *data, size_t len, void *ctx) {
+  return fwrite(data, 1, len, (FILE *)ctx);
+}
+
+void json_writer_init(json_writer_t *w, json_sink_t sink, void *ctx) {
+  memset(w, 0, offsetof(json_writer_t, buf));
+  w->sink = sink;
+  w->ctx = ctx;
+  w->failed = (sink == NULL);
+}
+
+void json_writer_init_file(json_writer_t *w, FILE *f) {
+  json_writer_init(w, f ? file_sink : NULL, f);
+}
+
+static void jw_flush(json_writer_t *w) {
+  if (w->used == 0 || w->failed) {
+    w->used = 0;
+    return;
+  }
+  if (w->sink(w->buf, w->used, w->ctx) != w->used) {
+    w->failed = true;
+  }
+  w->used = 0;
+}
+
+static void jw_put(json_writer_t *w, const char *data, size_t len) {
+  while (len > 0 && !w->failed) {
+    size_t room = sizeof(w->buf) - w->used;
+    if (room == 0) {
+      jw_flush(w);
+      continue;
+    }
+    size_t n = len < room ? len : room;
+    memcpy(w->buf + w->used, data, n);
+    w->used += n;
+    data += n;
+    len -= n;
+  }
+}
+
+static inline void jw_putc(json_writer_t *w, char c) {
+  if (w->used == sizeof(w->buf)) {
+    jw_flush(w);
+  }
+  if (!w->failed) {
+    w->buf[w->used++] = c;
+  }
+}
+
+// Emits the separator owed before a value at the current level.
+static void jw_value_prefix(json_writer_t *w) {
+  if (w->after_key) {
+    w->after_key = false;
+    return;
+  }
+  if (w->depth > 0) {
+    uint32_t bit = 1u << (w->depth - 1);
+    if (w->has_items & bit) {
+      jw_putc(w, ',');
+    }
+    w->has_items |= bit;
+  }
+}
+
+static void jw_open(json_writer_t *w, char c) {
+  if (w->failed) {
+    return;
+  }
+  if (w->depth >= JSON_WRITER_MAX_DEPTH) {
+    w->failed = true;
+    return;
+  }
+  jw_value_prefix(w);
+  jw_putc(w, c);
+  w->depth++;
+  w->has_items &= ~(1u << (w->depth - 1));
+}
+
+static void jw_close(json_writer_t *w, char c) {
+  if (w->failed) {
+    return;
+  }
+  if (w->depth == 0 || w->after_key) {
+    w->failed = true;
+    return;
+  }
+  w->depth--;
+  jw_putc(w, c);
+}
+
+void json_writer_begin_object(json_writer_t *w) { jw_open(w, '{'); }
+void json_writer_end_object(json_writer_t *w) { jw_close(w, '}'); }
+void json_writer_begin_array(json_writer_t *w) { jw_open(w, '['); }
+void json_writer_end_array(json_writer_t *w) { jw_close(w, ']'); }
+
+// Same escaping rules as cJSON: quotes, backslash, the usual short control
+// escapes and \u00XX for the rest below 0x20. UTF-8 passes through as-is.
+static void jw_quoted(json_writer_t *w, const char *s) {
+  jw_putc(w, '"');
+  const char *run = s;
+  for (; *s; s++) {
+    unsigned char c = (unsigned char)*s;
+    char esc = 0;
+    switch (c) {
+    case '"':
+      esc = '"';
+      break;
+    case '\\':
+      esc = '\\';
+      break;
+    case '\b':
+      esc = 'b';
+      break;
+    case '\f':
+      esc = 'f';
+      break;
+    case '\n':
+      esc = 'n';
+      break;
+    case '\r':
+      esc = 'r';
+      break;
+    case '\t':
+      esc = 't';
+      break;
+    default:
+      if (c >= 0x20) {
+        continue;
+      }
+      break;
+    }
+    jw_put(w, run, (size_t)(s - run));
+    run = s + 1;
+    if (esc) {
+      char pair[2] = {'\\', esc};
+      jw_put(w, pair, sizeof(pair));
+    } else {
+      char hex[7];
+      snprintf(hex, sizeof(hex), "\\u%04x", c);
+      jw_put(w, hex, 6);
+    }
+  }
+  jw_put(w, run, (size_t)(s - run));
+  jw_putc(w, '"');
+}
+
+void json_writer_key(json_writer_t *w, const char *key) {
+  if (w->failed) {
+    return;
+  }
+  if (w->depth == 0 || w->after_key) {
+    w->failed = true;
+    return;
+  }
+  jw_value_prefix(w);
+  jw_quoted(w, key ? key : "");
+  jw_putc(w, ':');
+  w->after_key = true;
+}
+
+void json_writer_string(json_writer_t *w, const char *value) {
+  if (w->failed) {
+    return;
+  }
+  jw_value_prefix(w);
+  jw_quoted(w, value ? value : "");
+}
+
+static void jw_raw_value(json_writer_t *w, const char *text, size_t len) {
+  if (w->failed) {
+    return;
+  }
+  jw_value_prefix(w);
+  jw_put(w, text, len);
+}
+
+void json_writer_number(json_writer_t *w, double value) {
+  char num[26];
+  int len;
+  if (isnan(value) || isinf(value)) {
+    len = snprintf(num, sizeof(num), "null");
+  } else if (value == (double)(int64_t)value && fabs(value) < 1e15) {
+    len = snprintf(num, sizeof(num), "%" PRId64, (int64_t)value);
+  } else {
+    // Shortest form that still round-trips, as cJSON does.
+    len = snprintf(num, sizeof(num), "%1.15g", value);
+    if (strtod(num, NULL) != value) {
+      len = snprintf(num, sizeof(num), "%1.17g", value);
+    }
+  }
+  jw_raw_value(w, num, (size_t)len);
+}
+
+void json_writer_int(json_writer_t *w, int64_t value) {
+  char num[24];
+  int len = snprintf(num, sizeof(num), "%" PRId64, value);
+  jw_raw_value(w, num, (size_t)len);
+}
+
+void json_writer_bool(json_writer_t *w, bool value) {
+  jw_raw_value(w, value ? "true" : "false", value ? 4 : 5);
+}
+
+void json_writer_null(json_writer_t *w) { jw_raw_value(w, "null", 4); }
+
+void json_writer_kv_string(json_writer_t *w, const char *key,
+                           const char *value) {
+  json_writer_key(w, key);
+  json_writer_string(w, value);
+}
+
+void json_writer_kv_number(json_writer_t *w, const char *key, double value) {
+  json_writer_key(w, key);
+  json_writer_number(w, value);
+}
+
+void json_writer_kv_int(json_writer_t *w, const char *key, int64_t value) {
+  json_writer_key(w, key);
+  json_writer_int(w, value);
+}
+
+esp_err_t json_writer_finish(json_writer_t *w) {
+  jw_flush(w);
+  if (w->failed) {
+    return ESP_FAIL;
+  }
+  if (w->depth != 0 || w->after_key) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  return ESP_OK;
+}
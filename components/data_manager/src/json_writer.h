@@ -0,0 +1,58 @@
+#pragma once
+
+// Streaming JSON writer. Emits tokens straight into a small fixed buffer
+// that is drained into a sink (FILE* or caller callback), so serialising a
+// record never builds a cJSON tree nor a full-size string on the heap.
+//
+// Errors are sticky: once a sink write fails or the nesting is invalid,
+// every later call is a no-op and json_writer_finish() reports the failure.
+
+#include "esp_err.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define JSON_WRITER_BUF_SIZE 256
+#define JSON_WRITER_MAX_DEPTH 16
+
+// Must consume all len bytes; a short count marks the writer as failed.
+typedef size_t (*json_sink_t)(const char *data, size_t len, void *ctx);
+
+typedef struct {
+  json_sink_t sink;
+  void *ctx;
+  size_t used;
+  uint32_t has_items; // Bit n: level n already holds a member
+  uint8_t depth;
+  bool after_key;
+  bool failed;
+  char buf[JSON_WRITER_BUF_SIZE];
+} json_writer_t;
+
+void json_writer_init(json_writer_t *w, json_sink_t sink, void *ctx);
+// The FILE* keeps its own buffering; callers may set it to _IONBF since the
+// writer already batches output.
+void json_writer_init_file(json_writer_t *w, FILE *f);
+
+void json_writer_begin_object(json_writer_t *w);
+void json_writer_end_object(json_writer_t *w);
+void json_writer_begin_array(json_writer_t *w);
+void json_writer_end_array(json_writer_t *w);
+
+void json_writer_key(json_writer_t *w, const char *key);
+void json_writer_string(json_writer_t *w, const char *value); // NULL -> ""
+void json_writer_number(json_writer_t *w, double value);
+void json_writer_int(json_writer_t *w, int64_t value);
+void json_writer_bool(json_writer_t *w, bool value);
+void json_writer_null(json_writer_t *w);
+
+// Object member shorthands.
+void json_writer_kv_string(json_writer_t *w, const char *key,
+                           const char *value);
+void json_writer_kv_number(json_writer_t *w, const char *key, double value);
+void json_writer_kv_int(json_writer_t *w, const char *key, int64_t value);
+
+// Flushes the buffer. ESP_ERR_INVALID_STATE if containers are still open,
+// ESP_FAIL if a sink write failed.
+esp_err_t json_writer_finish(json_writer_t *w);
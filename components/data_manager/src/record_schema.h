@@ -0,0 +1,121 @@
+#pragma once
+
+// Field tables describing flat records (reptile_t, document_t, contact_t).
+// Shared by the JSON decoder and the CBOR codec so each struct layout is
+// declared once. Tables are append-only: CBOR files use the field index as
+// map key, so reordering or removing an entry changes the on-flash format.
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+typedef enum {
+  RECORD_FIELD_STRING, // char[size], truncated to fit and NUL terminated
+  RECORD_FIELD_INT,    // Signed integer or enum of 1, 2, 4 or 8 bytes
+  RECORD_FIELD_FLOAT,  // float or double
+} record_field_type_t;
+
+typedef struct {
+  const char *name;
+  record_field_type_t type;
+  uint16_t offset;
+  uint16_t size;
+} record_field_t;
+
+// The field name (JSON key) is the struct member name.
+#define RECORD_FIELD(struct_type, member, field_type)                          \
+  {#member, field_type, offsetof(struct_type, member),                         \
+   sizeof(((struct_type *)0)->member)}
+
+static inline int64_t record_field_get_int(const record_field_t *field,
+                                           const void *obj) {
+  const uint8_t *p = (const uint8_t *)obj + field->offset;
+  switch (field->size) {
+  case 1: {
+    int8_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  case 2: {
+    int16_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  case 4: {
+    int32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  case 8: {
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  default:
+    return 0;
+  }
+}
+
+static inline void record_field_set_int(const record_field_t *field, void *obj,
+                                        int64_t value) {
+  uint8_t *p = (uint8_t *)obj + field->offset;
+  switch (field->size) {
+  case 1: {
+    int8_t v = (int8_t)value;
+    memcpy(p, &v, sizeof(v));
+    break;
+  }
+  case 2: {
+    int16_t v = (int16_t)value;
+    memcpy(p, &v, sizeof(v));
+    break;
+  }
+  case 4: {
+    int32_t v = (int32_t)value;
+    memcpy(p, &v, sizeof(v));
+    break;
+  }
+  case 8:
+    memcpy(p, &value, sizeof(value));
+    break;
+  default:
+    break;
+  }
+}
+
+static inline double record_field_get_float(const record_field_t *field,
+                                            const void *obj) {
+  const uint8_t *p = (const uint8_t *)obj + field->offset;
+  if (field->size == sizeof(float)) {
+    float v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+  }
+  double v = 0;
+  if (field->size == sizeof(double)) {
+    memcpy(&v, p, sizeof(v));
+  }
+  return v;
+}
+
+static inline void record_field_set_float(const record_field_t *field,
+                                          void *obj, double value) {
+  uint8_t *p = (uint8_t *)obj + field->offset;
+  if (field->size == sizeof(float)) {
+    float v = (float)value;
+    memcpy(p, &v, sizeof(v));
+  } else if (field->size == sizeof(double)) {
+    memcpy(p, &value, sizeof(value));
+  }
+}
+
+// Length of a string field, never reading past the member.
+static inline size_t record_field_strlen(const record_field_t *field,
+                                         const void *obj) {
+  const char *s = (const char *)obj + field->offset;
+  size_t n = 0;
+  while (n + 1 < field->size && s[n] != '\0') {
+    n++;
+  }
+  return n;
+}
@@ -0,0 +1,842 @@
+#include "search_index.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *TAG = "dm_search";
+
+#define SEARCH_FIELD_COUNT 4 // name, id, species, morph
+// Folding never lengthens a field, so the raw sizes bound the folded text.
+#define SEARCH_TEXT_MAX (MAX_NAME_LEN + MAX_ID_LEN + 2 * MAX_SPECIES_LEN)
+#define SEARCH_QUERY_MAX 128
+#define SEARCH_MAX_TERMS 8
+#define SEARCH_TERM_MAX 32
+#define SEARCH_ALPHABET 37 // Word boundary, a-z, 0-9
+#define SEARCH_TRIGRAMS (SEARCH_ALPHABET * SEARCH_ALPHABET * SEARCH_ALPHABET)
+// At most one trigram per letter plus one per word end.
+#define SEARCH_DOC_TRIGRAMS_MAX (SEARCH_TEXT_MAX + SEARCH_TEXT_MAX / 2 + 1)
+#define SEARCH_NO_SLOT UINT16_MAX
+#define SEARCH_MIN_DOCS 16
+#define SEARCH_MIN_BUCKETS 64
+
+// Field weights in ranking order: a hit on the name beats one on the morph.
+static const uint8_t s_field_weight[SEARCH_FIELD_COUNT] = {8, 4, 2, 1};
+
+enum {
+  MATCH_SUBSTRING = 1,
+  MATCH_PREFIX = 2,
+  MATCH_WORD = 3,
+};
+
+#define SEARCH_TERM_SCORE_MAX (MATCH_WORD * 8) // Whole word of the name
+#define SEARCH_SCORE_MAX (SEARCH_MAX_TERMS * SEARCH_TERM_SCORE_MAX)
+
+typedef struct {
+  uint32_t code; // 0 marks an empty bucket; no trigram encodes to 0
+  uint32_t count;
+  uint32_t cap;
+  uint16_t *slots; // Ascending doc slots
+} posting_t;
+
+typedef struct {
+  char id[MAX_ID_LEN]; // Empty while the slot is free
+  char *text;          // SEARCH_FIELD_COUNT folded fields, NUL separated
+  uint16_t text_len;   // Separators included
+  uint16_t next_free;
+  uint16_t term_score; // Query scratch, 0 between queries
+} search_doc_t;
+
+struct search_index {
+  search_doc_t *docs;
+  size_t doc_cap;
+  size_t doc_used; // Slots ever handed out
+  size_t live;
+  uint16_t free_head;
+  uint16_t *id_map; // Open addressing on id: slot + 1, 0 when empty
+  size_t id_map_cap;
+  posting_t *postings; // Open addressing on trigram code
+  size_t posting_cap;
+  size_t posting_used;
+  uint32_t *scratch; // Old and new trigram sets during an update
+};
+
+typedef struct {
+  char text[SEARCH_TERM_MAX];
+  size_t len;
+  uint32_t codes[SEARCH_TERM_MAX]; // All required, field 0
+  size_t code_count;
+  uint32_t start; // Some word starts like the term (longer terms only)
+  uint32_t end;   // Some word ends like the term
+  size_t cost;    // Candidates it yields alone, over all fields
+} search_term_t;
+
+typedef struct {
+  uint16_t slot;
+  uint16_t score;
+} search_hit_t;
+
+// At 5,000 animals postings and texts take a few hundred KB: keep them in
+// PSRAM when there is some.
+static void *search_realloc(void *ptr, size_t size) {
+#if CONFIG_SPIRAM
+  void *p = heap_caps_realloc(ptr, size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (p) {
+    return p;
+  }
+#endif
+  return realloc(ptr, size);
+}
+
+// --- Folding ---------------------------------------------------------------
+
+// U+00C0..U+00FF; "" for the two symbols of the block (× and ÷).
+static const char *const s_latin1_fold[64] = {
+    "a", "a", "a",  "a", "a", "a", "ae", "c",  // U+00C0
+    "e", "e", "e",  "e", "i", "i", "i",  "i",  // U+00C8
+    "d", "n", "o",  "o", "o", "o", "o",  "",   // U+00D0
+    "o", "u", "u",  "u", "u", "y", "th", "ss", // U+00D8
+    "a", "a", "a",  "a", "a", "a", "ae", "c",  // U+00E0
+    "e", "e", "e",  "e", "i", "i", "i",  "i",  // U+00E8
+    "d", "n", "o",  "o", "o", "o", "o",  "",   // U+00F0
+    "o", "u", "u",  "u", "u", "y", "th", "y",  // U+00F8
+};
+
+// Lowercase ASCII letters and digits from UTF-8 src, words separated by a
+// single space. Returns the length written, dst is NUL terminated.
+static size_t fold(const char *src, char *dst, size_t cap) {
+  const uint8_t *p = (const uint8_t *)src;
+  size_t n = 0;
+  bool pending_space = false;
+  while (*p) {
+    char ascii[2] = {0};
+    const char *rep = ascii;
+    if (*p < 0x80) {
+      if (*p >= 'A' && *p <= 'Z') {
+        ascii[0] = (char)(*p + ('a' - 'A'));
+      } else if ((*p >= 'a' && *p <= 'z') || (*p >= '0' && *p <= '9')) {
+        ascii[0] = (char)*p;
+      }
+      p++;
+    } else if (p[0] == 0xC3 && p[1] >= 0x80 && p[1] <= 0xBF) {
+      rep = s_latin1_fold[p[1] - 0x80];
+      p += 2;
+    } else if (p[0] == 0xC5 && (p[1] == 0x92 || p[1] == 0x93)) {
+      rep = "oe";
+      p += 2;
+    } else {
+      // Anything else separates words; skip its continuation bytes.
+      p++;
+      while ((*p & 0xC0) == 0x80) {
+        p++;
+      }
+    }
+    if (*rep == '\0') {
+      pending_space = n > 0;
+      continue;
+    }
+    size_t rep_len = strlen(rep);
+    if (n + pending_space + rep_len >= cap) {
+      break;
+    }
+    if (pending_space) {
+      dst[n++] = ' ';
+      pending_space = false;
+    }
+    memcpy(dst + n, rep, rep_len);
+    n += rep_len;
+  }
+  dst[n] = '\0';
+  return n;
+}
+
+static size_t doc_text(const reptile_summary_t *e, char *out) {
+  const char *fields[SEARCH_FIELD_COUNT] = {e->name, e->id, e->species,
+                                           e->morph};
+  size_t len = 0;
+  for (size_t i = 0; i < SEARCH_FIELD_COUNT; i++) {
+    len += fold(fields[i], out + len, SEARCH_TEXT_MAX - len) + 1;
+  }
+  return len;
+}
+
+// --- Trigrams --------------------------------------------------------------
+
+static inline uint32_t sym(char c) {
+  if (c >= 'a' && c <= 'z') {
+    return (uint32_t)(c - 'a' + 1);
+  }
+  if (c >= '0' && c <= '9') {
+    return (uint32_t)(c - '0' + 27);
+  }
+  return 0;
+}
+
+// Each field has its own trigram space, so a posting list also says where
+// the text matched.
+static inline uint32_t trigram(size_t field, uint32_t a, uint32_t b,
+                               uint32_t c) {
+  return (uint32_t)field * SEARCH_TRIGRAMS +
+         (a * SEARCH_ALPHABET + b) * SEARCH_ALPHABET + c;
+}
+
+static int cmp_u32(const void *a, const void *b) {
+  uint32_t x = *(const uint32_t *)a;
+  uint32_t y = *(const uint32_t *)b;
+  return (x > y) - (x < y);
+}
+
+// Sorted, de-duplicated trigrams: each letter or digit with the two symbols
+// before it (0 before the word start), plus a closing trigram per word.
+static size_t doc_trigrams(const char *text, size_t len, uint32_t *out) {
+  size_t n = 0;
+  size_t field = 0;
+  uint32_t prev1 = 0;
+  uint32_t prev2 = 0;
+  for (size_t i = 0; i < len; i++) {
+    uint32_t s = sym(text[i]);
+    if (s == 0) {
+      if (prev1 != 0) {
+        out[n++] = trigram(field, prev2, prev1, 0);
+      }
+      prev1 = prev2 = 0;
+      field += text[i] == '\0';
+      continue;
+    }
+    out[n++] = trigram(field, prev2, prev1, s);
+    prev2 = prev1;
+    prev1 = s;
+  }
+  qsort(out, n, sizeof(uint32_t), cmp_u32);
+  size_t unique = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (unique == 0 || out[unique - 1] != out[i]) {
+      out[unique++] = out[i];
+    }
+  }
+  return unique;
+}
+
+// --- Posting lists ---------------------------------------------------------
+
+static size_t posting_bucket(uint32_t code, size_t cap) {
+  return (size_t)(code * 2654435761u) & (cap - 1);
+}
+
+static posting_t *posting_find(const search_index_t *idx, uint32_t code) {
+  if (idx->posting_cap == 0) {
+    return NULL;
+  }
+  size_t mask = idx->posting_cap - 1;
+  for (size_t i = posting_bucket(code, idx->posting_cap);; i = (i + 1) & mask) {
+    posting_t *p = &idx->postings[i];
+    if (p->code == code) {
+      return p;
+    }
+    if (p->code == 0) {
+      return NULL;
+    }
+  }
+}
+
+static esp_err_t postings_grow(search_index_t *idx) {
+  size_t cap = idx->posting_cap ? idx->posting_cap * 2 : SEARCH_MIN_BUCKETS;
+  posting_t *table = search_realloc(NULL, cap * sizeof(posting_t));
+  if (!table) {
+    return ESP_ERR_NO_MEM;
+  }
+  memset(table, 0, cap * sizeof(posting_t));
+  for (size_t i = 0; i < idx->posting_cap; i++) {
+    const posting_t *p = &idx->postings[i];
+    if (p->code == 0) {
+      continue;
+    }
+    size_t j = posting_bucket(p->code, cap);
+    while (table[j].code != 0) {
+      j = (j + 1) & (cap - 1);
+    }
+    table[j] = *p;
+  }
+  free(idx->postings);
+  idx->postings = table;
+  idx->posting_cap = cap;
+  return ESP_OK;
+}
+
+// Trigram entries are never removed: an emptied list just stays empty.
+static posting_t *posting_get(search_index_t *idx, uint32_t code) {
+  posting_t *p = posting_find(idx, code);
+  if (p) {
+    return p;
+  }
+  if ((idx->posting_used + 1) * 4 > idx->posting_cap * 3 &&
+      postings_grow(idx) != ESP_OK) {
+    return NULL;
+  }
+  size_t mask = idx->posting_cap - 1;
+  size_t i = posting_bucket(code, idx->posting_cap);
+  while (idx->postings[i].code != 0) {
+    i = (i + 1) & mask;
+  }
+  idx->posting_used++;
+  idx->postings[i].code = code;
+  return &idx->postings[i];
+}
+
+static size_t posting_lower_bound(const posting_t *p, uint16_t slot) {
+  size_t lo = 0, hi = p->count;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (p->slots[mid] < slot) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+static esp_err_t posting_add(search_index_t *idx, uint32_t code,
+                             uint16_t slot) {
+  posting_t *p = posting_get(idx, code);
+  if (!p) {
+    return ESP_ERR_NO_MEM;
+  }
+  size_t pos = posting_lower_bound(p, slot);
+  if (pos < p->count && p->slots[pos] == slot) {
+    return ESP_OK;
+  }
+  if (p->count == p->cap) {
+    uint32_t cap = p->cap ? p->cap * 2 : 4;
+    uint16_t *grown = search_realloc(p->slots, cap * sizeof(uint16_t));
+    if (!grown) {
+      return ESP_ERR_NO_MEM;
+    }
+    p->slots = grown;
+    p->cap = cap;
+  }
+  memmove(&p->slots[pos + 1], &p->slots[pos],
+          (p->count - pos) * sizeof(uint16_t));
+  p->slots[pos] = slot;
+  p->count++;
+  return ESP_OK;
+}
+
+static void posting_remove(search_index_t *idx, uint32_t code, uint16_t slot) {
+  posting_t *p = posting_find(idx, code);
+  if (!p) {
+    return;
+  }
+  size_t pos = posting_lower_bound(p, slot);
+  if (pos < p->count && p->slots[pos] == slot) {
+    memmove(&p->slots[pos], &p->slots[pos + 1],
+            (p->count - pos - 1) * sizeof(uint16_t));
+    p->count--;
+  }
+}
+
+// --- Documents -------------------------------------------------------------
+
+static uint32_t hash_id(const char *id) {
+  uint32_t h = 2166136261u; // FNV-1a
+  for (; *id; id++) {
+    h = (h ^ (uint8_t)*id) * 16777619u;
+  }
+  return h;
+}
+
+// Bucket holding id, or the empty bucket where it would go.
+static size_t id_map_bucket(const search_index_t *idx, const char *id,
+                            bool *found) {
+  size_t mask = idx->id_map_cap - 1;
+  size_t i = hash_id(id) & mask;
+  while (idx->id_map[i] != 0) {
+    if (strcmp(idx->docs[idx->id_map[i] - 1].id, id) == 0) {
+      *found = true;
+      return i;
+    }
+    i = (i + 1) & mask;
+  }
+  *found = false;
+  return i;
+}
+
+static esp_err_t id_map_grow(search_index_t *idx) {
+  size_t cap = idx->id_map_cap ? idx->id_map_cap * 2 : SEARCH_MIN_BUCKETS;
+  uint16_t *map = search_realloc(NULL, cap * sizeof(uint16_t));
+  if (!map) {
+    return ESP_ERR_NO_MEM;
+  }
+  memset(map, 0, cap * sizeof(uint16_t));
+  for (size_t slot = 0; slot < idx->doc_used; slot++) {
+    if (idx->docs[slot].id[0] == '\0') {
+      continue;
+    }
+    size_t i = hash_id(idx->docs[slot].id) & (cap - 1);
+    while (map[i] != 0) {
+      i = (i + 1) & (cap - 1);
+    }
+    map[i] = (uint16_t)(slot + 1);
+  }
+  free(idx->id_map);
+  idx->id_map = map;
+  idx->id_map_cap = cap;
+  return ESP_OK;
+}
+
+// Backward-shift deletion keeps linear probing free of tombstones.
+static void id_map_erase(search_index_t *idx, size_t i) {
+  size_t mask = idx->id_map_cap - 1;
+  size_t j = i;
+  for (;;) {
+    j = (j + 1) & mask;
+    if (idx->id_map[j] == 0) {
+      break;
+    }
+    size_t home = hash_id(idx->docs[idx->id_map[j] - 1].id) & mask;
+    bool stays = (i <= j) ? (i < home && home <= j) : (i < home || home <= j);
+    if (!stays) {
+      idx->id_map[i] = idx->id_map[j];
+      i = j;
+    }
+  }
+  idx->id_map[i] = 0;
+}
+
+static esp_err_t doc_alloc(search_index_t *idx, uint16_t *out_slot) {
+  uint16_t slot = idx->free_head;
+  if (slot != SEARCH_NO_SLOT) {
+    idx->free_head = idx->docs[slot].next_free;
+  } else {
+    if (idx->doc_used == SEARCH_NO_SLOT) {
+      return ESP_ERR_NO_MEM;
+    }
+    if (idx->doc_used == idx->doc_cap) {
+      size_t cap = idx->doc_cap ? idx->doc_cap * 2 : SEARCH_MIN_DOCS;
+      if (cap > SEARCH_NO_SLOT) {
+        cap = SEARCH_NO_SLOT;
+      }
+      search_doc_t *grown = search_realloc(idx->docs, cap * sizeof(*grown));
+      if (!grown) {
+        return ESP_ERR_NO_MEM;
+      }
+      idx->docs = grown;
+      idx->doc_cap = cap;
+    }
+    slot = (uint16_t)idx->doc_used++;
+  }
+  memset(&idx->docs[slot], 0, sizeof(search_doc_t));
+  *out_slot = slot;
+  return ESP_OK;
+}
+
+static void doc_release(search_index_t *idx, uint16_t slot) {
+  search_doc_t *doc = &idx->docs[slot];
+  free(doc->text);
+  memset(doc, 0, sizeof(*doc));
+  doc->next_free = idx->free_head;
+  idx->free_head = slot;
+}
+
+// --- Public API ------------------------------------------------------------
+
+search_index_t *search_index_create(void) {
+  search_index_t *idx = calloc(1, sizeof(search_index_t));
+  if (!idx) {
+    return NULL;
+  }
+  idx->scratch = malloc(2 * SEARCH_DOC_TRIGRAMS_MAX * sizeof(uint32_t));
+  if (!idx->scratch) {
+    free(idx);
+    return NULL;
+  }
+  idx->free_head = SEARCH_NO_SLOT;
+  return idx;
+}
+
+void search_index_clear(search_index_t *idx) {
+  if (!idx) {
+    return;
+  }
+  for (size_t i = 0; i < idx->doc_used; i++) {
+    free(idx->docs[i].text);
+  }
+  for (size_t i = 0; i < idx->posting_cap; i++) {
+    free(idx->postings[i].slots);
+  }
+  free(idx->docs);
+  free(idx->id_map);
+  free(idx->postings);
+  uint32_t *scratch = idx->scratch;
+  memset(idx, 0, sizeof(*idx));
+  idx->scratch = scratch;
+  idx->free_head = SEARCH_NO_SLOT;
+}
+
+void search_index_destroy(search_index_t *idx) {
+  if (!idx) {
+    return;
+  }
+  search_index_clear(idx);
+  free(idx->scratch);
+  free(idx);
+}
+
+esp_err_t search_index_put(search_index_t *idx,
+                           const reptile_summary_t *entry) {
+  if (!idx || !entry || entry->id[0] == '\0') {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if ((idx->live + 1) * 2 > idx->id_map_cap && id_map_grow(idx) != ESP_OK) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  char text[SEARCH_TEXT_MAX];
+  size_t len = doc_text(entry, text);
+  uint32_t *old_tri = idx->scratch;
+  uint32_t *new_tri = idx->scratch + SEARCH_DOC_TRIGRAMS_MAX;
+  size_t old_n = 0;
+  size_t new_n = doc_trigrams(text, len, new_tri);
+
+  bool found = false;
+  size_t bucket = id_map_bucket(idx, entry->id, &found);
+  uint16_t slot;
+  if (found) {
+    slot = (uint16_t)(idx->id_map[bucket] - 1);
+    const search_doc_t *doc = &idx->docs[slot];
+    if (doc->text_len == len && memcmp(doc->text, text, len) == 0) {
+      return ESP_OK;
+    }
+    old_n = doc_trigrams(doc->text, doc->text_len, old_tri);
+  } else if (doc_alloc(idx, &slot) != ESP_OK) {
+    return ESP_ERR_NO_MEM;
+  }
+
+  search_doc_t *doc = &idx->docs[slot];
+  char *copy = search_realloc(doc->text, len);
+  if (!copy) {
+    if (!found) {
+      doc_release(idx, slot);
+    }
+    return ESP_ERR_NO_MEM;
+  }
+  memcpy(copy, text, len);
+  doc->text = copy;
+  doc->text_len = (uint16_t)len;
+  if (!found) {
+    strlcpy(doc->id, entry->id, sizeof(doc->id));
+    idx->id_map[bucket] = (uint16_t)(slot + 1);
+    idx->live++;
+  }
+
+  // Both trigram sets are sorted: walk them together and apply the delta.
+  esp_err_t err = ESP_OK;
+  size_t i = 0, j = 0;
+  while (i < old_n || j < new_n) {
+    if (j == new_n || (i < old_n && old_tri[i] < new_tri[j])) {
+      posting_remove(idx, old_tri[i++], slot);
+    } else if (i == old_n || new_tri[j] < old_tri[i]) {
+      if (posting_add(idx, new_tri[j++], slot) != ESP_OK) {
+        err = ESP_ERR_NO_MEM;
+      }
+    } else {
+      i++;
+      j++;
+    }
+  }
+  if (err != ESP_OK) {
+    ESP_LOGW(TAG, "Out of memory indexing %s; search may miss it", doc->id);
+  }
+  return err;
+}
+
+void search_index_remove(search_index_t *idx, const char *id) {
+  if (!idx || !id || idx->live == 0) {
+    return;
+  }
+  bool found = false;
+  size_t bucket = id_map_bucket(idx, id, &found);
+  if (!found) {
+    return;
+  }
+  uint16_t slot = (uint16_t)(idx->id_map[bucket] - 1);
+  const search_doc_t *doc = &idx->docs[slot];
+  uint32_t *tri = idx->scratch;
+  size_t n = doc_trigrams(doc->text, doc->text_len, tri);
+  for (size_t i = 0; i < n; i++) {
+    posting_remove(idx, tri[i], slot);
+  }
+  // Erase while the slot still holds its id: probing rehashes neighbours.
+  id_map_erase(idx, bucket);
+  doc_release(idx, slot);
+  idx->live--;
+}
+
+// Trigram codes a document must hold, in field 0, for it to match term t.
+// Short terms only match word prefixes, through the boundary-padded
+// trigrams; longer ones need every inner trigram.
+static void term_codes(search_term_t *t) {
+  const char *w = t->text;
+  size_t n = t->len;
+  t->code_count = 0;
+  t->start = 0;
+  if (n == 1) {
+    t->codes[t->code_count++] = trigram(0, 0, 0, sym(w[0]));
+    t->end = trigram(0, 0, sym(w[0]), 0);
+    return;
+  }
+  if (n == 2) {
+    t->codes[t->code_count++] = trigram(0, 0, sym(w[0]), sym(w[1]));
+  } else {
+    for (size_t i = 0; i + 2 < n; i++) {
+      t->codes[t->code_count++] =
+          trigram(0, sym(w[i]), sym(w[i + 1]), sym(w[i + 2]));
+    }
+    t->start = trigram(0, 0, sym(w[0]), sym(w[1]));
+  }
+  t->end = trigram(0, sym(w[n - 2]), sym(w[n - 1]), 0);
+}
+
+static size_t parse_terms(const char *query, search_term_t *terms) {
+  char folded[SEARCH_QUERY_MAX];
+  fold(query, folded, sizeof(folded));
+  size_t count = 0;
+  char *save = NULL;
+  for (char *word = strtok_r(folded, " ", &save);
+       word && count < SEARCH_MAX_TERMS; word = strtok_r(NULL, " ", &save)) {
+    search_term_t *t = &terms[count++];
+    strlcpy(t->text, word, sizeof(t->text));
+    t->len = strlen(t->text);
+    term_codes(t);
+  }
+  return count;
+}
+
+// Walks a posting list alongside candidates taken in ascending slot order.
+typedef struct {
+  const posting_t *list;
+  size_t pos;
+} cursor_t;
+
+// Gallops from the last position, so a pass over a list costs at most its
+// length whatever the number of probes.
+static bool cursor_has(cursor_t *c, uint16_t slot) {
+  const posting_t *p = c->list;
+  if (!p) {
+    return false;
+  }
+  size_t lo = c->pos;
+  size_t hi = lo;
+  size_t step = 1;
+  while (hi < p->count && p->slots[hi] < slot) {
+    lo = hi + 1;
+    hi = lo + step;
+    step <<= 1;
+  }
+  if (hi > p->count) {
+    hi = p->count;
+  }
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (p->slots[mid] < slot) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  c->pos = lo;
+  return lo < p->count && p->slots[lo] == slot;
+}
+
+// Posting lists of term t in one field, the shortest first. False when the
+// term cannot match there.
+static bool term_lists(const search_index_t *idx, const search_term_t *t,
+                       size_t field, cursor_t *lists) {
+  uint32_t base = (uint32_t)field * SEARCH_TRIGRAMS;
+  for (size_t i = 0; i < t->code_count; i++) {
+    const posting_t *p = posting_find(idx, base + t->codes[i]);
+    if (!p || p->count == 0) {
+      return false;
+    }
+    lists[i] = (cursor_t){.list = p};
+    if (p->count < lists[0].list->count) {
+      lists[i] = lists[0];
+      lists[0] = (cursor_t){.list = p};
+    }
+  }
+  return true;
+}
+
+// Match kind from the boundary trigrams. Exact for short terms; for longer
+// ones "a word starts (ends) like the term" stands for "the term starts
+// (ends) a word", which only differs on contrived texts.
+static unsigned match_kind(const search_term_t *t, cursor_t *start,
+                           cursor_t *end, uint16_t slot) {
+  if (t->len >= 3 && !cursor_has(start, slot)) {
+    return MATCH_SUBSTRING;
+  }
+  return cursor_has(end, slot) ? MATCH_WORD : MATCH_PREFIX;
+}
+
+// Scores term t into doc->term_score for every candidate. The first term
+// enumerates its shortest posting lists and fills hits; later ones probe the
+// hits still alive, which must then be sorted by slot.
+static void score_term(search_index_t *idx, const search_term_t *t,
+                       bool first, search_hit_t *hits, size_t *hit_count) {
+  cursor_t lists[SEARCH_TERM_MAX];
+  for (size_t f = 0; f < SEARCH_FIELD_COUNT; f++) {
+    if (!term_lists(idx, t, f, lists)) {
+      continue;
+    }
+    uint32_t base = (uint32_t)f * SEARCH_TRIGRAMS;
+    cursor_t start = {
+        .list = t->start ? posting_find(idx, base + t->start) : NULL};
+    cursor_t end = {.list = posting_find(idx, base + t->end)};
+    // The first term's driver list is its own candidate set.
+    size_t skip = first ? 1 : 0;
+    size_t candidates = first ? lists[0].list->count : *hit_count;
+    for (size_t c = 0; c < candidates; c++) {
+      uint16_t slot = first ? lists[0].list->slots[c] : hits[c].slot;
+      size_t i = skip;
+      while (i < t->code_count && cursor_has(&lists[i], slot)) {
+        i++;
+      }
+      if (i < t->code_count) {
+        continue;
+      }
+      search_doc_t *doc = &idx->docs[slot];
+      unsigned score = match_kind(t, &start, &end, slot) * s_field_weight[f];
+      if (first && doc->term_score == 0) {
+        hits[(*hit_count)++] = (search_hit_t){.slot = slot, .score = 0};
+      }
+      if (score > doc->term_score) {
+        doc->term_score = (uint16_t)score;
+      }
+    }
+  }
+}
+
+static int cmp_hit_slot(const void *a, const void *b) {
+  return (int)((const search_hit_t *)a)->slot -
+         (int)((const search_hit_t *)b)->slot;
+}
+
+// Exact check for terms whose trigrams can all be present without the term
+// ("ana" and "nan" for "anan").
+static bool term_in_text(const search_term_t *t, const search_doc_t *doc) {
+  const char *p = doc->text;
+  const char *end = doc->text + doc->text_len;
+  for (; p + t->len < end; p++) {
+    if (*p == t->text[0] && memcmp(p, t->text, t->len) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+esp_err_t search_index_query(search_index_t *idx, const char *query,
+                             size_t max_results, const char ***out_ids,
+                             size_t *out_count) {
+  if (!idx || !query || !out_ids || !out_count) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  *out_ids = NULL;
+  *out_count = 0;
+
+  search_term_t terms[SEARCH_MAX_TERMS];
+  size_t term_count = parse_terms(query, terms);
+  if (term_count == 0) {
+    return ESP_ERR_INVALID_ARG;
+  }
+
+  // Most selective term first: it bounds the candidate set.
+  cursor_t lists[SEARCH_TERM_MAX];
+  for (size_t i = 0; i < term_count; i++) {
+    terms[i].cost = 0;
+    for (size_t f = 0; f < SEARCH_FIELD_COUNT; f++) {
+      if (term_lists(idx, &terms[i], f, lists)) {
+        terms[i].cost += lists[0].list->count;
+      }
+    }
+    if (terms[i].cost == 0) {
+      return ESP_OK;
+    }
+    for (size_t j = i; j > 0 && terms[j].cost < terms[j - 1].cost; j--) {
+      search_term_t tmp = terms[j];
+      terms[j] = terms[j - 1];
+      terms[j - 1] = tmp;
+    }
+  }
+
+  search_hit_t *hits = malloc(terms[0].cost * sizeof(search_hit_t));
+  if (!hits) {
+    return ESP_ERR_NO_MEM;
+  }
+  size_t n = 0;
+  for (size_t t = 0; t < term_count; t++) {
+    score_term(idx, &terms[t], t == 0, hits, &n);
+    size_t alive = 0;
+    for (size_t i = 0; i < n; i++) {
+      search_doc_t *doc = &idx->docs[hits[i].slot];
+      if (doc->term_score > 0) {
+        hits[alive] = hits[i];
+        hits[alive++].score += doc->term_score;
+        doc->term_score = 0;
+      }
+    }
+    n = alive;
+    if (t == 0 && term_count > 1) {
+      // Fields were enumerated one after the other.
+      qsort(hits, n, sizeof(search_hit_t), cmp_hit_slot);
+    }
+  }
+
+  // Counting sort, best score first; ties keep slot order, which is id order
+  // for an index loaded at boot.
+  uint32_t by_score[SEARCH_SCORE_MAX + 1] = {0};
+  for (size_t i = 0; i < n; i++) {
+    by_score[hits[i].score]++;
+  }
+  uint32_t next = 0;
+  for (size_t score = SEARCH_SCORE_MAX + 1; score-- > 0;) {
+    uint32_t count = by_score[score];
+    by_score[score] = next;
+    next += count;
+  }
+  uint16_t *order = malloc((n ? n : 1) * sizeof(uint16_t));
+  size_t limit = (max_results > 0 && n > max_results) ? max_results : n;
+  const char **ids = malloc((limit ? limit : 1) * sizeof(const char *));
+  if (!order || !ids) {
+    free(order);
+    free(ids);
+    free(hits);
+    return ESP_ERR_NO_MEM;
+  }
+  for (size_t i = 0; i < n; i++) {
+    order[by_score[hits[i].score]++] = hits[i].slot;
+  }
+
+  size_t found = 0;
+  for (size_t i = 0; i < n && found < limit; i++) {
+    const search_doc_t *doc = &idx->docs[order[i]];
+    bool verified = true;
+    for (size_t t = 0; t < term_count && verified; t++) {
+      verified = terms[t].code_count < 2 || term_in_text(&terms[t], doc);
+    }
+    if (verified) {
+      ids[found++] = doc->id;
+    }
+  }
+  free(order);
+  free(hits);
+  if (found == 0) {
+    free(ids);
+    ids = NULL;
+  }
+  *out_ids = ids;
+  *out_count = found;
+  return ESP_OK;
+}
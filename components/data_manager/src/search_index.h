@@ -0,0 +1,34 @@
+#pragma once
+
+// In-RAM full-text index over reptile summaries (name, id, species, morph).
+// Text is folded to lowercase ASCII words (accents dropped, "œ" -> "oe") and
+// each word is indexed by its trigrams plus two word-start trigrams padded
+// with a boundary symbol, so one- and two-letter queries match word prefixes
+// and longer ones match any substring. Candidates are verified against the
+// folded text and ranked by field and match kind.
+//
+// Not thread-safe: the caller serializes every call (the summary index does
+// it under its own lock). Up to 65535 entries.
+
+#include "data_manager.h"
+#include "esp_err.h"
+#include <stddef.h>
+
+typedef struct search_index search_index_t;
+
+search_index_t *search_index_create(void);
+void search_index_destroy(search_index_t *idx);
+void search_index_clear(search_index_t *idx);
+
+// Inserts or updates the entry keyed by entry->id; only the trigrams that
+// changed are touched.
+esp_err_t search_index_put(search_index_t *idx, const reptile_summary_t *entry);
+void search_index_remove(search_index_t *idx, const char *id);
+
+// Ids of the entries matching every word of query, best first. The strings
+// belong to the index and stay valid until its next modification; the caller
+// frees the array itself. ESP_ERR_INVALID_ARG when the query holds no letter
+// or digit. max_results = 0 means no limit.
+esp_err_t search_index_query(search_index_t *idx, const char *query,
+                             size_t max_results, const char ***out_ids,
+                             size_t *out_count);
@@ -0,0 +1,86 @@
+#include "../src/dm_arena.h"
+#include "cJSON.h"
+#include "data_manager.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdio.h>
+
+#if CONFIG_ARS_DATA_ARENA
+
+// Heap traffic of a throwaway cJSON history (the legacy migration shape),
+// built and freed with the hooks on the heap, then on an arena.
+
+#define BENCH_ITERATIONS 100
+#define BENCH_EVENTS 100
+
+typedef struct {
+  int64_t total_us;
+  size_t internal_peak;
+  data_manager_arena_stats_t stats;
+} bench_result_t;
+
+static void churn(void) {
+  cJSON *arr = cJSON_CreateArray();
+  TEST_ASSERT_NOT_NULL(arr);
+  for (int i = 0; i < BENCH_EVENTS; i++) {
+    cJSON *evt = cJSON_CreateObject();
+    TEST_ASSERT_NOT_NULL(evt);
+    cJSON_AddStringToObject(evt, "id", "evt-000000");
+    cJSON_AddNumberToObject(evt, "type", i % 10);
+    cJSON_AddNumberToObject(evt, "timestamp", 1700000000.0 + i);
+    cJSON_AddStringToObject(evt, "notes", "Repas : souris adulte");
+    cJSON_AddItemToArray(arr, evt);
+  }
+  char *text = cJSON_PrintUnformatted(arr);
+  TEST_ASSERT_NOT_NULL(text);
+  cJSON_free(text);
+  cJSON_Delete(arr);
+}
+
+static bench_result_t run(bool arena) {
+  bench_result_t res = {0};
+  data_manager_reset_arena_stats();
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_INTERNAL);
+  TEST_ASSERT_EQUAL(ESP_OK, heap_caps_monitor_local_minimum_free_size_start());
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++) {
+    if (arena) {
+      dm_arena_begin();
+    }
+    churn();
+    if (arena) {
+      dm_arena_end();
+    }
+  }
+  res.total_us = esp_timer_get_time() - start;
+  size_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL);
+  TEST_ASSERT_EQUAL(ESP_OK, heap_caps_monitor_local_minimum_free_size_stop());
+  res.internal_peak = free_before > min_free ? free_before - min_free : 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_arena_stats(&res.stats));
+  return res;
+}
+
+TEST_CASE("arena: cJSON churn on the heap vs on an arena",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init()); // Installs the hooks
+  }
+  bench_result_t heap = run(false);
+  bench_result_t arena = run(true);
+  printf("churn x%d  heap : %lld us, %u mallocs, internal peak %u B\n",
+         BENCH_ITERATIONS, (long long)(heap.total_us / BENCH_ITERATIONS),
+         (unsigned)heap.stats.heap_allocs, (unsigned)heap.internal_peak);
+  printf("churn x%d  arena: %lld us, %u allocs on %u chunks, internal peak "
+         "%u B, scope peak %u B\n",
+         BENCH_ITERATIONS, (long long)(arena.total_us / BENCH_ITERATIONS),
+         (unsigned)arena.stats.arena_allocs,
+         (unsigned)arena.stats.chunk_allocs, (unsigned)arena.internal_peak,
+         (unsigned)arena.stats.peak_scope_bytes);
+
+  TEST_ASSERT_TRUE(arena.stats.arena_allocs > 0);
+  TEST_ASSERT_LESS_THAN(arena.stats.arena_allocs / 10,
+                        arena.stats.chunk_allocs);
+}
+
+#endif
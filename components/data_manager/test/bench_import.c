@@ -0,0 +1,120 @@
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+// Import throughput, one call per record vs one batch commit, on disjoint id
+// sets so neither run appends to the other's files.
+
+#define BENCH_ANIMALS 50
+#define BENCH_EVENTS 10  // Per animal
+#define BENCH_WEIGHTS 10 // Per animal
+#define BENCH_RECORDS (BENCH_ANIMALS * (1 + BENCH_EVENTS + BENCH_WEIGHTS))
+
+static void fill_reptile(reptile_t *r, const char *prefix, int i) {
+  memset(r, 0, sizeof(*r));
+  snprintf(r->id, sizeof(r->id), "%s-%03d", prefix, i);
+  snprintf(r->name, sizeof(r->name), "Import %d", i);
+  strlcpy(r->species, "Python regius", sizeof(r->species));
+  r->birth_date = 1600000000;
+  r->weight = 1000.0f;
+}
+
+static void fill_event(reptile_event_t *e, const char *reptile_id, int j) {
+  memset(e, 0, sizeof(*e));
+  snprintf(e->id, sizeof(e->id), "evt-%03d", j);
+  strlcpy(e->reptile_id, reptile_id, sizeof(e->reptile_id));
+  e->type = EVENT_FEEDING;
+  e->timestamp = 1700000000 + j * 86400LL;
+  strlcpy(e->notes, "Souris adulte", sizeof(e->notes));
+}
+
+static int64_t import_per_call(void) {
+  reptile_t r;
+  reptile_event_t e;
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    fill_reptile(&r, "imp-a", i);
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+    for (int j = 0; j < BENCH_EVENTS; j++) {
+      fill_event(&e, r.id, j);
+      TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&e));
+    }
+    for (int j = 0; j < BENCH_WEIGHTS; j++) {
+      TEST_ASSERT_EQUAL(ESP_OK,
+                        data_manager_add_weight(r.id, 1000.0f + j,
+                                                1700000000 + j * 604800LL));
+    }
+  }
+  // Pending saves are written back before the clock stops.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  return esp_timer_get_time() - start;
+}
+
+static int64_t import_batch(void) {
+  reptile_t r;
+  reptile_event_t e;
+  int64_t start = esp_timer_get_time();
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    fill_reptile(&r, "imp-b", i);
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_reptile(batch, &r));
+    for (int j = 0; j < BENCH_EVENTS; j++) {
+      fill_event(&e, r.id, j);
+      TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_event(batch, &e));
+    }
+    for (int j = 0; j < BENCH_WEIGHTS; j++) {
+      TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_weight(
+                                    batch, r.id, 1000.0f + j,
+                                    1700000000 + j * 604800LL));
+    }
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+  return esp_timer_get_time() - start;
+}
+
+static void cleanup(const char *prefix) {
+  char path[64];
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    char id[MAX_ID_LEN];
+    snprintf(id, sizeof(id), "%s-%03d", prefix, i);
+    data_manager_delete_reptile(id);
+    data_manager_delete_events(id);
+    snprintf(path, sizeof(path), "/data/weights/%s.wts", id);
+    remove(path);
+  }
+}
+
+static unsigned records_per_s(int64_t us) {
+  return us > 0 ? (unsigned)(BENCH_RECORDS * 1000000LL / us) : 0;
+}
+
+TEST_CASE("import: per-call saves vs one batch commit",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  int64_t per_call_us = import_per_call();
+  int64_t batch_us = import_batch();
+  printf("import %d records  per call: %lld ms, %u records/s\n", BENCH_RECORDS,
+         (long long)(per_call_us / 1000), records_per_s(per_call_us));
+  printf("import %d records  batch   : %lld ms, %u records/s\n", BENCH_RECORDS,
+         (long long)(batch_us / 1000), records_per_s(batch_us));
+
+  // Same content either way.
+  weight_stats_t a;
+  weight_stats_t b;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_weight_stats(
+                                "imp-a-007", INT64_MIN, INT64_MAX, &a));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_weight_stats(
+                                "imp-b-007", INT64_MIN, INT64_MAX, &b));
+  TEST_ASSERT_EQUAL(a.count, b.count);
+  TEST_ASSERT_EQUAL_FLOAT(a.last, b.last);
+
+  cleanup("imp-a");
+  cleanup("imp-b");
+  TEST_ASSERT_LESS_THAN(per_call_us, batch_us);
+}
@@ -0,0 +1,126 @@
+#include "../src/json_writer.h"
+#include "cJSON.h"
+#include "data_manager.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Compares the former save path (cJSON tree + PrintUnformatted + fwrite)
+// with the streaming writer, on the same record and the same file.
+
+#define BENCH_ITERATIONS 200
+#define BENCH_PATH "/data/bench_save.json"
+
+typedef struct {
+  int64_t total_us;
+  size_t heap_peak;
+} bench_result_t;
+
+static void fill_reptile(reptile_t *r) {
+  memset(r, 0, sizeof(*r));
+  strlcpy(r->id, "bench-0001", sizeof(r->id));
+  strlcpy(r->name, "Némésis \"la grande\"", sizeof(r->name));
+  strlcpy(r->species, "Python regius", sizeof(r->species));
+  strlcpy(r->morph, "Banana Pied Clown", sizeof(r->morph));
+  r->birth_date = 1672531200;
+  r->gender = GENDER_FEMALE;
+  r->weight = 1834.5f;
+}
+
+static esp_err_t save_tree(const reptile_t *r) {
+  cJSON *root = cJSON_CreateObject();
+  if (!root) {
+    return ESP_ERR_NO_MEM;
+  }
+  cJSON_AddStringToObject(root, "id", r->id);
+  cJSON_AddStringToObject(root, "name", r->name);
+  cJSON_AddStringToObject(root, "species", r->species);
+  cJSON_AddStringToObject(root, "morph", r->morph);
+  cJSON_AddNumberToObject(root, "birth_date", (double)r->birth_date);
+  cJSON_AddNumberToObject(root, "gender", r->gender);
+  cJSON_AddNumberToObject(root, "weight", r->weight);
+  char *string = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  if (!string) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t err = ESP_FAIL;
+  FILE *f = fopen(BENCH_PATH, "w");
+  if (f) {
+    size_t len = strlen(string);
+    err = fwrite(string, 1, len, f) == len ? ESP_OK : ESP_FAIL;
+    fclose(f);
+  }
+  free(string);
+  return err;
+}
+
+static esp_err_t save_stream(const reptile_t *r) {
+  FILE *f = fopen(BENCH_PATH, "w");
+  if (!f) {
+    return ESP_FAIL;
+  }
+  setvbuf(f, NULL, _IONBF, 0);
+  json_writer_t w;
+  json_writer_init_file(&w, f);
+  json_writer_begin_object(&w);
+  json_writer_kv_string(&w, "id", r->id);
+  json_writer_kv_string(&w, "name", r->name);
+  json_writer_kv_string(&w, "species", r->species);
+  json_writer_kv_string(&w, "morph", r->morph);
+  json_writer_kv_int(&w, "birth_date", r->birth_date);
+  json_writer_kv_int(&w, "gender", r->gender);
+  json_writer_kv_number(&w, "weight", r->weight);
+  json_writer_end_object(&w);
+  esp_err_t err = json_writer_finish(&w);
+  fclose(f);
+  return err;
+}
+
+static bench_result_t run(esp_err_t (*save)(const reptile_t *),
+                          const reptile_t *r) {
+  bench_result_t res = {0};
+  size_t free_before = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+  TEST_ASSERT_EQUAL(ESP_OK, heap_caps_monitor_local_minimum_free_size_start());
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < BENCH_ITERATIONS; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, save(r));
+  }
+  res.total_us = esp_timer_get_time() - start;
+  size_t min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+  TEST_ASSERT_EQUAL(ESP_OK, heap_caps_monitor_local_minimum_free_size_stop());
+  res.heap_peak = free_before > min_free ? free_before - min_free : 0;
+  return res;
+}
+
+TEST_CASE("save: cJSON tree vs streaming writer", "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  reptile_t r;
+  fill_reptile(&r);
+
+  bench_result_t tree = run(save_tree, &r);
+  bench_result_t stream = run(save_stream, &r);
+  printf("save x%d  cJSON tree: %lld us/save, heap peak %u B\n",
+         BENCH_ITERATIONS, (long long)(tree.total_us / BENCH_ITERATIONS),
+         (unsigned)tree.heap_peak);
+  printf("save x%d  streaming : %lld us/save, heap peak %u B\n",
+         BENCH_ITERATIONS, (long long)(stream.total_us / BENCH_ITERATIONS),
+         (unsigned)stream.heap_peak);
+
+  // The production save path must round-trip the record.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  reptile_t back;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(r.id, &back));
+  TEST_ASSERT_EQUAL_STRING(r.name, back.name);
+  TEST_ASSERT_EQUAL_INT64(r.birth_date, back.birth_date);
+  TEST_ASSERT_EQUAL_FLOAT(r.weight, back.weight);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(r.id));
+  remove(BENCH_PATH);
+
+  TEST_ASSERT_LESS_OR_EQUAL(tree.heap_peak, stream.heap_peak);
+}
@@ -0,0 +1,137 @@
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// stat() and open+read of one record-sized file as the directory grows,
+// with every file in one directory vs spread over 16 buckets. Plain files
+// under BENCH_DIR: the data_manager layout setting does not matter here.
+
+#define BENCH_DIR "/data/bench_layout"
+#define BENCH_BUCKETS 16
+#define BENCH_PROBES 64
+#define BENCH_FILE_SIZE 96 // Typical CBOR reptile record
+
+static const unsigned s_sizes[] = {100, 500, 1000, 2000};
+#define BENCH_MAX_FILES 2000
+
+static void file_path(char *out, size_t len, bool bucketed, unsigned i) {
+  if (bucketed) {
+    snprintf(out, len, BENCH_DIR "/%02x/r%05u.cbor", i % BENCH_BUCKETS, i);
+  } else {
+    snprintf(out, len, BENCH_DIR "/flat/r%05u.cbor", i);
+  }
+}
+
+static void make_dirs(void) {
+  char path[64];
+  mkdir(BENCH_DIR, 0775);
+  mkdir(BENCH_DIR "/flat", 0775);
+  for (unsigned b = 0; b < BENCH_BUCKETS; b++) {
+    snprintf(path, sizeof(path), BENCH_DIR "/%02x", b);
+    mkdir(path, 0775);
+  }
+}
+
+static void fill(bool bucketed, unsigned from, unsigned to) {
+  static const uint8_t payload[BENCH_FILE_SIZE] = {0xa7};
+  char path[64];
+  for (unsigned i = from; i < to; i++) {
+    file_path(path, sizeof(path), bucketed, i);
+    FILE *f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(sizeof(payload), fwrite(payload, 1, sizeof(payload), f));
+    fclose(f);
+  }
+}
+
+// Mean latency in us of BENCH_PROBES lookups spread over [0, count).
+static void probe(bool bucketed, unsigned count, int64_t *stat_us,
+                  int64_t *open_us) {
+  char path[64];
+  uint8_t buf[BENCH_FILE_SIZE];
+  struct stat st;
+  *stat_us = 0;
+  *open_us = 0;
+  for (unsigned p = 0; p < BENCH_PROBES; p++) {
+    file_path(path, sizeof(path), bucketed, (p * 7919u) % count);
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(0, stat(path, &st));
+    int64_t mid = esp_timer_get_time();
+    FILE *f = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL(sizeof(buf), fread(buf, 1, sizeof(buf), f));
+    fclose(f);
+    *stat_us += mid - start;
+    *open_us += esp_timer_get_time() - mid;
+  }
+  *stat_us /= BENCH_PROBES;
+  *open_us /= BENCH_PROBES;
+}
+
+static void cleanup(void) {
+  char path[64];
+  for (unsigned i = 0; i < BENCH_MAX_FILES; i++) {
+    file_path(path, sizeof(path), false, i);
+    unlink(path);
+    file_path(path, sizeof(path), true, i);
+    unlink(path);
+  }
+  rmdir(BENCH_DIR "/flat");
+  for (unsigned b = 0; b < BENCH_BUCKETS; b++) {
+    snprintf(path, sizeof(path), BENCH_DIR "/%02x", b);
+    rmdir(path);
+  }
+  rmdir(BENCH_DIR);
+}
+
+TEST_CASE("layout: stat/open latency, flat vs bucketed directory",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  cleanup();
+  make_dirs();
+
+  int64_t flat_open = 0;
+  int64_t bucket_open = 0;
+  unsigned filled = 0;
+  printf("layout: files  flat stat/open us  %d buckets stat/open us\n",
+         BENCH_BUCKETS);
+  for (size_t s = 0; s < sizeof(s_sizes) / sizeof(s_sizes[0]); s++) {
+    fill(false, filled, s_sizes[s]);
+    fill(true, filled, s_sizes[s]);
+    filled = s_sizes[s];
+    int64_t flat_stat = 0;
+    int64_t bucket_stat = 0;
+    probe(false, filled, &flat_stat, &flat_open);
+    probe(true, filled, &bucket_stat, &bucket_open);
+    printf("layout: %5u  %8lld / %-8lld  %8lld / %lld\n", filled,
+           (long long)flat_stat, (long long)flat_open, (long long)bucket_stat,
+           (long long)bucket_open);
+  }
+  cleanup();
+
+  TEST_ASSERT_LESS_THAN(flat_open, bucket_open);
+}
+
+TEST_CASE("layout: generated ids are compact and increasing",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  char prev[DATA_MANAGER_ID_LEN] = "";
+  char id[DATA_MANAGER_ID_LEN];
+  int64_t start = esp_timer_get_time();
+  for (int i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_new_id(id, sizeof(id)));
+    TEST_ASSERT_EQUAL(DATA_MANAGER_ID_LEN - 1, strlen(id));
+    TEST_ASSERT_TRUE(strcmp(prev, id) < 0);
+    memcpy(prev, id, sizeof(id));
+  }
+  printf("layout: 100 ids in %lld us, last %s\n",
+         (long long)(esp_timer_get_time() - start), id);
+}
@@ -0,0 +1,131 @@
+#include "../src/cbor_record.h"
+#include "../src/json_reader.h"
+#include "../src/json_writer.h"
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "storage_core.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+// Size on flash and decode time of the JSON and CBOR record encodings, on a
+// synthetic set of animals. Same field table as data_manager_records.c.
+
+#define BENCH_ANIMALS 1000
+#define BENCH_JSON_MAX 512
+
+static const record_field_t s_fields[] = {
+    RECORD_FIELD(reptile_t, id, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, name, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, species, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, morph, RECORD_FIELD_STRING),
+    RECORD_FIELD(reptile_t, birth_date, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_t, gender, RECORD_FIELD_INT),
+    RECORD_FIELD(reptile_t, weight, RECORD_FIELD_FLOAT),
+};
+#define FIELD_COUNT (sizeof(s_fields) / sizeof(s_fields[0]))
+
+typedef struct {
+  char *p;
+  size_t len;
+  size_t cap;
+} mem_sink_t;
+
+static size_t mem_write(const char *data, size_t len, void *ctx) {
+  mem_sink_t *m = ctx;
+  if (m->cap - m->len < len) {
+    return 0;
+  }
+  memcpy(m->p + m->len, data, len);
+  m->len += len;
+  return len;
+}
+
+static void fill_animal(reptile_t *r, int i) {
+  static const char *const species[] = {"Python regius", "Pogona vitticeps",
+                                        "Eublepharis macularius",
+                                        "Testudo hermanni"};
+  memset(r, 0, sizeof(*r));
+  snprintf(r->id, sizeof(r->id), "rep-%05d", i);
+  snprintf(r->name, sizeof(r->name), "Animal %d", i);
+  strlcpy(r->species, species[i % 4], sizeof(r->species));
+  strlcpy(r->morph, i % 3 ? "Classique" : "Banana Pied", sizeof(r->morph));
+  r->birth_date = 1600000000 + (int64_t)i * 86400;
+  r->gender = (reptile_gender_t)(i % 3);
+  r->weight = 50.0f + (float)(i % 2000) * 1.25f;
+}
+
+static size_t encode_json(const reptile_t *r, char *out, size_t cap) {
+  mem_sink_t m = {.p = out, .cap = cap};
+  json_writer_t w;
+  json_writer_init(&w, mem_write, &m);
+  json_writer_begin_object(&w);
+  for (size_t i = 0; i < FIELD_COUNT; i++) {
+    const record_field_t *field = &s_fields[i];
+    json_writer_key(&w, field->name);
+    switch (field->type) {
+    case RECORD_FIELD_STRING:
+      json_writer_string(&w, (const char *)r + field->offset);
+      break;
+    case RECORD_FIELD_INT:
+      json_writer_int(&w, record_field_get_int(field, r));
+      break;
+    case RECORD_FIELD_FLOAT:
+      json_writer_number(&w, record_field_get_float(field, r));
+      break;
+    }
+  }
+  json_writer_end_object(&w);
+  TEST_ASSERT_EQUAL(ESP_OK, json_writer_finish(&w));
+  return m.len;
+}
+
+// Records are encoded one at a time so the test fits without PSRAM; the
+// esp_timer overhead is the same on both sides.
+TEST_CASE("records: JSON vs CBOR size and decode time",
+          "[data_manager][bench]") {
+  char json[BENCH_JSON_MAX];
+  uint8_t cbor[CBOR_RECORD_MAX_SIZE];
+  size_t json_total = 0;
+  size_t cbor_total = 0;
+  int64_t json_us = 0;
+  int64_t cbor_us = 0;
+
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    reptile_t r;
+    fill_animal(&r, i);
+    size_t json_len = encode_json(&r, json, sizeof(json));
+    size_t cbor_len = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, cbor_record_encode(s_fields, FIELD_COUNT, &r,
+                                                 cbor, sizeof(cbor),
+                                                 &cbor_len));
+    json_total += json_len;
+    cbor_total += cbor_len + sizeof(storage_header_t);
+
+    reptile_t from_json;
+    memset(&from_json, 0, sizeof(from_json));
+    int64_t start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, json_decode_buffer(json, json_len, s_fields,
+                                                 FIELD_COUNT, &from_json));
+    json_us += esp_timer_get_time() - start;
+
+    reptile_t from_cbor;
+    memset(&from_cbor, 0, sizeof(from_cbor));
+    start = esp_timer_get_time();
+    TEST_ASSERT_EQUAL(ESP_OK, cbor_record_decode(cbor, cbor_len, s_fields,
+                                                 FIELD_COUNT, &from_cbor));
+    cbor_us += esp_timer_get_time() - start;
+
+    TEST_ASSERT_EQUAL_STRING(r.name, from_cbor.name);
+    TEST_ASSERT_EQUAL_INT64(r.birth_date, from_cbor.birth_date);
+    TEST_ASSERT_EQUAL_FLOAT(r.weight, from_cbor.weight);
+    TEST_ASSERT_EQUAL_MEMORY(&from_json, &from_cbor, sizeof(reptile_t));
+  }
+
+  printf("%d animals  JSON: %u B, decode %lld us\n", BENCH_ANIMALS,
+         (unsigned)json_total, (long long)json_us);
+  printf("%d animals  CBOR: %u B (header included), decode %lld us\n",
+         BENCH_ANIMALS, (unsigned)cbor_total, (long long)cbor_us);
+
+  TEST_ASSERT_LESS_THAN(json_total, cbor_total);
+}
@@ -0,0 +1,111 @@
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#if CONFIG_ARS_DATA_SNAPSHOT
+
+// Readers of the animal list: acquiring a snapshot against copying the index.
+// Then the cost of a save (new version, copied chunks), the memory the
+// versions take, and an old version left untouched by later saves.
+
+#define BENCH_ANIMALS 200
+#define BENCH_QUERIES 1000
+#define BENCH_SAVES 50
+
+static void bench_id(char *id, size_t len, int i) {
+  snprintf(id, len, "snap-%04d", i);
+}
+
+static void save(int i, const char *name) {
+  reptile_t r = {0};
+  bench_id(r.id, sizeof(r.id), i);
+  strlcpy(r.name, name, sizeof(r.name));
+  strlcpy(r.species, "Python regius", sizeof(r.species));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+}
+
+TEST_CASE("snapshot: acquire vs copy, publish cost, old versions",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    save(i, "Before");
+  }
+  const data_manager_snapshot_t *snap = data_manager_snapshot_acquire();
+  TEST_ASSERT_NOT_NULL(snap);
+  size_t animals = data_manager_snapshot_reptile_count(snap);
+  TEST_ASSERT_GREATER_OR_EQUAL(BENCH_ANIMALS, animals);
+
+  int64_t t0 = esp_timer_get_time();
+  for (int q = 0; q < BENCH_QUERIES; q++) {
+    const data_manager_snapshot_t *s = data_manager_snapshot_acquire();
+    data_manager_snapshot_release(s);
+  }
+  int64_t acquire_us = esp_timer_get_time() - t0;
+  t0 = esp_timer_get_time();
+  for (int q = 0; q < BENCH_QUERIES / 10; q++) {
+    reptile_summary_t *list = NULL;
+    size_t n = 0;
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_list_reptile_summaries(&list, &n));
+    free(list);
+  }
+  int64_t copy_us = (esp_timer_get_time() - t0) * 10;
+  printf("snapshot: %d acquire+release in %lld us, %d copies of %u "
+         "summaries in %lld us\n",
+         BENCH_QUERIES, (long long)acquire_us, BENCH_QUERIES,
+         (unsigned)animals, (long long)copy_us);
+
+  data_manager_snapshot_stats_t before, after;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_snapshot_stats(&before));
+  t0 = esp_timer_get_time();
+  for (int i = 0; i < BENCH_SAVES; i++) {
+    save(i * (BENCH_ANIMALS / BENCH_SAVES), "After");
+  }
+  int64_t save_us = (esp_timer_get_time() - t0) / BENCH_SAVES;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_snapshot_stats(&after));
+  uint32_t publishes = after.publishes - before.publishes;
+  TEST_ASSERT_GREATER_OR_EQUAL(BENCH_SAVES, publishes);
+  printf("snapshot: save %lld us, %u publishes, %u chunk copies, build "
+         "%llu us avg, %u us max\n",
+         (long long)save_us, (unsigned)publishes,
+         (unsigned)(after.chunk_copies - before.chunk_copies),
+         (unsigned long long)((after.total_build_us - before.total_build_us) /
+                              publishes),
+         (unsigned)after.max_build_us);
+  // The old version is still held: its chunks are no longer shared.
+  printf("snapshot: %u versions, %u chunks, %u bytes (index: %u bytes)\n",
+         (unsigned)after.live_versions, (unsigned)after.chunks,
+         (unsigned)after.bytes,
+         (unsigned)(animals * sizeof(reptile_summary_t)));
+
+  char id[MAX_ID_LEN];
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    bench_id(id, sizeof(id), i);
+    const reptile_summary_t *r = data_manager_snapshot_find_reptile(snap, id);
+    TEST_ASSERT_NOT_NULL(r);
+    TEST_ASSERT_EQUAL_STRING("Before", r->name);
+  }
+  const data_manager_snapshot_t *now = data_manager_snapshot_acquire();
+  TEST_ASSERT_NOT_NULL(now);
+  TEST_ASSERT_GREATER_THAN(data_manager_snapshot_version(snap),
+                           data_manager_snapshot_version(now));
+  bench_id(id, sizeof(id), 0);
+  TEST_ASSERT_EQUAL_STRING(
+      "After", data_manager_snapshot_find_reptile(now, id)->name);
+  data_manager_snapshot_release(now);
+  data_manager_snapshot_release(snap);
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_snapshot_stats(&after));
+  TEST_ASSERT_EQUAL(1, after.live_versions);
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    bench_id(id, sizeof(id), i);
+    data_manager_delete_reptile(id);
+  }
+}
+
+#endif
@@ -0,0 +1,109 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Interned species and morphs on a synthetic 5,000-animal facility, against
+// the layout they replace (two char[MAX_SPECIES_LEN] per summary): RAM of the
+// summaries, index file bytes, and a species filter by pointer against one
+// by strcmp.
+
+#define BENCH_ANIMALS 5000
+#define BENCH_ROUNDS 20
+
+typedef struct {
+  char id[MAX_ID_LEN];
+  char name[MAX_NAME_LEN];
+  char species[MAX_SPECIES_LEN];
+  char morph[MAX_SPECIES_LEN];
+  reptile_gender_t gender;
+  float weight;
+} text_summary_t;
+
+static const char *const s_species[] = {
+    "Python regius", "Pogona vitticeps", "Eublepharis macularius",
+    "Testudo hermanni", "Morelia spilota", "Correlophus ciliatus",
+    "Pantherophis guttatus", "Lampropeltis triangulum", "Boa constrictor",
+    "Varanus exanthematicus", "Chamaeleo calyptratus", "Furcifer pardalis",
+    "Rhacodactylus leachianus", "Tiliqua scincoides", "Heloderma suspectum",
+    "Iguana iguana", "Trachemys scripta", "Graptemys pseudogeographica",
+    "Python bivittatus", "Epicrates cenchria", "Hemitheconyx caudicinctus",
+    "Uromastyx ornata", "Phelsuma grandis", "Physignathus cocincinus"};
+static const char *const s_morphs[] = {
+    "", "Classique", "Banana Pied", "Albinos", "Tremper", "Hypo",
+    "Leucistique", "Anery", "Het Clown", "Mojave", "Pastel", "Axanthique"};
+
+#define SPECIES_COUNT (sizeof(s_species) / sizeof(s_species[0]))
+#define MORPH_COUNT (sizeof(s_morphs) / sizeof(s_morphs[0]))
+
+TEST_CASE("strings: interned summaries at 5000 animals",
+          "[data_manager][bench]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  text_summary_t *text = calloc(BENCH_ANIMALS, sizeof(*text));
+  reptile_summary_t *interned = calloc(BENCH_ANIMALS, sizeof(*interned));
+  TEST_ASSERT_NOT_NULL(text);
+  TEST_ASSERT_NOT_NULL(interned);
+
+  data_manager_string_stats_t before, after;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_string_stats(&before));
+  size_t text_blob = 0;
+  for (int i = 0; i < BENCH_ANIMALS; i++) {
+    const char *species = s_species[i % SPECIES_COUNT];
+    const char *morph = s_morphs[(i / SPECIES_COUNT) % MORPH_COUNT];
+    snprintf(text[i].id, sizeof(text[i].id), "str-%05d", i);
+    strlcpy(text[i].species, species, sizeof(text[i].species));
+    strlcpy(text[i].morph, morph, sizeof(text[i].morph));
+    memcpy(interned[i].id, text[i].id, sizeof(interned[i].id));
+    interned[i].species = string_intern(species);
+    interned[i].morph = string_intern(morph);
+    text_blob += strlen(species) + strlen(morph) + 2;
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_string_stats(&after));
+  TEST_ASSERT_LESS_OR_EQUAL(SPECIES_COUNT + MORPH_COUNT,
+                            after.strings - before.strings);
+
+  size_t text_ram = BENCH_ANIMALS * sizeof(text_summary_t);
+  size_t interned_ram = BENCH_ANIMALS * sizeof(reptile_summary_t);
+  printf("strings: %d summaries %u bytes as text, %u interned + %u pool "
+         "(%u strings); index file %u -> %u bytes for the two fields\n",
+         BENCH_ANIMALS, (unsigned)text_ram, (unsigned)interned_ram,
+         (unsigned)after.bytes, (unsigned)after.strings, (unsigned)text_blob,
+         (unsigned)(BENCH_ANIMALS * 2 * sizeof(uint16_t)));
+  TEST_ASSERT_LESS_THAN(text_ram, interned_ram + after.bytes);
+
+  // Filter on the species shared by the most animals.
+  const char *wanted = s_species[0];
+  size_t strcmp_hits = 0;
+  int64_t t0 = esp_timer_get_time();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    strcmp_hits = 0;
+    for (int i = 0; i < BENCH_ANIMALS; i++) {
+      strcmp_hits += strcmp(text[i].species, wanted) == 0;
+    }
+  }
+  int64_t strcmp_us = (esp_timer_get_time() - t0) / BENCH_ROUNDS;
+
+  size_t pointer_hits = 0;
+  t0 = esp_timer_get_time();
+  for (int round = 0; round < BENCH_ROUNDS; round++) {
+    const char *key = data_manager_find_string(wanted);
+    pointer_hits = 0;
+    for (int i = 0; i < BENCH_ANIMALS; i++) {
+      pointer_hits += interned[i].species == key;
+    }
+  }
+  int64_t pointer_us = (esp_timer_get_time() - t0) / BENCH_ROUNDS;
+  printf("strings: species filter %lld us by strcmp, %lld us by pointer "
+         "(%u matches)\n",
+         (long long)strcmp_us, (long long)pointer_us, (unsigned)pointer_hits);
+  TEST_ASSERT_EQUAL(strcmp_hits, pointer_hits);
+  TEST_ASSERT_NULL(data_manager_find_string("Espece jamais vue"));
+
+  free(text);
+  free(interned);
+}
@@ -0,0 +1,225 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+// Per-animal aggregates: kept up to date by single and batched appends in
+// any timestamp order, and equal to a rebuild from the history files.
+
+#define TEST_ID "agg-test"
+#define TEST_WTS DATA_MANAGER_ROOT "/weights/" TEST_ID ".wts"
+
+static void cleanup(void) {
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+  data_manager_delete_reptile(TEST_ID); // Absent in most tests
+  TEST_ASSERT_TRUE(data_fs_write_lock(pdMS_TO_TICKS(2000)));
+  unlink(TEST_WTS);
+  aggregate_remove_unlocked(TEST_ID);
+  data_fs_write_unlock();
+}
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  cleanup();
+}
+
+static void add_event(const char *id, int type, int64_t ts) {
+  reptile_event_t e = {.type = type, .timestamp = ts};
+  strlcpy(e.id, id, sizeof(e.id));
+  strlcpy(e.reptile_id, TEST_ID, sizeof(e.reptile_id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&e));
+}
+
+static reptile_aggregate_t get(void) {
+  reptile_aggregate_t agg;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_aggregate(TEST_ID, &agg));
+  TEST_ASSERT_EQUAL_STRING(TEST_ID, agg.id);
+  return agg;
+}
+
+TEST_CASE("aggregates: appends in any order update every field",
+          "[data_manager]") {
+  setup();
+  reptile_aggregate_t agg;
+  memset(&agg, 0xa5, sizeof(agg));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    data_manager_get_aggregate(TEST_ID, &agg));
+  TEST_ASSERT_EQUAL(0, agg.event_count);
+  TEST_ASSERT_EQUAL(0, agg.last_event);
+
+  // An older feeding recorded after a newer one does not move it back.
+  add_event("e1", EVENT_FEEDING, 300);
+  add_event("e2", EVENT_FEEDING, 100);
+  add_event("e3", EVENT_MOLT, 200);
+  add_event("e4", EVENT_VET, 400);
+  agg = get();
+  TEST_ASSERT_EQUAL(300, agg.last_feeding);
+  TEST_ASSERT_EQUAL(200, agg.last_shedding);
+  TEST_ASSERT_EQUAL(400, agg.last_event);
+  TEST_ASSERT_EQUAL(4, agg.event_count);
+  TEST_ASSERT_EQUAL(2, agg.events_by_type[EVENT_FEEDING]);
+  TEST_ASSERT_EQUAL(1, agg.events_by_type[EVENT_MOLT]);
+  TEST_ASSERT_EQUAL(1, agg.events_by_type[EVENT_VET]);
+  TEST_ASSERT_EQUAL(0, agg.weight_count);
+
+  // Batches go through the same path; the latest weighing wins.
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  reptile_event_t e = {.type = EVENT_SHEDDING, .timestamp = 500};
+  strlcpy(e.id, "e5", sizeof(e.id));
+  strlcpy(e.reptile_id, TEST_ID, sizeof(e.reptile_id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_event(batch, &e));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_batch_put_weight(batch, TEST_ID, 80.0f, 50));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_batch_put_weight(batch, TEST_ID, 90.0f, 40));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+  agg = get();
+  TEST_ASSERT_EQUAL(500, agg.last_shedding);
+  TEST_ASSERT_EQUAL(500, agg.last_event);
+  TEST_ASSERT_EQUAL(5, agg.event_count);
+  TEST_ASSERT_EQUAL(2, agg.weight_count);
+  TEST_ASSERT_EQUAL(50, agg.last_weight_ts);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 80.0f, agg.current_weight);
+
+  // On a tie, the last one recorded.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 85.0f, 50));
+  agg = get();
+  TEST_ASSERT_EQUAL(3, agg.weight_count);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 85.0f, agg.current_weight);
+
+  // Deleting the events keeps the weight part.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+  agg = get();
+  TEST_ASSERT_EQUAL(0, agg.event_count);
+  TEST_ASSERT_EQUAL(0, agg.last_feeding);
+  TEST_ASSERT_EQUAL(0, agg.events_by_type[EVENT_FEEDING]);
+  TEST_ASSERT_EQUAL(3, agg.weight_count);
+  cleanup();
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    data_manager_get_aggregate(TEST_ID, &agg));
+}
+
+TEST_CASE("aggregates: a rebuild from history gives the same values",
+          "[data_manager]") {
+  setup();
+  reptile_t r = {.gender = GENDER_UNKNOWN};
+  strlcpy(r.id, TEST_ID, sizeof(r.id));
+  strlcpy(r.name, "Agrégat", sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  for (int i = 0; i < 30; i++) {
+    char id[16];
+    snprintf(id, sizeof(id), "e%02d", i);
+    add_event(id, i % 3 == 0 ? EVENT_SHEDDING : EVENT_FEEDING,
+              1000 + (i * 37) % 30 * 10);
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 100.0f + i,
+                                                      2000 + i * 10));
+  }
+  reptile_aggregate_t before = get();
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_rebuild_aggregates());
+  reptile_aggregate_t after = get();
+  TEST_ASSERT_EQUAL(before.last_feeding, after.last_feeding);
+  TEST_ASSERT_EQUAL(before.last_shedding, after.last_shedding);
+  TEST_ASSERT_EQUAL(before.last_event, after.last_event);
+  TEST_ASSERT_EQUAL(before.last_weight_ts, after.last_weight_ts);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, before.current_weight,
+                           after.current_weight);
+  TEST_ASSERT_EQUAL(before.weight_count, after.weight_count);
+  TEST_ASSERT_EQUAL(before.event_count, after.event_count);
+  TEST_ASSERT_EQUAL_MEMORY(before.events_by_type, after.events_by_type,
+                           sizeof(before.events_by_type));
+  TEST_ASSERT_EQUAL(30, after.event_count);
+  TEST_ASSERT_EQUAL(2290, after.last_weight_ts);
+  cleanup();
+}
+
+static float summary_weight(void) {
+  float weight = -1.0f;
+  TEST_ASSERT_TRUE(data_manager_index_get_weight(TEST_ID, &weight));
+  return weight;
+}
+
+TEST_CASE("aggregates: the summary weight is the latest weighing",
+          "[data_manager]") {
+  setup();
+  reptile_t r = {.gender = GENDER_UNKNOWN, .weight = 80.0f};
+  strlcpy(r.id, TEST_ID, sizeof(r.id));
+  strlcpy(r.name, "Pesée", sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 80.0f, summary_weight());
+
+  // A back-filled weighing is older: the summary keeps the newer one.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 500.0f, 2000));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 300.0f, 1000));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 500.0f, summary_weight());
+
+  // Same in a batch whose last put is the oldest.
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_batch_put_weight(batch, TEST_ID, 700, 3000));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_batch_put_weight(batch, TEST_ID, 100, 1500));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 700.0f, summary_weight());
+
+  // A record save and a rebuild of the index give the same weight.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 700.0f, summary_weight());
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_rebuild_index());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 700.0f, summary_weight());
+
+  // Index persisted before a weighing: the next init catches up.
+  data_manager_index_set_weight(TEST_ID, 300.0f);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_aggregates_init());
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 700.0f, summary_weight());
+  cleanup();
+}
+
+static bool count_event(const reptile_event_t *event, void *user_ctx) {
+  (void)event;
+  (*(size_t *)user_ctx)++;
+  return true;
+}
+
+TEST_CASE("aggregates: deleting an animal removes its history",
+          "[data_manager]") {
+  setup();
+  reptile_t r = {.gender = GENDER_UNKNOWN, .weight = 80.0f};
+  strlcpy(r.id, TEST_ID, sizeof(r.id));
+  strlcpy(r.name, "Supprimé", sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  add_event("e1", EVENT_FEEDING, 100);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 500.0f, 200));
+  TEST_ASSERT_EQUAL(0, access(TEST_WTS, F_OK));
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+  reptile_aggregate_t agg;
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    data_manager_get_aggregate(TEST_ID, &agg));
+  reptile_aggregate_t *list = NULL;
+  size_t count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_list_aggregates(&list, &count));
+  for (size_t i = 0; i < count; i++) {
+    TEST_ASSERT_NOT_EQUAL(0, strcmp(list[i].id, TEST_ID));
+  }
+  free(list);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_WTS, F_OK));
+  size_t events = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, count_event, &events));
+  TEST_ASSERT_EQUAL(0, events);
+
+  // A reused id starts empty.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, 80.0f, summary_weight());
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    data_manager_get_aggregate(TEST_ID, &agg));
+  cleanup();
+}
@@ -0,0 +1,163 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "sdkconfig.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+#if CONFIG_ARS_DATA_CACHE
+
+// Coherence of the entity cache with the files behind it: write-back of
+// saves with the index stale mark held meanwhile, and LRU eviction under the
+// budget.
+
+#define TEST_ID "cache-test"
+#define TEST_BUDGET (CONFIG_ARS_DATA_CACHE_BUDGET_KB * 1024)
+#define TEST_STALE DATA_MANAGER_INDEX_DIR "/reptiles.stale"
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+}
+
+static void make_reptile(reptile_t *r, const char *id, const char *name) {
+  memset(r, 0, sizeof(*r));
+  strlcpy(r->id, id, sizeof(r->id));
+  strlcpy(r->name, name, sizeof(r->name));
+  strlcpy(r->species, "Pogona vitticeps", sizeof(r->species));
+}
+
+static void assert_name(const char *id, const char *name) {
+  reptile_t r;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(id, &r));
+  TEST_ASSERT_EQUAL_STRING(name, r.name);
+}
+
+static data_manager_cache_stats_t stats(void) {
+  data_manager_cache_stats_t s;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_cache_stats(&s));
+  return s;
+}
+
+TEST_CASE("cache: saves are written back and served from RAM meanwhile",
+          "[data_manager]") {
+  setup();
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  data_manager_reset_cache_stats();
+  reptile_t r;
+  make_reptile(&r, TEST_ID, "Avant");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  make_reptile(&r, TEST_ID, "Après");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+
+  // Pending: served from RAM, and the index is marked stale until written.
+  assert_name(TEST_ID, "Après");
+  data_manager_cache_stats_t s = stats();
+  TEST_ASSERT_EQUAL(1, s.dirty);
+  TEST_ASSERT_EQUAL(0, s.writebacks);
+  TEST_ASSERT_EQUAL(1, s.hits);
+  TEST_ASSERT_EQUAL(0, access(TEST_STALE, F_OK));
+
+  // Both saves reach flash as one write; the mark goes with the last one.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  s = stats();
+  TEST_ASSERT_EQUAL(0, s.dirty);
+  TEST_ASSERT_EQUAL(1, s.writebacks);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_STALE, F_OK));
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  assert_name(TEST_ID, "Après");
+  TEST_ASSERT_EQUAL(1, stats().misses);
+
+  // Deleted before its write-back: nothing is left, on flash or in RAM.
+  make_reptile(&r, TEST_ID, "Jamais écrit");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  TEST_ASSERT_EQUAL(0, stats().dirty);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_STALE, F_OK));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+}
+
+TEST_CASE("cache: batches and concurrent stores leave no stale copy",
+          "[data_manager]") {
+  setup();
+  reptile_t r;
+  make_reptile(&r, TEST_ID, "Avant");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  assert_name(TEST_ID, "Avant");
+
+  // Batches write straight to flash and invalidate what they replace: the
+  // pending save is dropped, never written over the imported file.
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  make_reptile(&r, TEST_ID, "Importé");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_reptile(batch, &r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+  TEST_ASSERT_EQUAL(0, stats().dirty);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  assert_name(TEST_ID, "Importé");
+
+  // A reader that loaded the old file before a store must not cache it.
+  reptile_t old;
+  make_reptile(&old, TEST_ID, "Lu avant");
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  uint32_t epoch = record_cache_epoch();
+  make_reptile(&r, TEST_ID, "Enregistré");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  record_cache_fill(RECORD_REPTILE, TEST_ID, &old, epoch);
+  assert_name(TEST_ID, "Enregistré");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  assert_name(TEST_ID, "Enregistré");
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+}
+
+TEST_CASE("cache: the least recently used entries are evicted",
+          "[data_manager]") {
+  setup();
+  // A pending save is written back before its entry is evicted.
+  reptile_t r;
+  make_reptile(&r, TEST_ID, "Évincé");
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+
+  // Twice the budget of entries, filled directly: nothing touches flash.
+  const int count = 2 * TEST_BUDGET / sizeof(reptile_t);
+  char id[MAX_ID_LEN];
+  data_manager_reset_cache_stats();
+  for (int i = 0; i < count; i++) {
+    snprintf(id, sizeof(id), "lru-%05d", i);
+    make_reptile(&r, id, id);
+    record_cache_fill(RECORD_REPTILE, id, &r, record_cache_epoch());
+    if (i > 0) {
+      // Keeps lru-00000 the most recently used.
+      TEST_ASSERT_TRUE(record_cache_get(RECORD_REPTILE, "lru-00000", &r));
+    }
+  }
+  data_manager_cache_stats_t s = stats();
+  TEST_ASSERT_GREATER_THAN(0, s.evictions);
+  TEST_ASSERT_LESS_OR_EQUAL(TEST_BUDGET, s.bytes);
+  TEST_ASSERT_EQUAL(1, s.writebacks);
+  TEST_ASSERT_EQUAL(0, s.dirty);
+  TEST_ASSERT_FALSE(record_cache_get(RECORD_REPTILE, TEST_ID, &r));
+  assert_name(TEST_ID, "Évincé");
+
+  TEST_ASSERT_TRUE(record_cache_get(RECORD_REPTILE, "lru-00000", &r));
+  TEST_ASSERT_EQUAL_STRING("lru-00000", r.name);
+  TEST_ASSERT_FALSE(record_cache_get(RECORD_REPTILE, "lru-00001", &r));
+  snprintf(id, sizeof(id), "lru-%05d", count - 1);
+  TEST_ASSERT_TRUE(record_cache_get(RECORD_REPTILE, id, &r));
+  TEST_ASSERT_EQUAL_STRING(id, r.name);
+
+  for (int i = 0; i < count; i++) {
+    snprintf(id, sizeof(id), "lru-%05d", i);
+    record_cache_drop(RECORD_REPTILE, id);
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+}
+
+#endif
@@ -0,0 +1,168 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "sdkconfig.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+#if CONFIG_ARS_DATA_CHANGES
+
+// What the change log records for each kind of write, and how a consumer
+// pages through it, catches up and is told to resync.
+
+#define TEST_A "chg-a"
+#define TEST_B "chg-b"
+#define TEST_CONTACT "chg-contact"
+#define TEST_MAX 16
+
+static data_manager_change_t s_changes[TEST_MAX];
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+}
+
+static void save(const char *id) {
+  reptile_t r = {.gender = GENDER_UNKNOWN};
+  strlcpy(r.id, id, sizeof(r.id));
+  strlcpy(r.name, id, sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+}
+
+static void make_event(reptile_event_t *e, const char *id, int64_t ts) {
+  memset(e, 0, sizeof(*e));
+  snprintf(e->id, sizeof(e->id), "e%lld", (long long)ts);
+  strlcpy(e->reptile_id, id, sizeof(e->reptile_id));
+  e->type = EVENT_FEEDING;
+  e->timestamp = ts;
+}
+
+static void add_event(const char *id, int64_t ts) {
+  reptile_event_t e;
+  make_event(&e, id, ts);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&e));
+}
+
+static size_t since(uint64_t seq, size_t max) {
+  size_t count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_changes_since(seq, s_changes, max, &count));
+  return count;
+}
+
+static void assert_change(size_t i, uint64_t seq, data_manager_entity_t entity,
+                          data_manager_change_op_t op, const char *id) {
+  TEST_ASSERT_EQUAL(seq, s_changes[i].seq);
+  TEST_ASSERT_EQUAL_STRING(data_manager_entity_name(entity),
+                           data_manager_entity_name(s_changes[i].entity));
+  TEST_ASSERT_EQUAL(op, s_changes[i].op);
+  TEST_ASSERT_EQUAL_STRING(id, s_changes[i].id);
+}
+
+TEST_CASE("changes: every write is logged once, in order", "[data_manager]") {
+  setup();
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_A));
+  uint64_t start = data_manager_change_seq();
+
+  save(TEST_A);
+  add_event(TEST_A, 1000);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_A, 120.0f, 1000));
+  contact_t c = {0};
+  strlcpy(c.id, TEST_CONTACT, sizeof(c.id));
+  strlcpy(c.name, "Vétérinaire", sizeof(c.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_contact(&c));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_A));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_A));
+
+  TEST_ASSERT_EQUAL(start + 6, data_manager_change_seq());
+  TEST_ASSERT_EQUAL(6, since(start, TEST_MAX));
+  const data_manager_change_op_t put = DATA_MANAGER_CHANGE_PUT;
+  const data_manager_change_op_t del = DATA_MANAGER_CHANGE_DELETE;
+  assert_change(0, start + 1, DATA_MANAGER_ENTITY_REPTILE, put, TEST_A);
+  assert_change(1, start + 2, DATA_MANAGER_ENTITY_EVENTS, put, TEST_A);
+  assert_change(2, start + 3, DATA_MANAGER_ENTITY_WEIGHTS, put, TEST_A);
+  assert_change(3, start + 4, DATA_MANAGER_ENTITY_CONTACT, put, TEST_CONTACT);
+  assert_change(4, start + 5, DATA_MANAGER_ENTITY_EVENTS, del, TEST_A);
+  assert_change(5, start + 6, DATA_MANAGER_ENTITY_REPTILE, del, TEST_A);
+
+  TEST_ASSERT_EQUAL_STRING(
+      "weights", data_manager_entity_name(DATA_MANAGER_ENTITY_WEIGHTS));
+  TEST_ASSERT_NULL(data_manager_entity_name(DATA_MANAGER_ENTITY_COUNT));
+  TEST_ASSERT_EQUAL(ESP_OK, record_delete(RECORD_CONTACT, TEST_CONTACT));
+}
+
+TEST_CASE("changes: a batch logs one entry per animal and kind",
+          "[data_manager]") {
+  setup();
+  uint64_t start = data_manager_change_seq();
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  reptile_event_t e;
+  for (int i = 0; i < 3; i++) {
+    make_event(&e, TEST_A, 2000 + i);
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_event(batch, &e));
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_weight(batch, TEST_A,
+                                                            100.0f + i,
+                                                            2000 + i));
+  }
+  make_event(&e, TEST_B, 2000);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_event(batch, &e));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+
+  TEST_ASSERT_EQUAL(3, since(start, TEST_MAX));
+  int seen[DATA_MANAGER_ENTITY_COUNT][2] = {{0}};
+  for (size_t i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(start + 1 + i, s_changes[i].seq);
+    TEST_ASSERT_EQUAL(DATA_MANAGER_CHANGE_PUT, s_changes[i].op);
+    seen[s_changes[i].entity][strcmp(s_changes[i].id, TEST_A) != 0]++;
+  }
+  TEST_ASSERT_EQUAL(1, seen[DATA_MANAGER_ENTITY_EVENTS][0]);
+  TEST_ASSERT_EQUAL(1, seen[DATA_MANAGER_ENTITY_WEIGHTS][0]);
+  TEST_ASSERT_EQUAL(1, seen[DATA_MANAGER_ENTITY_EVENTS][1]);
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_A));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_B));
+}
+
+TEST_CASE("changes: consumers page, catch up and resync", "[data_manager]") {
+  setup();
+  uint64_t start = data_manager_change_seq();
+  for (int i = 0; i < 10; i++) {
+    add_event(TEST_B, 3000 + i);
+  }
+
+  // Pages of four: a short page means caught up.
+  uint64_t seq = start;
+  size_t pages[3];
+  for (size_t p = 0; p < 3; p++) {
+    pages[p] = since(seq, 4);
+    TEST_ASSERT_EQUAL(seq + 1, s_changes[0].seq);
+    seq = s_changes[pages[p] - 1].seq;
+  }
+  TEST_ASSERT_EQUAL(4, pages[0]);
+  TEST_ASSERT_EQUAL(4, pages[1]);
+  TEST_ASSERT_EQUAL(2, pages[2]);
+  TEST_ASSERT_EQUAL(data_manager_change_seq(), seq);
+  TEST_ASSERT_EQUAL(0, since(seq, 4));
+
+  // A seq from the future cannot come from this log.
+  size_t count = 1;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                    data_manager_changes_since(seq + 1, s_changes, 4, &count));
+
+  // Overrun: the stale consumer resyncs, a current one reads on.
+  for (int i = 0; i < CONFIG_ARS_DATA_CHANGES_SIZE; i++) {
+    add_event(TEST_B, 4000 + i);
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE,
+                    data_manager_changes_since(start, s_changes, 4, &count));
+  seq = data_manager_change_seq();
+  TEST_ASSERT_EQUAL(1, since(seq - 1, 4));
+  assert_change(0, seq, DATA_MANAGER_ENTITY_EVENTS, DATA_MANAGER_CHANGE_PUT,
+                TEST_B);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_B));
+}
+
+#endif
@@ -0,0 +1,269 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// Conversion of legacy event histories on first access.
+
+#define TEST_ID "legacy-events"
+#define TEST_JSON DATA_MANAGER_ROOT "/events/" TEST_ID ".json"
+#define TEST_STAGE DATA_MANAGER_ROOT "/events/" TEST_ID ".migrating"
+#define TEST_START 1704067200LL // 2024-01-01 UTC
+#define HOUR 3600LL
+#define DAY 86400LL
+#define RANGE_START 1640995200LL // 2022-01-01 UTC
+#define RANGE_DAYS (3 * 365)
+
+typedef struct {
+  reptile_event_t *events;
+  size_t count;
+  size_t max;
+} collect_t;
+
+static bool collect_event(const reptile_event_t *event, void *user_ctx) {
+  collect_t *c = (collect_t *)user_ctx;
+  if (c->count < c->max) {
+    c->events[c->count] = *event;
+  }
+  c->count++;
+  return true;
+}
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+}
+
+static size_t file_size(const char *path) {
+  struct stat st;
+  TEST_ASSERT_EQUAL(0, stat(path, &st));
+  return (size_t)st.st_size;
+}
+
+// Same layout as the cJSON array the firmware used to rewrite on each add.
+static size_t write_legacy_json(size_t count) {
+  FILE *f = fopen(TEST_JSON, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fputs("[", f);
+  for (size_t i = 0; i < count; i++) {
+    fprintf(f,
+            "%s{\n\t\t\"id\":\t\"evt-%04u\",\n\t\t\"reptile_id\":\t\"%s\",\n"
+            "\t\t\"type\":\t%d,\n\t\t\"timestamp\":\t%lld,\n"
+            "\t\t\"notes\":\t\"Souris \\\"adulte\\\" n\\u00b0%u\"\n\t}",
+            i ? ", " : "", (unsigned)i, TEST_ID,
+            i % 5 == 0 ? EVENT_SHEDDING : EVENT_FEEDING,
+            (long long)(TEST_START + (long long)i * 12 * HOUR), (unsigned)i);
+  }
+  fputs("]", f);
+  fclose(f);
+  return file_size(TEST_JSON);
+}
+
+TEST_CASE("events: a legacy JSON history of any size is migrated",
+          "[data_manager]") {
+  setup();
+  // Four times the 8 KiB the tree-based loader was capped at.
+  const size_t count = 300;
+  TEST_ASSERT_GREATER_THAN(4 * 8192, write_legacy_json(count));
+
+  collect_t c = {.events = calloc(count + 1, sizeof(reptile_event_t)),
+                 .max = count + 1};
+  TEST_ASSERT_NOT_NULL(c.events);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(count, c.count);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_JSON, F_OK));
+  for (size_t i = 0; i < count; i++) {
+    char id[16];
+    char notes[32];
+    snprintf(id, sizeof(id), "evt-%04u", (unsigned)i);
+    snprintf(notes, sizeof(notes), "Souris \"adulte\" n\xc2\xb0%u",
+             (unsigned)i); // \u00b0 decoded to UTF-8
+    TEST_ASSERT_EQUAL_STRING(id, c.events[i].id);
+    TEST_ASSERT_EQUAL_STRING(TEST_ID, c.events[i].reptile_id);
+    TEST_ASSERT_EQUAL(i % 5 == 0 ? EVENT_SHEDDING : EVENT_FEEDING,
+                      c.events[i].type);
+    TEST_ASSERT_EQUAL(TEST_START + (int64_t)i * 12 * HOUR,
+                      c.events[i].timestamp);
+    TEST_ASSERT_EQUAL_STRING(notes, c.events[i].notes);
+  }
+
+  // Appends go to the shards next to the migrated history.
+  reptile_event_t next = {.type = EVENT_FEEDING,
+                          .timestamp = TEST_START + (int64_t)count * 12 * HOUR};
+  strlcpy(next.id, "evt-next", sizeof(next.id));
+  strlcpy(next.reptile_id, TEST_ID, sizeof(next.reptile_id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&next));
+  c.count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(count + 1, c.count);
+  TEST_ASSERT_EQUAL_STRING("evt-next", c.events[count].id);
+
+  free(c.events);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+}
+
+TEST_CASE("events: an unreadable legacy JSON history is kept",
+          "[data_manager]") {
+  setup();
+  // Cut mid-element, as a reset during the old rewrite could leave it.
+  size_t full = write_legacy_json(40);
+  FILE *f = fopen(TEST_JSON, "rb");
+  TEST_ASSERT_NOT_NULL(f);
+  char *head = malloc(full);
+  TEST_ASSERT_NOT_NULL(head);
+  TEST_ASSERT_EQUAL(full, fread(head, 1, full, f));
+  fclose(f);
+  f = fopen(TEST_JSON, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fwrite(head, 1, full / 2, f);
+  fclose(f);
+  free(head);
+
+  collect_t c = {0};
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(0, c.count);
+  TEST_ASSERT_EQUAL(full / 2, file_size(TEST_JSON));
+
+  // An append would mark the history as converted: refused instead.
+  reptile_event_t next = {.type = EVENT_FEEDING, .timestamp = TEST_START};
+  strlcpy(next.id, "evt-next", sizeof(next.id));
+  strlcpy(next.reptile_id, TEST_ID, sizeof(next.reptile_id));
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_add_event(&next));
+  TEST_ASSERT_EQUAL(full / 2, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(0, c.count);
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_JSON, F_OK));
+}
+
+TEST_CASE("events: an interrupted migration never duplicates events",
+          "[data_manager]") {
+  setup();
+  const size_t count = 50;
+  collect_t c = {.events = calloc(count + 1, sizeof(reptile_event_t)),
+                 .max = count + 1};
+  TEST_ASSERT_NOT_NULL(c.events);
+
+  // Reset while copying: a partial staging directory next to the source.
+  write_legacy_json(count);
+  TEST_ASSERT_EQUAL(0, mkdir(TEST_STAGE, 0775));
+  FILE *f = fopen(TEST_STAGE "/202401.log", "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fputs("partial", f);
+  fclose(f);
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(count, c.count);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_STAGE, F_OK));
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_JSON, F_OK));
+
+  // Reset after the shards were moved in, before the source was unlinked.
+  write_legacy_json(count);
+  c.count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(count, c.count);
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_JSON, F_OK));
+  for (size_t i = 0; i < count; i++) {
+    char id[16];
+    snprintf(id, sizeof(id), "evt-%04u", (unsigned)i);
+    TEST_ASSERT_EQUAL_STRING(id, c.events[i].id);
+  }
+
+  free(c.events);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+}
+
+static void put_daily_history(void) {
+  data_manager_batch_t *batch = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_begin(&batch));
+  for (int d = 0; d < RANGE_DAYS; d++) {
+    reptile_event_t e = {0};
+    snprintf(e.id, sizeof(e.id), "evt-%04d", d);
+    strlcpy(e.reptile_id, TEST_ID, sizeof(e.reptile_id));
+    e.type = d % 7 == 0 ? EVENT_SHEDDING : EVENT_FEEDING;
+    e.timestamp = RANGE_START + d * DAY;
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_put_event(batch, &e));
+  }
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_batch_commit(batch));
+}
+
+static size_t query(collect_t *c, int64_t from, int64_t to, uint32_t mask,
+                    size_t limit) {
+  c->count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_query_events(TEST_ID, from, to, mask,
+                                                      limit, collect_event, c));
+  return c->count;
+}
+
+TEST_CASE("events: range queries return exactly the events in range",
+          "[data_manager]") {
+  setup();
+  put_daily_history();
+  collect_t c = {.events = calloc(RANGE_DAYS + 2, sizeof(reptile_event_t)),
+                 .max = RANGE_DAYS + 2};
+  TEST_ASSERT_NOT_NULL(c.events);
+  int64_t last = RANGE_START + (RANGE_DAYS - 1) * DAY;
+
+  // Last 30 days, bounds included.
+  TEST_ASSERT_EQUAL(30, query(&c, last - 29 * DAY, last, 0, 0));
+  TEST_ASSERT_EQUAL(last - 29 * DAY, c.events[0].timestamp);
+  TEST_ASSERT_EQUAL(last, c.events[29].timestamp);
+  TEST_ASSERT_EQUAL(0, query(&c, last + 1, INT64_MAX, 0, 0));
+
+  // Exactly one month (February 2022), across both shard edges.
+  int64_t feb = RANGE_START + 31 * DAY;
+  TEST_ASSERT_EQUAL(28, query(&c, feb, feb + 28 * DAY - 1, 0, 0));
+  TEST_ASSERT_EQUAL_STRING("evt-0031", c.events[0].id);
+  TEST_ASSERT_EQUAL_STRING("evt-0058", c.events[27].id);
+
+  // Wider than the probed window: the months are listed instead.
+  TEST_ASSERT_EQUAL(801, query(&c, RANGE_START, RANGE_START + 800 * DAY, 0,
+                               0));
+  for (size_t i = 1; i < c.count; i++) {
+    TEST_ASSERT_EQUAL(c.events[i - 1].timestamp + DAY, c.events[i].timestamp);
+  }
+
+  // Type filter and limit: the first ten sheddings, oldest first.
+  TEST_ASSERT_EQUAL(10, query(&c, INT64_MIN, INT64_MAX,
+                              DATA_MANAGER_EVENT_TYPE_BIT(EVENT_SHEDDING),
+                              10));
+  for (size_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(EVENT_SHEDDING, c.events[i].type);
+    TEST_ASSERT_EQUAL(RANGE_START + (int64_t)i * 7 * DAY,
+                      c.events[i].timestamp);
+  }
+
+  // A late entry lands in its own month; a pre-1970 one sorts first.
+  reptile_event_t late = {.type = EVENT_OTHER, .timestamp = feb + HOUR};
+  strlcpy(late.id, "evt-late", sizeof(late.id));
+  strlcpy(late.reptile_id, TEST_ID, sizeof(late.reptile_id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&late));
+  reptile_event_t old = late;
+  old.timestamp = -DAY;
+  strlcpy(old.id, "evt-old", sizeof(old.id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&old));
+  TEST_ASSERT_EQUAL(29, query(&c, feb, feb + 28 * DAY - 1, 0, 0));
+  TEST_ASSERT_EQUAL_STRING("evt-late", c.events[28].id);
+  TEST_ASSERT_EQUAL(1, query(&c, INT64_MIN, -1, 0, 0));
+  TEST_ASSERT_EQUAL_STRING("evt-old", c.events[0].id);
+  c.count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, collect_event, &c));
+  TEST_ASSERT_EQUAL(RANGE_DAYS + 2, c.count);
+  TEST_ASSERT_EQUAL_STRING("evt-old", c.events[0].id);
+
+  free(c.events);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+}
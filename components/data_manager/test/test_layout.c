@@ -0,0 +1,148 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "sdkconfig.h"
+#include "storage_core.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// Moves done by record_layout_init() when the bucket fan-out of the record
+// files changes: flat files of older firmware, buckets of another fan-out,
+// and a move cut short by a reset.
+
+#define TEST_ID_A "layout-test-a"
+#define TEST_ID_B "layout-test-b"
+#define TEST_BITS CONFIG_ARS_DATA_RECORD_FANOUT_BITS
+#define TEST_OLD_BITS (TEST_BITS % 8 + 1) // Any other valid fan-out
+#define TEST_STAMP DATA_MANAGER_INDEX_DIR "/records.layout"
+
+// Current path of a reptile's .cbor file.
+static void record_file(const char *id, char *out, size_t len) {
+  char dir[96];
+  for (unsigned b = 0; b < record_bucket_count(); b++) {
+    record_bucket_dir(RECORD_REPTILE, b, dir, sizeof(dir));
+    snprintf(out, len, "%s/%s.cbor", dir, id);
+    if (access(out, F_OK) == 0) {
+      return;
+    }
+  }
+  TEST_FAIL_MESSAGE("record file not found");
+}
+
+static void save(const char *id, char *path, size_t len) {
+  reptile_t r = {.gender = GENDER_UNKNOWN, .weight = 42.0f};
+  strlcpy(r.id, id, sizeof(r.id));
+  strlcpy(r.name, id, sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush()); // Written back
+  record_file(id, path, len);
+}
+
+static void assert_loads(const char *id) {
+  record_cache_drop(RECORD_REPTILE, id);
+  reptile_t r;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(id, &r));
+  TEST_ASSERT_EQUAL_STRING(id, r.name);
+}
+
+static void assert_stamp(int bits) {
+  void *data = NULL;
+  size_t len = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, storage_load_secure(TEST_STAMP, &data, &len, 1));
+  TEST_ASSERT_EQUAL(1, len);
+  TEST_ASSERT_EQUAL(bits, ((uint8_t *)data)[0]);
+  free(data);
+}
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+}
+
+static void cleanup(void) {
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID_A));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID_B));
+}
+
+TEST_CASE("layout: flat record files are moved into their bucket",
+          "[data_manager]") {
+  setup();
+  char a[128];
+  char b[128];
+  char flat_a[128];
+  char flat_b[128];
+  save(TEST_ID_A, a, sizeof(a));
+  save(TEST_ID_B, b, sizeof(b));
+  snprintf(flat_a, sizeof(flat_a), "%s/%s.cbor", record_dir(RECORD_REPTILE),
+           TEST_ID_A);
+  snprintf(flat_b, sizeof(flat_b), "%s/%s.json", record_dir(RECORD_REPTILE),
+           TEST_ID_B);
+  // As left by older firmware: A in CBOR, B still in JSON.
+  TEST_ASSERT_EQUAL(0, rename(a, flat_a));
+  TEST_ASSERT_EQUAL(0, unlink(b));
+  FILE *f = fopen(flat_b, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fprintf(f, "{\n\t\"id\":\t\"%s\",\n\t\"name\":\t\"%s\"\n}", TEST_ID_B,
+          TEST_ID_B);
+  fclose(f);
+
+  TEST_ASSERT_EQUAL(ESP_OK, record_layout_init());
+  TEST_ASSERT_EQUAL(0, access(a, F_OK));
+  if (TEST_BITS > 0) {
+    TEST_ASSERT_NOT_EQUAL(0, access(flat_a, F_OK));
+    TEST_ASSERT_NOT_EQUAL(0, access(flat_b, F_OK));
+  }
+  assert_loads(TEST_ID_A);
+  assert_loads(TEST_ID_B);
+  assert_stamp(TEST_BITS);
+  cleanup();
+}
+
+TEST_CASE("layout: another fan-out is moved, even when cut short",
+          "[data_manager]") {
+  setup();
+  char a[128];
+  char b[128];
+  char old_dir[96];
+  char old_a[128];
+  save(TEST_ID_A, a, sizeof(a));
+  save(TEST_ID_B, b, sizeof(b));
+
+  // First pass: the stamp names the previous fan-out. Second pass: the
+  // stamp was lost, so every possible bucket is checked. In both, B was
+  // already moved when the reset hit and A is still in its old bucket.
+  const int old_bits[] = {TEST_OLD_BITS, 8};
+  for (size_t i = 0; i < sizeof(old_bits) / sizeof(old_bits[0]); i++) {
+    unsigned bucket = (1u << old_bits[i]) - 1; // Last bucket of that fan-out
+    snprintf(old_dir, sizeof(old_dir), "%s/%02x", record_dir(RECORD_REPTILE),
+             bucket);
+    snprintf(old_a, sizeof(old_a), "%s/%s.cbor", old_dir, TEST_ID_A);
+    mkdir(old_dir, 0775); // Already there when it is a current bucket
+    TEST_ASSERT_EQUAL(0, rename(a, old_a));
+    if (i == 0) {
+      uint8_t bits = TEST_OLD_BITS;
+      TEST_ASSERT_EQUAL(ESP_OK,
+                        storage_save_secure(TEST_STAMP, &bits, 1, 1));
+    } else {
+      TEST_ASSERT_EQUAL(0, unlink(TEST_STAMP));
+    }
+
+    TEST_ASSERT_EQUAL(ESP_OK, record_layout_init());
+    TEST_ASSERT_EQUAL(0, access(a, F_OK));
+    TEST_ASSERT_EQUAL(0, access(b, F_OK));
+    if (strcmp(old_a, a) != 0) {
+      TEST_ASSERT_NOT_EQUAL(0, access(old_a, F_OK));
+    }
+    if (TEST_BITS == 0 || bucket >= record_bucket_count()) {
+      TEST_ASSERT_NOT_EQUAL(0, access(old_dir, F_OK)); // Emptied, removed
+    }
+    assert_loads(TEST_ID_A);
+    assert_loads(TEST_ID_B);
+    assert_stamp(TEST_BITS);
+  }
+  cleanup();
+}
@@ -0,0 +1,136 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+#if CONFIG_ARS_DATA_METRICS
+
+// Attribution of calls, phases and bytes to operation classes, and the
+// quantiles read back from the histogram.
+
+#define TEST_ID "metrics-test"
+
+static data_manager_op_stats_t op_stats(data_manager_op_t op) {
+  data_manager_op_stats_t st;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_op_stats(op, &st));
+  return st;
+}
+
+static uint32_t histogram_total(const data_manager_op_stats_t *st) {
+  uint32_t total = 0;
+  for (unsigned b = 0; b < DATA_MANAGER_LATENCY_BUCKETS; b++) {
+    total += st->latency[b];
+  }
+  return total;
+}
+
+static bool count_event(const reptile_event_t *event, void *user_ctx) {
+  (void)event;
+  (*(size_t *)user_ctx)++;
+  return true;
+}
+
+TEST_CASE("metrics: public calls are counted under their class",
+          "[data_manager]") {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  data_manager_delete_events(TEST_ID);
+  reptile_t r = {.gender = GENDER_UNKNOWN};
+  strlcpy(r.id, TEST_ID, sizeof(r.id));
+  strlcpy(r.name, "Mesure", sizeof(r.name));
+  data_manager_reset_op_stats();
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  record_cache_drop(RECORD_REPTILE, TEST_ID); // First load reads the file
+  for (int i = 0; i < 3; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  }
+  reptile_event_t e = {.type = EVENT_FEEDING, .timestamp = 1000};
+  strlcpy(e.id, "e1", sizeof(e.id));
+  strlcpy(e.reptile_id, TEST_ID, sizeof(e.reptile_id));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&e));
+  size_t n = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_ID, count_event, &n));
+  TEST_ASSERT_EQUAL(1, n);
+  reptile_aggregate_t agg;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_aggregate(TEST_ID, &agg));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_ID));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+
+  data_manager_op_stats_t save = op_stats(DATA_MANAGER_OP_SAVE);
+  data_manager_op_stats_t load = op_stats(DATA_MANAGER_OP_LOAD);
+  TEST_ASSERT_EQUAL(1, save.calls);
+  TEST_ASSERT_EQUAL(3, load.calls);
+  TEST_ASSERT_EQUAL(1, op_stats(DATA_MANAGER_OP_EVENT_APPEND).calls);
+  TEST_ASSERT_EQUAL(1, op_stats(DATA_MANAGER_OP_EVENT_READ).calls);
+  TEST_ASSERT_EQUAL(1, op_stats(DATA_MANAGER_OP_AGGREGATE).calls);
+  TEST_ASSERT_EQUAL(2, op_stats(DATA_MANAGER_OP_DELETE).calls);
+  TEST_ASSERT_EQUAL(0, op_stats(DATA_MANAGER_OP_WEIGHT_APPEND).calls);
+
+  // The write-back wrote the record, the first load read it back.
+  data_manager_op_stats_t flush = op_stats(DATA_MANAGER_OP_FLUSH);
+  TEST_ASSERT_EQUAL(1, flush.calls);
+  TEST_ASSERT_GREATER_THAN(0, flush.bytes_written);
+  TEST_ASSERT_GREATER_THAN(0, load.bytes_read);
+  TEST_ASSERT_EQUAL(0, load.bytes_written);
+  TEST_ASSERT_EQUAL(load.calls, histogram_total(&load));
+  TEST_ASSERT_LESS_OR_EQUAL(load.total_us, load.max_us);
+
+  data_manager_reset_op_stats();
+  TEST_ASSERT_EQUAL(0, op_stats(DATA_MANAGER_OP_LOAD).calls);
+  TEST_ASSERT_EQUAL(0, op_stats(DATA_MANAGER_OP_LOAD).bytes_read);
+}
+
+TEST_CASE("metrics: phases go to the innermost open operation",
+          "[data_manager]") {
+  data_manager_reset_op_stats();
+  {
+    DM_OP_SCOPE(DATA_MANAGER_OP_MAINTENANCE);
+    {
+      DM_OP_SCOPE(DATA_MANAGER_OP_LIST);
+      dm_op_io(esp_timer_get_time(), 100, 0);
+    }
+    dm_op_io(esp_timer_get_time(), 7, 3);
+  }
+  dm_op_io(esp_timer_get_time(), 1000, 1000); // No operation open: dropped
+
+  data_manager_op_stats_t outer = op_stats(DATA_MANAGER_OP_MAINTENANCE);
+  data_manager_op_stats_t inner = op_stats(DATA_MANAGER_OP_LIST);
+  TEST_ASSERT_EQUAL(1, outer.calls);
+  TEST_ASSERT_EQUAL(1, inner.calls);
+  TEST_ASSERT_EQUAL(100, inner.bytes_read);
+  TEST_ASSERT_EQUAL(0, inner.bytes_written);
+  TEST_ASSERT_EQUAL(7, outer.bytes_read);
+  TEST_ASSERT_EQUAL(3, outer.bytes_written);
+  data_manager_reset_op_stats();
+}
+
+TEST_CASE("metrics: quantiles are read from the histogram bounds",
+          "[data_manager]") {
+  data_manager_op_stats_t st = {0};
+  TEST_ASSERT_EQUAL(0, data_manager_op_quantile_us(&st, 0.5f));
+
+  st.calls = 100;
+  st.latency[0] = 50; // < 1 us
+  st.latency[3] = 49; // [4, 8) us
+  st.latency[DATA_MANAGER_LATENCY_BUCKETS - 1] = 1;
+  TEST_ASSERT_EQUAL(1, data_manager_op_quantile_us(&st, 0.01f));
+  TEST_ASSERT_EQUAL(1, data_manager_op_quantile_us(&st, 0.5f));
+  TEST_ASSERT_EQUAL(8, data_manager_op_quantile_us(&st, 0.51f));
+  TEST_ASSERT_EQUAL(8, data_manager_op_quantile_us(&st, 0.99f));
+  TEST_ASSERT_EQUAL(UINT32_MAX, data_manager_op_quantile_us(&st, 1.0f));
+
+  TEST_ASSERT_EQUAL_STRING("event_read",
+                           data_manager_op_name(DATA_MANAGER_OP_EVENT_READ));
+  TEST_ASSERT_NULL(data_manager_op_name(DATA_MANAGER_OP_COUNT));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    data_manager_get_op_stats(DATA_MANAGER_OP_COUNT, &st));
+}
+
+#endif
@@ -0,0 +1,228 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "sdkconfig.h"
+#include "storage_core.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// Record files across format and schema versions: legacy JSON records, their
+// conversion to CBOR, and blobs written by a newer firmware.
+
+#define TEST_ID "records-test"
+#define TEST_CBOR_VERSION 1 // RECORD_CBOR_VERSION
+
+static void fill_reptile(reptile_t *r) {
+  memset(r, 0, sizeof(*r));
+  strlcpy(r->id, TEST_ID, sizeof(r->id));
+  strlcpy(r->name, "Nala \"la grande\"", sizeof(r->name));
+  strlcpy(r->species, "Python regius", sizeof(r->species));
+  strlcpy(r->morph, "Banana Pied", sizeof(r->morph));
+  r->birth_date = 1600000000;
+  r->gender = GENDER_FEMALE;
+  r->weight = 1234.5f;
+}
+
+static void assert_reptile(const reptile_t *r) {
+  reptile_t expected;
+  fill_reptile(&expected);
+  TEST_ASSERT_EQUAL_STRING(expected.id, r->id);
+  TEST_ASSERT_EQUAL_STRING(expected.name, r->name);
+  TEST_ASSERT_EQUAL_STRING(expected.species, r->species);
+  TEST_ASSERT_EQUAL_STRING(expected.morph, r->morph);
+  TEST_ASSERT_EQUAL(expected.birth_date, r->birth_date);
+  TEST_ASSERT_EQUAL(expected.gender, r->gender);
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, expected.weight, r->weight);
+}
+
+// Path of TEST_ID's record without its extension, in whichever bucket the
+// current layout puts it.
+static void record_stem(char *out, size_t len) {
+  char dir[96];
+  char path[128];
+  for (unsigned b = 0; b < record_bucket_count(); b++) {
+    record_bucket_dir(RECORD_REPTILE, b, dir, sizeof(dir));
+    snprintf(out, len, "%s/%s", dir, TEST_ID);
+    snprintf(path, sizeof(path), "%s.cbor", out);
+    if (access(path, F_OK) == 0) {
+      return;
+    }
+    snprintf(path, sizeof(path), "%s.json", out);
+    if (access(path, F_OK) == 0) {
+      return;
+    }
+  }
+  TEST_FAIL_MESSAGE("record file not found");
+}
+
+static void record_file(const char *stem, const char *ext, char *out,
+                        size_t len) {
+  snprintf(out, len, "%s%s", stem, ext);
+}
+
+// Saves and writes back the test reptile and returns its path stem. The
+// cached copy is dropped so the next load reads the file.
+static void setup(char *stem, size_t len) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  reptile_t r;
+  fill_reptile(&r);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  record_stem(stem, len);
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+}
+
+// Same layout as the cJSON objects the firmware used to write.
+static void write_legacy_json(const char *path) {
+  reptile_t r;
+  fill_reptile(&r);
+  FILE *f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fprintf(f,
+          "{\n\t\"id\":\t\"%s\",\n\t\"name\":\t\"Nala \\\"la grande\\\"\",\n"
+          "\t\"species\":\t\"%s\",\n\t\"morph\":\t\"%s\",\n"
+          "\t\"birth_date\":\t%lld,\n\t\"gender\":\t%d,\n"
+          "\t\"weight\":\t%g\n}",
+          r.id, r.species, r.morph, (long long)r.birth_date, (int)r.gender,
+          r.weight);
+  fclose(f);
+}
+
+TEST_CASE("records: a legacy JSON record is read and converted to CBOR",
+          "[data_manager]") {
+  char stem[120];
+  char cbor[128];
+  char json[128];
+  setup(stem, sizeof(stem));
+  record_file(stem, ".cbor", cbor, sizeof(cbor));
+  record_file(stem, ".json", json, sizeof(json));
+  unlink(cbor);
+  write_legacy_json(json);
+
+  reptile_t r;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  assert_reptile(&r);
+  TEST_ASSERT_EQUAL(0, access(json, F_OK));
+
+#if !CONFIG_ARS_DATA_RECORD_FORMAT_JSON
+  size_t converted = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_convert_records_to_cbor(&converted));
+  TEST_ASSERT_GREATER_OR_EQUAL(1, converted);
+  TEST_ASSERT_NOT_EQUAL(0, access(json, F_OK));
+
+  void *data = NULL;
+  size_t len = 0;
+  uint32_t version = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    storage_load_secure_versioned(cbor, &data, &len, &version));
+  TEST_ASSERT_EQUAL(TEST_CBOR_VERSION, version);
+  free(data);
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  memset(&r, 0, sizeof(r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  assert_reptile(&r);
+
+  // A leftover JSON copy, as an interrupted conversion leaves it: the CBOR
+  // file shadows it and a second pass has nothing to do.
+  write_legacy_json(json);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_convert_records_to_cbor(&converted));
+  TEST_ASSERT_EQUAL(0, converted);
+#endif
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+  TEST_ASSERT_NOT_EQUAL(0, access(cbor, F_OK));
+  TEST_ASSERT_NOT_EQUAL(0, access(json, F_OK));
+}
+
+#if !CONFIG_ARS_DATA_RECORD_FORMAT_JSON
+TEST_CASE("records: a record of an unknown schema version is kept",
+          "[data_manager]") {
+  char stem[120];
+  char cbor[128];
+  setup(stem, sizeof(stem));
+  record_file(stem, ".cbor", cbor, sizeof(cbor));
+
+  // Same payload, stamped by a newer firmware (or a zero version).
+  void *data = NULL;
+  size_t len = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, storage_load_secure(cbor, &data, &len,
+                                                TEST_CBOR_VERSION));
+  const uint32_t versions[] = {TEST_CBOR_VERSION + 1, 0};
+  for (size_t i = 0; i < sizeof(versions) / sizeof(versions[0]); i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, storage_save_secure(cbor, data, len,
+                                                  versions[i]));
+    reptile_t r;
+    TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+
+    // Neither rewritten nor removed: a downgrade must not lose the data.
+    void *kept = NULL;
+    size_t kept_len = 0;
+    uint32_t version = TEST_CBOR_VERSION;
+    TEST_ASSERT_EQUAL(ESP_OK, storage_load_secure_versioned(cbor, &kept,
+                                                            &kept_len,
+                                                            &version));
+    TEST_ASSERT_EQUAL(versions[i], version);
+    TEST_ASSERT_EQUAL(len, kept_len);
+    TEST_ASSERT_EQUAL_MEMORY(data, kept, len);
+    free(kept);
+  }
+
+  // Back at the current version, the same bytes decode again.
+  TEST_ASSERT_EQUAL(ESP_OK, storage_save_secure(cbor, data, len,
+                                                TEST_CBOR_VERSION));
+  free(data);
+  reptile_t r;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  assert_reptile(&r);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_ID));
+}
+#endif
+
+#define TEST_INDEX_STALE DATA_MANAGER_INDEX_DIR "/reptiles.stale"
+
+// The summary index holds what a rebuild from the records would give, and a
+// leftover stale mark (reset between a record write and the index persist)
+// makes the next init rebuild it.
+TEST_CASE("records: the index matches a rebuild, even after a reset",
+          "[data_manager]") {
+  char stem[96];
+  setup(stem, sizeof(stem));
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_INDEX_STALE, F_OK));
+
+  // A UI edit carries weight = 0: the record keeps the last weight.
+  reptile_t r;
+  fill_reptile(&r);
+  r.weight = 0.0f;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush());
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_INDEX_STALE, F_OK));
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_ID, &r));
+  assert_reptile(&r);
+  float weight = 0.0f;
+  TEST_ASSERT_TRUE(data_manager_index_get_weight(TEST_ID, &weight));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, r.weight, weight);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_rebuild_index());
+  TEST_ASSERT_TRUE(data_manager_index_get_weight(TEST_ID, &weight));
+  TEST_ASSERT_FLOAT_WITHIN(0.01f, r.weight, weight);
+
+  // Record gone, index persist lost: the mark makes init read the files.
+  char path[112];
+  record_file(stem, ".cbor", path, sizeof(path));
+  if (access(path, F_OK) != 0) {
+    record_file(stem, ".json", path, sizeof(path));
+  }
+  TEST_ASSERT_EQUAL(0, unlink(path));
+  record_cache_drop(RECORD_REPTILE, TEST_ID);
+  FILE *f = fopen(TEST_INDEX_STALE, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fclose(f);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_index_init());
+  TEST_ASSERT_FALSE(data_manager_index_get_weight(TEST_ID, &weight));
+  TEST_ASSERT_NOT_EQUAL(0, access(TEST_INDEX_STALE, F_OK));
+}
@@ -0,0 +1,223 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "sdkconfig.h"
+#include "unity.h"
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+#if CONFIG_ARS_DATA_SCRUB
+
+// What a scrubber pass does with each kind of damage: records repaired from
+// the cache or quarantined out of every index, torn event shards reported.
+
+#define TEST_CACHED "scrub-cached"
+#define TEST_LOST "scrub-lost"
+#define TEST_EVENTS 3
+#define TEST_QUARANTINE DATA_MANAGER_ROOT "/quarantine"
+#define TEST_REPORT TEST_QUARANTINE "/report.log"
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+}
+
+static void save(const char *id) {
+  reptile_t r = {.gender = GENDER_UNKNOWN};
+  strlcpy(r.id, id, sizeof(r.id));
+  strlcpy(r.name, id, sizeof(r.name));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_save_reptile(&r));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_flush()); // Written back
+}
+
+static void add_events(const char *id) {
+  for (int i = 0; i < TEST_EVENTS; i++) {
+    reptile_event_t e = {.type = EVENT_FEEDING, .timestamp = 1000 + i};
+    snprintf(e.id, sizeof(e.id), "e%d", i);
+    strlcpy(e.reptile_id, id, sizeof(e.reptile_id));
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_event(&e));
+  }
+}
+
+// Path of a reptile's .cbor file in the current layout.
+static void record_file(const char *id, char *out, size_t len) {
+  char dir[96];
+  for (unsigned b = 0; b < record_bucket_count(); b++) {
+    record_bucket_dir(RECORD_REPTILE, b, dir, sizeof(dir));
+    snprintf(out, len, "%s/%s.cbor", dir, id);
+    if (access(out, F_OK) == 0) {
+      return;
+    }
+  }
+  TEST_FAIL_MESSAGE("record file not found");
+}
+
+static void overwrite(const char *path, const char *text) {
+  FILE *f = fopen(path, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fputs(text, f);
+  fclose(f);
+}
+
+// Same name as the scrubber gives it: the path below the root, flattened.
+static void quarantine_path(const char *path, char *out, size_t len) {
+  snprintf(out, len, TEST_QUARANTINE "/%s",
+           path + strlen(DATA_MANAGER_ROOT) + 1);
+  for (char *p = out + strlen(TEST_QUARANTINE) + 1; *p; p++) {
+    if (*p == '/') {
+      *p = '_';
+    }
+  }
+}
+
+static bool report_mentions(const char *action, const char *path) {
+  char needle[192];
+  char line[256];
+  snprintf(needle, sizeof(needle), " %s %s ", action, path);
+  FILE *f = fopen(TEST_REPORT, "r");
+  bool found = false;
+  while (f && !found && fgets(line, sizeof(line), f)) {
+    found = strstr(line, needle) != NULL;
+  }
+  if (f) {
+    fclose(f);
+  }
+  return found;
+}
+
+static bool listed(const char *id) {
+  reptile_summary_t *list = NULL;
+  size_t count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_list_reptile_summaries(&list, &count));
+  bool found = false;
+  for (size_t i = 0; i < count; i++) {
+    found |= strcmp(list[i].id, id) == 0;
+  }
+  free(list);
+  return found;
+}
+
+static data_manager_scrub_stats_t scrub(void) {
+  // The first call finishes a pass the background task may have started
+  // past the damaged files; the second one is a whole pass.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_scrub_now());
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_scrub_now());
+  data_manager_scrub_stats_t st;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_scrub_stats(&st));
+  return st;
+}
+
+TEST_CASE("scrub: unreadable records are repaired or quarantined",
+          "[data_manager]") {
+  setup();
+  char cached[128];
+  char lost[128];
+  char moved[192];
+  save(TEST_CACHED);
+  save(TEST_LOST);
+  add_events(TEST_LOST);
+  record_file(TEST_CACHED, cached, sizeof(cached));
+  record_file(TEST_LOST, lost, sizeof(lost));
+  quarantine_path(lost, moved, sizeof(moved));
+  unlink(moved);
+
+  // Both files go bad; only the first one still has a decoded copy.
+  overwrite(cached, "not a storage_core blob");
+  overwrite(lost, "not a storage_core blob");
+  record_cache_drop(RECORD_REPTILE, TEST_LOST);
+  data_manager_scrub_stats_t before;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_scrub_stats(&before));
+  data_manager_scrub_stats_t after = scrub();
+  TEST_ASSERT_EQUAL(1, after.repaired - before.repaired);
+  TEST_ASSERT_EQUAL(1, after.quarantined - before.quarantined);
+
+  // Rewritten in place from the cache.
+  record_cache_drop(RECORD_REPTILE, TEST_CACHED);
+  reptile_t r;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_CACHED, &r));
+  TEST_ASSERT_EQUAL_STRING(TEST_CACHED, r.name);
+  TEST_ASSERT_TRUE(report_mentions("repaired", cached));
+  TEST_ASSERT_TRUE(listed(TEST_CACHED));
+
+  // Moved aside, and out of the listings and the aggregate table.
+  TEST_ASSERT_NOT_EQUAL(0, access(lost, F_OK));
+  TEST_ASSERT_EQUAL(0, access(moved, F_OK));
+  TEST_ASSERT_TRUE(report_mentions("quarantined", lost));
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_load_reptile(TEST_LOST, &r));
+  TEST_ASSERT_FALSE(listed(TEST_LOST));
+  reptile_aggregate_t agg;
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    data_manager_get_aggregate(TEST_LOST, &agg));
+
+  // Nothing left to find on the next pass.
+  before = after;
+  after = scrub();
+  TEST_ASSERT_EQUAL(before.repaired, after.repaired);
+  TEST_ASSERT_EQUAL(before.quarantined, after.quarantined);
+
+  unlink(moved);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_LOST));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_CACHED));
+}
+
+// Appends a record whose CRC does not match to the first shard of the animal.
+static void tear_shard(const char *id, char *path, size_t len) {
+  char dir[96];
+  snprintf(dir, sizeof(dir), DATA_MANAGER_ROOT "/events/%s", id);
+  DIR *d = opendir(dir);
+  TEST_ASSERT_NOT_NULL(d);
+  struct dirent *ent;
+  while ((ent = readdir(d)) != NULL && ent->d_name[0] == '.') {
+  }
+  TEST_ASSERT_NOT_NULL(ent);
+  snprintf(path, len, "%s/%s", dir, ent->d_name);
+  closedir(d);
+  FILE *f = fopen(path, "ab");
+  TEST_ASSERT_NOT_NULL(f);
+  // magic "EL", payload length 4, CRC 0, payload
+  static const uint8_t bad[] = {'E', 'L', 4, 0,   0,   0,
+                                0,   0,   'a', 'b', 'c', 'd'};
+  fwrite(bad, 1, sizeof(bad), f);
+  fclose(f);
+}
+
+static bool count_event(const reptile_event_t *event, void *user_ctx) {
+  (void)event;
+  (*(size_t *)user_ctx)++;
+  return true;
+}
+
+TEST_CASE("scrub: a torn event shard is reported and kept",
+          "[data_manager]") {
+  setup();
+  char shard[160];
+  save(TEST_LOST);
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_LOST));
+  add_events(TEST_LOST);
+  tear_shard(TEST_LOST, shard, sizeof(shard));
+
+  data_manager_scrub_stats_t before;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_get_scrub_stats(&before));
+  data_manager_scrub_stats_t after = scrub();
+  TEST_ASSERT_GREATER_OR_EQUAL(1, after.damaged - before.damaged);
+  TEST_ASSERT_EQUAL(before.quarantined, after.quarantined);
+  TEST_ASSERT_TRUE(report_mentions("damaged", shard));
+  TEST_ASSERT_EQUAL(0, access(shard, F_OK));
+
+  // The intact events of the shard are still served.
+  size_t count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    data_manager_foreach_event(TEST_LOST, count_event, &count));
+  TEST_ASSERT_EQUAL(TEST_EVENTS, count);
+  TEST_ASSERT_TRUE(listed(TEST_LOST));
+
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_events(TEST_LOST));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_delete_reptile(TEST_LOST));
+}
+
+#endif
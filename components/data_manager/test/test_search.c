@@ -0,0 +1,142 @@
+#include "../src/search_index.h"
+#include "data_manager.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Matching and ranking rules of the search index, on a private index so the
+// live one is left alone.
+
+typedef struct {
+  const char *name;
+  const char *species;
+  const char *morph;
+} animal_t;
+
+static const animal_t s_animals[] = {
+    {"Némésis", "Python regius", "Banana Pied"},
+    {"Éclair", "Pogona vitticeps", "Hypo"},
+    {"Chloé", "Python regius", "Albinos"},
+    {"Kaa", "Morelia spilota", ""},
+    {"Hypolite", "Eublepharis macularius", "Classique"},
+};
+#define ANIMAL_COUNT (sizeof(s_animals) / sizeof(s_animals[0]))
+
+static void fill_summary(reptile_summary_t *e, size_t i, const char *name) {
+  memset(e, 0, sizeof(*e));
+  snprintf(e->id, sizeof(e->id), "rep-%05u", (unsigned)i + 1);
+  strlcpy(e->name, name, sizeof(e->name));
+  e->species = s_animals[i].species;
+  e->morph = s_animals[i].morph;
+}
+
+static search_index_t *create_index(void) {
+  search_index_t *idx = search_index_create();
+  TEST_ASSERT_NOT_NULL(idx);
+  reptile_summary_t e;
+  for (size_t i = 0; i < ANIMAL_COUNT; i++) {
+    fill_summary(&e, i, s_animals[i].name);
+    TEST_ASSERT_EQUAL(ESP_OK, search_index_put(idx, &e));
+  }
+  return idx;
+}
+
+static int cmp_str(const void *a, const void *b) {
+  return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Hits of query as a sorted, comma-separated list of animal numbers.
+static const char *hits(search_index_t *idx, const char *query) {
+  static char out[64];
+  const char **ids = NULL;
+  size_t n = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, search_index_query(idx, query, 0, &ids, &n));
+  qsort(ids, n, sizeof(*ids), cmp_str);
+  out[0] = '\0';
+  for (size_t i = 0; i < n; i++) {
+    size_t len = strlen(out);
+    snprintf(out + len, sizeof(out) - len, "%s%d", i ? "," : "",
+             atoi(ids[i] + strlen("rep-")));
+  }
+  free(ids);
+  return out;
+}
+
+TEST_CASE("search: words, prefixes and substrings match", "[data_manager]") {
+  search_index_t *idx = create_index();
+
+  // Case and accents are folded on both sides.
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "nem"));
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "NÉMÉSIS"));
+  TEST_ASSERT_EQUAL_STRING("2", hits(idx, "eclair"));
+  TEST_ASSERT_EQUAL_STRING("3", hits(idx, "chloe"));
+
+  // One or two letters only match the start of a word.
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "n"));
+  TEST_ASSERT_EQUAL_STRING("1,3", hits(idx, "py"));
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "th"));
+  // Three and more match anywhere in a word.
+  TEST_ASSERT_EQUAL_STRING("1,3", hits(idx, "yth"));
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "ana"));
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "anab"));
+
+  // Every word must match, in any field.
+  TEST_ASSERT_EQUAL_STRING("3", hits(idx, "python albinos"));
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "python hypo"));
+  TEST_ASSERT_EQUAL_STRING("3", hits(idx, "rep-00003"));
+  TEST_ASSERT_EQUAL_STRING("4", hits(idx, "spilota kaa"));
+
+  const char **ids = NULL;
+  size_t n = 1;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG,
+                    search_index_query(idx, " -- ", 0, &ids, &n));
+  search_index_destroy(idx);
+}
+
+TEST_CASE("search: name hits rank first and results are capped",
+          "[data_manager]") {
+  search_index_t *idx = create_index();
+  const char **ids = NULL;
+  size_t n = 0;
+
+  // Name of 5 before morph of 2.
+  TEST_ASSERT_EQUAL(ESP_OK, search_index_query(idx, "hypo", 0, &ids, &n));
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL_STRING("rep-00005", ids[0]);
+  TEST_ASSERT_EQUAL_STRING("rep-00002", ids[1]);
+  free(ids);
+
+  TEST_ASSERT_EQUAL(ESP_OK, search_index_query(idx, "python", 1, &ids, &n));
+  TEST_ASSERT_EQUAL(1, n);
+  free(ids);
+  search_index_destroy(idx);
+}
+
+TEST_CASE("search: updates and removals are reflected at once",
+          "[data_manager]") {
+  search_index_t *idx = create_index();
+  reptile_summary_t e;
+
+  // A rename drops the old name's trigrams.
+  fill_summary(&e, 0, "Zygomatique");
+  TEST_ASSERT_EQUAL(ESP_OK, search_index_put(idx, &e));
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "nem"));
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "zygo"));
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "banana"));
+
+  search_index_remove(idx, "rep-00001");
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "zygo"));
+  TEST_ASSERT_EQUAL_STRING("3", hits(idx, "python"));
+
+  // The freed slot is reused without stale postings.
+  fill_summary(&e, 0, "Némésis");
+  TEST_ASSERT_EQUAL(ESP_OK, search_index_put(idx, &e));
+  TEST_ASSERT_EQUAL_STRING("1", hits(idx, "nem"));
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "zygo"));
+  TEST_ASSERT_EQUAL_STRING("1,3", hits(idx, "python"));
+
+  search_index_clear(idx);
+  TEST_ASSERT_EQUAL_STRING("", hits(idx, "python"));
+  search_index_destroy(idx);
+}
@@ -0,0 +1,174 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "storage_core.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// Chunked loads and random-access reads of storage_core files: payloads
+// around the chunk size come back intact, and damage is reported.
+
+#define TEST_DIR DATA_MANAGER_ROOT "/test_stream"
+#define TEST_PATH TEST_DIR "/blob.bin"
+#define TEST_MAX (3 * STORAGE_CHUNK_SIZE + 17)
+
+typedef struct {
+  uint8_t data[TEST_MAX];
+  size_t len;
+  size_t chunks;
+  size_t fail_at; // Chunk that returns an error, 0 for none
+  bool short_before_last;
+} collect_t;
+
+static esp_err_t collect_chunk(const uint8_t *chunk, size_t len, void *ctx) {
+  collect_t *c = ctx;
+  TEST_ASSERT_LESS_OR_EQUAL(STORAGE_CHUNK_SIZE, len);
+  TEST_ASSERT_LESS_OR_EQUAL(sizeof(c->data) - c->len, len);
+  // Only the last chunk may be shorter.
+  if (c->chunks > 0 && c->len % STORAGE_CHUNK_SIZE != 0) {
+    c->short_before_last = true;
+  }
+  memcpy(c->data + c->len, chunk, len);
+  c->len += len;
+  c->chunks++;
+  return c->chunks == c->fail_at ? ESP_ERR_NO_MEM : ESP_OK;
+}
+
+static void fill_blob(uint8_t *blob, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    blob[i] = (uint8_t)(i * 31 + i / 251);
+  }
+}
+
+static void cleanup(void) {
+  unlink(TEST_PATH);
+  rmdir(TEST_DIR);
+}
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  cleanup();
+  TEST_ASSERT_EQUAL(0, mkdir(TEST_DIR, 0775));
+}
+
+// Rewrites one payload byte in place.
+static void flip_payload_byte(size_t offset) {
+  FILE *f = fopen(TEST_PATH, "r+b");
+  TEST_ASSERT_NOT_NULL(f);
+  TEST_ASSERT_EQUAL(0, fseek(f, sizeof(storage_header_t) + offset, SEEK_SET));
+  int c = fgetc(f);
+  TEST_ASSERT_NOT_EQUAL(EOF, c);
+  TEST_ASSERT_EQUAL(0, fseek(f, sizeof(storage_header_t) + offset, SEEK_SET));
+  fputc(c ^ 0xff, f);
+  fclose(f);
+}
+
+TEST_CASE("stream: chunked loads return the payload intact",
+          "[data_manager]") {
+  setup();
+  static uint8_t blob[TEST_MAX];
+  static collect_t c;
+  fill_blob(blob, sizeof(blob));
+  const size_t sizes[] = {1, STORAGE_CHUNK_SIZE - 1, STORAGE_CHUNK_SIZE,
+                          STORAGE_CHUNK_SIZE + 1, TEST_MAX};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, storage_save_secure(TEST_PATH, blob, sizes[i],
+                                                  1));
+    memset(&c, 0, sizeof(c));
+    TEST_ASSERT_EQUAL(ESP_OK, storage_load_secure_stream(TEST_PATH, 1,
+                                                         collect_chunk, &c));
+    TEST_ASSERT_EQUAL(sizes[i], c.len);
+    TEST_ASSERT_EQUAL((sizes[i] + STORAGE_CHUNK_SIZE - 1) / STORAGE_CHUNK_SIZE,
+                      c.chunks);
+    TEST_ASSERT_FALSE(c.short_before_last);
+    TEST_ASSERT_EQUAL_MEMORY(blob, c.data, sizes[i]);
+  }
+
+  // A callback error stops the load and is returned as is.
+  memset(&c, 0, sizeof(c));
+  c.fail_at = 2;
+  TEST_ASSERT_EQUAL(ESP_ERR_NO_MEM, storage_load_secure_stream(
+                                        TEST_PATH, 1, collect_chunk, &c));
+  TEST_ASSERT_EQUAL(2, c.chunks);
+
+  memset(&c, 0, sizeof(c));
+  TEST_ASSERT_EQUAL(ESP_ERR_NOT_FOUND,
+                    storage_load_secure_stream(TEST_DIR "/missing.bin", 1,
+                                               collect_chunk, &c));
+  TEST_ASSERT_EQUAL(0, c.chunks);
+  cleanup();
+}
+
+TEST_CASE("stream: damaged payloads are reported", "[data_manager]") {
+  setup();
+  static uint8_t blob[TEST_MAX];
+  static collect_t c;
+  fill_blob(blob, sizeof(blob));
+
+  // The flipped byte sits in the last chunk: every chunk is delivered, then
+  // the CRC check fails.
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    storage_save_secure(TEST_PATH, blob, sizeof(blob), 1));
+  flip_payload_byte(sizeof(blob) - 1);
+  memset(&c, 0, sizeof(c));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, storage_load_secure_stream(
+                                             TEST_PATH, 1, collect_chunk, &c));
+  TEST_ASSERT_EQUAL(sizeof(blob), c.len);
+
+  // Cut short: the stream fails before the end.
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    storage_save_secure(TEST_PATH, blob, sizeof(blob), 1));
+  TEST_ASSERT_EQUAL(0, truncate(TEST_PATH, sizeof(storage_header_t) +
+                                               STORAGE_CHUNK_SIZE + 3));
+  memset(&c, 0, sizeof(c));
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, storage_load_secure_stream(
+                                    TEST_PATH, 1, collect_chunk, &c));
+  TEST_ASSERT_LESS_THAN(sizeof(blob), c.len);
+  cleanup();
+}
+
+TEST_CASE("stream: readers give random access and a separate CRC check",
+          "[data_manager]") {
+  setup();
+  static uint8_t blob[TEST_MAX];
+  fill_blob(blob, sizeof(blob));
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    storage_save_secure(TEST_PATH, blob, sizeof(blob), 7));
+
+  storage_reader_t *reader = NULL;
+  TEST_ASSERT_EQUAL(ESP_OK, storage_open_secure(TEST_PATH, 7, &reader));
+  TEST_ASSERT_EQUAL(sizeof(blob), storage_reader_size(reader));
+  TEST_ASSERT_EQUAL(7, storage_reader_version(reader));
+  uint8_t slice[64];
+  // Across a chunk boundary, then the very end.
+  size_t offsets[] = {0, STORAGE_CHUNK_SIZE - 10, sizeof(blob) - sizeof(slice)};
+  for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, storage_reader_read(reader, offsets[i], slice,
+                                                  sizeof(slice)));
+    TEST_ASSERT_EQUAL_MEMORY(blob + offsets[i], slice, sizeof(slice));
+  }
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    storage_reader_read(reader, sizeof(blob) - 8, slice,
+                                        sizeof(slice)));
+  TEST_ASSERT_EQUAL(ESP_OK, storage_reader_verify(reader));
+  storage_close_secure(reader);
+
+  // Opening checks the header and the size, not the CRC.
+  flip_payload_byte(100);
+  TEST_ASSERT_EQUAL(ESP_OK, storage_open_secure(TEST_PATH, 7, &reader));
+  TEST_ASSERT_EQUAL(ESP_OK, storage_reader_read(reader, 0, slice, 4));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, storage_reader_verify(reader));
+  storage_close_secure(reader);
+
+  TEST_ASSERT_EQUAL(0, truncate(TEST_PATH, sizeof(storage_header_t) + 100));
+  reader = (storage_reader_t *)1;
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_SIZE,
+                    storage_open_secure(TEST_PATH, 7, &reader));
+  TEST_ASSERT_NULL(reader);
+  cleanup();
+}
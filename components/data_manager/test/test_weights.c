@@ -0,0 +1,171 @@
+#include "../src/data_manager_priv.h"
+#include "data_manager.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/unistd.h>
+
+// Conversion of legacy weight histories on first access.
+
+#define TEST_ID "legacy-weights"
+#define TEST_JSON DATA_MANAGER_ROOT "/weights/" TEST_ID ".json"
+#define TEST_WTS DATA_MANAGER_ROOT "/weights/" TEST_ID ".wts"
+#define TEST_MIG TEST_WTS ".mig"
+#define TEST_START 1704067200LL // 2024-01-01 UTC
+#define DAY 86400LL
+
+typedef struct {
+  weight_sample_t *samples;
+  size_t count;
+  size_t max;
+} collect_t;
+
+static bool collect_sample(const weight_sample_t *sample, void *user_ctx) {
+  collect_t *c = (collect_t *)user_ctx;
+  if (c->count < c->max) {
+    c->samples[c->count] = *sample;
+  }
+  c->count++;
+  return true;
+}
+
+static size_t query_all(collect_t *c) {
+  c->count = 0;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_query_weights(TEST_ID, INT64_MIN,
+                                                       INT64_MAX,
+                                                       collect_sample, c));
+  return c->count;
+}
+
+static void cleanup(void) {
+  unlink(TEST_JSON);
+  unlink(TEST_WTS);
+  unlink(TEST_MIG);
+}
+
+static void setup(void) {
+  if (!data_manager_is_ready()) {
+    TEST_ASSERT_EQUAL(ESP_OK, data_manager_init());
+  }
+  cleanup();
+}
+
+static long file_size(const char *path) {
+  struct stat st;
+  return stat(path, &st) == 0 ? (long)st.st_size : -1;
+}
+
+// 0.1 g steps, the resolution of the series.
+static float legacy_weight(size_t i) { return 150.0f + (float)(i % 40) / 10; }
+
+// Same layout as the cJSON array the firmware used to rewrite on each add.
+// Every 50th entry lacks its weight, which the old readers skipped.
+static size_t write_legacy_json(size_t count) {
+  FILE *f = fopen(TEST_JSON, "wb");
+  TEST_ASSERT_NOT_NULL(f);
+  fputs("[", f);
+  size_t valid = 0;
+  for (size_t i = 0; i < count; i++) {
+    long long ts = TEST_START + (long long)i * DAY;
+    if (i % 50 == 49) {
+      fprintf(f, "%s{\n\t\t\"timestamp\":\t%lld\n\t}", i ? ", " : "", ts);
+      continue;
+    }
+    fprintf(f, "%s{\n\t\t\"weight\":\t%g,\n\t\t\"timestamp\":\t%lld\n\t}",
+            i ? ", " : "", legacy_weight(i), ts);
+    valid++;
+  }
+  fputs("]", f);
+  fclose(f);
+  return valid;
+}
+
+TEST_CASE("weights: a legacy JSON series of any size is migrated",
+          "[data_manager]") {
+  setup();
+  // Four times the 8 KiB the tree-based loader was capped at.
+  const size_t count = 1000;
+  size_t valid = write_legacy_json(count);
+  TEST_ASSERT_GREATER_THAN(4 * 8192, file_size(TEST_JSON));
+
+  collect_t c = {.samples = calloc(count + 1, sizeof(weight_sample_t)),
+                 .max = count + 1};
+  TEST_ASSERT_NOT_NULL(c.samples);
+  TEST_ASSERT_EQUAL(valid, query_all(&c));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_MIG));
+  size_t n = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (i % 50 == 49) {
+      continue;
+    }
+    TEST_ASSERT_EQUAL(TEST_START + (int64_t)i * DAY, c.samples[n].timestamp);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, legacy_weight(i), c.samples[n].weight);
+    n++;
+  }
+
+  // Appends extend the migrated series.
+  int64_t next_ts = TEST_START + (int64_t)count * DAY;
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 212.3f, next_ts));
+  TEST_ASSERT_EQUAL(valid + 1, query_all(&c));
+  TEST_ASSERT_EQUAL(next_ts, c.samples[valid].timestamp);
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 212.3f, c.samples[valid].weight);
+
+  free(c.samples);
+  cleanup();
+}
+
+TEST_CASE("weights: a migration never truncates an existing series",
+          "[data_manager]") {
+  setup();
+  weight_sample_t samples[8];
+  collect_t c = {.samples = samples, .max = 8};
+
+  // A series written by the new code, then a stray legacy file.
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 90.0f, 10));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 91.0f, 20));
+  long series = file_size(TEST_WTS);
+  write_legacy_json(5);
+  TEST_ASSERT_EQUAL(2, query_all(&c));
+  TEST_ASSERT_FLOAT_WITHIN(0.05f, 91.0f, samples[1].weight);
+  TEST_ASSERT_EQUAL(series, file_size(TEST_WTS));
+  TEST_ASSERT_NOT_EQUAL(-1, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_MIG));
+  // Merging is left to the user: appends are refused meanwhile.
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 92.0f, 30));
+  TEST_ASSERT_EQUAL(2, query_all(&c));
+
+  // A reset after the rename but before the JSON was removed: the same
+  // conversion is already in place, so it completes without duplicates.
+  unlink(TEST_WTS);
+  TEST_ASSERT_EQUAL(5, query_all(&c));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_JSON));
+  series = file_size(TEST_WTS);
+  write_legacy_json(5);
+  TEST_ASSERT_EQUAL(5, query_all(&c));
+  TEST_ASSERT_EQUAL(series, file_size(TEST_WTS));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 92.0f, 30));
+  cleanup();
+}
+
+TEST_CASE("weights: an unreadable legacy JSON series is kept",
+          "[data_manager]") {
+  setup();
+  write_legacy_json(40);
+  long full = file_size(TEST_JSON);
+  TEST_ASSERT_EQUAL(0, truncate(TEST_JSON, full / 2));
+
+  weight_sample_t samples[4];
+  collect_t c = {.samples = samples, .max = 4};
+  TEST_ASSERT_EQUAL(0, query_all(&c));
+  TEST_ASSERT_EQUAL(full / 2, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_WTS));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_MIG));
+  TEST_ASSERT_NOT_EQUAL(ESP_OK, data_manager_add_weight(TEST_ID, 92.0f, 30));
+  TEST_ASSERT_EQUAL(full / 2, file_size(TEST_JSON));
+  TEST_ASSERT_EQUAL(-1, file_size(TEST_WTS));
+  cleanup();
+}
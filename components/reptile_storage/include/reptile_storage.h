@@ -4,9 +4,27 @@
 #include <stddef.h>
 #include <stdint.h>
 
+// Settings in the NVS namespace "storage". The namespace is read once into a
+// RAM shadow behind a long-lived handle: reads never touch NVS, writes update
+// the shadow and are committed together CONFIG_ARS_SETTINGS_COMMIT_DELAY_MS
+// after the last one. Call storage_nvs_flush() before a reboot.
+
+typedef struct {
+  uint32_t reads;           // get calls served from the shadow
+  uint32_t writes;          // set calls
+  uint32_t unchanged;       // set calls with the value already stored
+  uint32_t commits;         // nvs_commit() calls
+  uint32_t commits_avoided; // set calls that did not need their own commit
+  uint32_t errors;          // failed flushes (values kept for the next one)
+} storage_nvs_stats_t;
 
 // API
 esp_err_t storage_nvs_set_str(const char *key, const char *value);
 esp_err_t storage_nvs_get_str(const char *key, char *out_value, size_t max_len);
 esp_err_t storage_nvs_set_i32(const char *key, int32_t value);
 esp_err_t storage_nvs_get_i32(const char *key, int32_t *out_value);
+
+// Writes pending values and commits now.
+esp_err_t storage_nvs_flush(void);
+
+esp_err_t storage_nvs_get_stats(storage_nvs_stats_t *out);
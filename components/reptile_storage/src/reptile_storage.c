@@ -1,67 +1,348 @@
 #include "reptile_storage.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 #include "nvs.h"
 #include "nvs_flash.h"
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
+static const char *TAG = "reptile_storage";
 
-// static const char *TAG = "reptile_storage";
+#define SETTINGS_NAMESPACE "storage"
+#define SETTINGS_STR_MAX 4000 // Longest NVS string, NUL included
 
-esp_err_t storage_nvs_set_str(const char *key, const char *value) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
+typedef struct {
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  nvs_type_t type; // NVS_TYPE_STR or NVS_TYPE_I32
+  union {
+    char *str;
+    int32_t i32;
+  } v;
+  bool dirty;
+  bool retyped; // NVS still holds the key under its previous type
+} setting_t;
 
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
-    return err;
+static StaticSemaphore_t s_lock_buf;
+static SemaphoreHandle_t s_lock;
+static portMUX_TYPE s_init_mux = portMUX_INITIALIZER_UNLOCKED;
 
-  err = nvs_set_str(my_handle, key, value);
-  if (err == ESP_OK)
-    err = nvs_commit(my_handle);
+// Everything below is guarded by s_lock.
+static nvs_handle_t s_handle;
+static bool s_loaded;
+static setting_t *s_settings;
+static size_t s_count;
+static size_t s_capacity;
+static uint32_t s_pending; // Set calls since the last commit
+static esp_timer_handle_t s_commit_timer;
+static storage_nvs_stats_t s_stats;
 
-  nvs_close(my_handle);
-  return err;
+static void settings_lock(void) {
+  if (!s_lock) {
+    portENTER_CRITICAL(&s_init_mux);
+    if (!s_lock) {
+      s_lock = xSemaphoreCreateMutexStatic(&s_lock_buf);
+    }
+    portEXIT_CRITICAL(&s_init_mux);
+  }
+  xSemaphoreTake(s_lock, portMAX_DELAY);
 }
 
-esp_err_t storage_nvs_get_str(const char *key, char *out_value,
-                              size_t max_len) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
+static void settings_unlock(void) { xSemaphoreGive(s_lock); }
+
+static setting_t *setting_find(const char *key) {
+  for (size_t i = 0; i < s_count; i++) {
+    if (strcmp(s_settings[i].key, key) == 0) {
+      return &s_settings[i];
+    }
+  }
+  return NULL;
+}
+
+static setting_t *setting_add(const char *key) {
+  if (s_count == s_capacity) {
+    size_t capacity = s_capacity ? s_capacity * 2 : 8;
+    setting_t *grown = realloc(s_settings, capacity * sizeof(*grown));
+    if (!grown) {
+      return NULL;
+    }
+    s_settings = grown;
+    s_capacity = capacity;
+  }
+  setting_t *s = &s_settings[s_count++];
+  memset(s, 0, sizeof(*s));
+  strlcpy(s->key, key, sizeof(s->key));
+  return s;
+}
+
+static void settings_clear(void) {
+  for (size_t i = 0; i < s_count; i++) {
+    if (s_settings[i].type == NVS_TYPE_STR) {
+      free(s_settings[i].v.str);
+    }
+  }
+  free(s_settings);
+  s_settings = NULL;
+  s_count = 0;
+  s_capacity = 0;
+}
 
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
+static esp_err_t setting_read(const nvs_entry_info_t *info) {
+  if (info->type != NVS_TYPE_STR && info->type != NVS_TYPE_I32) {
+    return ESP_OK; // Not reachable through this API
+  }
+  setting_t *s = setting_add(info->key);
+  if (!s) {
+    return ESP_ERR_NO_MEM;
+  }
+  s->type = info->type;
+  if (info->type == NVS_TYPE_I32) {
+    return nvs_get_i32(s_handle, info->key, &s->v.i32);
+  }
+  size_t len = 0;
+  esp_err_t err = nvs_get_str(s_handle, info->key, NULL, &len);
+  if (err != ESP_OK) {
     return err;
+  }
+  s->v.str = malloc(len);
+  if (!s->v.str) {
+    return ESP_ERR_NO_MEM;
+  }
+  return nvs_get_str(s_handle, info->key, s->v.str, &len);
+}
 
-  err = nvs_get_str(my_handle, key, out_value, &max_len);
-  nvs_close(my_handle);
-  return err;
+// Opens the handle kept for the lifetime of the firmware and copies the
+// namespace into the shadow.
+static esp_err_t settings_load(void) {
+  if (s_loaded) {
+    return ESP_OK;
+  }
+  esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &s_handle);
+  if (err != ESP_OK) {
+    return err;
+  }
+  nvs_iterator_t it = NULL;
+  esp_err_t res = nvs_entry_find_in_handle(s_handle, NVS_TYPE_ANY, &it);
+  while (res == ESP_OK && err == ESP_OK) {
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    err = setting_read(&info);
+    res = nvs_entry_next(&it);
+  }
+  nvs_release_iterator(it);
+  if (err == ESP_OK && res != ESP_ERR_NVS_NOT_FOUND) {
+    err = res;
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Failed to load settings: %s", esp_err_to_name(err));
+    settings_clear();
+    nvs_close(s_handle);
+    return err;
+  }
+  s_loaded = true;
+  ESP_LOGI(TAG, "%u settings loaded", (unsigned)s_count);
+  return ESP_OK;
 }
 
-esp_err_t storage_nvs_set_i32(const char *key, int32_t value) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
+static esp_err_t setting_store(setting_t *s) {
+  if (s->retyped) {
+    esp_err_t err = nvs_erase_key(s_handle, s->key);
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+      return err;
+    }
+  }
+  return s->type == NVS_TYPE_STR ? nvs_set_str(s_handle, s->key, s->v.str)
+                                 : nvs_set_i32(s_handle, s->key, s->v.i32);
+}
 
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
+// Dirty values stay dirty on error and go out with the next flush.
+static esp_err_t settings_flush_locked(void) {
+  if (s_pending == 0) {
+    return ESP_OK;
+  }
+  esp_err_t err = ESP_OK;
+  for (size_t i = 0; i < s_count && err == ESP_OK; i++) {
+    if (s_settings[i].dirty) {
+      err = setting_store(&s_settings[i]);
+    }
+  }
+  if (err == ESP_OK) {
+    err = nvs_commit(s_handle);
+  }
+  if (err != ESP_OK) {
+    s_stats.errors++;
+    ESP_LOGW(TAG, "Settings commit failed: %s", esp_err_to_name(err));
     return err;
+  }
+  for (size_t i = 0; i < s_count; i++) {
+    s_settings[i].dirty = false;
+    s_settings[i].retyped = false;
+  }
+  s_stats.commits++;
+  s_stats.commits_avoided += s_pending - 1;
+  s_pending = 0;
+  return ESP_OK;
+}
 
-  err = nvs_set_i32(my_handle, key, value);
-  if (err == ESP_OK)
-    err = nvs_commit(my_handle);
+static void commit_timer_cb(void *arg) {
+  settings_lock();
+  if (settings_flush_locked() != ESP_OK) {
+    esp_timer_start_once(s_commit_timer,
+                         CONFIG_ARS_SETTINGS_COMMIT_DELAY_MS * 1000ULL);
+  }
+  settings_unlock();
+}
 
-  nvs_close(my_handle);
+// Restarts the debounce window; commits right away without a timer.
+static esp_err_t schedule_commit(void) {
+  if (CONFIG_ARS_SETTINGS_COMMIT_DELAY_MS == 0) {
+    return settings_flush_locked();
+  }
+  if (!s_commit_timer) {
+    const esp_timer_create_args_t args = {.callback = commit_timer_cb,
+                                          .name = "settings_commit"};
+    if (esp_timer_create(&args, &s_commit_timer) != ESP_OK) {
+      s_commit_timer = NULL;
+      return settings_flush_locked();
+    }
+  }
+  esp_timer_stop(s_commit_timer);
+  if (esp_timer_start_once(s_commit_timer,
+                           CONFIG_ARS_SETTINGS_COMMIT_DELAY_MS * 1000ULL) !=
+      ESP_OK) {
+    return settings_flush_locked();
+  }
+  return ESP_OK;
+}
+
+static esp_err_t setting_put(const char *key, nvs_type_t type, const char *str,
+                             int32_t i32) {
+  if (!key) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  if (strlen(key) >= NVS_KEY_NAME_MAX_SIZE) {
+    return ESP_ERR_NVS_KEY_TOO_LONG;
+  }
+  if (str && strlen(str) >= SETTINGS_STR_MAX) {
+    return ESP_ERR_NVS_VALUE_TOO_LONG;
+  }
+  settings_lock();
+  esp_err_t err = settings_load();
+  if (err != ESP_OK) {
+    settings_unlock();
+    return err;
+  }
+  s_stats.writes++;
+  setting_t *s = setting_find(key);
+  if (s && s->type == type &&
+      (type == NVS_TYPE_STR ? strcmp(s->v.str, str) == 0 : s->v.i32 == i32)) {
+    s_stats.unchanged++;
+    s_stats.commits_avoided++;
+    settings_unlock();
+    return ESP_OK;
+  }
+  char *copy = NULL;
+  if (type == NVS_TYPE_STR && !(copy = strdup(str))) {
+    settings_unlock();
+    return ESP_ERR_NO_MEM;
+  }
+  if (s) {
+    if (s->type == NVS_TYPE_STR) {
+      free(s->v.str);
+    }
+    s->retyped |= s->type != type;
+  } else if (!(s = setting_add(key))) {
+    free(copy);
+    settings_unlock();
+    return ESP_ERR_NO_MEM;
+  }
+  s->type = type;
+  if (type == NVS_TYPE_STR) {
+    s->v.str = copy;
+  } else {
+    s->v.i32 = i32;
+  }
+  s->dirty = true;
+  s_pending++;
+  err = schedule_commit();
+  settings_unlock();
   return err;
 }
 
-esp_err_t storage_nvs_get_i32(const char *key, int32_t *out_value) {
-  nvs_handle_t my_handle;
-  esp_err_t err;
+esp_err_t storage_nvs_set_str(const char *key, const char *value) {
+  if (!value) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  return setting_put(key, NVS_TYPE_STR, value, 0);
+}
 
-  err = nvs_open("storage", NVS_READWRITE, &my_handle);
-  if (err != ESP_OK)
-    return err;
+esp_err_t storage_nvs_get_str(const char *key, char *out_value,
+                              size_t max_len) {
+  if (!key || !out_value) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  settings_lock();
+  esp_err_t err = settings_load();
+  if (err == ESP_OK) {
+    s_stats.reads++;
+    const setting_t *s = setting_find(key);
+    if (!s) {
+      err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (s->type != NVS_TYPE_STR) {
+      err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else if (strlen(s->v.str) >= max_len) {
+      err = ESP_ERR_NVS_INVALID_LENGTH;
+    } else {
+      strcpy(out_value, s->v.str);
+    }
+  }
+  settings_unlock();
+  return err;
+}
 
-  err = nvs_get_i32(my_handle, key, out_value);
-  nvs_close(my_handle);
+esp_err_t storage_nvs_set_i32(const char *key, int32_t value) {
+  return setting_put(key, NVS_TYPE_I32, NULL, value);
+}
+
+esp_err_t storage_nvs_get_i32(const char *key, int32_t *out_value) {
+  if (!key || !out_value) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  settings_lock();
+  esp_err_t err = settings_load();
+  if (err == ESP_OK) {
+    s_stats.reads++;
+    const setting_t *s = setting_find(key);
+    if (!s) {
+      err = ESP_ERR_NVS_NOT_FOUND;
+    } else if (s->type != NVS_TYPE_I32) {
+      err = ESP_ERR_NVS_TYPE_MISMATCH;
+    } else {
+      *out_value = s->v.i32;
+    }
+  }
+  settings_unlock();
   return err;
 }
+
+esp_err_t storage_nvs_flush(void) {
+  settings_lock();
+  if (s_commit_timer) {
+    esp_timer_stop(s_commit_timer);
+  }
+  esp_err_t err = s_loaded ? settings_flush_locked() : ESP_OK;
+  settings_unlock();
+  return err;
+}
+
+esp_err_t storage_nvs_get_stats(storage_nvs_stats_t *out) {
+  if (!out) {
+    return ESP_ERR_INVALID_ARG;
+  }
+  settings_lock();
+  *out = s_stats;
+  settings_unlock();
+  return ESP_OK;
+}
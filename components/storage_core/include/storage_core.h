@@ -50,6 +50,180 @@ esp_err_t storage_save_secure(const char *path, const void *data, size_t len,
 esp_err_t storage_load_secure(const char *path, void **out_data,
                               size_t *out_len, uint32_t expected_version);
 
+/**
+ * @brief Load data from a secure file and report its schema version
+ *
+ * Same checks as storage_load_secure() but accepts any version, so callers
+ * can decode older payloads and migrate them.
+ *
+ * @param path File path
+ * @param out_data Set to a malloc'd buffer the caller must free
+ * @param out_len Pointer to write data length
+ * @param out_version Version stored in the header
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the file is
+ * missing, ESP_ERR_INVALID_CRC if corrupt
+ */
+esp_err_t storage_load_secure_versioned(const char *path, void **out_data,
+                                        size_t *out_len,
+                                        uint32_t *out_version);
+
+// Chunk size of the streaming readers (stack buffer)
+#define STORAGE_CHUNK_SIZE 512
+
+/**
+ * @brief Receives the payload of a secure file, STORAGE_CHUNK_SIZE bytes at a
+ * time (the last chunk may be shorter). Any error stops the load.
+ */
+typedef esp_err_t (*storage_chunk_cb_t)(const uint8_t *chunk, size_t len,
+                                        void *ctx);
+
+/**
+ * @brief Load a secure file through a callback, with O(chunk) memory
+ *
+ * The CRC is updated chunk by chunk and checked after the last one: the
+ * chunks are only trustworthy once this returns ESP_OK, so callers decode
+ * into scratch state they drop on error.
+ *
+ * @param path File path
+ * @param expected_version Version expected (0 to ignore)
+ * @param cb Called for each chunk, in order
+ * @param ctx Passed to cb
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the file is
+ * missing, ESP_ERR_INVALID_CRC if corrupt, or the error returned by cb
+ */
+esp_err_t storage_load_secure_stream(const char *path,
+                                     uint32_t expected_version,
+                                     storage_chunk_cb_t cb, void *ctx);
+
+/**
+ * @brief Random-access reader over the payload of a secure file
+ *
+ * Opening checks the header and that the file holds the whole payload, not
+ * the CRC: call storage_reader_verify() (one streaming pass) before trusting
+ * the content.
+ */
+typedef struct storage_reader storage_reader_t;
+
+/**
+ * @brief Open a secure file for random access
+ *
+ * @param path File path
+ * @param expected_version Version expected (0 to ignore)
+ * @param out_reader Set to the reader, to close with storage_close_secure()
+ * @return esp_err_t ESP_OK on success, ESP_ERR_NOT_FOUND if the file is
+ * missing, ESP_ERR_INVALID_SIZE if it is truncated
+ */
+esp_err_t storage_open_secure(const char *path, uint32_t expected_version,
+                              storage_reader_t **out_reader);
+
+/**
+ * @brief Schema version stored in the header
+ */
+uint32_t storage_reader_version(const storage_reader_t *reader);
+
+/**
+ * @brief Payload length in bytes
+ */
+size_t storage_reader_size(const storage_reader_t *reader);
+
+/**
+ * @brief Read exactly len payload bytes starting at offset
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_SIZE past the end
+ */
+esp_err_t storage_reader_read(storage_reader_t *reader, size_t offset,
+                              void *buf, size_t len);
+
+/**
+ * @brief Check the payload CRC in chunks
+ *
+ * @return esp_err_t ESP_OK on success, ESP_ERR_INVALID_CRC if corrupt
+ */
+esp_err_t storage_reader_verify(storage_reader_t *reader);
+
+/**
+ * @brief Close a reader (NULL is ignored)
+ */
+void storage_close_secure(storage_reader_t *reader);
+
+/**
+ * @brief Multi-file transaction backed by a redo journal
+ *
+ * Writes are staged in the journal file; storage_txn_commit() seals it with a
+ * single fsync, then applies every write and removes it. A reset before the
+ * seal drops the whole group, a reset after it is finished by
+ * storage_txn_recover() at boot: the group is applied entirely or not at all.
+ * Consecutive writes to the same file at contiguous offsets are merged into
+ * one journal entry. One transaction per journal at a time.
+ */
+typedef struct storage_txn storage_txn_t;
+
+/**
+ * @brief Start a transaction, truncating the journal
+ *
+ * @param journal_path Journal file, on the same filesystem as the targets
+ * @param out_txn Set to the new transaction
+ * @return esp_err_t ESP_OK on success
+ */
+esp_err_t storage_txn_begin(const char *journal_path, storage_txn_t **out_txn);
+
+/**
+ * @brief Stage a write of len bytes at offset, growing the file if needed
+ *
+ * Replay overwrites the same bytes, so it is idempotent: appends must pass
+ * the file size they expect rather than rely on the append position.
+ */
+esp_err_t storage_txn_write(storage_txn_t *txn, const char *path,
+                            uint32_t offset, const void *data, size_t len);
+
+/**
+ * @brief Stage a whole-file rewrite: the file is truncated and gets data
+ *
+ * A following storage_txn_write() at offset len extends the new content.
+ */
+esp_err_t storage_txn_replace(storage_txn_t *txn, const char *path,
+                              const void *data, size_t len);
+
+/**
+ * @brief Stage the same file storage_save_secure() would write
+ */
+esp_err_t storage_txn_save_secure(storage_txn_t *txn, const char *path,
+                                  const void *data, size_t len,
+                                  uint32_t version);
+
+/**
+ * @brief Stage the removal of a file (a missing file is not an error)
+ */
+esp_err_t storage_txn_remove(storage_txn_t *txn, const char *path);
+
+/**
+ * @brief Seal, apply and release the transaction
+ *
+ * After a staging error the transaction is aborted instead and that error is
+ * returned. Once the journal is sealed, a failure while applying leaves it in
+ * place for storage_txn_recover().
+ *
+ * @return esp_err_t ESP_OK when every write reached its file
+ */
+esp_err_t storage_txn_commit(storage_txn_t *txn);
+
+/**
+ * @brief Drop the staged writes and release the transaction
+ */
+void storage_txn_abort(storage_txn_t *txn);
+
+/**
+ * @brief Finish or discard a transaction interrupted by a reset
+ *
+ * A sealed journal is applied, a torn one (reset while staging) is dropped.
+ * Call before anything reads the target files.
+ *
+ * @param journal_path Journal file given to storage_txn_begin()
+ * @param out_applied Optional, set to the number of entries replayed
+ * @return esp_err_t ESP_OK when there is nothing left to recover
+ */
+esp_err_t storage_txn_recover(const char *journal_path, size_t *out_applied);
+
 /**
  * @brief Helper for string safe copy
  */
@@ -3,6 +3,7 @@
 #include "esp_crc.h"
 #include "esp_log.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/unistd.h>
@@ -79,40 +80,60 @@ esp_err_t storage_save_secure(const char *path, const void *data, size_t len,
   return ESP_OK;
 }
 
-esp_err_t storage_load_secure(const char *path, void **out_data,
-                              size_t *out_len, uint32_t expected_version) {
-  ESP_RETURN_ON_FALSE(path && out_data && out_len, ESP_ERR_INVALID_ARG, TAG,
-                      "Invalid args");
-
-  *out_data = NULL;
-  *out_len = 0;
-
+// Opens path and checks the header magic. On success *out_f is positioned at
+// the payload.
+static esp_err_t open_checked(const char *path, FILE **out_f,
+                              storage_header_t *header,
+                              uint32_t expected_version) {
   FILE *f = fopen(path, "rb");
   if (!f) {
     return ESP_ERR_NOT_FOUND;
   }
 
-  storage_header_t header;
-  size_t read = fread(&header, 1, sizeof(header), f);
-  if (read != sizeof(header)) {
+  size_t read = fread(header, 1, sizeof(*header), f);
+  if (read != sizeof(*header)) {
     ESP_LOGW(TAG, "Header read failed or file too small");
     fclose(f);
     return ESP_ERR_INVALID_SIZE;
   }
 
-  if (header.magic != STORAGE_MAGIC) {
-    ESP_LOGE(TAG, "Invalid magic 0x%08X", (unsigned int)header.magic);
+  if (header->magic != STORAGE_MAGIC) {
+    ESP_LOGE(TAG, "Invalid magic 0x%08X", (unsigned int)header->magic);
     fclose(f);
     return ESP_FAIL;
   }
 
-  if (expected_version != 0 && header.version != expected_version) {
+  if (expected_version != 0 && header->version != expected_version) {
     ESP_LOGW(TAG, "Version mismatch: file=%u expected=%u",
-             (unsigned int)header.version, (unsigned int)expected_version);
+             (unsigned int)header->version, (unsigned int)expected_version);
     // We continue, letting caller handle migration if needed, or return error?
     // Usually we might want to return a specific error code
   }
 
+  *out_f = f;
+  return ESP_OK;
+}
+
+static esp_err_t load_secure(const char *path, void **out_data,
+                             size_t *out_len, uint32_t expected_version,
+                             uint32_t *out_version) {
+  ESP_RETURN_ON_FALSE(path && out_data && out_len, ESP_ERR_INVALID_ARG, TAG,
+                      "Invalid args");
+
+  *out_data = NULL;
+  *out_len = 0;
+
+  FILE *f = NULL;
+  storage_header_t header;
+  esp_err_t err = open_checked(path, &f, &header, expected_version);
+  if (err != ESP_OK) {
+    return err;
+  }
+
+  if (out_version) {
+    *out_version = header.version;
+  }
+
   void *data =
       malloc(header.data_len + 1); // +1 for safety null terminator if string
   if (!data) {
@@ -121,7 +142,7 @@ esp_err_t storage_load_secure(const char *path, void **out_data,
     return ESP_ERR_NO_MEM;
   }
 
-  read = fread(data, 1, header.data_len, f);
+  size_t read = fread(data, 1, header.data_len, f);
   fclose(f);
 
   if (read != header.data_len) {
@@ -145,3 +166,140 @@ esp_err_t storage_load_secure(const char *path, void **out_data,
 
   return ESP_OK;
 }
+
+esp_err_t storage_load_secure(const char *path, void **out_data,
+                              size_t *out_len, uint32_t expected_version) {
+  return load_secure(path, out_data, out_len, expected_version, NULL);
+}
+
+esp_err_t storage_load_secure_versioned(const char *path, void **out_data,
+                                        size_t *out_len,
+                                        uint32_t *out_version) {
+  ESP_RETURN_ON_FALSE(out_version, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  return load_secure(path, out_data, out_len, 0, out_version);
+}
+
+// Reads len payload bytes from f in chunks, CRC included; cb may be NULL.
+static esp_err_t stream_payload(FILE *f, size_t len, uint32_t *crc,
+                                storage_chunk_cb_t cb, void *ctx) {
+  uint8_t chunk[STORAGE_CHUNK_SIZE];
+  while (len > 0) {
+    size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+    if (fread(chunk, 1, n, f) != n) {
+      ESP_LOGE(TAG, "Data read incomplete");
+      return ESP_FAIL;
+    }
+    *crc = esp_crc32_le(*crc, chunk, n);
+    if (cb) {
+      esp_err_t err = cb(chunk, n, ctx);
+      if (err != ESP_OK) {
+        return err;
+      }
+    }
+    len -= n;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t check_crc(const storage_header_t *header, uint32_t crc) {
+  if (crc != header->crc32) {
+    ESP_LOGE(TAG, "CRC Mismatch: file=0x%08X calc=0x%08X",
+             (unsigned int)header->crc32, (unsigned int)crc);
+    return ESP_ERR_INVALID_CRC;
+  }
+  return ESP_OK;
+}
+
+esp_err_t storage_load_secure_stream(const char *path,
+                                     uint32_t expected_version,
+                                     storage_chunk_cb_t cb, void *ctx) {
+  ESP_RETURN_ON_FALSE(path && cb, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  FILE *f = NULL;
+  storage_header_t header;
+  esp_err_t err = open_checked(path, &f, &header, expected_version);
+  if (err != ESP_OK) {
+    return err;
+  }
+  uint32_t crc = 0;
+  err = stream_payload(f, header.data_len, &crc, cb, ctx);
+  fclose(f);
+  return err == ESP_OK ? check_crc(&header, crc) : err;
+}
+
+struct storage_reader {
+  FILE *f;
+  storage_header_t header;
+};
+
+esp_err_t storage_open_secure(const char *path, uint32_t expected_version,
+                              storage_reader_t **out_reader) {
+  ESP_RETURN_ON_FALSE(path && out_reader, ESP_ERR_INVALID_ARG, TAG,
+                      "Invalid args");
+  *out_reader = NULL;
+  storage_reader_t *r = calloc(1, sizeof(storage_reader_t));
+  if (!r) {
+    return ESP_ERR_NO_MEM;
+  }
+  esp_err_t err = open_checked(path, &r->f, &r->header, expected_version);
+  if (err == ESP_OK) {
+    // A truncated payload is caught here rather than by a later read.
+    fseek(r->f, 0, SEEK_END);
+    long size = ftell(r->f);
+    if (size < 0 ||
+        (unsigned long)size < sizeof(storage_header_t) + r->header.data_len) {
+      ESP_LOGW(TAG, "%s shorter than its header says", path);
+      err = ESP_ERR_INVALID_SIZE;
+    }
+  }
+  if (err != ESP_OK) {
+    storage_close_secure(r);
+    return err;
+  }
+  *out_reader = r;
+  return ESP_OK;
+}
+
+uint32_t storage_reader_version(const storage_reader_t *reader) {
+  return reader ? reader->header.version : 0;
+}
+
+size_t storage_reader_size(const storage_reader_t *reader) {
+  return reader ? reader->header.data_len : 0;
+}
+
+esp_err_t storage_reader_read(storage_reader_t *reader, size_t offset,
+                              void *buf, size_t len) {
+  ESP_RETURN_ON_FALSE(reader && (buf || len == 0), ESP_ERR_INVALID_ARG, TAG,
+                      "Invalid args");
+  if (offset > reader->header.data_len ||
+      len > reader->header.data_len - offset) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+  if (fseek(reader->f, (long)(sizeof(storage_header_t) + offset), SEEK_SET) !=
+          0 ||
+      fread(buf, 1, len, reader->f) != len) {
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+esp_err_t storage_reader_verify(storage_reader_t *reader) {
+  ESP_RETURN_ON_FALSE(reader, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  if (fseek(reader->f, sizeof(storage_header_t), SEEK_SET) != 0) {
+    return ESP_FAIL;
+  }
+  uint32_t crc = 0;
+  esp_err_t err =
+      stream_payload(reader->f, reader->header.data_len, &crc, NULL, NULL);
+  return err == ESP_OK ? check_crc(&reader->header, crc) : err;
+}
+
+void storage_close_secure(storage_reader_t *reader) {
+  if (!reader) {
+    return;
+  }
+  if (reader->f) {
+    fclose(reader->f);
+  }
+  free(reader);
+}
@@ -0,0 +1,434 @@
+#include "esp_check.h"
+#include "esp_crc.h"
+#include "esp_log.h"
+#include "storage_core.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/unistd.h>
+
+static const char *TAG = "storage_txn";
+
+// Journal layout:
+//   txn_file_header_t
+//   per entry: txn_entry_t, path (path_len bytes), data (len bytes)
+//   txn_commit_t once sealed
+// Each entry CRC covers its path and data; the commit record CRC chains the
+// entry headers, so a journal is applied only if it was completely written.
+// Applying rewrites every target from the journal, the same way at commit
+// and at recovery.
+#define TXN_MAGIC 0x4E585453u        // "STXN"
+#define TXN_ENTRY_MAGIC 0x59524E45u  // "ENRY"
+#define TXN_COMMIT_MAGIC 0x54494D43u // "CMIT"
+#define TXN_VERSION 1
+#define TXN_MAX_PATH 128
+#define TXN_COPY_CHUNK 256
+#define TXN_MIN_BUFFER 256
+
+typedef enum {
+  TXN_WRITE = 1,   // len bytes at offset
+  TXN_REPLACE = 2, // Truncate, then len bytes at 0
+  TXN_REMOVE = 3,  // unlink, no data
+} txn_kind_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+} txn_file_header_t;
+
+typedef struct {
+  uint32_t magic;
+  uint8_t kind;
+  uint8_t path_len;
+  uint16_t reserved;
+  uint32_t offset;
+  uint32_t len;
+  uint32_t crc32; // Path then data
+} txn_entry_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t count;
+  uint32_t crc32; // Every entry header, in order
+} txn_commit_t;
+
+struct storage_txn {
+  FILE *f;
+  char journal[TXN_MAX_PATH];
+  uint32_t count;     // Entries written to the journal
+  uint32_t chain_crc; // Over their headers
+  esp_err_t err;      // First staging error
+  // The last entry stays in RAM while contiguous writes may extend it.
+  bool pending;
+  txn_entry_t entry;
+  char path[TXN_MAX_PATH];
+  uint8_t *buf;
+  size_t buf_cap;
+};
+
+static esp_err_t txn_fail(storage_txn_t *txn, esp_err_t err) {
+  if (txn->err == ESP_OK) {
+    txn->err = err;
+  }
+  return err;
+}
+
+static esp_err_t entry_flush(storage_txn_t *txn) {
+  if (!txn->pending) {
+    return ESP_OK;
+  }
+  txn->pending = false;
+  txn->entry.crc32 =
+      esp_crc32_le(esp_crc32_le(0, (const uint8_t *)txn->path,
+                                txn->entry.path_len),
+                   txn->buf, txn->entry.len);
+  if (fwrite(&txn->entry, 1, sizeof(txn->entry), txn->f) !=
+          sizeof(txn->entry) ||
+      fwrite(txn->path, 1, txn->entry.path_len, txn->f) !=
+          txn->entry.path_len ||
+      fwrite(txn->buf, 1, txn->entry.len, txn->f) != txn->entry.len) {
+    ESP_LOGE(TAG, "Journal write failed");
+    return txn_fail(txn, ESP_FAIL);
+  }
+  txn->chain_crc = esp_crc32_le(txn->chain_crc, (const uint8_t *)&txn->entry,
+                                sizeof(txn->entry));
+  txn->count++;
+  return ESP_OK;
+}
+
+static esp_err_t entry_append(storage_txn_t *txn, const void *data,
+                              size_t len) {
+  if (len > UINT32_MAX - txn->entry.offset - txn->entry.len) {
+    return txn_fail(txn, ESP_ERR_INVALID_SIZE);
+  }
+  size_t need = txn->entry.len + len;
+  if (need > txn->buf_cap) {
+    size_t cap = txn->buf_cap ? txn->buf_cap : TXN_MIN_BUFFER;
+    while (cap < need) {
+      cap *= 2;
+    }
+    uint8_t *buf = realloc(txn->buf, cap);
+    if (!buf) {
+      ESP_LOGE(TAG, "Alloc failed (%u bytes)", (unsigned)cap);
+      return txn_fail(txn, ESP_ERR_NO_MEM);
+    }
+    txn->buf = buf;
+    txn->buf_cap = cap;
+  }
+  if (len > 0) {
+    memcpy(txn->buf + txn->entry.len, data, len);
+  }
+  txn->entry.len += (uint32_t)len;
+  return ESP_OK;
+}
+
+static esp_err_t entry_start(storage_txn_t *txn, txn_kind_t kind,
+                             const char *path, uint32_t offset) {
+  size_t path_len = strlen(path);
+  if (path_len == 0 || path_len >= TXN_MAX_PATH) {
+    ESP_LOGE(TAG, "Invalid path length %u", (unsigned)path_len);
+    return txn_fail(txn, ESP_ERR_INVALID_ARG);
+  }
+  ESP_RETURN_ON_ERROR(entry_flush(txn), TAG, "Cannot stage %s", path);
+  memcpy(txn->path, path, path_len + 1);
+  txn->entry = (txn_entry_t){.magic = TXN_ENTRY_MAGIC,
+                             .kind = (uint8_t)kind,
+                             .path_len = (uint8_t)path_len,
+                             .offset = offset};
+  txn->pending = true;
+  return ESP_OK;
+}
+
+esp_err_t storage_txn_begin(const char *journal_path,
+                            storage_txn_t **out_txn) {
+  ESP_RETURN_ON_FALSE(journal_path && out_txn, ESP_ERR_INVALID_ARG, TAG,
+                      "Invalid args");
+  *out_txn = NULL;
+  // A journal a failed commit left behind must not be truncated unapplied.
+  ESP_RETURN_ON_ERROR(storage_txn_recover(journal_path, NULL), TAG,
+                      "Pending journal %s", journal_path);
+  storage_txn_t *txn = calloc(1, sizeof(storage_txn_t));
+  if (!txn) {
+    return ESP_ERR_NO_MEM;
+  }
+  storage_core_strlcpy(txn->journal, journal_path, sizeof(txn->journal));
+  txn->f = fopen(txn->journal, "wb");
+  txn_file_header_t header = {.magic = TXN_MAGIC, .version = TXN_VERSION};
+  if (!txn->f ||
+      fwrite(&header, 1, sizeof(header), txn->f) != sizeof(header)) {
+    ESP_LOGE(TAG, "Cannot create journal %s", txn->journal);
+    storage_txn_abort(txn);
+    return ESP_FAIL;
+  }
+  *out_txn = txn;
+  return ESP_OK;
+}
+
+esp_err_t storage_txn_write(storage_txn_t *txn, const char *path,
+                            uint32_t offset, const void *data, size_t len) {
+  ESP_RETURN_ON_FALSE(txn && path && (data || len == 0), ESP_ERR_INVALID_ARG,
+                      TAG, "Invalid args");
+  if (txn->err != ESP_OK) {
+    return txn->err;
+  }
+  bool contiguous = txn->pending && txn->entry.kind != TXN_REMOVE &&
+                    offset == txn->entry.offset + txn->entry.len &&
+                    strcmp(path, txn->path) == 0;
+  if (!contiguous) {
+    ESP_RETURN_ON_ERROR(entry_start(txn, TXN_WRITE, path, offset), TAG,
+                        "Cannot stage %s", path);
+  }
+  return entry_append(txn, data, len);
+}
+
+esp_err_t storage_txn_replace(storage_txn_t *txn, const char *path,
+                              const void *data, size_t len) {
+  ESP_RETURN_ON_FALSE(txn && path && (data || len == 0), ESP_ERR_INVALID_ARG,
+                      TAG, "Invalid args");
+  if (txn->err != ESP_OK) {
+    return txn->err;
+  }
+  ESP_RETURN_ON_ERROR(entry_start(txn, TXN_REPLACE, path, 0), TAG,
+                      "Cannot stage %s", path);
+  return entry_append(txn, data, len);
+}
+
+esp_err_t storage_txn_save_secure(storage_txn_t *txn, const char *path,
+                                  const void *data, size_t len,
+                                  uint32_t version) {
+  ESP_RETURN_ON_FALSE(data, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  storage_header_t header = {.magic = STORAGE_MAGIC,
+                             .version = version,
+                             .crc32 = storage_crc32(data, len),
+                             .data_len = (uint32_t)len,
+                             .reserved = {0}};
+  esp_err_t err = storage_txn_replace(txn, path, &header, sizeof(header));
+  if (err == ESP_OK) {
+    err = storage_txn_write(txn, path, sizeof(header), data, len);
+  }
+  return err;
+}
+
+esp_err_t storage_txn_remove(storage_txn_t *txn, const char *path) {
+  ESP_RETURN_ON_FALSE(txn && path, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  if (txn->err != ESP_OK) {
+    return txn->err;
+  }
+  return entry_start(txn, TXN_REMOVE, path, 0);
+}
+
+void storage_txn_abort(storage_txn_t *txn) {
+  if (!txn) {
+    return;
+  }
+  if (txn->f) {
+    fclose(txn->f);
+    unlink(txn->journal);
+  }
+  free(txn->buf);
+  free(txn);
+}
+
+// --- Replay -----------------------------------------------------------------
+
+// Reads the path and data of an entry, feeding them to the CRC. With target
+// set, the data is copied to it instead of being skipped.
+static bool entry_copy(FILE *f, const txn_entry_t *e, char *path,
+                       FILE *target) {
+  if (fread(path, 1, e->path_len, f) != e->path_len) {
+    return false;
+  }
+  path[e->path_len] = '\0';
+  uint32_t crc = esp_crc32_le(0, (const uint8_t *)path, e->path_len);
+  uint8_t chunk[TXN_COPY_CHUNK];
+  for (uint32_t done = 0; done < e->len;) {
+    size_t n = e->len - done < sizeof(chunk) ? e->len - done : sizeof(chunk);
+    if (fread(chunk, 1, n, f) != n) {
+      return false;
+    }
+    crc = esp_crc32_le(crc, chunk, n);
+    if (target && fwrite(chunk, 1, n, target) != n) {
+      return false;
+    }
+    done += n;
+  }
+  return crc == e->crc32;
+}
+
+// True when the journal ends with a commit record matching its entries.
+static bool journal_sealed(FILE *f) {
+  txn_file_header_t header;
+  if (fread(&header, 1, sizeof(header), f) != sizeof(header) ||
+      header.magic != TXN_MAGIC || header.version != TXN_VERSION) {
+    return false;
+  }
+  char path[TXN_MAX_PATH];
+  uint32_t count = 0;
+  uint32_t chain = 0;
+  for (;;) {
+    uint32_t magic;
+    if (fread(&magic, 1, sizeof(magic), f) != sizeof(magic)) {
+      return false;
+    }
+    if (magic == TXN_COMMIT_MAGIC) {
+      txn_commit_t commit = {.magic = magic};
+      size_t rest = sizeof(commit) - sizeof(magic);
+      return fread((uint8_t *)&commit + sizeof(magic), 1, rest, f) == rest &&
+             commit.count == count && commit.crc32 == chain;
+    }
+    txn_entry_t e = {.magic = magic};
+    size_t rest = sizeof(e) - sizeof(magic);
+    if (magic != TXN_ENTRY_MAGIC ||
+        fread((uint8_t *)&e + sizeof(magic), 1, rest, f) != rest ||
+        e.path_len == 0 || e.path_len >= TXN_MAX_PATH ||
+        !entry_copy(f, &e, path, NULL)) {
+      return false;
+    }
+    chain = esp_crc32_le(chain, (const uint8_t *)&e, sizeof(e));
+    count++;
+  }
+}
+
+static esp_err_t entry_apply(FILE *f, const txn_entry_t *e) {
+  char path[TXN_MAX_PATH];
+  if (e->kind == TXN_REMOVE) {
+    if (!entry_copy(f, e, path, NULL)) {
+      return ESP_FAIL;
+    }
+    if (unlink(path) != 0 && errno != ENOENT) {
+      ESP_LOGE(TAG, "Cannot remove %s (errno=%d)", path, errno);
+      return ESP_FAIL;
+    }
+    return ESP_OK;
+  }
+  // The path comes first in the journal: peek at it to open the target.
+  long pos = ftell(f);
+  if (fread(path, 1, e->path_len, f) != e->path_len) {
+    return ESP_FAIL;
+  }
+  path[e->path_len] = '\0';
+  fseek(f, pos, SEEK_SET);
+
+  FILE *target = NULL;
+  if (e->kind == TXN_REPLACE) {
+    target = fopen(path, "wb");
+  } else {
+    target = fopen(path, "r+b");
+    if (!target) {
+      target = fopen(path, "w+b");
+    }
+  }
+  if (!target) {
+    ESP_LOGE(TAG, "Cannot open %s", path);
+    return ESP_FAIL;
+  }
+  bool ok = fseek(target, e->offset, SEEK_SET) == 0 &&
+            entry_copy(f, e, path, target);
+  // No fsync: LittleFS commits a file when it is closed, and the journal
+  // stays until every target has been closed.
+  if (fclose(target) != 0) {
+    ok = false;
+  }
+  if (!ok) {
+    ESP_LOGE(TAG, "Cannot apply journal entry to %s", path);
+  }
+  return ok ? ESP_OK : ESP_FAIL;
+}
+
+// Applies a sealed journal. ESP_ERR_NOT_FOUND without a journal,
+// ESP_ERR_INVALID_CRC when it is torn.
+static esp_err_t journal_apply(const char *journal_path, size_t *applied) {
+  *applied = 0;
+  FILE *f = fopen(journal_path, "rb");
+  if (!f) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  if (!journal_sealed(f)) {
+    fclose(f);
+    return ESP_ERR_INVALID_CRC;
+  }
+  fseek(f, sizeof(txn_file_header_t), SEEK_SET);
+  esp_err_t err = ESP_OK;
+  txn_entry_t e;
+  while (err == ESP_OK && fread(&e, 1, sizeof(e), f) == sizeof(e) &&
+         e.magic == TXN_ENTRY_MAGIC) {
+    err = entry_apply(f, &e);
+    if (err == ESP_OK) {
+      (*applied)++;
+    }
+  }
+  fclose(f);
+  return err;
+}
+
+esp_err_t storage_txn_commit(storage_txn_t *txn) {
+  ESP_RETURN_ON_FALSE(txn, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  esp_err_t err = entry_flush(txn);
+  if (err != ESP_OK || txn->err != ESP_OK) {
+    err = txn->err != ESP_OK ? txn->err : err;
+    storage_txn_abort(txn);
+    return err;
+  }
+  if (txn->count == 0) {
+    storage_txn_abort(txn);
+    return ESP_OK;
+  }
+
+  txn_commit_t commit = {.magic = TXN_COMMIT_MAGIC,
+                         .count = txn->count,
+                         .crc32 = txn->chain_crc};
+  bool sealed =
+      fwrite(&commit, 1, sizeof(commit), txn->f) == sizeof(commit) &&
+      fflush(txn->f) == 0 && fsync(fileno(txn->f)) == 0;
+  if (fclose(txn->f) != 0) {
+    sealed = false;
+  }
+  txn->f = NULL;
+  if (!sealed) {
+    ESP_LOGE(TAG, "Cannot seal journal %s", txn->journal);
+    unlink(txn->journal);
+    storage_txn_abort(txn);
+    return ESP_FAIL;
+  }
+
+  // From here on the transaction is durable: a failure is finished by
+  // storage_txn_recover() at the next boot.
+  size_t applied = 0;
+  err = journal_apply(txn->journal, &applied);
+  if (err == ESP_OK) {
+    unlink(txn->journal);
+    ESP_LOGD(TAG, "Committed %u entries", (unsigned)applied);
+  } else {
+    ESP_LOGE(TAG, "Applied %u of %u entries (%s), journal kept",
+             (unsigned)applied, (unsigned)txn->count, esp_err_to_name(err));
+  }
+  storage_txn_abort(txn);
+  return err;
+}
+
+esp_err_t storage_txn_recover(const char *journal_path, size_t *out_applied) {
+  ESP_RETURN_ON_FALSE(journal_path, ESP_ERR_INVALID_ARG, TAG, "Invalid args");
+  size_t applied = 0;
+  esp_err_t err = journal_apply(journal_path, &applied);
+  if (out_applied) {
+    *out_applied = applied;
+  }
+  if (err == ESP_ERR_NOT_FOUND) {
+    return ESP_OK;
+  }
+  if (err == ESP_ERR_INVALID_CRC) {
+    ESP_LOGW(TAG, "Dropping unfinished transaction %s", journal_path);
+    unlink(journal_path);
+    return ESP_OK;
+  }
+  if (err != ESP_OK) {
+    ESP_LOGE(TAG, "Replay of %s failed (%s)", journal_path,
+             esp_err_to_name(err));
+    return err;
+  }
+  ESP_LOGW(TAG, "Replayed %u entries from %s", (unsigned)applied,
+           journal_path);
+  unlink(journal_path);
+  return ESP_OK;
+}
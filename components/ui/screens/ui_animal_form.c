@@ -146,9 +146,9 @@ static void save_btn_cb(lv_event_t *e) {
 
   if (is_edit_mode) {
     strlcpy(animal.id, current_animal_id, sizeof(animal.id));
-  } else {
-    // Generate ID or let core handle it? Core expects us to pass one usually or
-    // generates if empty? Core_save_animal logic: if ID empty/zero, assume new.
+  } else if (core_new_id(animal.id, sizeof(animal.id)) != ESP_OK) {
+    ui_show_toast("Echec de la sauvegarde", UI_TOAST_ERROR);
+    return;
   }
 
   strlcpy(animal.name, name, sizeof(animal.name));
@@ -54,41 +54,56 @@ static void clear_animal_list_items(void) {
   }
 }
 
+static bool add_animal_item(const animal_summary_t *animal, void *ctx) {
+  size_t *added = ctx;
+  char *id_copy = ui_strdup(animal->id);
+  if (!id_copy)
+    return true;
+  char label[256];
+  snprintf(label, sizeof(label), "%s (%s)", animal->name, animal->species);
+
+  lv_obj_t *btn = lv_list_add_btn(list_animals, LV_SYMBOL_PASTE, label);
+  lv_obj_add_event_cb(btn, animal_item_wrapper_cb, LV_EVENT_ALL, id_copy);
+  (*added)++;
+  return true;
+}
+
 static void load_animal_list_correct(const char *query) {
   clear_animal_list_items();
 
-  animal_summary_t *animals = NULL;
-  size_t count = 0;
-  if (core_search_animals(query, &animals, &count) == ESP_OK) {
-    if (count == 0) {
-      if (query && strlen(query) > 0) {
-        lv_list_add_text(list_animals, "Aucun resultat pour la recherche.");
-      } else {
-        // Empty state visual
-        lv_obj_t *cont_empty = lv_obj_create(list_animals);
-        lv_obj_set_size(cont_empty, LV_PCT(100), 100);
-        lv_obj_set_style_bg_opa(cont_empty, LV_OPA_TRANSP, 0);
-        lv_obj_set_style_border_width(cont_empty, 0, 0);
-        lv_obj_t *l = lv_label_create(cont_empty);
-        lv_label_set_text(l, LV_SYMBOL_DIRECTORY
-                          "\nListe vide. Ajoutez un animal !");
-        lv_obj_set_style_text_align(l, LV_TEXT_ALIGN_CENTER, 0);
-        lv_obj_center(l);
-      }
-    } else {
+  bool searching = query && strlen(query) > 0;
+  size_t added = 0;
+  esp_err_t err;
+  if (searching) {
+    animal_summary_t *animals = NULL;
+    size_t count = 0;
+    err = core_search_animals(query, &animals, &count);
+    if (err == ESP_OK) {
       for (size_t i = 0; i < count; i++) {
-        char *id_copy = ui_strdup(animals[i].id);
-        if (!id_copy)
-          continue;
-        char label[256];
-        snprintf(label, sizeof(label), "%s (%s)", animals[i].name,
-                 animals[i].species);
-
-        lv_obj_t *btn = lv_list_add_btn(list_animals, LV_SYMBOL_PASTE, label);
-        lv_obj_add_event_cb(btn, animal_item_wrapper_cb, LV_EVENT_ALL, id_copy);
+        add_animal_item(&animals[i], &added);
       }
       core_free_animal_list(animals);
     }
+  } else {
+    // Full list: streamed page by page instead of copied whole.
+    err = core_foreach_animal(0, 0, add_animal_item, &added);
+  }
+  if (err != ESP_OK || added > 0)
+    return;
+
+  if (searching) {
+    lv_list_add_text(list_animals, "Aucun resultat pour la recherche.");
+  } else {
+    // Empty state visual
+    lv_obj_t *cont_empty = lv_obj_create(list_animals);
+    lv_obj_set_size(cont_empty, LV_PCT(100), 100);
+    lv_obj_set_style_bg_opa(cont_empty, LV_OPA_TRANSP, 0);
+    lv_obj_set_style_border_width(cont_empty, 0, 0);
+    lv_obj_t *l = lv_label_create(cont_empty);
+    lv_label_set_text(l, LV_SYMBOL_DIRECTORY
+                      "\nListe vide. Ajoutez un animal !");
+    lv_obj_set_style_text_align(l, LV_TEXT_ALIGN_CENTER, 0);
+    lv_obj_center(l);
   }
 }
 
@@ -52,6 +52,19 @@ static void animal_select_event_cb(lv_event_t *e) {
   }
 }
 
+static bool add_animal_choice(const animal_summary_t *animal, void *ctx) {
+  lv_obj_t *list = ctx;
+  char label_txt[256];
+  snprintf(label_txt, sizeof(label_txt), "%s (%s)", animal->name,
+           animal->species);
+  lv_obj_t *btn = lv_list_add_btn(list, NULL, label_txt);
+
+  // Store ID copies for callback
+  char *id_copy = ui_strdup(animal->id);
+  lv_obj_add_event_cb(btn, animal_select_event_cb, LV_EVENT_CLICKED, id_copy);
+  return true;
+}
+
 static lv_obj_t *modal_cont;
 static void close_modal_cb(lv_event_t *e) {
   if (modal_cont) {
@@ -83,23 +96,8 @@ static void generate_report_btn_cb(lv_event_t *e) {
   lv_obj_set_size(list, LV_PCT(100), LV_PCT(80));
   lv_obj_align(list, LV_ALIGN_BOTTOM_MID, 0, 0);
 
-  // Load animals
-  animal_summary_t *animals = NULL;
-  size_t count = 0;
-  if (core_list_animals(&animals, &count) == ESP_OK) {
-    for (size_t i = 0; i < count; i++) {
-      char label_txt[256];
-      snprintf(label_txt, sizeof(label_txt), "%s (%s)", animals[i].name,
-               animals[i].species);
-      lv_obj_t *btn = lv_list_add_btn(list, NULL, label_txt);
-
-      // Store ID copies for callback
-      char *id_copy = ui_strdup(animals[i].id);
-      lv_obj_add_event_cb(btn, animal_select_event_cb, LV_EVENT_CLICKED,
-                          id_copy);
-    }
-    core_free_animal_list(animals);
-  }
+  // Load animals, a page at a time
+  core_foreach_animal(0, 0, add_animal_choice, list);
 }
 
 // Helper to delete list item
@@ -5,6 +5,7 @@
 #include "../ui_theme.h"
 #include "board.h"
 #include "core_export.h"
+#include "core_service.h"
 #include "iot_manager.h"
 #include "lvgl.h"
 #include "net_manager.h"
@@ -70,6 +71,7 @@ static void ota_btn_cb(lv_event_t *e) {
   }
   if (strlen(url) > 0) {
     ui_helper_show_spinner();
+    core_flush(); // The update ends in a reboot
     iot_ota_start(url);
   }
 }
@@ -5,7 +5,6 @@
 #include "cJSON.h"
 #include "esp_http_server.h"
 #include "esp_log.h"
-#include "esp_random.h"
 #include "esp_timer.h"
 #include "nvs.h"
 #include "sdkconfig.h"
@@ -161,6 +160,61 @@ static esp_err_t js_get_handler(httpd_req_t *req) {
 #include "net_manager.h"
 #include "sd.h" // for capacity
 
+// Per-operation storage metrics; operations never called are left out.
+static void add_data_metrics(cJSON *root) {
+  cJSON *data = cJSON_AddObjectToObject(root, "data");
+  if (!data) {
+    return;
+  }
+  for (int op = 0; op < DATA_MANAGER_OP_COUNT; op++) {
+    data_manager_op_stats_t st;
+    if (core_get_op_stats(op, &st) != ESP_OK || st.calls == 0) {
+      continue;
+    }
+    cJSON *o = cJSON_AddObjectToObject(data, core_op_name(op));
+    if (!o) {
+      return;
+    }
+    cJSON_AddNumberToObject(o, "calls", st.calls);
+    cJSON_AddNumberToObject(o, "avg_us", (double)(st.total_us / st.calls));
+    cJSON_AddNumberToObject(o, "p50_us", core_op_quantile_us(&st, 0.5f));
+    cJSON_AddNumberToObject(o, "p99_us", core_op_quantile_us(&st, 0.99f));
+    cJSON_AddNumberToObject(o, "max_us", st.max_us);
+    cJSON_AddNumberToObject(o, "lock_wait_us", (double)st.lock_wait_us);
+    cJSON_AddNumberToObject(o, "io_us", (double)st.io_us);
+    cJSON_AddNumberToObject(o, "parse_us", (double)st.parse_us);
+    cJSON_AddNumberToObject(o, "bytes_read", (double)st.bytes_read);
+    cJSON_AddNumberToObject(o, "bytes_written", (double)st.bytes_written);
+    int hist[DATA_MANAGER_LATENCY_BUCKETS];
+    for (int b = 0; b < DATA_MANAGER_LATENCY_BUCKETS; b++) {
+      hist[b] = (int)st.latency[b];
+    }
+    cJSON_AddItemToObject(
+        o, "hist", cJSON_CreateIntArray(hist, DATA_MANAGER_LATENCY_BUCKETS));
+  }
+}
+
+// Integrity scrubber progress and findings; absent when disabled.
+static void add_scrub_stats(cJSON *root) {
+  data_manager_scrub_stats_t st;
+  if (core_get_scrub_stats(&st) != ESP_OK) {
+    return;
+  }
+  cJSON *o = cJSON_AddObjectToObject(root, "scrub");
+  if (!o) {
+    return;
+  }
+  cJSON_AddNumberToObject(o, "passes", st.passes);
+  cJSON_AddNumberToObject(o, "position", st.position);
+  cJSON_AddNumberToObject(o, "files_checked", st.files_checked);
+  cJSON_AddNumberToObject(o, "bytes_checked", (double)st.bytes_checked);
+  cJSON_AddNumberToObject(o, "quarantined", st.quarantined);
+  cJSON_AddNumberToObject(o, "repaired", st.repaired);
+  cJSON_AddNumberToObject(o, "damaged", st.damaged);
+  cJSON_AddNumberToObject(o, "deferred", st.deferred);
+  cJSON_AddNumberToObject(o, "max_slice_us", st.max_slice_us);
+}
+
 static esp_err_t health_get_handler(httpd_req_t *req) {
   httpd_resp_set_cors(req);
   if (!is_authenticated(req))
@@ -191,6 +245,8 @@ static esp_err_t health_get_handler(httpd_req_t *req) {
     cJSON_AddNumberToObject(store, "total_kb", total);
     cJSON_AddNumberToObject(store, "free_kb", free_kb);
   }
+  add_data_metrics(root);
+  add_scrub_stats(root);
 
   const char *json_str = cJSON_PrintUnformatted(root);
   httpd_resp_set_type(req, "application/json");
@@ -200,36 +256,148 @@ static esp_err_t health_get_handler(httpd_req_t *req) {
   return ESP_OK;
 }
 
-/* GET /api/animals handler */
+typedef struct {
+  httpd_req_t *req;
+  bool first;
+  esp_err_t err;
+} animal_stream_t;
+
+// Sends one array element per chunk; escaping is left to cJSON.
+static bool stream_animal_cb(const animal_summary_t *animal, void *ctx) {
+  animal_stream_t *st = ctx;
+  char buf[512];
+  buf[0] = st->first ? '[' : ',';
+  cJSON *item = cJSON_CreateObject();
+  if (!item) {
+    st->err = ESP_ERR_NO_MEM;
+    return false;
+  }
+  cJSON_AddStringToObject(item, "id", animal->id);
+  cJSON_AddStringToObject(item, "name", animal->name);
+  cJSON_AddStringToObject(item, "species", animal->species);
+  bool printed = cJSON_PrintPreallocated(item, buf + 1, sizeof(buf) - 1, 0);
+  cJSON_Delete(item);
+  if (!printed) {
+    st->err = ESP_ERR_INVALID_SIZE;
+    return false;
+  }
+  st->err = httpd_resp_send_chunk(st->req, buf, HTTPD_RESP_USE_STRLEN);
+  st->first = false;
+  return st->err == ESP_OK;
+}
+
+static size_t query_size_param(const char *query, const char *key) {
+  char val[12];
+  if (!query || httpd_query_key_value(query, key, val, sizeof(val)) != ESP_OK)
+    return 0;
+  return (size_t)strtoul(val, NULL, 10);
+}
+
+/* GET /api/animals[?offset=N&limit=M] handler, streamed page by page */
 static esp_err_t api_animals_get_handler(httpd_req_t *req) {
   httpd_resp_set_cors(req);
   if (!is_authenticated(req))
     return httpd_resp_send_401(req);
-  animal_summary_t *list = NULL;
-  size_t count = 0;
 
-  // Use core_list_animals
-  if (core_list_animals(&list, &count) != ESP_OK) {
-    httpd_resp_send_500(req);
+  char query[64];
+  bool has_query =
+      httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK;
+  size_t offset = has_query ? query_size_param(query, "offset") : 0;
+  size_t limit = has_query ? query_size_param(query, "limit") : 0;
+
+  httpd_resp_set_type(req, "application/json");
+  animal_stream_t st = {.req = req, .first = true, .err = ESP_OK};
+  esp_err_t err = core_foreach_animal(offset, limit, stream_animal_cb, &st);
+  if (st.first) {
+    // Nothing sent yet: a clean status can still be returned.
+    if (err != ESP_OK || st.err != ESP_OK) {
+      httpd_resp_send_500(req);
+      return ESP_FAIL;
+    }
+    return httpd_resp_send(req, "[]", HTTPD_RESP_USE_STRLEN);
+  }
+  if (err != ESP_OK || st.err != ESP_OK) {
+    ESP_LOGE(TAG, "Animal list stream aborted (%s)",
+             esp_err_to_name(st.err != ESP_OK ? st.err : err));
     return ESP_FAIL;
   }
+  httpd_resp_send_chunk(req, "]", 1);
+  return httpd_resp_send_chunk(req, NULL, 0);
+}
 
-  cJSON *root = cJSON_CreateArray();
-  for (size_t i = 0; i < count; i++) {
-    cJSON *item = cJSON_CreateObject();
-    cJSON_AddStringToObject(item, "id", list[i].id);
-    cJSON_AddStringToObject(item, "name", list[i].name);
-    cJSON_AddStringToObject(item, "species", list[i].species);
-    cJSON_AddItemToArray(root, item);
-  }
-  core_free_animal_list(list);
+#define CHANGES_PAGE_MAX 64
 
-  const char *json_str = cJSON_PrintUnformatted(root);
+static void send_changes_json(httpd_req_t *req, cJSON *root) {
+  char *json_str = cJSON_PrintUnformatted(root);
+  cJSON_Delete(root);
+  if (!json_str) {
+    httpd_resp_send_500(req);
+    return;
+  }
   httpd_resp_set_type(req, "application/json");
-  httpd_resp_send(req, json_str, strlen(json_str));
+  httpd_resp_send(req, json_str, HTTPD_RESP_USE_STRLEN);
+  free(json_str);
+}
 
-  free((void *)json_str);
-  cJSON_Delete(root);
+/* GET /api/changes?since=N[&limit=M] handler: changes after seq N. 410 with
+ * the current seq when they are no longer logged: reload everything, then
+ * continue from that seq. */
+static esp_err_t api_changes_get_handler(httpd_req_t *req) {
+  httpd_resp_set_cors(req);
+  if (!is_authenticated(req))
+    return httpd_resp_send_401(req);
+
+  char query[64];
+  char val[24];
+  uint64_t since = 0;
+  size_t limit = 0;
+  if (httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK) {
+    if (httpd_query_key_value(query, "since", val, sizeof(val)) == ESP_OK)
+      since = strtoull(val, NULL, 10);
+    limit = query_size_param(query, "limit");
+  }
+  if (limit == 0 || limit > CHANGES_PAGE_MAX)
+    limit = CHANGES_PAGE_MAX;
+
+  // Read first: changes made during the page are only repeated next time.
+  uint64_t seq = core_change_seq();
+  data_manager_change_t *changes = malloc(limit * sizeof(*changes));
+  cJSON *root = cJSON_CreateObject();
+  if (!changes || !root) {
+    free(changes);
+    cJSON_Delete(root);
+    return httpd_resp_send_500(req);
+  }
+  size_t count = 0;
+  esp_err_t err = core_changes_since(since, changes, limit, &count);
+  if (err == ESP_ERR_NOT_SUPPORTED) {
+    free(changes);
+    cJSON_Delete(root);
+    return httpd_resp_send_503(req, "Change log disabled");
+  }
+  cJSON_AddNumberToObject(root, "seq", (double)seq);
+  if (err != ESP_OK) {
+    free(changes);
+    cJSON_AddBoolToObject(root, "resync", true);
+    httpd_resp_set_status(req, "410 Gone");
+    send_changes_json(req, root);
+    return ESP_OK;
+  }
+  cJSON_AddBoolToObject(root, "more", count == limit);
+  cJSON *arr = cJSON_AddArrayToObject(root, "changes");
+  for (size_t i = 0; arr && i < count; i++) {
+    cJSON *c = cJSON_CreateObject();
+    if (!c)
+      break;
+    cJSON_AddNumberToObject(c, "seq", (double)changes[i].seq);
+    cJSON_AddStringToObject(c, "entity", core_entity_name(changes[i].entity));
+    bool deleted = changes[i].op == DATA_MANAGER_CHANGE_DELETE;
+    cJSON_AddStringToObject(c, "op", deleted ? "delete" : "put");
+    cJSON_AddStringToObject(c, "id", changes[i].id);
+    cJSON_AddItemToArray(arr, c);
+  }
+  free(changes);
+  send_changes_json(req, root);
   return ESP_OK;
 }
 
@@ -268,12 +436,10 @@ static esp_err_t api_animals_post_handler(httpd_req_t *req) {
       strlen(name->valuestring) < 64 && strlen(species->valuestring) < 64) {
 
     animal_t new_animal = {0};
-
-    // SECURITY: Secure ID generation
-    uint32_t r1 = esp_random();
-    uint32_t r2 = esp_random();
-    snprintf(new_animal.id, sizeof(new_animal.id), "%08lx-%08lx",
-             (unsigned long)r1, (unsigned long)r2);
+    if (core_new_id(new_animal.id, sizeof(new_animal.id)) != ESP_OK) {
+      cJSON_Delete(root);
+      return httpd_resp_send_500(req);
+    }
 
     strlcpy(new_animal.name, name->valuestring, sizeof(new_animal.name));
     strlcpy(new_animal.species, species->valuestring,
@@ -402,6 +568,7 @@ esp_err_t web_server_init(void) {
 
   httpd_config_t config = HTTPD_DEFAULT_CONFIG();
   config.stack_size = 8192; // Increase stack for JSON processing
+  config.max_uri_handlers = 12; // Default of 8 is already taken
   config.uri_match_fn =
       httpd_uri_match_wildcard; // Enable wildcard for /reports/*
 
@@ -440,6 +607,12 @@ esp_err_t web_server_init(void) {
                                     .handler = api_animals_post_handler};
     httpd_register_uri_handler(server, &animals_post_uri);
 
+    // URI: /api/changes (GET)
+    httpd_uri_t changes_get_uri = {.uri = "/api/changes",
+                                   .method = HTTP_GET,
+                                   .handler = api_changes_get_handler};
+    httpd_register_uri_handler(server, &changes_get_uri);
+
     // URI: /reports (GET)
     httpd_uri_t reports_list = {
         .uri = "/reports", .method = HTTP_GET, .handler = reports_list_handler};
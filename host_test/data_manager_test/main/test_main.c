@@ -0,0 +1,27 @@
+#define _GNU_SOURCE // nftw()
+
+#include "sdkconfig.h"
+#include "unity.h"
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Runs every data_manager TEST_CASE linked in (see CMakeLists.txt) and exits
+// non-zero when a case fails, for CI.
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+void app_main(void) {
+  // Start from an empty /data: the first test runs data_manager_init().
+  nftw(CONFIG_ARS_DATA_HOST_ROOT, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  UNITY_BEGIN();
+  unity_run_all_tests();
+  int failures = UNITY_END();
+  exit(failures == 0 ? 0 : 1);
+}
@@ -0,0 +1,73 @@
+#include "bench_heap.h"
+#include <malloc.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+
+// FreeRTOS tasks are pthreads on linux, so every counter is atomic.
+static atomic_size_t s_in_use;
+static atomic_size_t s_peak;
+
+static void account_alloc(void *ptr) {
+  if (!ptr) {
+    return;
+  }
+  size_t size = malloc_usable_size(ptr);
+  size_t now = atomic_fetch_add(&s_in_use, size) + size;
+  size_t peak = atomic_load(&s_peak);
+  while (now > peak && !atomic_compare_exchange_weak(&s_peak, &peak, now)) {
+  }
+}
+
+// Blocks allocated inside libc (strdup, getline...) never went through
+// account_alloc: clamp at zero rather than wrap around.
+static void account_release(size_t size) {
+  size_t cur = atomic_load(&s_in_use);
+  while (!atomic_compare_exchange_weak(&s_in_use, &cur,
+                                       cur > size ? cur - size : 0)) {
+  }
+}
+
+void *__wrap_malloc(size_t size) {
+  void *ptr = __real_malloc(size);
+  account_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+  void *ptr = __real_calloc(n, size);
+  account_alloc(ptr);
+  return ptr;
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+  size_t old = ptr ? malloc_usable_size(ptr) : 0;
+  void *grown = __real_realloc(ptr, size);
+  if (!grown && size > 0) {
+    return NULL; // ptr untouched
+  }
+  account_release(old); // realloc(ptr, 0) freed it
+  account_alloc(grown);
+  return grown;
+}
+
+void __wrap_free(void *ptr) {
+  if (ptr) {
+    account_release(malloc_usable_size(ptr));
+  }
+  __real_free(ptr);
+}
+
+size_t bench_heap_in_use(void) { return atomic_load(&s_in_use); }
+
+size_t bench_heap_mark(void) {
+  size_t now = atomic_load(&s_in_use);
+  atomic_store(&s_peak, now);
+  return now;
+}
+
+size_t bench_heap_peak(void) { return atomic_load(&s_peak); }
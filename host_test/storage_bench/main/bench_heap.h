@@ -0,0 +1,14 @@
+#pragma once
+
+#include <stddef.h>
+
+// Process-wide allocation accounting, fed by the --wrap=malloc/calloc/
+// realloc/free wrappers in bench_heap.c. Sizes are usable sizes as reported
+// by glibc, so they include allocator rounding.
+
+// Bytes currently allocated.
+size_t bench_heap_in_use(void);
+// Restarts peak tracking from the current usage and returns it.
+size_t bench_heap_mark(void);
+// Highest usage since the last bench_heap_mark().
+size_t bench_heap_peak(void);
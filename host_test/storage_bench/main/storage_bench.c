@@ -0,0 +1,289 @@
+#define _GNU_SOURCE // nftw()
+
+#include "bench_heap.h"
+#include "compliance_engine.h"
+#include "core_export.h"
+#include "core_service.h"
+#include "data_manager.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic facility benchmark for the host build. The dataset grows to 100,
+// 1 000 then 10 000 animals (up to CONFIG_ARS_BENCH_MAX_ANIMALS); at each
+// size every operation is timed on random animals and reported as latency
+// percentiles plus the heap peak of its worst call. One "result" line per
+// operation and size, easy to grep from a CI log.
+
+static const char *TAG = "storage_bench";
+
+#define BENCH_SEED 0x5EED1234u
+#define BENCH_IMPORT_CHUNK 100 // Animals per batch commit
+#define BENCH_EXPORT_ROUNDS 5
+
+static const int s_sizes[] = {100, 1000, 10000};
+
+static uint32_t s_rng = BENCH_SEED;
+
+static uint32_t bench_rand(void) {
+  // xorshift32: deterministic across runs and libc versions.
+  s_rng ^= s_rng << 13;
+  s_rng ^= s_rng >> 17;
+  s_rng ^= s_rng << 5;
+  return s_rng;
+}
+
+static void bench_id(char *id, size_t len, int i) {
+  snprintf(id, len, "bench-%05d", i);
+}
+
+static void fill_reptile(reptile_t *r, int i) {
+  static const char *const names[] = {"Némésis", "Éclair", "Chloé", "Noël",
+                                      "Zoé",     "Léon",   "Hélène", "Kaa"};
+  static const char *const species[] = {
+      "Python regius", "Pogona vitticeps", "Eublepharis macularius",
+      "Testudo hermanni", "Morelia spilota", "Correlophus ciliatus"};
+  static const char *const morphs[] = {"Classique", "Banana Pied", "Albinos",
+                                       "Tremper", "Hypo", ""};
+  memset(r, 0, sizeof(*r));
+  bench_id(r->id, sizeof(r->id), i);
+  snprintf(r->name, sizeof(r->name), "%s %d", names[i % 8], i / 8);
+  strlcpy(r->species, species[i % 6], sizeof(r->species));
+  strlcpy(r->morph, morphs[(i / 6) % 6], sizeof(r->morph));
+  r->birth_date = 1500000000 + (int64_t)(i % 2000) * 86400;
+  r->gender = (reptile_gender_t)(i % 3);
+  r->weight = 50.0f + (float)(i % 1500);
+}
+
+// Appends animals [from, to) with their histories, one batch per chunk.
+static esp_err_t generate(int from, int to) {
+  static const event_type_t types[] = {EVENT_FEEDING, EVENT_FEEDING,
+                                       EVENT_SHEDDING, EVENT_CLEANING,
+                                       EVENT_VET};
+  for (int base = from; base < to; base += BENCH_IMPORT_CHUNK) {
+    data_manager_batch_t *batch = NULL;
+    esp_err_t err = data_manager_batch_begin(&batch);
+    if (err != ESP_OK) {
+      return err;
+    }
+    int end = base + BENCH_IMPORT_CHUNK < to ? base + BENCH_IMPORT_CHUNK : to;
+    for (int i = base; i < end && err == ESP_OK; i++) {
+      reptile_t r;
+      fill_reptile(&r, i);
+      err = data_manager_batch_put_reptile(batch, &r);
+      for (int j = 0; j < CONFIG_ARS_BENCH_EVENTS_PER_ANIMAL && err == ESP_OK;
+           j++) {
+        reptile_event_t e = {0};
+        snprintf(e.id, sizeof(e.id), "evt-%04d", j);
+        strlcpy(e.reptile_id, r.id, sizeof(e.reptile_id));
+        e.type = types[j % 5];
+        e.timestamp = 1600000000 + (int64_t)j * 3 * 86400;
+        strlcpy(e.notes, "Souris adulte, prise sans hésitation",
+                sizeof(e.notes));
+        err = data_manager_batch_put_event(batch, &e);
+      }
+      for (int j = 0; j < CONFIG_ARS_BENCH_WEIGHTS_PER_ANIMAL && err == ESP_OK;
+           j++) {
+        err = data_manager_batch_put_weight(batch, r.id, r.weight + j * 2.5f,
+                                            1600000000 + (int64_t)j * 604800);
+      }
+    }
+    if (err != ESP_OK) {
+      data_manager_batch_abort(batch);
+      return err;
+    }
+    err = data_manager_batch_commit(batch);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  return ESP_OK;
+}
+
+// One call of the measured operation on animal i; false on failure.
+typedef bool (*bench_op_fn_t)(int animals, int i);
+
+static bool op_list(int animals, int i) {
+  (void)i;
+  animal_summary_t *list = NULL;
+  size_t count = 0;
+  bool ok = core_list_animals(&list, &count) == ESP_OK &&
+            count == (size_t)animals;
+  core_free_animal_list(list);
+  return ok;
+}
+
+static bool op_load(int animals, int i) {
+  (void)animals;
+  char id[MAX_ID_LEN];
+  bench_id(id, sizeof(id), i);
+  animal_t a = {0};
+  bool ok = core_get_animal(id, &a) == ESP_OK;
+  core_free_animal_content(&a);
+  return ok;
+}
+
+static bool op_add_event(int animals, int i) {
+  (void)animals;
+  char id[MAX_ID_LEN];
+  bench_id(id, sizeof(id), i);
+  return core_add_event(id, EVENT_FEEDING, "Rat sevré") == ESP_OK;
+}
+
+static bool op_add_weight(int animals, int i) {
+  (void)animals;
+  char id[MAX_ID_LEN];
+  bench_id(id, sizeof(id), i);
+  return core_add_weight(id, 100.0f + (float)(i % 900), "g") == ESP_OK;
+}
+
+static bool op_search(int animals, int i) {
+  static const char *const queries[] = {"n",      "ne",    "nem",
+                                        "zoe 12", "regius", "banana",
+                                        "bench-00", "eclair hypo"};
+  (void)animals;
+  animal_summary_t *list = NULL;
+  size_t count = 0;
+  bool ok = core_search_animals(queries[i % 8], &list, &count) == ESP_OK;
+  core_free_animal_list(list);
+  return ok;
+}
+
+static bool op_unfed(int animals, int i) {
+  (void)animals;
+  animal_summary_t *list = NULL;
+  size_t count = 0;
+  bool ok = core_list_unfed_animals(1 + i % 30, &list, &count) == ESP_OK;
+  core_free_animal_list(list);
+  return ok;
+}
+
+static bool op_compliance(int animals, int i) {
+  (void)animals;
+  char id[MAX_ID_LEN];
+  bench_id(id, sizeof(id), i);
+  compliance_report_t report;
+  return compliance_check_animal(id, &report) == ESP_OK;
+}
+
+static bool op_export(int animals, int i) {
+  (void)animals;
+  (void)i;
+  return core_export_csv(CONFIG_ARS_DATA_HOST_ROOT "/export.csv") == ESP_OK;
+}
+
+typedef struct {
+  const char *name;
+  bench_op_fn_t fn;
+  int rounds; // 0: CONFIG_ARS_BENCH_SAMPLES
+} bench_op_t;
+
+static const bench_op_t s_ops[] = {
+    {"list", op_list, 0},
+    {"load", op_load, 0},
+    {"add_event", op_add_event, 0},
+    {"add_weight", op_add_weight, 0},
+    {"search", op_search, 0},
+    {"unfed", op_unfed, 0},
+    {"compliance", op_compliance, 0},
+    {"export", op_export, BENCH_EXPORT_ROUNDS},
+};
+
+static int cmp_i64(const void *a, const void *b) {
+  int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static int64_t percentile(const int64_t *sorted, int n, int pct) {
+  int rank = (n * pct + 99) / 100; // Nearest rank
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+static bool run_op(const bench_op_t *op, int animals, int64_t *us) {
+  int rounds = op->rounds ? op->rounds : CONFIG_ARS_BENCH_SAMPLES;
+  size_t heap_peak = 0;
+  for (int r = 0; r < rounds; r++) {
+    int i = (int)(bench_rand() % (uint32_t)animals);
+    size_t base = bench_heap_mark();
+    int64_t start = esp_timer_get_time();
+    if (!op->fn(animals, i)) {
+      ESP_LOGE(TAG, "%s failed on animal %d", op->name, i);
+      return false;
+    }
+    us[r] = esp_timer_get_time() - start;
+    size_t peak = bench_heap_peak() - base;
+    if (peak > heap_peak) {
+      heap_peak = peak;
+    }
+  }
+  qsort(us, rounds, sizeof(us[0]), cmp_i64);
+  printf("result animals=%d op=%s n=%d p50_us=%" PRId64 " p90_us=%" PRId64
+         " p99_us=%" PRId64 " max_us=%" PRId64 " heap_peak_b=%u\n",
+         animals, op->name, rounds, percentile(us, rounds, 50),
+         percentile(us, rounds, 90), percentile(us, rounds, 99),
+         us[rounds - 1], (unsigned)heap_peak);
+  return true;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+  (void)st;
+  (void)flag;
+  (void)ftw;
+  return remove(path);
+}
+
+void app_main(void) {
+  // Start from an empty facility: no leftovers from a previous run.
+  nftw(CONFIG_ARS_DATA_HOST_ROOT, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+  if (data_manager_init() != ESP_OK) {
+    ESP_LOGE(TAG, "data_manager_init failed");
+    exit(1);
+  }
+  compliance_engine_init();
+
+  int max_rounds = CONFIG_ARS_BENCH_SAMPLES > BENCH_EXPORT_ROUNDS
+                       ? CONFIG_ARS_BENCH_SAMPLES
+                       : BENCH_EXPORT_ROUNDS;
+  int64_t *us = malloc(max_rounds * sizeof(int64_t));
+  if (!us) {
+    exit(1);
+  }
+
+  int animals = 0;
+  bool ok = true;
+  for (size_t s = 0; s < sizeof(s_sizes) / sizeof(s_sizes[0]) && ok; s++) {
+    int target = s_sizes[s];
+    if (target > CONFIG_ARS_BENCH_MAX_ANIMALS) {
+      break;
+    }
+    size_t base = bench_heap_mark();
+    int64_t start = esp_timer_get_time();
+    if (generate(animals, target) != ESP_OK) {
+      ESP_LOGE(TAG, "generating %d animals failed", target);
+      ok = false;
+      break;
+    }
+    int64_t gen_us = esp_timer_get_time() - start;
+    printf("facility animals=%d events=%lld weights=%lld import_ms=%lld "
+           "import_heap_peak_b=%u\n",
+           target, (long long)target * CONFIG_ARS_BENCH_EVENTS_PER_ANIMAL,
+           (long long)target * CONFIG_ARS_BENCH_WEIGHTS_PER_ANIMAL,
+           (long long)(gen_us / 1000), (unsigned)(bench_heap_peak() - base));
+    animals = target;
+
+    for (size_t o = 0; o < sizeof(s_ops) / sizeof(s_ops[0]) && ok; o++) {
+      ok = run_op(&s_ops[o], animals, us);
+    }
+  }
+
+  free(us);
+  data_manager_flush();
+  printf("storage_bench %s\n", ok ? "done" : "FAILED");
+  exit(ok ? 0 : 1);
+}